@@ -12,15 +12,51 @@
     StructuredBuffer<uint> _BatchObjectIndices : register(t5);
     StructuredBuffer<BatchObjectInfo> _BatchObjectInfo : register(t6);
 
+    // 和_BatchObjectIndices用同一个实例下标，值是实例的材质在_BatchMaterialParams里的下标
+    StructuredBuffer<uint> _BatchMaterialIndices : register(t12);
+
     BatchObjectInfo GetBatchObjectInfo(uint id)
     {
         return _BatchObjectInfo[_BatchObjectIndices[id]];
     }
 
+    // 材质参数写在MATERIAL_PARAMS_BEGIN和MATERIAL_PARAMS_END之间，用MATERIAL_PARAM(input, name)读取
+    // 合批时参数按材质放在一张表里，shader和渲染状态相同的材质可以合并成一次绘制
+    #if defined(BATCH_RENDERING)
+        #define MATERIAL_PARAMS_BEGIN struct BatchMaterialParams {
+        #define MATERIAL_PARAMS_END }; StructuredBuffer<BatchMaterialParams> _BatchMaterialParams : register(t13);
+        #define MATERIAL_PARAM(input, name) _BatchMaterialParams[(input).materialIndex].name
+        #define TRANSFER_MATERIAL_INDEX(input, output) (output).materialIndex = _BatchMaterialIndices[(input).id];
+    #else
+        #define MATERIAL_PARAMS_BEGIN cbuffer PerMaterialCBuffer : register(b5) {
+        #define MATERIAL_PARAMS_END };
+        #define MATERIAL_PARAM(input, name) name
+        #define TRANSFER_MATERIAL_INDEX(input, output)
+    #endif
+
+    // BatchMesh的顶点是压缩过的，布局见src/render/vertex_compression.h
+    // 位置是按包围盒归一化的unorm16，反量化已经乘进了localToWorld，可以直接变换
+    // 法线和切线是八面体映射后的snorm16，只有xy有意义
+    float3 DecodeOctahedral(float2 e)
+    {
+        float3 n = float3(e.xy, 1.0f - abs(e.x) - abs(e.y));
+        float t = saturate(-n.z);
+        n.x += n.x >= 0.0f ? -t : t;
+        n.y += n.y >= 0.0f ? -t : t;
+
+        return normalize(n);
+    }
+
+    // 副法线方向存在positionOS.w里，0是负，1是正
+    float4 DecodeBatchTangent(float4 tangentOS, float4 positionOS)
+    {
+        return float4(DecodeOctahedral(tangentOS.xy), positionOS.w * 2.0f - 1.0f);
+    }
+
     #if defined(BATCH_RENDERING)
         #define TransformObjectToWorld(positionOS) TransformObjectToWorld(positionOS, GetBatchObjectInfo(input.id).localToWorld)
         #define TransformObjectToHClip(positionOS) TransformObjectToHClip(positionOS, GetBatchObjectInfo(input.id).localToWorld)
-        #define TransformObjectToWorldNormal(normalOS) TransformObjectToWorldNormal(normalOS, GetBatchObjectInfo(input.id).worldToLocal)
+        #define TransformObjectToWorldNormal(normalOS) TransformObjectToWorldNormal(DecodeOctahedral((normalOS).xy), GetBatchObjectInfo(input.id).worldToLocal)
     #endif
 
 #endif // BATCH_RENDERING_HLSL_INCLUDED
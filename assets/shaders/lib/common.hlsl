@@ -68,6 +68,9 @@
         float3 normalWS : TEXCOORD1;
         float3 positionWS : TEXCOORD2;
         float2 uv : TEXCOORD2;
+        #if defined(BATCH_RENDERING)
+            nointerpolation uint materialIndex : TEXCOORD3;
+        #endif
     };
 
     struct PSOutput
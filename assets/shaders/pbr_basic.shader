@@ -1,5 +1,9 @@
 #include "shaders/lib/common.hlsl"
 
+MATERIAL_PARAMS_BEGIN
+    float4 _Albedo;
+MATERIAL_PARAMS_END
+
 PSInput VS_Main(VSInput input)
 {
     PSInput output;
@@ -8,6 +12,7 @@ PSInput VS_Main(VSInput input)
     output.positionSS = output.positionCS;
     output.normalWS = TransformObjectToWorldNormal(input.normalOS.xyz);
     output.uv = input.uv0;
+    TRANSFER_MATERIAL_INDEX(input, output)
 
     return output;
 }
@@ -17,7 +22,7 @@ SamplerState _MainTexSampler;
 
 PSOutput PS_Main(PSInput input) : SV_TARGET
 {
-    float4 albedo = _MainTex.Sample(_MainTexSampler, input.uv);
+    float4 albedo = _MainTex.Sample(_MainTexSampler, input.uv) * MATERIAL_PARAM(input, _Albedo);
     float3 normalWS = normalize(input.normalWS);
 
     PSOutput output;
@@ -0,0 +1,44 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+
+namespace op
+{
+    static constexpr uint32_t BIT_WORD_SIZE = 64;
+
+    inline uint32_t bit_word_index(const uint32_t bitIndex)
+    {
+        return bitIndex / BIT_WORD_SIZE;
+    }
+
+    inline uint64_t bit_word_mask(const uint32_t bitIndex)
+    {
+        return 1ull << (bitIndex % BIT_WORD_SIZE);
+    }
+
+    inline bool test_bit(const uint64_t* words, const uint32_t bitIndex)
+    {
+        return (words[bit_word_index(bitIndex)] & bit_word_mask(bitIndex)) != 0;
+    }
+
+    // 按从低到高的顺序遍历word里所有为1的位，f的参数是位在整个bitset里的下标
+    template <typename F>
+    void for_each_set_bit(uint64_t word, const uint32_t wordIndex, F&& f)
+    {
+        while (word != 0)
+        {
+            auto bit = static_cast<uint32_t>(std::countr_zero(word));
+            f(wordIndex * BIT_WORD_SIZE + bit);
+            word &= word - 1;
+        }
+    }
+
+    template <typename F>
+    void for_each_set_bit(const uint64_t* words, const uint32_t wordCount, F&& f)
+    {
+        for (uint32_t i = 0; i < wordCount; ++i)
+        {
+            for_each_set_bit(words[i], i, f);
+        }
+    }
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+
+#include "const.h"
+
+namespace op
+{
+    // 槽位被复用时generation加一，已经删掉的元素的handle不会指到新元素上
+    struct ChunkListHandle
+    {
+        static constexpr uint32_t INVALID_SLOT = ~0u;
+
+        uint32_t slot = INVALID_SLOT;
+        uint32_t generation = 0;
+
+        bool IsValid() const { return slot != INVALID_SLOT; }
+    };
+
+    // 元素按固定大小的块连续存放，扩容只追加新块，已有的块不会搬家
+    // 删除时把最后一个元素挪到空位上，增删都是O(1)，元素的下标会变，外部通过handle访问
+    // 遍历可以按块拿到连续的span，方便切分给job
+    template <typename T, uint32_t ChunkSize = 256>
+    class ChunkList
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+    public:
+        class Iterator
+        {
+        public:
+            Iterator(const ChunkList* list, const uint32_t index) : m_list(list), m_index(index) {}
+
+            const T& operator*() const { return (*m_list)[m_index]; }
+            Iterator& operator++() { ++m_index; return *this; }
+            bool operator!=(const Iterator& other) const { return m_index != other.m_index; }
+
+        private:
+            const ChunkList* m_list;
+            uint32_t m_index;
+        };
+
+        ChunkList() = default;
+        ~ChunkList() = default;
+        ChunkList(const ChunkList& other) = delete;
+        ChunkList(ChunkList&& other) noexcept = default;
+        ChunkList& operator=(const ChunkList& other) = delete;
+        ChunkList& operator=(ChunkList&& other) noexcept = default;
+
+        ChunkListHandle Add(const T& elem);
+        void Remove(ChunkListHandle handle);
+        bool Contains(ChunkListHandle handle) const;
+        T& Get(const ChunkListHandle handle) { assert(Contains(handle)); return (*this)[m_slots[handle.slot].index]; }
+        void Clear();
+
+        T& operator[](const uint32_t index) { return m_chunks[index / ChunkSize]->elems[index % ChunkSize]; }
+        const T& operator[](const uint32_t index) const { return m_chunks[index / ChunkSize]->elems[index % ChunkSize]; }
+        uint32_t Size() const { return m_size; }
+        bool Empty() const { return m_size == 0; }
+
+        // 只包含有效的元素，最后一块可能不满
+        uint32_t GetChunkCount() const { return (m_size + ChunkSize - 1) / ChunkSize; }
+        std::span<T> GetChunk(uint32_t chunkIndex);
+        std::span<const T> GetChunk(uint32_t chunkIndex) const;
+
+        Iterator begin() const { return Iterator(this, 0); }
+        Iterator end() const { return Iterator(this, m_size); }
+
+    private:
+        struct Chunk
+        {
+            T elems[ChunkSize];
+            // 每个元素占用的槽位，挪动元素时用来更新槽位里的下标
+            uint32_t slots[ChunkSize];
+        };
+
+        struct Slot
+        {
+            uint32_t index = 0;
+            uint32_t generation = 0;
+        };
+
+        vec<up<Chunk>> m_chunks;
+        vec<Slot> m_slots;
+        vec<uint32_t> m_freeSlots;
+        uint32_t m_size = 0;
+
+        uint32_t& SlotAt(const uint32_t index) { return m_chunks[index / ChunkSize]->slots[index % ChunkSize]; }
+    };
+
+    template <typename T, uint32_t ChunkSize>
+    ChunkListHandle ChunkList<T, ChunkSize>::Add(const T& elem)
+    {
+        uint32_t slot;
+        if (!m_freeSlots.empty())
+        {
+            slot = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        }
+        else
+        {
+            slot = static_cast<uint32_t>(m_slots.size());
+            m_slots.emplace_back();
+        }
+
+        if (m_size == m_chunks.size() * ChunkSize)
+        {
+            m_chunks.push_back(std::make_unique<Chunk>());
+        }
+
+        auto index = m_size++;
+        (*this)[index] = elem;
+        SlotAt(index) = slot;
+        m_slots[slot].index = index;
+
+        return { slot, m_slots[slot].generation };
+    }
+
+    template <typename T, uint32_t ChunkSize>
+    void ChunkList<T, ChunkSize>::Remove(const ChunkListHandle handle)
+    {
+        assert(Contains(handle));
+
+        auto& slot = m_slots[handle.slot];
+        auto index = slot.index;
+        auto last = --m_size;
+        if (index != last)
+        {
+            (*this)[index] = (*this)[last];
+            auto movedSlot = SlotAt(last);
+            SlotAt(index) = movedSlot;
+            m_slots[movedSlot].index = index;
+        }
+
+        slot.generation++;
+        m_freeSlots.push_back(handle.slot);
+
+        // 留一个空块，避免在块的边界上反复增删时来回分配
+        if (m_chunks.size() > GetChunkCount() + 1)
+        {
+            m_chunks.pop_back();
+        }
+    }
+
+    template <typename T, uint32_t ChunkSize>
+    bool ChunkList<T, ChunkSize>::Contains(const ChunkListHandle handle) const
+    {
+        return handle.slot < m_slots.size() && m_slots[handle.slot].generation == handle.generation && m_slots[handle.slot].index < m_size;
+    }
+
+    template <typename T, uint32_t ChunkSize>
+    void ChunkList<T, ChunkSize>::Clear()
+    {
+        for (uint32_t i = 0; i < m_size; ++i)
+        {
+            auto slot = SlotAt(i);
+            m_slots[slot].generation++;
+            m_freeSlots.push_back(slot);
+        }
+        m_size = 0;
+    }
+
+    template <typename T, uint32_t ChunkSize>
+    std::span<T> ChunkList<T, ChunkSize>::GetChunk(const uint32_t chunkIndex)
+    {
+        auto start = chunkIndex * ChunkSize;
+        return { m_chunks[chunkIndex]->elems, std::min(ChunkSize, m_size - start) };
+    }
+
+    template <typename T, uint32_t ChunkSize>
+    std::span<const T> ChunkList<T, ChunkSize>::GetChunk(const uint32_t chunkIndex) const
+    {
+        auto start = chunkIndex * ChunkSize;
+        return { m_chunks[chunkIndex]->elems, std::min(ChunkSize, m_size - start) };
+    }
+}
@@ -0,0 +1,123 @@
+#include "cpu_features.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace op
+{
+    struct CpuFeatures
+    {
+        bool avx2 = false;
+        bool avx512 = false;
+
+        CpuFeatures();
+    };
+
+    static void cpuid(const uint32_t leaf, const uint32_t subLeaf, uint32_t (&regs)[4])
+    {
+#ifdef _MSC_VER
+        int r[4];
+        __cpuidex(r, static_cast<int>(leaf), static_cast<int>(subLeaf));
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            regs[i] = static_cast<uint32_t>(r[i]);
+        }
+#else
+        __cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    static uint64_t xgetbv0()
+    {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        uint32_t lo, hi;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return static_cast<uint64_t>(hi) << 32 | lo;
+#endif
+    }
+
+    CpuFeatures::CpuFeatures()
+    {
+        uint32_t regs[4];
+
+        cpuid(0, 0, regs);
+        if (regs[0] < 7)
+        {
+            return;
+        }
+
+        cpuid(1, 0, regs);
+        auto osxsave = (regs[2] & (1u << 27)) != 0;
+        auto avx = (regs[2] & (1u << 28)) != 0;
+        auto fma = (regs[2] & (1u << 12)) != 0;
+        if (!osxsave || !avx)
+        {
+            return;
+        }
+
+        // 操作系统需要在上下文切换时保存对应的寄存器，否则CPU支持也不能用
+        auto xcr0 = xgetbv0();
+        auto osAvx = (xcr0 & 0x6) == 0x6;
+        auto osAvx512 = (xcr0 & 0xe6) == 0xe6;
+
+        cpuid(7, 0, regs);
+        avx2 = osAvx && fma && (regs[1] & (1u << 5)) != 0;
+        avx512 = osAvx512 && (regs[1] & (1u << 16)) != 0;
+    }
+
+    static const CpuFeatures& get_cpu_features()
+    {
+        static CpuFeatures features;
+        return features;
+    }
+
+    const char* simd_isa_name(const SimdIsa isa)
+    {
+        switch (isa)
+        {
+        case SimdIsa::SSE:
+            return "SSE";
+        case SimdIsa::AVX2:
+            return "AVX2";
+        case SimdIsa::AVX512:
+            return "AVX-512";
+        default:
+            return "Unknown";
+        }
+    }
+
+    bool simd_isa_supported(const SimdIsa isa)
+    {
+        switch (isa)
+        {
+        case SimdIsa::SSE:
+            return true;
+        case SimdIsa::AVX2:
+            return get_cpu_features().avx2;
+        case SimdIsa::AVX512:
+            return get_cpu_features().avx512;
+        default:
+            return false;
+        }
+    }
+
+    SimdIsa best_simd_isa()
+    {
+        if (simd_isa_supported(SimdIsa::AVX512))
+        {
+            return SimdIsa::AVX512;
+        }
+
+        if (simd_isa_supported(SimdIsa::AVX2))
+        {
+            return SimdIsa::AVX2;
+        }
+
+        return SimdIsa::SSE;
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+
+// msvc里可以直接使用任意指令集的intrinsic，gcc和clang需要给函数单独标注目标指令集
+#if defined(_MSC_VER) && !defined(__clang__)
+#define OP_TARGET_AVX2
+#define OP_TARGET_AVX512
+#else
+#define OP_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define OP_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+namespace op
+{
+    enum class SimdIsa : uint8_t
+    {
+        SSE = 0,
+        AVX2 = 1,
+        AVX512 = 2,
+
+        COUNT = 3
+    };
+
+    const char* simd_isa_name(SimdIsa isa);
+    // CPU和操作系统都支持才算支持，检测结果在第一次调用时缓存
+    bool simd_isa_supported(SimdIsa isa);
+    SimdIsa best_simd_isa();
+}
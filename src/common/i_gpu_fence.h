@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+
+namespace op
+{
+    // fence按插入顺序递增，等待某个fence意味着它之前的GPU命令也都执行完了
+    class IGpuFence
+    {
+    public:
+        IGpuFence() = default;
+        virtual ~IGpuFence() = default;
+        IGpuFence(const IGpuFence& other) = delete;
+        IGpuFence(IGpuFence&& other) noexcept = delete;
+        IGpuFence& operator=(const IGpuFence& other) = delete;
+        IGpuFence& operator=(IGpuFence&& other) noexcept = delete;
+
+        virtual uint64_t Insert() = 0;
+        virtual void Wait(uint64_t fence) = 0;
+    };
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace op
+{
+    template <typename Signature, size_t Capacity = 64>
+    class InlineFunction;
+
+    // 闭包直接存在对象内部的定长buffer里，不会分配堆内存，闭包超出容量时编译报错
+    template <typename R, typename... Args, size_t Capacity>
+    class InlineFunction<R(Args...), Capacity>
+    {
+    public:
+        InlineFunction() = default;
+        ~InlineFunction();
+        InlineFunction(const InlineFunction& other) = delete;
+        InlineFunction(InlineFunction&& other) noexcept = delete;
+        InlineFunction& operator=(const InlineFunction& other) = delete;
+        InlineFunction& operator=(InlineFunction&& other) noexcept = delete;
+
+        template <typename F>
+        InlineFunction& operator=(F&& f);
+        InlineFunction& operator=(std::nullptr_t);
+
+        R operator()(Args... args) const;
+        explicit operator bool() const { return m_invoke != nullptr; }
+
+    private:
+        alignas(std::max_align_t) mutable std::byte m_storage[Capacity];
+        R (*m_invoke)(void*, Args&&...) = nullptr;
+        void (*m_destroy)(void*) = nullptr;
+
+        void Reset();
+    };
+
+    template <typename R, typename... Args, size_t Capacity>
+    InlineFunction<R(Args...), Capacity>::~InlineFunction()
+    {
+        Reset();
+    }
+
+    template <typename R, typename... Args, size_t Capacity>
+    template <typename F>
+    InlineFunction<R(Args...), Capacity>& InlineFunction<R(Args...), Capacity>::operator=(F&& f)
+    {
+        using func_type = std::decay_t<F>;
+        static_assert(sizeof(func_type) <= Capacity, "Closure is too large for InlineFunction");
+        static_assert(alignof(func_type) <= alignof(std::max_align_t));
+
+        Reset();
+
+        new (m_storage) func_type(std::forward<F>(f));
+        m_invoke = [](void* storage, Args&&... args) -> R
+        {
+            return (*static_cast<func_type*>(storage))(std::forward<Args>(args)...);
+        };
+        m_destroy = [](void* storage)
+        {
+            static_cast<func_type*>(storage)->~func_type();
+        };
+
+        return *this;
+    }
+
+    template <typename R, typename... Args, size_t Capacity>
+    InlineFunction<R(Args...), Capacity>& InlineFunction<R(Args...), Capacity>::operator=(std::nullptr_t)
+    {
+        Reset();
+
+        return *this;
+    }
+
+    template <typename R, typename... Args, size_t Capacity>
+    R InlineFunction<R(Args...), Capacity>::operator()(Args... args) const
+    {
+        assert(m_invoke);
+
+        return m_invoke(m_storage, std::forward<Args>(args)...);
+    }
+
+    template <typename R, typename... Args, size_t Capacity>
+    void InlineFunction<R(Args...), Capacity>::Reset()
+    {
+        if (m_destroy)
+        {
+            m_destroy(m_storage);
+        }
+
+        m_invoke = nullptr;
+        m_destroy = nullptr;
+    }
+}
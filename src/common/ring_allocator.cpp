@@ -0,0 +1,293 @@
+#include "ring_allocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <random>
+
+#include "i_gpu_fence.h"
+
+namespace op
+{
+    RingAllocator::RingAllocator(const uint32_t capacityB, const uint32_t maxFramesInFlight, IGpuFence* fence)
+    {
+        assert(maxFramesInFlight > 0 && fence);
+
+        m_fence = fence;
+        m_capacityB = capacityB;
+        m_maxFramesInFlight = maxFramesInFlight;
+    }
+
+    bool RingAllocator::Alloc(const uint32_t sizeB, const uint32_t alignmentB, uint32_t& offsetB)
+    {
+        assert(alignmentB > 0 && (alignmentB & (alignmentB - 1)) == 0 && m_capacityB % alignmentB == 0);
+
+        if (sizeB > m_capacityB)
+        {
+            return false;
+        }
+
+        while (true)
+        {
+            // 没有东西在用时从头开始，不浪费尾部的空间
+            if (m_headB == m_tailB && m_frames.empty())
+            {
+                m_headB = m_tailB = 0;
+            }
+
+            auto position = static_cast<uint32_t>(m_headB % m_capacityB);
+            auto start = (position + alignmentB - 1) & ~(alignmentB - 1);
+            // 尾部放不下就跳过剩下的部分从0开始，跳过的部分跟着这次分配一起回收
+            if (start + sizeB > m_capacityB)
+            {
+                start = 0;
+            }
+            auto advanceB = start >= position ?
+                start - position + sizeB :
+                m_capacityB - position + sizeB;
+
+            if (GetUsed() + advanceB <= m_capacityB)
+            {
+                m_headB += advanceB;
+                offsetB = start;
+                return true;
+            }
+
+            if (m_frames.empty())
+            {
+                return false;
+            }
+
+            WaitOldestFrame();
+        }
+    }
+
+    void RingAllocator::EndFrame(uint64_t fence)
+    {
+        if (fence == ~0ull)
+        {
+            fence = m_fence->Insert();
+        }
+        m_frames.push_back({ fence, m_headB });
+
+        // 限制同时在GPU上的帧数，超过时等最早的一帧
+        while (m_frames.size() > m_maxFramesInFlight)
+        {
+            WaitOldestFrame();
+        }
+    }
+
+    void RingAllocator::WaitAll()
+    {
+        while (!m_frames.empty())
+        {
+            WaitOldestFrame();
+        }
+    }
+
+    void RingAllocator::Reset(const uint32_t capacityB)
+    {
+        assert(m_frames.empty());
+
+        m_capacityB = capacityB;
+        m_headB = m_tailB = 0;
+    }
+
+    void RingAllocator::WaitOldestFrame()
+    {
+        auto frame = m_frames.front();
+        m_frames.pop_front();
+
+        m_fence->Wait(frame.fence);
+        m_tailB = frame.endB;
+        m_waitCount++;
+    }
+
+    namespace
+    {
+        // 插入的fence从1开始递增，Wait之后它和之前的fence都算完成
+        class MockGpuFence final : public IGpuFence
+        {
+        public:
+            uint64_t Insert() override { return ++m_lastInserted; }
+
+            void Wait(const uint64_t fence) override
+            {
+                // 等还没插入的fence会死锁，等倒退的fence说明帧的顺序乱了
+                m_invalidWait |= fence > m_lastInserted || fence < m_lastWaited;
+                m_lastWaited = fence;
+                m_waits.push_back(fence);
+            }
+
+            uint64_t GetLastInserted() const { return m_lastInserted; }
+            uint64_t GetLastWaited() const { return m_lastWaited; }
+            bool HasInvalidWait() const { return m_invalidWait; }
+            const std::vector<uint64_t>& GetWaits() const { return m_waits; }
+            void ClearWaits() { m_waits.clear(); }
+
+        private:
+            uint64_t m_lastInserted = 0;
+            uint64_t m_lastWaited = 0;
+            bool m_invalidWait = false;
+            std::vector<uint64_t> m_waits;
+        };
+    }
+
+    RingAllocatorValidation validate_ring_allocator()
+    {
+        RingAllocatorValidation result;
+        auto check = [&result](const bool condition, const char* name)
+        {
+            result.checkCount++;
+            if (!condition)
+            {
+                if (result.failedCount == 0)
+                {
+                    result.firstFailure = name;
+                }
+                result.failedCount++;
+            }
+        };
+
+        uint32_t offsetB = 0;
+
+        // 对齐：前面的分配没对齐时空出中间的部分，空出的部分也算在用
+        {
+            MockGpuFence fence;
+            RingAllocator allocator(1024, 3, &fence);
+            check(allocator.Alloc(10, 1, offsetB) && offsetB == 0, "unaligned alloc starts at 0");
+            check(allocator.Alloc(16, 64, offsetB) && offsetB == 64, "aligned alloc is padded to 64");
+            check(allocator.GetUsed() == 80, "padding counts as used");
+            check(allocator.Alloc(4, 16, offsetB) && offsetB == 80, "aligned alloc right after previous end");
+        }
+
+        // 超过容量的分配直接失败，不等待也不改变状态
+        {
+            MockGpuFence fence;
+            RingAllocator allocator(1024, 3, &fence);
+            check(allocator.Alloc(100, 4, offsetB), "small alloc");
+            allocator.EndFrame();
+            check(!allocator.Alloc(1025, 4, offsetB), "alloc larger than capacity fails");
+            check(fence.GetWaits().empty() && allocator.GetUsed() == 100 && allocator.GetFramesInFlight() == 1, "failed alloc leaves state untouched");
+            check(allocator.Alloc(1024, 4, offsetB) && offsetB == 0, "alloc of exactly capacity waits and restarts at 0");
+            check(fence.GetWaits().size() == 1 && fence.GetWaits()[0] == 1, "full capacity alloc waited for the only frame");
+        }
+
+        // 尾部放不下时回绕到0，等最早一帧完成之后才能用它的空间
+        {
+            MockGpuFence fence;
+            RingAllocator allocator(1024, 3, &fence);
+            check(allocator.Alloc(600, 4, offsetB) && offsetB == 0, "frame 1 alloc");
+            allocator.EndFrame();
+            check(allocator.Alloc(300, 4, offsetB) && offsetB == 600, "frame 2 alloc follows frame 1");
+            allocator.EndFrame();
+            check(fence.GetWaits().empty(), "no wait while space remains");
+            check(allocator.Alloc(200, 4, offsetB) && offsetB == 0, "alloc past the end wraps to 0");
+            check(fence.GetWaits().size() == 1 && fence.GetWaits()[0] == 1, "wrap waited for frame 1 only");
+            // 跳过的尾部124B跟着这次分配一起算在用
+            check(allocator.GetUsed() == 300 + 124 + 200, "skipped tail counts as used");
+            check(allocator.GetFramesInFlight() == 1 && allocator.GetWaitCount() == 1, "frame 1 was retired");
+        }
+
+        // 当前帧自己把空间占满时没有帧可以等，返回false
+        {
+            MockGpuFence fence;
+            RingAllocator allocator(1024, 3, &fence);
+            check(allocator.Alloc(1000, 4, offsetB), "fill current frame");
+            check(!allocator.Alloc(100, 4, offsetB), "alloc fails when only the current frame holds the space");
+            check(fence.GetWaits().empty(), "no wait without frames in flight");
+        }
+
+        // 空间不够时按顺序等，直到放得下为止
+        {
+            MockGpuFence fence;
+            RingAllocator allocator(1024, 8, &fence);
+            for (uint32_t i = 0; i < 4; ++i)
+            {
+                check(allocator.Alloc(256, 4, offsetB) && offsetB == i * 256, "fill with four frames");
+                allocator.EndFrame();
+            }
+            check(allocator.Alloc(512, 4, offsetB) && offsetB == 0, "alloc after full ring");
+            check(fence.GetWaits() == std::vector<uint64_t>({ 1, 2 }), "waits the two oldest frames in order");
+            allocator.EndFrame();
+            allocator.WaitAll();
+            check(allocator.GetFramesInFlight() == 0 && allocator.GetUsed() == 0 && fence.GetLastWaited() == 5, "WaitAll retires every frame");
+            check(allocator.Alloc(8, 4, offsetB) && offsetB == 0, "idle ring restarts at 0");
+        }
+
+        // 同时在GPU上的帧数不超过上限，超过时EndFrame等最早的一帧
+        {
+            MockGpuFence fence;
+            RingAllocator allocator(1024, 2, &fence);
+            for (uint32_t i = 0; i < 2; ++i)
+            {
+                allocator.Alloc(16, 4, offsetB);
+                allocator.EndFrame();
+            }
+            check(fence.GetWaits().empty() && allocator.GetFramesInFlight() == 2, "frames up to the cap do not wait");
+            allocator.Alloc(16, 4, offsetB);
+            allocator.EndFrame();
+            check(fence.GetWaits() == std::vector<uint64_t>({ 1 }) && allocator.GetFramesInFlight() == 2, "frame over the cap waits the oldest");
+            // 外部插入的fence
+            auto external = fence.Insert();
+            allocator.EndFrame(external);
+            check(fence.GetLastInserted() == external && fence.GetWaits().back() == 2, "external fence is not inserted again");
+        }
+
+        // 随机大小和对齐，检查新的分配不会和还没等过fence的分配重叠
+        {
+            struct LiveRange
+            {
+                uint64_t fence;
+                uint32_t offsetB;
+                uint32_t sizeB;
+            };
+
+            constexpr uint32_t CAPACITY_B = 64 * 1024;
+            MockGpuFence fence;
+            RingAllocator allocator(CAPACITY_B, 3, &fence);
+            std::mt19937 rng(12345);
+            std::deque<LiveRange> liveRanges;
+            for (uint32_t frame = 0; frame < 2000; ++frame)
+            {
+                auto allocCount = static_cast<uint32_t>(rng() % 16);
+                for (uint32_t i = 0; i < allocCount; ++i)
+                {
+                    auto sizeB = 1 + static_cast<uint32_t>(rng() % (CAPACITY_B / 8));
+                    auto alignmentB = 1u << static_cast<uint32_t>(rng() % 9);
+                    if (!allocator.Alloc(sizeB, alignmentB, offsetB))
+                    {
+                        // 当前帧已经放不下了
+                        break;
+                    }
+                    result.randomAllocCount++;
+
+                    // 等过的fence之前的分配GPU已经用完了
+                    while (!liveRanges.empty() && liveRanges.front().fence <= fence.GetLastWaited())
+                    {
+                        liveRanges.pop_front();
+                    }
+
+                    auto overlap = offsetB % alignmentB != 0 || offsetB + sizeB > CAPACITY_B;
+                    for (auto& range : liveRanges)
+                    {
+                        overlap |= offsetB < range.offsetB + range.sizeB && range.offsetB < offsetB + sizeB;
+                    }
+                    if (overlap)
+                    {
+                        result.overlapCount++;
+                    }
+
+                    // 当前帧的fence在EndFrame时才插入
+                    liveRanges.push_back({ fence.GetLastInserted() + 1, offsetB, sizeB });
+                }
+                allocator.EndFrame();
+                check(allocator.GetFramesInFlight() <= 3, "random frames stay under the cap");
+            }
+            result.randomWaitCount = allocator.GetWaitCount();
+            check(result.overlapCount == 0, "random allocs never overlap live ranges");
+            check(!fence.HasInvalidWait(), "fences are waited in order and only after insertion");
+        }
+
+        return result;
+    }
+}
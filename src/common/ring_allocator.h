@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+
+namespace op
+{
+    class IGpuFence;
+
+    // 环形分配器，只管理偏移，不持有内存
+    // 一帧里的分配在EndFrame时绑上fence，后面空间不够时等最早一帧的fence完成再回收它占的空间
+    class RingAllocator
+    {
+    public:
+        RingAllocator(uint32_t capacityB, uint32_t maxFramesInFlight, IGpuFence* fence);
+        ~RingAllocator() = default;
+        RingAllocator(const RingAllocator& other) = delete;
+        RingAllocator(RingAllocator&& other) noexcept = delete;
+        RingAllocator& operator=(const RingAllocator& other) = delete;
+        RingAllocator& operator=(RingAllocator&& other) noexcept = delete;
+
+        // 等完所有帧还放不下时返回false，alignmentB必须是2的幂并且能整除容量
+        bool Alloc(uint32_t sizeB, uint32_t alignmentB, uint32_t& offsetB);
+        // fence为空时自己插入一个，多个分配器共用一个fence时由外部插入后传进来
+        void EndFrame(uint64_t fence = ~0ull);
+        void WaitAll();
+        // 只能在没有未完成的帧时调用
+        void Reset(uint32_t capacityB);
+
+        uint32_t GetCapacity() const { return m_capacityB; }
+        uint32_t GetUsed() const { return static_cast<uint32_t>(m_headB - m_tailB); }
+        uint32_t GetFramesInFlight() const { return static_cast<uint32_t>(m_frames.size()); }
+        uint32_t GetMaxFramesInFlight() const { return m_maxFramesInFlight; }
+        uint64_t GetWaitCount() const { return m_waitCount; }
+
+    private:
+        struct Frame
+        {
+            uint64_t fence;
+            uint64_t endB;
+        };
+
+        IGpuFence* m_fence;
+        uint32_t m_capacityB;
+        uint32_t m_maxFramesInFlight;
+        // 虚拟偏移单调递增，对容量取模得到实际位置，两者的差就是正在使用的大小
+        uint64_t m_headB = 0;
+        uint64_t m_tailB = 0;
+        uint64_t m_waitCount = 0;
+        std::deque<Frame> m_frames;
+
+        void WaitOldestFrame();
+    };
+
+    struct RingAllocatorValidation
+    {
+        uint32_t checkCount = 0;
+        uint32_t failedCount = 0;
+        // 第一个失败的检查
+        std::string firstFailure;
+        // 随机分配里和还没等过fence的分配重叠、越界或者没对齐的次数
+        uint32_t overlapCount = 0;
+        uint32_t randomAllocCount = 0;
+        uint64_t randomWaitCount = 0;
+    };
+
+    // 用不依赖GL的假fence跑RingAllocator，检查对齐、回绕、空间不够时的等待、帧数上限和超过容量的分配
+    RingAllocatorValidation validate_ring_allocator();
+}
@@ -72,13 +72,13 @@ namespace op
     }
 
     template <typename T>
-    SimpleList<T>::SimpleList(const SimpleList& other)
+    SimpleList<T>::SimpleList(const SimpleList& other) : m_alignment(other.m_alignment)
     {
         CopyFrom(other);
     }
 
     template <typename T>
-    SimpleList<T>::SimpleList(SimpleList&& other) noexcept
+    SimpleList<T>::SimpleList(SimpleList&& other) noexcept : m_alignment(other.m_alignment)
     {
         StealFrom(other);
     }
@@ -1,21 +1,44 @@
 #include "thread_pool.h"
 
+#include <chrono>
+#include <queue>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include "consumer_thread.h"
+#include "function_pool.h"
 
 namespace op
 {
-    ThreadPool::ThreadPool(const uint32_t numThreads)
+    thread_local ThreadPool* ThreadPool::s_curPool = nullptr;
+    thread_local uint32_t ThreadPool::s_curWorkerIndex = 0;
+    thread_local bool ThreadPool::s_curTaskStolen = false;
+    std::atomic<uint32_t> ThreadPool::s_nodeAllocCount = 0;
+
+    ThreadPool::ThreadPool(const uint32_t numThreads, const bool pinThreads) : m_pinThreads(pinThreads)
     {
+        for (auto& globalTasks : m_globalTasks)
+        {
+            globalTasks = mup<LockFreeQueue<Task>>(4096);
+        }
+
         for (uint32_t i = 0; i < numThreads; ++i)
         {
-            m_threads.emplace_back(&ThreadPool::Worker, this);
+            m_workerQueues.push_back(mup<WorkerQueues>());
+        }
+
+        for (uint32_t i = 0; i < numThreads; ++i)
+        {
+            m_threads.emplace_back(&ThreadPool::Worker, this, i);
         }
     }
 
     ThreadPool::~ThreadPool()
     {
         {
-            std::lock_guard lock(m_taskMutex);
+            std::lock_guard lock(m_sleepMutex);
             m_shutdown = true;
             m_taskCond.notify_all();
         }
@@ -28,38 +51,374 @@ namespace op
 
     void ThreadPool::Run(const Task task, const int32_t priority)
     {
-        std::lock_guard lock(m_taskMutex);
-        m_tasks.emplace(priority, task);
-        m_taskCond.notify_all();
+        auto level = GetPriorityLevel(priority);
+
+        // 先计数再入队，保证worker取到任务时计数不会减成负数
+        m_pendingTaskCount.fetch_add(1);
+
+        // worker里派生出来的任务直接放进自己的deque，不走全局队列
+        auto pushed = s_curPool == this && m_workerQueues[s_curWorkerIndex]->deques[level].Push(task);
+        if (!pushed)
+        {
+            m_globalTasks[level]->push(task);
+        }
+
+        if (m_sleepingCount.load() > 0)
+        {
+            std::lock_guard lock(m_sleepMutex);
+            m_taskCond.notify_one();
+        }
+    }
+
+    ThreadPool::Task ThreadPool::AllocTask()
+    {
+        Task task = nullptr;
+        if (m_freeTasks.pop(task))
+        {
+            return task;
+        }
+
+        std::lock_guard lock(m_taskBlocksMutex);
+
+        auto block = std::make_unique<TaskFunc[]>(TASK_BLOCK_SIZE);
+        for (uint32_t i = 1; i < TASK_BLOCK_SIZE; ++i)
+        {
+            m_freeTasks.push(&block[i]);
+        }
+        task = &block[0];
+        m_taskBlocks.push_back(std::move(block));
+        m_taskAllocCount.fetch_add(1, std::memory_order_relaxed);
+
+        return task;
+    }
+
+    void ThreadPool::FreeTask(const Task task)
+    {
+        *task = nullptr;
+        m_freeTasks.push(task);
+    }
+
+    bool ThreadPool::TryRunPendingTask()
+    {
+        Task task = nullptr;
+        bool stolen = false;
+
+        auto workerIndex = s_curPool == this ? s_curWorkerIndex : INVALID_WORKER_INDEX;
+        if (!TryPopTask(workerIndex, task, stolen))
+        {
+            return false;
+        }
+
+        if (workerIndex == INVALID_WORKER_INDEX)
+        {
+            m_helpedTaskCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        ExecuteTask(task, stolen);
+
+        return true;
+    }
+
+    void ThreadPool::ExecuteTask(const Task task, const bool stolen)
+    {
+        // 等待中的任务可能在帮忙时嵌套执行别的任务，结束后要还原
+        auto prevStolen = s_curTaskStolen;
+        s_curTaskStolen = stolen;
+        (*task)();
+        s_curTaskStolen = prevStolen;
+
+        FreeTask(task);
     }
 
-    void ThreadPool::Worker()
+    bool ThreadPool::TryPopTask(const uint32_t workerIndex, Task& task, bool& stolen)
+    {
+        stolen = false;
+
+        auto workerCount = static_cast<uint32_t>(m_workerQueues.size());
+        auto isWorker = workerIndex != INVALID_WORKER_INDEX;
+
+        for (int32_t level = PRIORITY_LEVEL_COUNT - 1; level >= 0; --level)
+        {
+            if (isWorker && m_workerQueues[workerIndex]->deques[level].Pop(task))
+            {
+                m_pendingTaskCount.fetch_sub(1);
+                return true;
+            }
+
+            if (m_globalTasks[level]->pop(task))
+            {
+                m_pendingTaskCount.fetch_sub(1);
+                return true;
+            }
+
+            // 非worker线程没有自己的deque，所有worker都可以偷
+            for (uint32_t i = isWorker ? 1 : 0; i < workerCount; ++i)
+            {
+                auto victim = isWorker ? (workerIndex + i) % workerCount : i;
+                if (m_workerQueues[victim]->deques[level].Steal(task))
+                {
+                    m_pendingTaskCount.fetch_sub(1);
+                    m_stealCount.fetch_add(1, std::memory_order_relaxed);
+                    stolen = true;
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    void ThreadPool::Worker(const uint32_t workerIndex)
     {
         tracy::SetThreadName("ThreadPool Worker");
-        
+
+        s_curPool = this;
+        s_curWorkerIndex = workerIndex;
+
+        if (m_pinThreads)
+        {
+            auto cpuCount = std::max(std::thread::hardware_concurrency(), 2u);
+            PinCurrentThread(1 + workerIndex % (cpuCount - 1));
+        }
+
         while (true)
         {
             Task task = nullptr;
-            
+            bool stolen = false;
+
+            if (TryPopTask(workerIndex, task, stolen))
+            {
+                ExecuteTask(task, stolen);
+
+                continue;
+            }
+
+            auto idleBegin = std::chrono::steady_clock::now();
+
+            std::unique_lock lock(m_sleepMutex);
+            m_sleepingCount.fetch_add(1);
+            m_taskCond.wait(lock, [this]
+            {
+                return m_shutdown || m_pendingTaskCount.load() > 0;
+            });
+            m_sleepingCount.fetch_sub(1);
+
+            auto idleTime = std::chrono::steady_clock::now() - idleBegin;
+            m_idleTimeNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(idleTime).count(), std::memory_order_relaxed);
+
+            if (m_shutdown)
+            {
+                return;
+            }
+        }
+    }
+
+    uint32_t ThreadPool::GetDefaultThreadCount()
+    {
+        // hardware_concurrency取不到时返回0，退回到原来的3个worker
+        auto cpuCount = std::thread::hardware_concurrency();
+        if (cpuCount == 0)
+        {
+            return 3;
+        }
+
+        return std::max(cpuCount - 1, 1u);
+    }
+
+    bool ThreadPool::PinCurrentThread(const uint32_t cpu)
+    {
+#ifdef __linux__
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cpu, &cpuSet);
+
+        return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet) == 0;
+#else
+        return false;
+#endif
+    }
+
+    uint32_t ThreadPool::GetPriorityLevel(const int32_t priority)
+    {
+        return static_cast<uint32_t>(std::clamp(priority, 0, static_cast<int32_t>(PRIORITY_LEVEL_COUNT) - 1));
+    }
+
+    vec<ThreadPool::BenchmarkResult> ThreadPool::Benchmark(const uint32_t taskCount)
+    {
+        // 原来ThreadPool的做法
+        class LegacyPool
+        {
+        public:
+            using Task = std::function<void()>*;
+
+            explicit LegacyPool(const uint32_t numThreads)
             {
-                std::unique_lock lock(m_taskMutex);
-                m_taskCond.wait(lock, [this]
+                for (uint32_t i = 0; i < numThreads; ++i)
                 {
-                    return m_shutdown || !m_tasks.empty();
-                });
-                
-                if (m_shutdown)
+                    m_threads.emplace_back(&LegacyPool::Worker, this);
+                }
+            }
+
+            ~LegacyPool()
+            {
+                {
+                    std::lock_guard lock(m_taskMutex);
+                    m_shutdown = true;
+                    m_taskCond.notify_all();
+                }
+
+                for (auto& thread : m_threads)
                 {
-                    return;
+                    thread.join();
+                }
+            }
+
+            LegacyPool(const LegacyPool& other) = delete;
+            LegacyPool(LegacyPool&& other) noexcept = delete;
+            LegacyPool& operator=(const LegacyPool& other) = delete;
+            LegacyPool& operator=(LegacyPool&& other) noexcept = delete;
+
+            void Run(std::function<void()>&& func, const int32_t priority = 0)
+            {
+                auto task = FunctionPool<void()>::Ins()->Alloc(std::move(func));
+
+                std::lock_guard lock(m_taskMutex);
+                m_tasks.emplace(priority, task);
+                m_taskCond.notify_all();
+            }
+
+        private:
+            vec<std::thread> m_threads;
+            std::priority_queue<std::pair<int32_t, Task>> m_tasks;
+            std::mutex m_taskMutex;
+            std::condition_variable m_taskCond;
+            bool m_shutdown = false;
+
+            void Worker()
+            {
+                while (true)
+                {
+                    Task task = nullptr;
+
+                    {
+                        std::unique_lock lock(m_taskMutex);
+                        m_taskCond.wait(lock, [this]
+                        {
+                            return m_shutdown || !m_tasks.empty();
+                        });
+
+                        if (m_shutdown)
+                        {
+                            return;
+                        }
+
+                        task = m_tasks.top().second;
+                        m_tasks.pop();
+                    }
+
+                    (*task)();
+
+                    FunctionPool<void()>::Ins()->Free(task);
                 }
-                
-                task = m_tasks.top().second;
-                m_tasks.pop();
+            }
+        };
+
+        // 每个任务做一小段计算，和job里切出来的小批次差不多大
+        vec<uint32_t> sink(taskCount);
+        auto work = [&sink](const uint32_t i)
+        {
+            auto x = i;
+            for (uint32_t k = 0; k < 256; ++k)
+            {
+                x = x * 1664525u + 1013904223u;
+            }
+            sink[i] = x;
+        };
+
+        // 主线程只提交和等待，不帮忙执行，两个线程池用的线程数相同
+        auto runFlat = [&](auto& pool)
+        {
+            std::atomic<uint32_t> remaining = taskCount;
+            for (uint32_t i = 0; i < taskCount; ++i)
+            {
+                pool.Run([&work, &remaining, i]
+                {
+                    work(i);
+                    remaining.fetch_sub(1, std::memory_order_release);
+                });
             }
 
-            (*task)();
+            while (remaining.load(std::memory_order_acquire) > 0)
+            {
+                std::this_thread::yield();
+            }
+        };
 
-            FunctionPool<void()>::Ins()->Free(task);
+        static constexpr uint32_t CHILD_COUNT = 64;
+        auto runNested = [&](auto& pool)
+        {
+            auto rootCount = taskCount / CHILD_COUNT;
+            std::atomic<uint32_t> remaining = rootCount * CHILD_COUNT;
+            for (uint32_t root = 0; root < rootCount; ++root)
+            {
+                pool.Run([&pool, &work, &remaining, root]
+                {
+                    for (uint32_t i = 0; i < CHILD_COUNT; ++i)
+                    {
+                        pool.Run([&work, &remaining, index = root * CHILD_COUNT + i]
+                        {
+                            work(index);
+                            remaining.fetch_sub(1, std::memory_order_release);
+                        });
+                    }
+                });
+            }
+
+            while (remaining.load(std::memory_order_acquire) > 0)
+            {
+                std::this_thread::yield();
+            }
+        };
+
+        auto measure = [](auto&& f)
+        {
+            auto bestMs = std::numeric_limits<double>::max();
+            for (uint32_t i = 0; i < 3; ++i)
+            {
+                auto begin = std::chrono::steady_clock::now();
+                f();
+                auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                bestMs = std::min(bestMs, ms);
+            }
+            return bestMs;
+        };
+
+        vec<uint32_t> threadCounts = { 1, 3, GetDefaultThreadCount() };
+        std::sort(threadCounts.begin(), threadCounts.end());
+        threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+        vec<BenchmarkResult> results;
+        for (auto threadCount : threadCounts)
+        {
+            BenchmarkResult result;
+            result.threadCount = threadCount;
+            result.taskCount = taskCount;
+
+            {
+                LegacyPool pool(threadCount);
+                result.legacyFlatMs = measure([&] { runFlat(pool); });
+                result.legacyNestedMs = measure([&] { runNested(pool); });
+            }
+
+            {
+                ThreadPool pool(threadCount);
+                result.flatMs = measure([&] { runFlat(pool); });
+                result.nestedMs = measure([&] { runNested(pool); });
+            }
+
+            results.push_back(result);
         }
+
+        return results;
     }
 }
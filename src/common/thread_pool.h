@@ -1,18 +1,28 @@
 #pragma once
-#include <queue>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
+#include <boost/lockfree/queue.hpp>
+#include <boost/lockfree/stack.hpp>
 
-#include "function_pool.h"
+#include "inline_function.h"
+#include "work_stealing_deque.h"
 #include "math/vec.h"
 
 namespace op
 {
     class ThreadPool
     {
-        using Task = std::function<void()>*;
-        
     public:
-        explicit ThreadPool(uint32_t numThreads);
+        using TaskFunc = InlineFunction<void()>;
+        using Task = TaskFunc*;
+
+        static constexpr uint32_t PRIORITY_LEVEL_COUNT = 4;
+
+        // pinThreads为true时worker绑定到1号之后的核上，0号核留给主线程
+        explicit ThreadPool(uint32_t numThreads, bool pinThreads = false);
         ~ThreadPool();
         ThreadPool(const ThreadPool& other) = delete;
         ThreadPool(ThreadPool&& other) noexcept = delete;
@@ -21,22 +31,121 @@ namespace op
 
         template <typename F>
         void Run(F&& func, int32_t priority = 0);
+        // 在调用线程上执行一个待处理的任务，没有任务时返回false，等待中的线程可以借此帮忙干活
+        bool TryRunPendingTask();
+
+        uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_threads.size()); }
+        // 任务对象从堆上分配的次数，稳定运行时应当不再增长
+        uint32_t GetTaskAllocCount() const { return m_taskAllocCount.load(std::memory_order_relaxed); }
+        // 无锁队列和栈的节点从堆上分配的次数，所有线程池共用一个计数，构造时预分配的节点也算在内
+        static uint32_t GetNodeAllocCount() { return s_nodeAllocCount.load(std::memory_order_relaxed); }
+        uint64_t GetStealCount() const { return m_stealCount.load(std::memory_order_relaxed); }
+        // 所有worker累计的空闲等待时间
+        uint64_t GetIdleTimeNs() const { return m_idleTimeNs.load(std::memory_order_relaxed); }
+        // 由非worker线程通过TryRunPendingTask执行掉的任务数
+        uint64_t GetHelpedTaskCount() const { return m_helpedTaskCount.load(std::memory_order_relaxed); }
+
+        // 当前线程正在执行的任务是否是从其它worker那里偷来的
+        static bool IsCurrentTaskStolen() { return s_curTaskStolen; }
+        // 除主线程外每个核一个worker
+        static uint32_t GetDefaultThreadCount();
+        // 目前只在linux下生效，其它平台返回false
+        static bool PinCurrentThread(uint32_t cpu);
+
+        struct BenchmarkResult
+        {
+            uint32_t threadCount = 0;
+            uint32_t taskCount = 0;
+            // 原来的做法，所有任务进一个加锁的priority_queue
+            double legacyFlatMs = 0;
+            double flatMs = 0;
+            // 外部提交少量任务，每个任务里再派生子任务
+            double legacyNestedMs = 0;
+            double nestedMs = 0;
+        };
+
+        // 分别用1个、3个和默认数量的worker，比较原来的线程池和现在的任务吞吐
+        static vec<BenchmarkResult> Benchmark(uint32_t taskCount);
 
     private:
+        // boost::lockfree的空闲节点用完后会从堆上分配新节点，通过这个分配器计数
+        template <typename T>
+        struct NodeAllocator : std::allocator<T>
+        {
+            template <typename U>
+            struct rebind
+            {
+                using other = NodeAllocator<U>;
+            };
+
+            NodeAllocator() = default;
+            template <typename U>
+            NodeAllocator(const NodeAllocator<U>&) {}
+
+            T* allocate(const size_t n)
+            {
+                s_nodeAllocCount.fetch_add(1, std::memory_order_relaxed);
+                return std::allocator<T>::allocate(n);
+            }
+        };
+
+        template <typename T>
+        using LockFreeQueue = boost::lockfree::queue<T, boost::lockfree::allocator<NodeAllocator<T>>>;
+        template <typename T>
+        using LockFreeStack = boost::lockfree::stack<T, boost::lockfree::allocator<NodeAllocator<T>>>;
+
+        // 每个worker每个优先级一个deque，worker自己产生的任务放进自己的deque，其它worker可以从顶部偷
+        struct WorkerQueues
+        {
+            arr<WorkStealingDeque<Task>, PRIORITY_LEVEL_COUNT> deques;
+        };
+
         vec<std::thread> m_threads;
-        std::priority_queue<std::pair<int32_t, Task>> m_tasks;
-        std::mutex m_taskMutex;
+        vecup<WorkerQueues> m_workerQueues;
+        // 外部线程提交的任务以及deque溢出的任务进入全局队列，不限长度，避免worker往满队列里push时自己卡死
+        arr<up<LockFreeQueue<Task>>, PRIORITY_LEVEL_COUNT> m_globalTasks;
+
+        std::atomic<uint32_t> m_pendingTaskCount = 0;
+        std::atomic<uint32_t> m_sleepingCount = 0;
+        std::mutex m_sleepMutex;
         std::condition_variable m_taskCond;
-        bool m_shutdown = false;
+        std::atomic_bool m_shutdown = false;
+        bool m_pinThreads = false;
+
+        // 执行完的任务对象回收到free list里复用
+        static constexpr uint32_t TASK_BLOCK_SIZE = 256;
+        LockFreeStack<Task> m_freeTasks = LockFreeStack<Task>(TASK_BLOCK_SIZE * 4);
+        vec<up<TaskFunc[]>> m_taskBlocks;
+        std::mutex m_taskBlocksMutex;
+        std::atomic<uint32_t> m_taskAllocCount = 0;
+
+        std::atomic<uint64_t> m_stealCount = 0;
+        std::atomic<uint64_t> m_idleTimeNs = 0;
+        std::atomic<uint64_t> m_helpedTaskCount = 0;
+
+        static constexpr uint32_t INVALID_WORKER_INDEX = ~0u;
+
+        static std::atomic<uint32_t> s_nodeAllocCount;
+
+        static thread_local ThreadPool* s_curPool;
+        static thread_local uint32_t s_curWorkerIndex;
+        static thread_local bool s_curTaskStolen;
 
         void Run(Task task, int32_t priority = 0);
-        void Worker();
+        Task AllocTask();
+        void FreeTask(Task task);
+        void ExecuteTask(Task task, bool stolen);
+        bool TryPopTask(uint32_t workerIndex, Task& task, bool& stolen);
+        void Worker(uint32_t workerIndex);
+
+        static uint32_t GetPriorityLevel(int32_t priority);
     };
 
     template <typename F>
     void ThreadPool::Run(F&& func, int32_t priority)
     {
-        auto task = FunctionPool<void()>::Ins()->Alloc(std::forward<F>(func));
+        auto task = AllocTask();
+        *task = std::forward<F>(func);
         Run(task, priority);
     }
 }
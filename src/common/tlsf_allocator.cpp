@@ -0,0 +1,480 @@
+#include "tlsf_allocator.h"
+
+#include <bit>
+#include <cassert>
+#include <map>
+#include <random>
+
+namespace op
+{
+    TlsfAllocator::TlsfAllocator(const uint32_t capacity)
+    {
+        for (auto& heads : m_freeHeads)
+        {
+            heads.fill(NONE);
+        }
+
+        Grow(capacity);
+    }
+
+    uint32_t TlsfAllocator::Alloc(const uint32_t size)
+    {
+        assert(size > 0);
+
+        // 向上取到下一个桶的起点，找到的桶里任何一个块都放得下
+        uint64_t searchSize = size;
+        if (size >= SL_COUNT)
+        {
+            auto log2 = static_cast<uint32_t>(std::bit_width(size)) - 1;
+            searchSize += (1ull << (log2 - SL_BITS)) - 1;
+        }
+
+        auto index = searchSize > ~0u ? NONE : FindFree(static_cast<uint32_t>(searchSize));
+        if (index == NONE)
+        {
+            // 更大的桶都空了，size所在的桶里可能还有刚好放得下的块，逐个找一遍
+            uint32_t fl, sl;
+            Mapping(size, fl, sl);
+            for (index = m_freeHeads[fl][sl]; index != NONE && m_blocks[index].size < size; index = m_blocks[index].nextFree) {}
+            if (index == NONE)
+            {
+                return INVALID_HANDLE;
+            }
+        }
+
+        assert(m_blocks[index].size >= size);
+        RemoveFree(index);
+
+        // 剩下的部分切成新的空闲块
+        if (m_blocks[index].size > size)
+        {
+            auto remain = NewBlock(m_blocks[index].offset + size, m_blocks[index].size - size);
+            auto& block = m_blocks[index];
+            auto& remainBlock = m_blocks[remain];
+            remainBlock.prevPhys = index;
+            remainBlock.nextPhys = block.nextPhys;
+            if (block.nextPhys != NONE)
+            {
+                m_blocks[block.nextPhys].prevPhys = remain;
+            }
+            block.nextPhys = remain;
+            block.size = size;
+            if (m_lastBlock == index)
+            {
+                m_lastBlock = remain;
+            }
+            InsertFree(remain);
+        }
+
+        m_blocks[index].free = false;
+        m_used += size;
+        m_allocCount++;
+
+        return index;
+    }
+
+    void TlsfAllocator::Free(uint32_t handle)
+    {
+        assert(handle < m_blocks.size() && !m_blocks[handle].free);
+
+        m_used -= m_blocks[handle].size;
+        m_allocCount--;
+        m_blocks[handle].free = true;
+
+        auto next = m_blocks[handle].nextPhys;
+        if (next != NONE && m_blocks[next].free)
+        {
+            RemoveFree(next);
+            MergeWithNext(handle);
+        }
+
+        auto prev = m_blocks[handle].prevPhys;
+        if (prev != NONE && m_blocks[prev].free)
+        {
+            RemoveFree(prev);
+            MergeWithNext(prev);
+            handle = prev;
+        }
+
+        InsertFree(handle);
+    }
+
+    void TlsfAllocator::Grow(const uint32_t capacity)
+    {
+        assert(capacity >= m_capacity);
+
+        auto extra = capacity - m_capacity;
+        if (extra == 0)
+        {
+            return;
+        }
+
+        if (m_lastBlock != NONE && m_blocks[m_lastBlock].free)
+        {
+            RemoveFree(m_lastBlock);
+            m_blocks[m_lastBlock].size += extra;
+            InsertFree(m_lastBlock);
+        }
+        else
+        {
+            auto index = NewBlock(m_capacity, extra);
+            m_blocks[index].prevPhys = m_lastBlock;
+            m_blocks[index].free = true;
+            if (m_lastBlock != NONE)
+            {
+                m_blocks[m_lastBlock].nextPhys = index;
+            }
+            m_lastBlock = index;
+            InsertFree(index);
+        }
+
+        m_capacity = capacity;
+    }
+
+    bool TlsfAllocator::Validate() const
+    {
+        if (m_lastBlock == NONE)
+        {
+            return m_capacity == 0 && m_used == 0;
+        }
+        if (m_blocks[m_lastBlock].nextPhys != NONE)
+        {
+            return false;
+        }
+
+        // 从最后一块往前走，偏移必须首尾相接，不能有两个相邻的空闲块
+        uint32_t used = 0;
+        uint32_t allocCount = 0;
+        uint32_t freeCount = 0;
+        auto end = m_capacity;
+        for (auto index = m_lastBlock; index != NONE; index = m_blocks[index].prevPhys)
+        {
+            auto& block = m_blocks[index];
+            if (block.offset + block.size != end || block.size == 0)
+            {
+                return false;
+            }
+            if (block.prevPhys != NONE && m_blocks[block.prevPhys].nextPhys != index)
+            {
+                return false;
+            }
+            end = block.offset;
+
+            if (block.free)
+            {
+                freeCount++;
+                if (block.prevPhys != NONE && m_blocks[block.prevPhys].free)
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                used += block.size;
+                allocCount++;
+            }
+        }
+
+        if (end != 0 || used != m_used || allocCount != m_allocCount)
+        {
+            return false;
+        }
+
+        // 每个空闲块都要在自己大小对应的桶里，位图和链表是否为空一致
+        uint32_t listedCount = 0;
+        for (uint32_t fl = 0; fl < FL_COUNT; ++fl)
+        {
+            if (((m_flBitmap >> fl) & 1) != (m_slBitmaps[fl] != 0 ? 1u : 0u))
+            {
+                return false;
+            }
+
+            for (uint32_t sl = 0; sl < SL_COUNT; ++sl)
+            {
+                if (((m_slBitmaps[fl] >> sl) & 1) != (m_freeHeads[fl][sl] != NONE ? 1u : 0u))
+                {
+                    return false;
+                }
+
+                for (auto index = m_freeHeads[fl][sl]; index != NONE; index = m_blocks[index].nextFree)
+                {
+                    uint32_t blockFl, blockSl;
+                    Mapping(m_blocks[index].size, blockFl, blockSl);
+                    if (!m_blocks[index].free || blockFl != fl || blockSl != sl)
+                    {
+                        return false;
+                    }
+                    listedCount++;
+                }
+            }
+        }
+
+        return listedCount == freeCount;
+    }
+
+    uint32_t TlsfAllocator::NewBlock(const uint32_t offset, const uint32_t size)
+    {
+        uint32_t index;
+        if (!m_unusedBlocks.empty())
+        {
+            index = m_unusedBlocks.back();
+            m_unusedBlocks.pop_back();
+        }
+        else
+        {
+            index = static_cast<uint32_t>(m_blocks.size());
+            m_blocks.emplace_back();
+        }
+
+        m_blocks[index] = {};
+        m_blocks[index].offset = offset;
+        m_blocks[index].size = size;
+
+        return index;
+    }
+
+    uint32_t TlsfAllocator::FindFree(const uint32_t searchSize) const
+    {
+        uint32_t fl, sl;
+        Mapping(searchSize, fl, sl);
+
+        auto slBitmap = m_slBitmaps[fl] & (~0u << sl);
+        if (slBitmap == 0)
+        {
+            auto flBitmap = fl + 1 < 32 ? m_flBitmap & (~0u << (fl + 1)) : 0;
+            if (flBitmap == 0)
+            {
+                return NONE;
+            }
+
+            fl = static_cast<uint32_t>(std::countr_zero(flBitmap));
+            slBitmap = m_slBitmaps[fl];
+        }
+        sl = static_cast<uint32_t>(std::countr_zero(slBitmap));
+
+        return m_freeHeads[fl][sl];
+    }
+
+    void TlsfAllocator::InsertFree(const uint32_t index)
+    {
+        uint32_t fl, sl;
+        Mapping(m_blocks[index].size, fl, sl);
+
+        auto& head = m_freeHeads[fl][sl];
+        auto& block = m_blocks[index];
+        block.free = true;
+        block.prevFree = NONE;
+        block.nextFree = head;
+        if (head != NONE)
+        {
+            m_blocks[head].prevFree = index;
+        }
+        head = index;
+
+        m_slBitmaps[fl] |= 1u << sl;
+        m_flBitmap |= 1u << fl;
+    }
+
+    void TlsfAllocator::RemoveFree(const uint32_t index)
+    {
+        uint32_t fl, sl;
+        Mapping(m_blocks[index].size, fl, sl);
+
+        auto& block = m_blocks[index];
+        if (block.prevFree != NONE)
+        {
+            m_blocks[block.prevFree].nextFree = block.nextFree;
+        }
+        else
+        {
+            m_freeHeads[fl][sl] = block.nextFree;
+        }
+        if (block.nextFree != NONE)
+        {
+            m_blocks[block.nextFree].prevFree = block.prevFree;
+        }
+        block.prevFree = block.nextFree = NONE;
+
+        if (m_freeHeads[fl][sl] == NONE)
+        {
+            m_slBitmaps[fl] &= ~(1u << sl);
+            if (m_slBitmaps[fl] == 0)
+            {
+                m_flBitmap &= ~(1u << fl);
+            }
+        }
+    }
+
+    void TlsfAllocator::MergeWithNext(const uint32_t index)
+    {
+        auto next = m_blocks[index].nextPhys;
+        assert(next != NONE && m_blocks[next].free);
+
+        auto& block = m_blocks[index];
+        auto& nextBlock = m_blocks[next];
+        block.size += nextBlock.size;
+        block.nextPhys = nextBlock.nextPhys;
+        if (nextBlock.nextPhys != NONE)
+        {
+            m_blocks[nextBlock.nextPhys].prevPhys = index;
+        }
+        if (m_lastBlock == next)
+        {
+            m_lastBlock = index;
+        }
+
+        nextBlock = {};
+        m_unusedBlocks.push_back(next);
+    }
+
+    void TlsfAllocator::Mapping(const uint32_t size, uint32_t& fl, uint32_t& sl)
+    {
+        // 小于SL_COUNT的大小都放在第0级，每个大小一个桶
+        if (size < SL_COUNT)
+        {
+            fl = 0;
+            sl = size;
+            return;
+        }
+
+        auto log2 = static_cast<uint32_t>(std::bit_width(size)) - 1;
+        sl = (size >> (log2 - SL_BITS)) - SL_COUNT;
+        fl = log2 - SL_BITS + 1;
+    }
+
+    TlsfAllocatorValidation validate_tlsf_allocator()
+    {
+        TlsfAllocatorValidation result;
+        auto check = [&result](const bool condition, const char* name)
+        {
+            result.checkCount++;
+            if (!condition)
+            {
+                if (result.failedCount == 0)
+                {
+                    result.firstFailure = name;
+                }
+                result.failedCount++;
+            }
+        };
+        constexpr auto INVALID = TlsfAllocator::INVALID_HANDLE;
+
+        // 按顺序切分，剩下的部分留在最后
+        {
+            TlsfAllocator allocator(1024);
+            auto a = allocator.Alloc(100);
+            auto b = allocator.Alloc(200);
+            auto c = allocator.Alloc(300);
+            check(a != INVALID && b != INVALID && c != INVALID, "split allocs succeed");
+            check(allocator.GetOffset(a) == 0 && allocator.GetOffset(b) == 100 && allocator.GetOffset(c) == 300, "split allocs are contiguous");
+            check(allocator.GetUsed() == 600 && allocator.GetAllocCount() == 3 && allocator.Validate(), "split keeps counts");
+
+            // 先释放两头，最后释放中间，和前后两个空闲块一起合并成一整块
+            allocator.Free(a);
+            allocator.Free(c);
+            check(allocator.Validate(), "free without neighbours to merge");
+            check(allocator.Alloc(1024 - 200) == INVALID, "free space is still split by b");
+            allocator.Free(b);
+            check(allocator.Validate() && allocator.GetUsed() == 0 && allocator.GetAllocCount() == 0, "free merges with both neighbours");
+            auto all = allocator.Alloc(1024);
+            check(all != INVALID && allocator.GetOffset(all) == 0, "merged space serves a full alloc");
+        }
+
+        // 最后一块空闲时Grow直接把它变大，不然在后面接一块新的
+        {
+            TlsfAllocator allocator(256);
+            auto a = allocator.Alloc(128);
+            allocator.Grow(512);
+            check(allocator.Validate() && allocator.GetCapacity() == 512, "grow a free last block");
+            auto b = allocator.Alloc(384);
+            check(b != INVALID && allocator.GetOffset(b) == 128, "grown last block is one block");
+            allocator.Grow(768);
+            auto c = allocator.Alloc(256);
+            check(c != INVALID && allocator.GetOffset(c) == 512 && allocator.Validate(), "grow after a used last block appends");
+            allocator.Free(b);
+            allocator.Free(a);
+            allocator.Free(c);
+            auto all = allocator.Alloc(768);
+            check(all != INVALID && allocator.GetOffset(all) == 0, "grown blocks merge with old ones");
+        }
+
+        // 103和101在同一个桶里，更大的桶都是空的，要在这个桶里逐个找
+        {
+            TlsfAllocator allocator(103);
+            check(allocator.Alloc(104) == INVALID, "alloc larger than every block fails");
+            auto a = allocator.Alloc(101);
+            check(a != INVALID && allocator.GetOffset(a) == 0 && allocator.GetSize(a) == 101, "same bucket block is found by scanning");
+            check(allocator.Alloc(3) == INVALID && allocator.Alloc(2) != INVALID && allocator.Validate(), "remainder of a scanned block");
+        }
+
+        // 随机分配、释放和扩容，和BatchMesh一样放不下时扩容再重试
+        {
+            TlsfAllocator allocator(4096);
+            std::mt19937 rng(2024);
+            vec<uint32_t> handles;
+            // 偏移 -> 结束位置
+            std::map<uint32_t, uint32_t> ranges;
+            uint32_t used = 0;
+            for (uint32_t op = 0; op < 20000; ++op)
+            {
+                result.randomOpCount++;
+                auto roll = rng() % 8;
+                if (roll < 4 || handles.empty())
+                {
+                    // 大多数分配很小，偶尔有很大的
+                    auto size = rng() % 16 == 0 ? 1 + rng() % 8192 : 1 + rng() % 256;
+                    auto handle = allocator.Alloc(size);
+                    while (handle == INVALID)
+                    {
+                        allocator.Grow(allocator.GetCapacity() * 2);
+                        result.growCount++;
+                        handle = allocator.Alloc(size);
+                    }
+
+                    auto offset = allocator.GetOffset(handle);
+                    auto next = ranges.lower_bound(offset);
+                    auto overlaps = (next != ranges.end() && next->first < offset + size) ||
+                        (next != ranges.begin() && std::prev(next)->second > offset);
+                    if (overlaps || offset + size > allocator.GetCapacity() || allocator.GetSize(handle) != size)
+                    {
+                        result.overlapCount++;
+                    }
+                    ranges[offset] = offset + size;
+                    handles.push_back(handle);
+                    used += size;
+                }
+                else if (roll < 7)
+                {
+                    auto i = rng() % handles.size();
+                    auto handle = handles[i];
+                    used -= allocator.GetSize(handle);
+                    ranges.erase(allocator.GetOffset(handle));
+                    allocator.Free(handle);
+                    handles[i] = handles.back();
+                    handles.pop_back();
+                }
+                else
+                {
+                    allocator.Grow(allocator.GetCapacity() + 1 + rng() % 1024);
+                    result.growCount++;
+                }
+
+                if (!allocator.Validate() || allocator.GetUsed() != used || allocator.GetAllocCount() != handles.size())
+                {
+                    result.invalidCount++;
+                }
+            }
+            check(result.overlapCount == 0, "random allocs never overlap");
+            check(result.invalidCount == 0, "random ops keep the allocator valid");
+
+            for (auto handle : handles)
+            {
+                allocator.Free(handle);
+            }
+            auto all = allocator.Alloc(allocator.GetCapacity());
+            check(all != INVALID && allocator.GetOffset(all) == 0, "freeing everything merges back into one block");
+        }
+
+        return result;
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "const.h"
+
+namespace op
+{
+    // 两级分离空闲链表（TLSF）分配器，只管理偏移，不持有内存，单位由使用者决定
+    // 第一级按大小的最高位分桶，第二级把每个桶再均分成SL_COUNT份，分配和释放都是O(1)，释放时和相邻的空闲块合并
+    class TlsfAllocator
+    {
+    public:
+        static constexpr uint32_t INVALID_HANDLE = ~0u;
+
+        explicit TlsfAllocator(uint32_t capacity);
+        ~TlsfAllocator() = default;
+        TlsfAllocator(const TlsfAllocator& other) = delete;
+        TlsfAllocator(TlsfAllocator&& other) noexcept = delete;
+        TlsfAllocator& operator=(const TlsfAllocator& other) = delete;
+        TlsfAllocator& operator=(TlsfAllocator&& other) noexcept = delete;
+
+        // 放不下时返回INVALID_HANDLE，Grow之后可以重试，handle在Free之前一直有效
+        uint32_t Alloc(uint32_t size);
+        void Free(uint32_t handle);
+        // 只能变大，新增的空间接在最后，已有的分配不会移动
+        void Grow(uint32_t capacity);
+
+        uint32_t GetOffset(const uint32_t handle) const { return m_blocks[handle].offset; }
+        uint32_t GetSize(const uint32_t handle) const { return m_blocks[handle].size; }
+        uint32_t GetCapacity() const { return m_capacity; }
+        uint32_t GetUsed() const { return m_used; }
+        uint32_t GetAllocCount() const { return m_allocCount; }
+        // 校验物理链表和空闲链表是否一致，只用来调试
+        bool Validate() const;
+
+    private:
+        static constexpr uint32_t SL_BITS = 4;
+        static constexpr uint32_t SL_COUNT = 1 << SL_BITS;
+        static constexpr uint32_t FL_COUNT = 32 - SL_BITS + 1;
+        static constexpr uint32_t NONE = ~0u;
+
+        struct Block
+        {
+            uint32_t offset = 0;
+            uint32_t size = 0;
+            // 按偏移相邻的块
+            uint32_t prevPhys = NONE;
+            uint32_t nextPhys = NONE;
+            // 同一个桶里的空闲块
+            uint32_t prevFree = NONE;
+            uint32_t nextFree = NONE;
+            bool free = false;
+        };
+
+        uint32_t m_capacity = 0;
+        uint32_t m_used = 0;
+        uint32_t m_allocCount = 0;
+        // 偏移最大的块，Grow时接在它后面
+        uint32_t m_lastBlock = NONE;
+
+        uint32_t m_flBitmap = 0;
+        arr<uint32_t, FL_COUNT> m_slBitmaps = {};
+        arr<arr<uint32_t, SL_COUNT>, FL_COUNT> m_freeHeads;
+
+        vec<Block> m_blocks;
+        // 回收的Block下标
+        vec<uint32_t> m_unusedBlocks;
+
+        uint32_t NewBlock(uint32_t offset, uint32_t size);
+        // 找第一个不小于searchSize的非空桶，返回它的第一个块，桶里的块都不小于searchSize
+        uint32_t FindFree(uint32_t searchSize) const;
+        void InsertFree(uint32_t index);
+        void RemoveFree(uint32_t index);
+        // 两个块都必须已经不在空闲链表里
+        void MergeWithNext(uint32_t index);
+
+        static void Mapping(uint32_t size, uint32_t& fl, uint32_t& sl);
+    };
+
+    struct TlsfAllocatorValidation
+    {
+        uint32_t checkCount = 0;
+        uint32_t failedCount = 0;
+        // 第一个失败的检查
+        std::string firstFailure;
+        // 随机操作之后Validate失败，或者分配和其他分配重叠、越界、大小不对的次数
+        uint32_t invalidCount = 0;
+        uint32_t overlapCount = 0;
+        uint32_t randomOpCount = 0;
+        uint32_t growCount = 0;
+    };
+
+    // 不依赖GL，检查切分、前后合并、Grow接在空闲的最后一块上和同一个桶里逐个查找的情况
+    // 再随机分配、释放和扩容，每一步之后都调用Validate
+    TlsfAllocatorValidation validate_tlsf_allocator();
+}
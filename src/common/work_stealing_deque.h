@@ -0,0 +1,118 @@
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+namespace op
+{
+    // Chase-Lev 双端队列，只有owner线程能Push/Pop底部，其它线程从顶部Steal
+    // 容量固定，满了之后Push会失败，由调用方自己兜底
+    template <typename T>
+    class WorkStealingDeque
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+    public:
+        explicit WorkStealingDeque(uint32_t capacity = 1024);
+        ~WorkStealingDeque() = default;
+        WorkStealingDeque(const WorkStealingDeque& other) = delete;
+        WorkStealingDeque(WorkStealingDeque&& other) noexcept = delete;
+        WorkStealingDeque& operator=(const WorkStealingDeque& other) = delete;
+        WorkStealingDeque& operator=(WorkStealingDeque&& other) noexcept = delete;
+
+        bool Push(const T& element);
+        bool Pop(T& element);
+        bool Steal(T& element);
+
+        bool Empty() const;
+
+    private:
+        alignas(64) std::atomic<int64_t> m_top = 0;
+        alignas(64) std::atomic<int64_t> m_bottom = 0;
+
+        int64_t m_mask = 0;
+        std::unique_ptr<std::atomic<T>[]> m_buffer;
+    };
+
+    template <typename T>
+    WorkStealingDeque<T>::WorkStealingDeque(const uint32_t capacity)
+    {
+        assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+        m_mask = static_cast<int64_t>(capacity) - 1;
+        m_buffer = std::make_unique<std::atomic<T>[]>(capacity);
+    }
+
+    template <typename T>
+    bool WorkStealingDeque<T>::Push(const T& element)
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed);
+        auto t = m_top.load(std::memory_order_acquire);
+        if (b - t > m_mask)
+        {
+            return false;
+        }
+
+        m_buffer[b & m_mask].store(element, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    template <typename T>
+    bool WorkStealingDeque<T>::Pop(T& element)
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = m_top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            // 空队列
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        element = m_buffer[b & m_mask].load(std::memory_order_relaxed);
+        if (t != b)
+        {
+            return true;
+        }
+
+        // 只剩最后一个元素，和Steal抢
+        auto success = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+
+        return success;
+    }
+
+    template <typename T>
+    bool WorkStealingDeque<T>::Steal(T& element)
+    {
+        auto t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = m_bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+        {
+            return false;
+        }
+
+        element = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+
+        return m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    template <typename T>
+    bool WorkStealingDeque<T>::Empty() const
+    {
+        auto t = m_top.load(std::memory_order_relaxed);
+        auto b = m_bottom.load(std::memory_order_relaxed);
+
+        return b <= t;
+    }
+}
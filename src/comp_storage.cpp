@@ -0,0 +1,152 @@
+#include "comp_storage.h"
+
+#include <chrono>
+
+namespace op
+{
+    umap<std::type_index, CompStorage::TypedCompsCreator> CompStorage::m_typedCompsCreators = {};
+
+    void CompStorage::AddComp(crsp<Comp> comp)
+    {
+        // 已经加过了
+        if (comp->m_typeHandle.IsValid())
+        {
+            return;
+        }
+
+        auto& typedComps = m_typedComps[comp->GetType()];
+        if (!typedComps)
+        {
+            typedComps = m_typedCompsCreators.at(comp->GetType())();
+        }
+
+        comp->m_typeHandle = typedComps->Add(comp.get());
+        comp->m_pendingHandle = m_pendingComps.Add(comp.get());
+    }
+
+    void CompStorage::RemoveComp(crsp<Comp> comp)
+    {
+        if (!comp->m_typeHandle.IsValid())
+        {
+            return;
+        }
+
+        m_typedComps.at(comp->GetType())->Remove(comp->m_typeHandle);
+        comp->m_typeHandle = {};
+
+        if (m_iterating)
+        {
+            m_removedWhileIterating.push_back(comp);
+        }
+
+        if (comp->m_allHandle.IsValid())
+        {
+            if (m_iterating)
+            {
+                m_allComps.Get(comp->m_allHandle) = nullptr;
+                m_deferredRemoves.push_back(comp->m_allHandle);
+            }
+            else
+            {
+                m_allComps.Remove(comp->m_allHandle);
+            }
+            comp->m_allHandle = {};
+        }
+
+        // 还没有Start过
+        if (comp->m_pendingHandle.IsValid())
+        {
+            if (m_iterating)
+            {
+                m_pendingComps.Get(comp->m_pendingHandle) = nullptr;
+                m_deferredPendingRemoves.push_back(comp->m_pendingHandle);
+            }
+            else
+            {
+                m_pendingComps.Remove(comp->m_pendingHandle);
+            }
+            comp->m_pendingHandle = {};
+        }
+    }
+
+    void CompStorage::EndIterating()
+    {
+        m_iterating = false;
+
+        for (auto handle : m_deferredRemoves)
+        {
+            m_allComps.Remove(handle);
+        }
+        m_deferredRemoves.clear();
+
+        for (auto handle : m_deferredPendingRemoves)
+        {
+            m_pendingComps.Remove(handle);
+        }
+        m_deferredPendingRemoves.clear();
+        m_removedWhileIterating.clear();
+    }
+
+    CompStorage::BenchmarkResult CompStorage::Benchmark(const uint32_t compCount)
+    {
+        vecsp<Comp> comps;
+        vecwp<Comp> weakComps;
+        CompStorage storage;
+        comps.reserve(compCount);
+        weakComps.reserve(compCount);
+        for (uint32_t i = 0; i < compCount; ++i)
+        {
+            auto comp = msp<Comp>();
+            comp->m_type = std::type_index(typeid(Comp));
+            comps.push_back(comp);
+            weakComps.push_back(comp);
+        }
+
+        // Comp本身没有注册，直接放进列表
+        storage.m_typedComps[std::type_index(typeid(Comp))] = mup<TypedComps<Comp>>();
+        for (auto& comp : comps)
+        {
+            storage.AddComp(comp);
+        }
+        storage.ForeachPendingComp([](Comp*) { return true; });
+
+        auto measure = [](auto&& f)
+        {
+            auto bestMs = std::numeric_limits<double>::max();
+            for (uint32_t i = 0; i < 3; ++i)
+            {
+                auto begin = std::chrono::steady_clock::now();
+                f();
+                auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                bestMs = std::min(bestMs, ms);
+            }
+            return bestMs;
+        };
+
+        BenchmarkResult result;
+        result.compCount = compCount;
+        result.weakPtrMs = measure([&]
+        {
+            static vecwp<Comp> curVec;
+            curVec.assign(weakComps.begin(), weakComps.end());
+            for (const auto& compPtr : curVec)
+            {
+                compPtr.lock()->Update();
+            }
+        });
+        result.chunkMs = measure([&]
+        {
+            storage.ForeachAllComp([](Comp* comp)
+            {
+                comp->Update();
+            });
+        });
+
+        for (auto& comp : comps)
+        {
+            storage.RemoveComp(comp);
+        }
+
+        return result;
+    }
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <typeindex>
+
+#include "const.h"
+#include "common/chunk_list.h"
+#include "objects/comp.h"
+
+namespace op
+{
+    // 同一种comp的指针按块连续存放，GetComps<T>直接拿到带类型的列表，另外按加入顺序存一份所有Start过的comp
+    // comp里记着自己在列表里的handle，增删都是O(1)，遍历时不需要lock weak_ptr
+    // 不持有comp，comp所在的Object被销毁之前必须先从这里移除
+    class CompStorage
+    {
+    public:
+        template <typename T>
+        using CompList = ChunkList<T*>;
+
+        CompStorage() = default;
+        ~CompStorage() = default;
+        CompStorage(const CompStorage& other) = delete;
+        CompStorage(CompStorage&& other) noexcept = delete;
+        CompStorage& operator=(const CompStorage& other) = delete;
+        CompStorage& operator=(CompStorage&& other) noexcept = delete;
+
+        void AddComp(crsp<Comp> comp);
+        void RemoveComp(crsp<Comp> comp);
+        // 返回的列表在CompStorage销毁之前一直有效，可以按块切分给job
+        template <typename T>
+        cr<CompList<T>> GetComps();
+        cr<CompList<Comp>> GetAllComps() const { return m_allComps; }
+        template <typename T>
+        static void RegisterComp();
+
+        // func返回true的comp加入所有comp的列表，返回false的留到下一次
+        template <typename Func>
+        void ForeachPendingComp(Func&& func);
+        // 遍历过程中被移除的comp不会再被访问，遍历结束之前也不会被释放
+        template <typename Func>
+        void ForeachAllComp(Func&& func);
+
+        struct BenchmarkResult
+        {
+            uint32_t compCount = 0;
+            // 原来的做法，复制一份weak_ptr的列表，逐个lock之后调用Update
+            double weakPtrMs = 0;
+            double chunkMs = 0;
+        };
+
+        static BenchmarkResult Benchmark(uint32_t compCount);
+
+    private:
+        struct TypedCompsBase
+        {
+            virtual ~TypedCompsBase() = default;
+            virtual ChunkListHandle Add(Comp* comp) = 0;
+            virtual void Remove(ChunkListHandle handle) = 0;
+        };
+
+        template <typename T>
+        struct TypedComps final : TypedCompsBase
+        {
+            CompList<T> comps;
+
+            ChunkListHandle Add(Comp* comp) override { return comps.Add(static_cast<T*>(comp)); }
+            void Remove(const ChunkListHandle handle) override { comps.Remove(handle); }
+        };
+
+        using TypedCompsCreator = up<TypedCompsBase>(*)();
+
+        umap<std::type_index, up<TypedCompsBase>> m_typedComps;
+        CompList<Comp> m_allComps;
+        CompList<Comp> m_pendingComps;
+        bool m_iterating = false;
+        // 遍历中被移除的comp先在列表里置空，遍历结束后再删掉，同时保证comp在遍历结束前不被释放
+        vec<ChunkListHandle> m_deferredRemoves;
+        vec<ChunkListHandle> m_deferredPendingRemoves;
+        vecsp<Comp> m_removedWhileIterating;
+
+        static umap<std::type_index, TypedCompsCreator> m_typedCompsCreators;
+
+        void EndIterating();
+    };
+
+    template <typename T>
+    cr<CompStorage::CompList<T>> CompStorage::GetComps()
+    {
+        static_assert(std::is_base_of_v<Comp, T>);
+
+        auto& typedComps = m_typedComps[std::type_index(typeid(T))];
+        if (!typedComps)
+        {
+            typedComps = mup<TypedComps<T>>();
+        }
+
+        return static_cast<TypedComps<T>*>(typedComps.get())->comps;
+    }
+
+    template <typename T>
+    void CompStorage::RegisterComp()
+    {
+        static_assert(std::is_base_of_v<Comp, T>);
+
+        m_typedCompsCreators[std::type_index(typeid(T))] = []() -> up<TypedCompsBase>
+        {
+            return mup<TypedComps<T>>();
+        };
+    }
+
+    template <typename Func>
+    void CompStorage::ForeachPendingComp(Func&& func)
+    {
+        m_iterating = true;
+        // 遍历中新加的comp排在后面，留到下一次
+        auto count = m_pendingComps.Size();
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            auto comp = m_pendingComps[i];
+            if (!comp)
+            {
+                continue;
+            }
+
+            auto started = func(comp);
+            // 在func里把自己移除了
+            if (!comp->m_pendingHandle.IsValid())
+            {
+                continue;
+            }
+
+            if (started)
+            {
+                m_pendingComps[i] = nullptr;
+                m_deferredPendingRemoves.push_back(comp->m_pendingHandle);
+                comp->m_pendingHandle = {};
+                comp->m_allHandle = m_allComps.Add(comp);
+            }
+        }
+
+        EndIterating();
+    }
+
+    template <typename Func>
+    void CompStorage::ForeachAllComp(Func&& func)
+    {
+        m_iterating = true;
+        for (uint32_t chunkIndex = 0; chunkIndex < m_allComps.GetChunkCount(); ++chunkIndex)
+        {
+            for (auto comp : m_allComps.GetChunk(chunkIndex))
+            {
+                if (comp)
+                {
+                    func(comp);
+                }
+            }
+        }
+
+        EndIterating();
+    }
+}
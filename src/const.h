@@ -12,8 +12,6 @@ namespace op
 {
     #define TRACY_IDLE_COLOR 0x25281E
 
-    static uint32_t JOB_THREAD_COUNT = 3;
-    
     static bool LOG_RENDER_TARGET_STACK_NOT_EMPTY = false;
     static bool ENABLE_GL_CHECK_ERROR = true;
     
@@ -98,6 +96,7 @@ namespace op
     STRING_HANDLE(PER_VIEW_CBUFFER, PerViewCBuffer)
     STRING_HANDLE(PER_MATERIAL_CBUFFER, PerMaterialCBuffer)
     STRING_HANDLE(OBJECT_INDEX_CBUFFER, ObjectIndexCBuffer)
+    STRING_HANDLE(BATCH_MATERIAL_PARAMS, _BatchMaterialParams)
 
     STRING_HANDLE(MIN_LUMINANCE, _MinLuminance)
     STRING_HANDLE(MAX_LUMINANCE, _MaxLuminance)
@@ -182,6 +181,8 @@ namespace op
     };
     
     static constexpr uint32_t MAX_VERTEX_ATTR_STRIDE_F = 16;
+    // 包括LOD0
+    static constexpr uint32_t MAX_MESH_LOD_COUNT = 4;
 
     inline std::unordered_map<VertexAttr, uint32_t> VERTEX_ATTR_STRIDE =
     {
@@ -0,0 +1,430 @@
+#include "culling_bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+
+#include "math/math_utils.h"
+
+namespace op
+{
+    void CullingBvh::Build(cr<CullingView> view, cr<vec<uint32_t>> indices)
+    {
+        m_items = indices;
+        m_itemBounds.resize(m_items.size());
+        m_nodes.clear();
+        m_nodes.reserve(ceil_div(static_cast<uint32_t>(m_items.size()), LEAF_SIZE) * 2 + 1);
+
+        auto maxIndex = m_items.empty() ? 0 : *std::max_element(m_items.begin(), m_items.end());
+        m_itemLeaf.assign(maxIndex + 1, INVALID_INDEX);
+
+        if (!m_items.empty())
+        {
+            BuildNode(view, INVALID_INDEX, 0, static_cast<uint32_t>(m_items.size()));
+        }
+
+        m_leafDirty.assign(m_nodes.size(), false);
+        m_dirtyLeaves.clear();
+        m_movedCount = 0;
+
+        CollectSubtrees();
+    }
+
+    void CullingBvh::Refit(cr<CullingView> view)
+    {
+        for (auto leaf : m_dirtyLeaves)
+        {
+            ComputeLeafBounds(view, m_nodes[leaf]);
+            m_leafDirty[leaf] = false;
+
+            for (auto parent = m_nodes[leaf].parent; parent != INVALID_INDEX; parent = m_nodes[parent].parent)
+            {
+                ComputeInnerBounds(parent);
+            }
+        }
+
+        m_dirtyLeaves.clear();
+    }
+
+    void CullingBvh::MarkMoved(const uint32_t index)
+    {
+        if (index >= m_itemLeaf.size() || m_itemLeaf[index] == INVALID_INDEX)
+        {
+            return;
+        }
+
+        auto leaf = m_itemLeaf[index];
+        if (!m_leafDirty[leaf])
+        {
+            m_leafDirty[leaf] = true;
+            m_dirtyLeaves.push_back(leaf);
+        }
+
+        m_movedCount++;
+    }
+
+    bool CullingBvh::NeedRebuild() const
+    {
+        // refit不会改变树的结构，移动的物体多了以后节点会互相重叠，剔除效率下降
+        return m_movedCount > m_items.size() / 4 + LEAF_SIZE;
+    }
+
+    void CullingBvh::CullSubtree(const uint32_t subtree, cr<CullingPlanes> planes, uint64_t* visibleBits) const
+    {
+        CullNode(m_subtrees[subtree], 0x3f, planes, visibleBits);
+    }
+
+    uint32_t CullingBvh::BuildNode(cr<CullingView> view, const uint32_t parent, const uint32_t first, const uint32_t count)
+    {
+        auto nodeIndex = static_cast<uint32_t>(m_nodes.size());
+        m_nodes.push_back({});
+        m_nodes[nodeIndex].firstItem = first;
+        m_nodes[nodeIndex].itemCount = count;
+        m_nodes[nodeIndex].right = 0;
+        m_nodes[nodeIndex].parent = parent;
+
+        if (count <= LEAF_SIZE)
+        {
+            // 叶子内部按index排序，写visible时同一个word的位可以合并成一次写入
+            std::sort(m_items.begin() + first, m_items.begin() + first + count);
+            
+            ComputeLeafBounds(view, m_nodes[nodeIndex]);
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                m_itemLeaf[m_items[i]] = nodeIndex;
+            }
+
+            return nodeIndex;
+        }
+
+        // 按中心点包围盒最长的轴对半分
+        arr<const float*, 3> centers = { view.centerX, view.centerY, view.centerZ };
+        arr<float, 3> minCenter, maxCenter;
+        minCenter.fill(std::numeric_limits<float>::max());
+        maxCenter.fill(std::numeric_limits<float>::lowest());
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            for (uint32_t axis = 0; axis < 3; ++axis)
+            {
+                minCenter[axis] = std::min(minCenter[axis], centers[axis][m_items[i]]);
+                maxCenter[axis] = std::max(maxCenter[axis], centers[axis][m_items[i]]);
+            }
+        }
+
+        uint32_t splitAxis = 0;
+        for (uint32_t axis = 1; axis < 3; ++axis)
+        {
+            if (maxCenter[axis] - minCenter[axis] > maxCenter[splitAxis] - minCenter[splitAxis])
+            {
+                splitAxis = axis;
+            }
+        }
+
+        auto axisCenters = centers[splitAxis];
+        auto leftCount = count / 2;
+        std::nth_element(
+            m_items.begin() + first,
+            m_items.begin() + first + leftCount,
+            m_items.begin() + first + count,
+            [axisCenters](const uint32_t a, const uint32_t b)
+            {
+                return axisCenters[a] < axisCenters[b];
+            });
+
+        BuildNode(view, nodeIndex, first, leftCount);
+        auto right = BuildNode(view, nodeIndex, first + leftCount, count - leftCount);
+        m_nodes[nodeIndex].right = right;
+        ComputeInnerBounds(nodeIndex);
+
+        return nodeIndex;
+    }
+
+    void CullingBvh::ComputeLeafBounds(cr<CullingView> view, Node& node)
+    {
+        node.minX = node.minY = node.minZ = std::numeric_limits<float>::max();
+        node.maxX = node.maxY = node.maxZ = std::numeric_limits<float>::lowest();
+
+        for (uint32_t i = node.firstItem; i < node.firstItem + node.itemCount; ++i)
+        {
+            auto item = m_items[i];
+            auto& bounds = m_itemBounds[i];
+            bounds.centerX = view.centerX[item];
+            bounds.centerY = view.centerY[item];
+            bounds.centerZ = view.centerZ[item];
+            bounds.extentsX = view.extentsX[item];
+            bounds.extentsY = view.extentsY[item];
+            bounds.extentsZ = view.extentsZ[item];
+
+            node.minX = std::min(node.minX, bounds.centerX - bounds.extentsX);
+            node.minY = std::min(node.minY, bounds.centerY - bounds.extentsY);
+            node.minZ = std::min(node.minZ, bounds.centerZ - bounds.extentsZ);
+            node.maxX = std::max(node.maxX, bounds.centerX + bounds.extentsX);
+            node.maxY = std::max(node.maxY, bounds.centerY + bounds.extentsY);
+            node.maxZ = std::max(node.maxZ, bounds.centerZ + bounds.extentsZ);
+        }
+    }
+
+    void CullingBvh::ComputeInnerBounds(const uint32_t nodeIndex)
+    {
+        auto& node = m_nodes[nodeIndex];
+        auto& left = m_nodes[nodeIndex + 1];
+        auto& right = m_nodes[node.right];
+
+        node.minX = std::min(left.minX, right.minX);
+        node.minY = std::min(left.minY, right.minY);
+        node.minZ = std::min(left.minZ, right.minZ);
+        node.maxX = std::max(left.maxX, right.maxX);
+        node.maxY = std::max(left.maxY, right.maxY);
+        node.maxZ = std::max(left.maxZ, right.maxZ);
+    }
+
+    void CullingBvh::CollectSubtrees()
+    {
+        m_subtrees.clear();
+        if (m_nodes.empty())
+        {
+            return;
+        }
+
+        // 从根节点往下逐层展开，直到子树数量足够分给所有worker
+        m_subtrees.push_back(0);
+        while (m_subtrees.size() < SUBTREE_COUNT)
+        {
+            vec<uint32_t> next;
+            next.reserve(m_subtrees.size() * 2);
+
+            auto expanded = false;
+            for (auto nodeIndex : m_subtrees)
+            {
+                if (m_nodes[nodeIndex].right == 0)
+                {
+                    next.push_back(nodeIndex);
+                    continue;
+                }
+
+                next.push_back(nodeIndex + 1);
+                next.push_back(m_nodes[nodeIndex].right);
+                expanded = true;
+            }
+
+            if (!expanded)
+            {
+                break;
+            }
+
+            m_subtrees.swap(next);
+        }
+    }
+
+    void CullingBvh::CullNode(const uint32_t nodeIndex, uint32_t planeMask, cr<CullingPlanes> planes, uint64_t* visibleBits) const
+    {
+        auto& node = m_nodes[nodeIndex];
+
+        auto cx = (node.minX + node.maxX) * 0.5f;
+        auto cy = (node.minY + node.maxY) * 0.5f;
+        auto cz = (node.minZ + node.maxZ) * 0.5f;
+        auto ex = (node.maxX - node.minX) * 0.5f;
+        auto ey = (node.maxY - node.minY) * 0.5f;
+        auto ez = (node.maxZ - node.minZ) * 0.5f;
+
+        for (uint32_t p = 0; p < 6; ++p)
+        {
+            if ((planeMask & (1u << p)) == 0)
+            {
+                continue;
+            }
+
+            auto d = planes.nx[p] * cx + planes.ny[p] * cy + planes.nz[p] * cz + planes.w[p];
+            auto r = planes.absX[p] * ex + planes.absY[p] * ey + planes.absZ[p] * ez;
+            if (d + r < 0.0f)
+            {
+                return;
+            }
+
+            // 整个节点都在这个平面内侧，子节点不用再测这个平面
+            if (d - r >= 0.0f)
+            {
+                planeMask &= ~(1u << p);
+            }
+        }
+
+        if (planeMask == 0)
+        {
+            SetVisible(visibleBits, node.firstItem, node.itemCount);
+            return;
+        }
+
+        if (node.right != 0)
+        {
+            CullNode(nodeIndex + 1, planeMask, planes, visibleBits);
+            CullNode(node.right, planeMask, planes, visibleBits);
+            return;
+        }
+
+        auto curWord = INVALID_INDEX;
+        uint64_t bits = 0;
+        for (uint32_t i = node.firstItem; i < node.firstItem + node.itemCount; ++i)
+        {
+            auto& bounds = m_itemBounds[i];
+
+            auto visible = true;
+            for (uint32_t p = 0; p < 6 && visible; ++p)
+            {
+                if ((planeMask & (1u << p)) == 0)
+                {
+                    continue;
+                }
+
+                auto d = planes.nx[p] * bounds.centerX + planes.ny[p] * bounds.centerY + planes.nz[p] * bounds.centerZ + planes.w[p];
+                auto r = planes.absX[p] * bounds.extentsX + planes.absY[p] * bounds.extentsY + planes.absZ[p] * bounds.extentsZ;
+                visible = d + r >= 0.0f;
+            }
+
+            if (!visible)
+            {
+                continue;
+            }
+
+            auto item = m_items[i];
+            if (bit_word_index(item) != curWord)
+            {
+                FlushBits(visibleBits, curWord, bits);
+                curWord = bit_word_index(item);
+                bits = 0;
+            }
+            bits |= bit_word_mask(item);
+        }
+        FlushBits(visibleBits, curWord, bits);
+    }
+
+    void CullingBvh::SetVisible(uint64_t* visibleBits, const uint32_t first, const uint32_t count) const
+    {
+        auto curWord = INVALID_INDEX;
+        uint64_t bits = 0;
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            auto item = m_items[i];
+            if (bit_word_index(item) != curWord)
+            {
+                FlushBits(visibleBits, curWord, bits);
+                curWord = bit_word_index(item);
+                bits = 0;
+            }
+            bits |= bit_word_mask(item);
+        }
+        FlushBits(visibleBits, curWord, bits);
+    }
+
+    void CullingBvh::FlushBits(uint64_t* visibleBits, const uint32_t word, const uint64_t bits)
+    {
+        if (bits == 0)
+        {
+            return;
+        }
+
+        // 空间上相邻的物体可能落在同一个word里，不同子树会同时写
+        std::atomic_ref(visibleBits[word]).fetch_or(bits, std::memory_order_relaxed);
+    }
+
+    vec<CullingBvh::BenchmarkResult> CullingBvh::Benchmark(const uint32_t count)
+    {
+        auto wordCount = ceil_div(count, CULLING_BLOCK_SIZE);
+        auto paddedCount = wordCount * CULLING_BLOCK_SIZE;
+
+        vec<sl<float>> data;
+        data.reserve(6);
+        for (uint32_t i = 0; i < 6; ++i)
+        {
+            data.emplace_back(paddedCount, CULLING_SIMD_ALIGNMENT);
+            data.back().Resize(paddedCount);
+        }
+        vec<uint64_t> visibleBits(wordCount);
+
+        // 补齐的部分放在很远的地方，保证不可见
+        std::mt19937 random(12345);
+        std::uniform_real_distribution centerDist(-1000.0f, 1000.0f);
+        std::uniform_real_distribution extentsDist(0.5f, 5.0f);
+        for (uint32_t i = 0; i < paddedCount; ++i)
+        {
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                data[j][i] = i < count ? centerDist(random) : 1e6f;
+                data[j + 3][i] = extentsDist(random);
+            }
+        }
+
+        CullingView view;
+        view.centerX = data[0].Data();
+        view.centerY = data[1].Data();
+        view.centerZ = data[2].Data();
+        view.extentsX = data[3].Data();
+        view.extentsY = data[4].Data();
+        view.extentsZ = data[5].Data();
+        view.visibleBits[0] = visibleBits.data();
+
+        vec<uint32_t> indices(count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            indices[i] = i;
+        }
+
+        CullingBvh bvh;
+        bvh.Build(view, indices);
+
+        auto kernel = get_culling_kernel(best_simd_isa());
+
+        auto measure = [](auto&& f)
+        {
+            auto bestNs = std::numeric_limits<double>::max();
+            for (uint32_t i = 0; i < 5; ++i)
+            {
+                auto begin = std::chrono::steady_clock::now();
+                f();
+                auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+                bestNs = std::min(bestNs, ns);
+            }
+            return bestNs;
+        };
+
+        vec<BenchmarkResult> results;
+        for (auto targetRatio : { 0.01f, 0.05f, 0.25f, 0.5f, 1.0f })
+        {
+            // 盒状视锥，体积占整个场景的targetRatio
+            auto halfSize = 1000.0f * std::cbrt(targetRatio);
+            CullingPlanes planes(arr<Vec4, 6>{
+                Vec4(1, 0, 0, halfSize), Vec4(-1, 0, 0, halfSize),
+                Vec4(0, 1, 0, halfSize), Vec4(0, -1, 0, halfSize),
+                Vec4(0, 0, 1, halfSize), Vec4(0, 0, -1, halfSize),
+            });
+
+            BenchmarkResult result;
+            result.flatNs = measure([&]
+            {
+                kernel(&planes, 1, view, 0, paddedCount);
+            });
+            result.bvhNs = measure([&]
+            {
+                std::fill(visibleBits.begin(), visibleBits.end(), 0);
+                for (uint32_t i = 0; i < bvh.GetSubtreeCount(); ++i)
+                {
+                    bvh.CullSubtree(i, planes, visibleBits.data());
+                }
+            });
+
+            uint32_t visibleCount = 0;
+            for (auto word : visibleBits)
+            {
+                visibleCount += std::popcount(word);
+            }
+            result.visibleRatio = static_cast<float>(visibleCount) / static_cast<float>(count);
+
+            results.push_back(result);
+        }
+
+        return results;
+    }
+}
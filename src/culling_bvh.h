@@ -0,0 +1,82 @@
+#pragma once
+
+#include "culling_kernels.h"
+
+namespace op
+{
+    // 建在CullingBuffer的包围盒上的BVH，先按节点剔除，只有和视锥相交的叶子才逐个测试
+    // 物体移动时只refit，启用的物体集合变化或者移动的物体太多时重建
+    class CullingBvh
+    {
+    public:
+        struct BenchmarkResult
+        {
+            float visibleRatio = 0.0f;
+            double flatNs = 0.0;
+            double bvhNs = 0.0;
+        };
+
+        CullingBvh() = default;
+        ~CullingBvh() = default;
+        CullingBvh(const CullingBvh& other) = delete;
+        CullingBvh(CullingBvh&& other) noexcept = delete;
+        CullingBvh& operator=(const CullingBvh& other) = delete;
+        CullingBvh& operator=(CullingBvh&& other) noexcept = delete;
+
+        void Build(cr<CullingView> view, cr<vec<uint32_t>> indices);
+        void Refit(cr<CullingView> view);
+        void MarkMoved(uint32_t index);
+        bool NeedRebuild() const;
+
+        // 并行剔除时每个子树一个任务
+        uint32_t GetSubtreeCount() const { return static_cast<uint32_t>(m_subtrees.size()); }
+        // 只会把可见物体的位置1，调用前visibleBits需要清零，多个子树可以同时写
+        void CullSubtree(uint32_t subtree, cr<CullingPlanes> planes, uint64_t* visibleBits) const;
+
+        // 同样的随机包围盒分别用平铺剔除和BVH剔除，视锥大小按visibleRatio调整
+        static vec<BenchmarkResult> Benchmark(uint32_t count);
+
+    private:
+        struct Node
+        {
+            float minX, minY, minZ;
+            float maxX, maxY, maxZ;
+            // 子树覆盖m_items里连续的一段
+            uint32_t firstItem;
+            uint32_t itemCount;
+            // 左子节点紧跟在父节点后面，right为0表示叶子
+            uint32_t right;
+            uint32_t parent;
+        };
+
+        static constexpr uint32_t LEAF_SIZE = 8;
+        static constexpr uint32_t SUBTREE_COUNT = 64;
+        static constexpr uint32_t INVALID_INDEX = ~0u;
+
+        // 叶子里物体的包围盒按m_items的顺序拷贝一份，叶子测试时连续访问
+        struct ItemBounds
+        {
+            float centerX, centerY, centerZ;
+            float extentsX, extentsY, extentsZ;
+        };
+
+        vec<Node> m_nodes;
+        vec<uint32_t> m_items;
+        vec<ItemBounds> m_itemBounds;
+        vec<uint32_t> m_subtrees;
+        // 每个物体所在的叶子，用于refit
+        vec<uint32_t> m_itemLeaf;
+        vec<uint32_t> m_dirtyLeaves;
+        vec<bool> m_leafDirty;
+        uint32_t m_movedCount = 0;
+
+        uint32_t BuildNode(cr<CullingView> view, uint32_t parent, uint32_t first, uint32_t count);
+        void ComputeLeafBounds(cr<CullingView> view, Node& node);
+        void ComputeInnerBounds(uint32_t nodeIndex);
+        void CollectSubtrees();
+        void CullNode(uint32_t nodeIndex, uint32_t planeMask, cr<CullingPlanes> planes, uint64_t* visibleBits) const;
+        void SetVisible(uint64_t* visibleBits, uint32_t first, uint32_t count) const;
+
+        static void FlushBits(uint64_t* visibleBits, uint32_t word, uint64_t bits);
+    };
+}
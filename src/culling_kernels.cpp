@@ -0,0 +1,259 @@
+#include "culling_kernels.h"
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <immintrin.h>
+#include <limits>
+#include <random>
+
+#include "math/math_utils.h"
+
+namespace op
+{
+    CullingPlanes::CullingPlanes(cr<arr<Vec4, 6>> planes)
+    {
+        for (uint32_t i = 0; i < 6; ++i)
+        {
+            nx[i] = planes[i].x;
+            ny[i] = planes[i].y;
+            nz[i] = planes[i].z;
+            w[i] = planes[i].w;
+            absX[i] = std::abs(planes[i].x);
+            absY[i] = std::abs(planes[i].y);
+            absZ[i] = std::abs(planes[i].z);
+        }
+    }
+
+    static __m128 test_planes_sse(cr<CullingPlanes> planes, const __m128 cx, const __m128 cy, const __m128 cz, const __m128 ex, const __m128 ey, const __m128 ez)
+    {
+        auto result = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+        for (uint32_t p = 0; p < 6; ++p)
+        {
+            auto d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes.nx[p]), cx), _mm_set1_ps(planes.w[p]));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes.ny[p]), cy));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes.nz[p]), cz));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes.absX[p]), ex));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes.absY[p]), ey));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes.absZ[p]), ez));
+
+            result = _mm_and_ps(result, _mm_cmpge_ps(d, _mm_setzero_ps()));
+        }
+
+        return result;
+    }
+
+    static void cull_sse(const CullingPlanes* planes, const uint32_t viewCount, cr<CullingView> view, const uint32_t start, const uint32_t end)
+    {
+        arr<uint64_t, CULLING_MAX_VIEW_COUNT> bits = {};
+        for (uint32_t i = start; i < end; i += 4)
+        {
+            auto cx = _mm_load_ps(view.centerX + i);
+            auto cy = _mm_load_ps(view.centerY + i);
+            auto cz = _mm_load_ps(view.centerZ + i);
+            auto ex = _mm_load_ps(view.extentsX + i);
+            auto ey = _mm_load_ps(view.extentsY + i);
+            auto ez = _mm_load_ps(view.extentsZ + i);
+
+            for (uint32_t v = 0; v < viewCount; ++v)
+            {
+                auto result = test_planes_sse(planes[v], cx, cy, cz, ex, ey, ez);
+                bits[v] |= static_cast<uint64_t>(_mm_movemask_ps(result)) << (i % CULLING_BLOCK_SIZE);
+            }
+
+            if ((i + 4) % CULLING_BLOCK_SIZE == 0)
+            {
+                for (uint32_t v = 0; v < viewCount; ++v)
+                {
+                    view.visibleBits[v][i / CULLING_BLOCK_SIZE] = bits[v];
+                    bits[v] = 0;
+                }
+            }
+        }
+    }
+
+    OP_TARGET_AVX2
+    static __m256 test_planes_avx2(cr<CullingPlanes> planes, const __m256 cx, const __m256 cy, const __m256 cz, const __m256 ex, const __m256 ey, const __m256 ez)
+    {
+        auto result = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (uint32_t p = 0; p < 6; ++p)
+        {
+            auto d = _mm256_fmadd_ps(_mm256_set1_ps(planes.nx[p]), cx, _mm256_set1_ps(planes.w[p]));
+            d = _mm256_fmadd_ps(_mm256_set1_ps(planes.ny[p]), cy, d);
+            d = _mm256_fmadd_ps(_mm256_set1_ps(planes.nz[p]), cz, d);
+            d = _mm256_fmadd_ps(_mm256_set1_ps(planes.absX[p]), ex, d);
+            d = _mm256_fmadd_ps(_mm256_set1_ps(planes.absY[p]), ey, d);
+            d = _mm256_fmadd_ps(_mm256_set1_ps(planes.absZ[p]), ez, d);
+
+            result = _mm256_and_ps(result, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+
+        return result;
+    }
+
+    OP_TARGET_AVX2
+    static void cull_avx2(const CullingPlanes* planes, const uint32_t viewCount, cr<CullingView> view, const uint32_t start, const uint32_t end)
+    {
+        arr<uint64_t, CULLING_MAX_VIEW_COUNT> bits = {};
+        for (uint32_t i = start; i < end; i += 8)
+        {
+            auto cx = _mm256_load_ps(view.centerX + i);
+            auto cy = _mm256_load_ps(view.centerY + i);
+            auto cz = _mm256_load_ps(view.centerZ + i);
+            auto ex = _mm256_load_ps(view.extentsX + i);
+            auto ey = _mm256_load_ps(view.extentsY + i);
+            auto ez = _mm256_load_ps(view.extentsZ + i);
+
+            for (uint32_t v = 0; v < viewCount; ++v)
+            {
+                auto result = test_planes_avx2(planes[v], cx, cy, cz, ex, ey, ez);
+                bits[v] |= static_cast<uint64_t>(_mm256_movemask_ps(result)) << (i % CULLING_BLOCK_SIZE);
+            }
+
+            if ((i + 8) % CULLING_BLOCK_SIZE == 0)
+            {
+                for (uint32_t v = 0; v < viewCount; ++v)
+                {
+                    view.visibleBits[v][i / CULLING_BLOCK_SIZE] = bits[v];
+                    bits[v] = 0;
+                }
+            }
+        }
+    }
+
+    OP_TARGET_AVX512
+    static __mmask16 test_planes_avx512(cr<CullingPlanes> planes, const __m512 cx, const __m512 cy, const __m512 cz, const __m512 ex, const __m512 ey, const __m512 ez)
+    {
+        __mmask16 result = 0xffff;
+        for (uint32_t p = 0; p < 6; ++p)
+        {
+            auto d = _mm512_fmadd_ps(_mm512_set1_ps(planes.nx[p]), cx, _mm512_set1_ps(planes.w[p]));
+            d = _mm512_fmadd_ps(_mm512_set1_ps(planes.ny[p]), cy, d);
+            d = _mm512_fmadd_ps(_mm512_set1_ps(planes.nz[p]), cz, d);
+            d = _mm512_fmadd_ps(_mm512_set1_ps(planes.absX[p]), ex, d);
+            d = _mm512_fmadd_ps(_mm512_set1_ps(planes.absY[p]), ey, d);
+            d = _mm512_fmadd_ps(_mm512_set1_ps(planes.absZ[p]), ez, d);
+
+            result &= _mm512_cmp_ps_mask(d, _mm512_setzero_ps(), _CMP_GE_OQ);
+        }
+
+        return result;
+    }
+
+    OP_TARGET_AVX512
+    static void cull_avx512(const CullingPlanes* planes, const uint32_t viewCount, cr<CullingView> view, const uint32_t start, const uint32_t end)
+    {
+        arr<uint64_t, CULLING_MAX_VIEW_COUNT> bits = {};
+        for (uint32_t i = start; i < end; i += 16)
+        {
+            auto cx = _mm512_load_ps(view.centerX + i);
+            auto cy = _mm512_load_ps(view.centerY + i);
+            auto cz = _mm512_load_ps(view.centerZ + i);
+            auto ex = _mm512_load_ps(view.extentsX + i);
+            auto ey = _mm512_load_ps(view.extentsY + i);
+            auto ez = _mm512_load_ps(view.extentsZ + i);
+
+            for (uint32_t v = 0; v < viewCount; ++v)
+            {
+                auto result = test_planes_avx512(planes[v], cx, cy, cz, ex, ey, ez);
+                bits[v] |= static_cast<uint64_t>(result) << (i % CULLING_BLOCK_SIZE);
+            }
+
+            if ((i + 16) % CULLING_BLOCK_SIZE == 0)
+            {
+                for (uint32_t v = 0; v < viewCount; ++v)
+                {
+                    view.visibleBits[v][i / CULLING_BLOCK_SIZE] = bits[v];
+                    bits[v] = 0;
+                }
+            }
+        }
+    }
+
+    culling_kernel get_culling_kernel(const SimdIsa isa)
+    {
+        assert(simd_isa_supported(isa));
+
+        switch (isa)
+        {
+        case SimdIsa::AVX512:
+            return cull_avx512;
+        case SimdIsa::AVX2:
+            return cull_avx2;
+        default:
+            return cull_sse;
+        }
+    }
+
+    double benchmark_culling_kernel(const SimdIsa isa, const uint32_t count, const uint32_t viewCount)
+    {
+        assert(viewCount > 0 && viewCount <= CULLING_MAX_VIEW_COUNT);
+
+        if (!simd_isa_supported(isa))
+        {
+            return 0.0;
+        }
+
+        auto wordCount = ceil_div(count, CULLING_BLOCK_SIZE);
+        auto paddedCount = wordCount * CULLING_BLOCK_SIZE;
+
+        vec<sl<float>> data;
+        data.reserve(6);
+        for (uint32_t i = 0; i < 6; ++i)
+        {
+            data.emplace_back(paddedCount, CULLING_SIMD_ALIGNMENT);
+            data.back().Resize(paddedCount);
+        }
+        vec<vec<uint64_t>> visibleBits(viewCount, vec<uint64_t>(wordCount));
+
+        std::mt19937 random(12345);
+        std::uniform_real_distribution centerDist(-100.0f, 100.0f);
+        std::uniform_real_distribution extentsDist(0.1f, 5.0f);
+        for (uint32_t i = 0; i < paddedCount; ++i)
+        {
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                data[j][i] = centerDist(random);
+                data[j + 3][i] = extentsDist(random);
+            }
+        }
+
+        // 固定的盒状视锥，大约一半的包围盒可见，多个视锥往不同方向错开
+        arr<CullingPlanes, CULLING_MAX_VIEW_COUNT> planes;
+        for (uint32_t v = 0; v < viewCount; ++v)
+        {
+            auto offset = static_cast<float>(v) * 10.0f;
+            planes[v] = CullingPlanes(arr<Vec4, 6>{
+                Vec4(1, 0, 0, 80 + offset), Vec4(-1, 0, 0, 80 - offset),
+                Vec4(0, 1, 0, 80), Vec4(0, -1, 0, 80),
+                Vec4(0, 0, 1, 80), Vec4(0, 0, -1, 80),
+            });
+        }
+
+        CullingView view;
+        view.centerX = data[0].Data();
+        view.centerY = data[1].Data();
+        view.centerZ = data[2].Data();
+        view.extentsX = data[3].Data();
+        view.extentsY = data[4].Data();
+        view.extentsZ = data[5].Data();
+        for (uint32_t v = 0; v < viewCount; ++v)
+        {
+            view.visibleBits[v] = visibleBits[v].data();
+        }
+
+        auto kernel = get_culling_kernel(isa);
+
+        // 取多次里最快的一次，排除首次访问内存和调度的干扰
+        auto bestNs = std::numeric_limits<double>::max();
+        for (uint32_t i = 0; i < 5; ++i)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            kernel(planes.data(), viewCount, view, 0, paddedCount);
+            auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+            bestNs = std::min(bestNs, ns);
+        }
+
+        return static_cast<double>(paddedCount) / bestNs;
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "const.h"
+#include "common/bit_utils.h"
+#include "common/cpu_features.h"
+#include "math/vec.h"
+
+namespace op
+{
+    // CullingSoA按最宽的lane对齐，任何一种指令集都能整块处理
+    static constexpr uint32_t CULLING_SIMD_WIDTH = 16;
+    static constexpr uint32_t CULLING_SIMD_ALIGNMENT = CULLING_SIMD_WIDTH * sizeof(float);
+    // 剔除结果每个包围盒占1位，按64位的word补齐，一个word只会被一个线程写
+    static constexpr uint32_t CULLING_BLOCK_SIZE = BIT_WORD_SIZE;
+    // 一次剔除最多同时测试的视锥数，主相机、阴影级联和以后的探针共用同一份包围盒
+    static constexpr uint32_t CULLING_MAX_VIEW_COUNT = 4;
+
+    // 平面按分量拆开，并预先算好法线的绝对值
+    // 包围盒在平面外侧当且仅当 dot(n, c) + dot(|n|, e) + w < 0，每个平面只需要一次点积
+    struct CullingPlanes
+    {
+        arr<float, 6> nx;
+        arr<float, 6> ny;
+        arr<float, 6> nz;
+        arr<float, 6> w;
+        arr<float, 6> absX;
+        arr<float, 6> absY;
+        arr<float, 6> absZ;
+
+        CullingPlanes() = default;
+        explicit CullingPlanes(cr<arr<Vec4, 6>> planes);
+    };
+
+    struct CullingView
+    {
+        const float* centerX = nullptr;
+        const float* centerY = nullptr;
+        const float* centerZ = nullptr;
+        const float* extentsX = nullptr;
+        const float* extentsY = nullptr;
+        const float* extentsZ = nullptr;
+        // 每个视锥一份剔除结果
+        arr<uint64_t*, CULLING_MAX_VIEW_COUNT> visibleBits = {};
+    };
+
+    // 每块包围盒只加载一次，依次测试viewCount个视锥，planes[i]的结果写到visibleBits[i]
+    // start和end是元素下标，必须是CULLING_BLOCK_SIZE的倍数
+    using culling_kernel = void(*)(const CullingPlanes* planes, uint32_t viewCount, cr<CullingView> view, uint32_t start, uint32_t end);
+
+    culling_kernel get_culling_kernel(SimdIsa isa);
+
+    // 用指定的指令集对viewCount个视锥剔除count个随机包围盒，返回每纳秒剔除的包围盒数（不乘视锥数），不支持的指令集返回0
+    double benchmark_culling_kernel(SimdIsa isa, uint32_t count, uint32_t viewCount = 1);
+}
@@ -10,6 +10,7 @@
 #include "object.h"
 #include "scene.h"
 #include "objects/render_comp.h"
+#include "math/math_utils.h"
 
 // bool FrustumCulling(const float3 center, const float3 extents)
 // {
@@ -61,9 +62,9 @@ namespace op
 
         for (const auto& renderObj : renderObjs)
         {
-            if (CullOnce(renderObj.lock()->GetWorldBounds(), planes))
+            if (CullOnce(renderObj->GetWorldBounds(), planes))
             {
-                GetRC()->visibleRenderObjs.push_back(renderObj.lock().get());
+                GetRC()->visibleRenderObjs.push_back(renderObj);
             }
         }
     }
@@ -93,62 +94,229 @@ namespace op
         m_buffer->SetBounds(m_index, bounds);
     }
 
+    void CullingBuffer::Accessor::Release()
+    {
+        assert(m_enable);
+        
+        m_buffer->Free(this);
+    }
+
+    std::atomic<SimdIsa> CullingBuffer::s_isa = best_simd_isa();
+    std::atomic_bool CullingBuffer::s_bvhEnabled = false;
+    std::atomic_bool CullingBuffer::s_temporalEnabled = true;
+
+    CullingBuffer::CullingBuffer(const uint32_t viewCount) : m_viewCount(viewCount), m_soa(viewCount)
+    {
+        assert(viewCount > 0 && viewCount <= CULLING_MAX_VIEW_COUNT);
+    }
+
     CullingBuffer::~CullingBuffer()
     {
-        for (auto accessor : m_accessors)
-        {
-            delete accessor;
-        }
     }
 
     CullingBuffer::Accessor* CullingBuffer::Alloc()
     {
-        for (auto searchIndex = m_firstEmpty; searchIndex <= m_accessors.size(); ++searchIndex)
+        if (m_freeSlots.empty())
         {
-            if (searchIndex >= m_accessors.size())
+            Grow();
+        }
+
+        if (m_freeAccessors.empty())
+        {
+            auto block = mup<arr<Accessor, CULLING_BLOCK_SIZE>>();
+            for (auto it = block->rbegin(); it != block->rend(); ++it)
             {
-                for (uint32_t i = 0; i < 4; ++i)
-                {
-                    m_soa.Add();
-
-                    auto accessor = new Accessor();
-                    accessor->m_buffer = this;
-                    accessor->m_enable = false;
-                    accessor->m_index = m_accessors.size();
-                    m_accessors.push_back(accessor);
-                }
+                it->m_buffer = this;
+                m_freeAccessors.push_back(&*it);
             }
+            m_accessorBlocks.push_back(std::move(block));
+        }
+
+        auto slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+        auto accessor = m_freeAccessors.back();
+        m_freeAccessors.pop_back();
+
+        accessor->m_enable = true;
+        accessor->m_index = slot;
+        m_slotAccessors[slot] = accessor;
+
+        m_bvhStructureDirty = true;
+        m_soa.MarkDirty(slot);
+        
+        return accessor;
+    }
 
-            if (!m_accessors[searchIndex]->m_enable)
+    void CullingBuffer::Free(Accessor* accessor)
+    {
+        accessor->m_enable = false;
+        m_slotAccessors[accessor->m_index] = nullptr;
+        m_freeSlots.push_back(accessor->m_index);
+        m_freeAccessors.push_back(accessor);
+
+        m_bvhStructureDirty = true;
+    }
+
+    void CullingBuffer::Grow()
+    {
+        // 一次加一个word的槽位，倒序入栈，先分配下标小的
+        auto start = static_cast<uint32_t>(m_slotAccessors.size());
+        for (uint32_t i = 0; i < CULLING_BLOCK_SIZE; ++i)
+        {
+            m_soa.Add();
+            m_slotAccessors.push_back(nullptr);
+        }
+
+        for (auto i = start + CULLING_BLOCK_SIZE; i > start; --i)
+        {
+            m_freeSlots.push_back(i - 1);
+        }
+    }
+
+    bool CullingBuffer::NeedCompact() const
+    {
+        auto freeCount = static_cast<uint32_t>(m_freeSlots.size());
+        return freeCount >= COMPACT_MIN_FREE_WORDS * CULLING_BLOCK_SIZE && freeCount * 2 > m_slotAccessors.size();
+    }
+
+    void CullingBuffer::Compact()
+    {
+        ZoneScoped;
+
+        auto liveCount = GetLiveCount();
+
+        // 从前往后找空槽位，从后往前找存活的槽位，把后面的挪到前面
+        uint32_t dst = 0;
+        auto src = static_cast<uint32_t>(m_slotAccessors.size());
+        while (true)
+        {
+            while (dst < src && m_slotAccessors[dst])
             {
-                m_firstEmpty = searchIndex + 1;
-                m_accessors[searchIndex]->m_enable = true;
-                return m_accessors[searchIndex];
+                ++dst;
             }
+            while (src > dst && !m_slotAccessors[src - 1])
+            {
+                --src;
+            }
+            if (dst >= src)
+            {
+                break;
+            }
+
+            --src;
+            auto accessor = m_slotAccessors[src];
+            m_soa.Move(src, dst);
+            accessor->m_index = dst;
+            m_slotAccessors[dst] = accessor;
+            m_slotAccessors[src] = nullptr;
+            ++dst;
         }
+        assert(dst == liveCount);
 
-        throw std::runtime_error("CullingBuffer::Alloc: This could not happened");
+        auto newSize = ceil_div(liveCount, CULLING_BLOCK_SIZE) * CULLING_BLOCK_SIZE;
+        m_soa.Truncate(newSize);
+        m_slotAccessors.resize(newSize);
+        m_freeSlots.clear();
+        for (auto i = newSize; i > liveCount; --i)
+        {
+            m_freeSlots.push_back(i - 1);
+        }
+
+        m_compactVersion++;
+        m_bvhStructureDirty = true;
+        m_needFullCull = true;
     }
 
     void CullingBuffer::SetBounds(const uint32_t index, cr<Bounds> bounds)
     {
+        // 每帧Submit的物体大多没有动，只有包围盒真的变了才算进BVH的移动数量
+        auto moved = m_soa.centerX[index] != bounds.center.x || m_soa.centerY[index] != bounds.center.y || m_soa.centerZ[index] != bounds.center.z ||
+            m_soa.extentsX[index] != bounds.extents.x || m_soa.extentsY[index] != bounds.extents.y || m_soa.extentsZ[index] != bounds.extents.z;
+
         m_soa.centerX[index] = bounds.center.x;
         m_soa.centerY[index] = bounds.center.y;
         m_soa.centerZ[index] = bounds.center.z;
         m_soa.extentsX[index] = bounds.extents.x;
         m_soa.extentsY[index] = bounds.extents.y;
         m_soa.extentsZ[index] = bounds.extents.z;
+
+        m_soa.MarkDirty(index);
+
+        if (!moved)
+        {
+            return;
+        }
+
+        if (IsBvhEnabled())
+        {
+            m_bvh.MarkMoved(index);
+        }
+        else
+        {
+            // 关闭期间不维护BVH，下次启用时直接重建
+            m_bvhStructureDirty = true;
+        }
     }
 
-    sp<Job> CullingBuffer::CreateCullJob(cr<arr<Vec4, 6>> planes)
+    sp<Job> CullingBuffer::CreateCullJob(cr<vec<arr<Vec4, 6>>> viewPlanes)
     {
-        assert(!m_cullJob || m_cullJob->IsComplete());
+        // 平面和剔除函数在job完成前不会再被修改，存在成员里，闭包只需要捕获this
+        PreparePlanes(viewPlanes);
+        m_kernel = get_culling_kernel(GetIsa());
+
+        // 任何一个视锥的平面变了所有物体都要重新剔除，没变的话只有包围盒变过的word需要
+        // hash只用来快速排除，hash相同时还要逐个比较平面，碰撞时不能沿用旧的结果
+        auto planesHash = HashPlanes(viewPlanes);
+        auto planesChanged = planesHash != m_planesHash || m_needFullCull;
+        for (uint32_t i = 0; i < m_viewCount && !planesChanged; ++i)
+        {
+            planesChanged = memcmp(viewPlanes[i].data(), m_lastViewPlanes[i].data(), sizeof(arr<Vec4, 6>)) != 0;
+        }
+        m_planesHash = planesHash;
+        m_needFullCull = false;
+        std::copy(viewPlanes.begin(), viewPlanes.end(), m_lastViewPlanes.begin());
+
+        m_soa.TakeDirty(m_cullWords);
         
-        // 每个simd命令为一组，需要除4
-        auto job = Job::CreateParallel(m_soa.centerX.Size() / 4, [planes, this](const uint32_t start, const uint32_t end)
+        sp<Job> job;
+        if (IsBvhEnabled())
+        {
+            UpdateBvh();
+
+            // BVH只会给可见的物体置位
+            for (auto& visibleBits : m_soa.visibleBits)
+            {
+                memset(visibleBits.Data(), 0, visibleBits.Size() * sizeof(uint64_t));
+            }
+
+            // 每个视锥分别遍历所有子树
+            job = Job::CreateParallel(m_bvh.GetSubtreeCount() * m_viewCount, [this](const uint32_t start, const uint32_t end)
+            {
+                this->CullBvhBatch(start, end);
+            });
+            job->SetName("Culling BVH");
+            job->SetMinBatchSize(1);
+            m_lastCulledWordCount = m_soa.GetWordCount();
+        }
+        else if (IsTemporalEnabled() && !planesChanged)
         {
-            this->CullBatch(planes, start, end);
-        });
+            job = Job::CreateParallel(static_cast<uint32_t>(m_cullWords.size()), [this](const uint32_t start, const uint32_t end)
+            {
+                this->CullDirtyBatch(start, end);
+            });
+            job->SetName("Culling Dirty");
+            m_lastCulledWordCount = static_cast<uint32_t>(m_cullWords.size());
+        }
+        else
+        {
+            // 一组CULLING_BLOCK_SIZE个包围盒，正好写满一个visible word
+            job = Job::CreateParallel(m_soa.GetWordCount(), [this](const uint32_t start, const uint32_t end)
+            {
+                this->CullBatch(start, end);
+            });
+            job->SetName("Culling");
+            m_lastCulledWordCount = m_soa.GetWordCount();
+        }
 
         m_cullJob = job;
 
@@ -161,69 +329,148 @@ namespace op
         m_cullJob->WaitForStop();
     }
 
-    void CullingBuffer::CullBatch(cr<arr<Vec4, 6>> planes, uint32_t start, uint32_t end)
+    void CullingBuffer::PrepareGpuCull(cr<vec<arr<Vec4, 6>>> viewPlanes)
     {
         ZoneScoped;
-        
-        arr<SimdVec4, 6> plane;
-        arr<SimdVec4, 6> planeSign;
 
-        for (uint32_t i = 0; i < 6; ++i)
+        PreparePlanes(viewPlanes);
+
+        // 这期间visibleBits和BVH都没有更新，dirty word也不用再攒着
+        m_soa.TakeDirty(m_cullWords);
+        m_needFullCull = true;
+        m_bvhStructureDirty = true;
+    }
+
+    void CullingBuffer::PreparePlanes(cr<vec<arr<Vec4, 6>>> viewPlanes)
+    {
+        assert(!m_cullJob || m_cullJob->IsComplete());
+        assert(viewPlanes.size() == m_viewCount);
+
+        if (NeedCompact())
         {
-            auto p = _mm_load_ps(&planes[i].x);
-            plane[i] = SimdVec4(p);
+            Compact();
+        }
 
-            auto s = sign(p);
-            planeSign[i] = SimdVec4(s);
-            planeSign[i].w = _mm_set1_ps(1.0f);
+        for (uint32_t i = 0; i < m_viewCount; ++i)
+        {
+            m_planes[i] = CullingPlanes(viewPlanes[i]);
         }
-        
-        for (uint32_t j = start; j < end; j++)
-        {
-            auto i = j * 4;
-            
-            SimdVec4 center = {
-                _mm_load_ps(m_soa.centerX.Data() + i),
-                _mm_load_ps(m_soa.centerY.Data() + i),
-                _mm_load_ps(m_soa.centerZ.Data() + i),
-                _mm_set1_ps(0.0f)
-            };
-            SimdVec4 extents = {
-                _mm_load_ps(m_soa.extentsX.Data() + i),
-                _mm_load_ps(m_soa.extentsY.Data() + i),
-                _mm_load_ps(m_soa.extentsZ.Data() + i),
-                _mm_set1_ps(0.0f)
-            };
-
-            auto resultP = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
-            for (uint32_t j = 0; j < 6; ++j)
+    }
+
+    void CullingBuffer::SetIsa(const SimdIsa isa)
+    {
+        if (!simd_isa_supported(isa))
+        {
+            log_warning("Culling ISA %s is not supported", simd_isa_name(isa));
+            return;
+        }
+
+        s_isa.store(isa, std::memory_order_relaxed);
+    }
+
+    CullingView CullingBuffer::GetView()
+    {
+        CullingView view;
+        view.centerX = m_soa.centerX.Data();
+        view.centerY = m_soa.centerY.Data();
+        view.centerZ = m_soa.centerZ.Data();
+        view.extentsX = m_soa.extentsX.Data();
+        view.extentsY = m_soa.extentsY.Data();
+        view.extentsZ = m_soa.extentsZ.Data();
+        for (uint32_t i = 0; i < m_viewCount; ++i)
+        {
+            view.visibleBits[i] = m_soa.visibleBits[i].Data();
+        }
+
+        return view;
+    }
+
+    void CullingBuffer::UpdateBvh()
+    {
+        ZoneScoped;
+
+        if (!m_bvhStructureDirty && !m_bvh.NeedRebuild())
+        {
+            m_bvh.Refit(GetView());
+            return;
+        }
+
+        vec<uint32_t> indices;
+        indices.reserve(GetLiveCount());
+        for (auto accessor : m_slotAccessors)
+        {
+            if (accessor)
             {
-                auto offset = mul(extents, planeSign[j]);
-                auto a = add(center, offset);
-                auto s = sub(center, offset);
-                a.w = s.w = _mm_set1_ps(1.0f);
-                auto d0 = dot(plane[j], a);
-                auto d1 = dot(plane[j], s);
-                
-                auto cmp_d0 = _mm_cmpge_ps(d0, _mm_setzero_ps());
-                auto cmp_d1 = _mm_cmpge_ps(d1, _mm_setzero_ps());
-
-                resultP = _mm_and_ps(resultP, _mm_or_ps(cmp_d0, cmp_d1));
+                indices.push_back(accessor->m_index);
             }
+        }
+
+        m_bvh.Build(GetView(), indices);
+        m_bvhStructureDirty = false;
+    }
+
+    void CullingBuffer::CullBatch(const uint32_t start, const uint32_t end)
+    {
+        ZoneScoped;
+
+        m_kernel(m_planes.data(), m_viewCount, GetView(), start * CULLING_BLOCK_SIZE, end * CULLING_BLOCK_SIZE);
+    }
+
+    void CullingBuffer::CullDirtyBatch(const uint32_t start, const uint32_t end)
+    {
+        ZoneScoped;
 
-            _mm_store_ps(m_soa.visible.Data() + i, resultP);
+        auto view = GetView();
+        for (auto i = start; i < end; ++i)
+        {
+            auto word = m_cullWords[i];
+            m_kernel(m_planes.data(), m_viewCount, view, word * CULLING_BLOCK_SIZE, (word + 1) * CULLING_BLOCK_SIZE);
         }
     }
 
-    CullingBuffer::CullingSoA::CullingSoA()
+    void CullingBuffer::CullBvhBatch(const uint32_t start, const uint32_t end)
     {
-        centerX = sl<float>(1024);
-        centerY = sl<float>(1024);
-        centerZ = sl<float>(1024);
-        extentsX = sl<float>(1024);
-        extentsY = sl<float>(1024);
-        extentsZ = sl<float>(1024);
-        visible = sl<float>(1024);
+        ZoneScoped;
+
+        auto subtreeCount = m_bvh.GetSubtreeCount();
+        for (auto i = start; i < end; ++i)
+        {
+            auto viewIndex = i / subtreeCount;
+            m_bvh.CullSubtree(i % subtreeCount, m_planes[viewIndex], m_soa.visibleBits[viewIndex].Data());
+        }
+    }
+
+    size_t CullingBuffer::HashPlanes(cr<vec<arr<Vec4, 6>>> viewPlanes)
+    {
+        size_t result = 0;
+        for (auto& planes : viewPlanes)
+        {
+            for (auto& plane : planes)
+            {
+                result = Utils::CombineHash(result, std::hash<float>()(plane.x));
+                result = Utils::CombineHash(result, std::hash<float>()(plane.y));
+                result = Utils::CombineHash(result, std::hash<float>()(plane.z));
+                result = Utils::CombineHash(result, std::hash<float>()(plane.w));
+            }
+        }
+
+        return result;
+    }
+
+    // SimpleList移动赋值要求对齐一致，只能在构造时指定对齐
+    CullingBuffer::CullingSoA::CullingSoA(const uint32_t viewCount) :
+        centerX(1024, CULLING_SIMD_ALIGNMENT),
+        centerY(1024, CULLING_SIMD_ALIGNMENT),
+        centerZ(1024, CULLING_SIMD_ALIGNMENT),
+        extentsX(1024, CULLING_SIMD_ALIGNMENT),
+        extentsY(1024, CULLING_SIMD_ALIGNMENT),
+        extentsZ(1024, CULLING_SIMD_ALIGNMENT)
+    {
+        visibleBits.reserve(viewCount);
+        for (uint32_t i = 0; i < viewCount; ++i)
+        {
+            visibleBits.emplace_back(1024 / CULLING_BLOCK_SIZE);
+        }
     }
 
     void CullingBuffer::CullingSoA::Add()
@@ -234,6 +481,62 @@ namespace op
         extentsX.Add(0);
         extentsY.Add(0);
         extentsZ.Add(0);
-        visible.Add(1);
+        if (GetWordCount() * CULLING_BLOCK_SIZE < centerX.Size())
+        {
+            for (auto& bits : visibleBits)
+            {
+                bits.Add(~0ull);
+            }
+            wordDirty.push_back(0);
+        }
+    }
+
+    void CullingBuffer::CullingSoA::Move(const uint32_t from, const uint32_t to)
+    {
+        centerX[to] = centerX[from];
+        centerY[to] = centerY[from];
+        centerZ[to] = centerZ[from];
+        extentsX[to] = extentsX[from];
+        extentsY[to] = extentsY[from];
+        extentsZ[to] = extentsZ[from];
+    }
+
+    void CullingBuffer::CullingSoA::Truncate(const uint32_t size)
+    {
+        assert(size % CULLING_BLOCK_SIZE == 0 && size <= centerX.Size());
+
+        centerX.Resize(size);
+        centerY.Resize(size);
+        centerZ.Resize(size);
+        extentsX.Resize(size);
+        extentsY.Resize(size);
+        extentsZ.Resize(size);
+        for (auto& bits : visibleBits)
+        {
+            bits.Resize(size / CULLING_BLOCK_SIZE);
+        }
+
+        dirtyWords.clear();
+        wordDirty.assign(size / CULLING_BLOCK_SIZE, 0);
+    }
+
+    void CullingBuffer::CullingSoA::MarkDirty(const uint32_t index)
+    {
+        auto word = bit_word_index(index);
+        if (!wordDirty[word])
+        {
+            wordDirty[word] = 1;
+            dirtyWords.push_back(word);
+        }
+    }
+
+    void CullingBuffer::CullingSoA::TakeDirty(vec<uint32_t>& words)
+    {
+        words.clear();
+        words.swap(dirtyWords);
+        for (auto word : words)
+        {
+            wordDirty[word] = 0;
+        }
     }
 }
@@ -1,6 +1,8 @@
 ﻿#pragma once
 #include <vector>
 
+#include "culling_bvh.h"
+#include "culling_kernels.h"
 #include "job_system/job_scheduler.h"
 #include "math/vec.h"
 
@@ -23,6 +25,12 @@ namespace op
 
     #define CULLING_BUFFER_COUNT static_cast<uint8_t>(CullingGroup::COUNT)
 
+    // COMMON和SHADOW剔除的是同一批物体，共用一个CullingBuffer，分别是它的第0和第1个视锥
+    inline uint32_t get_culling_view_index(const CullingGroup group)
+    {
+        return group == CullingGroup::SHADOW ? 1 : 0;
+    }
+
     class CullingSystem final
     {
     public:
@@ -42,7 +50,6 @@ namespace op
 
         sl<uint32_t> m_input;
         sl<uint32_t> m_output;
-        JobScheduler m_jobScheduler;
 
         static bool CullOnce(const Bounds& bounds, const std::array<Vec4, 6>& planes);
     };
@@ -55,9 +62,10 @@ namespace op
             Accessor() = default;
             
             void Submit(cr<Bounds> bounds);
-            bool GetVisible() const { assert(m_enable); return *(m_buffer->m_soa.visible.Data() + m_index) != 0.0f; }
+            bool GetVisible(const uint32_t viewIndex = 0) const { assert(m_enable); return test_bit(m_buffer->GetVisibleWords(viewIndex), m_index); }
+            uint32_t GetIndex() const { return m_index; }
             bool IsEnable() const { return m_enable; }
-            void Release() { assert(m_enable); m_enable = false; }
+            void Release();
 
         private:
             
@@ -68,17 +76,46 @@ namespace op
             friend class CullingBuffer;
         };
 
-        CullingBuffer() = default;
+        explicit CullingBuffer(uint32_t viewCount = 1);
         ~CullingBuffer();
         CullingBuffer(const CullingBuffer& other) = delete;
         CullingBuffer(CullingBuffer&& other) noexcept = delete;
         CullingBuffer& operator=(const CullingBuffer& other) = delete;
         CullingBuffer& operator=(CullingBuffer&& other) noexcept = delete;
 
+        // 空闲槽位和空闲Accessor都用栈管理，O(1)分配，Accessor的地址在整个生命周期内不变
         Accessor* Alloc();
 
-        sp<Job> CreateCullJob(cr<arr<Vec4, 6>> planes);
+        // viewPlanes的数量必须等于构造时的viewCount，所有视锥在同一个job里剔除，每块包围盒只加载一次
+        sp<Job> CreateCullJob(cr<vec<arr<Vec4, 6>>> viewPlanes);
         void WaitForCull();
+        // GPU剔除时代替CreateCullJob，只压缩并记下平面，不更新剔除结果，下次CPU剔除时全部重新算
+        void PrepareGpuCull(cr<vec<arr<Vec4, 6>>> viewPlanes);
+
+        uint32_t GetViewCount() const { return m_viewCount; }
+        // 每个视锥一份剔除结果，每个Accessor的index对应一位，可以按word整块跳过不可见的物体
+        const uint64_t* GetVisibleWords(const uint32_t viewIndex = 0) const { return m_soa.visibleBits[viewIndex].Data(); }
+        uint32_t GetVisibleWordCount() const { return m_soa.GetWordCount(); }
+        // 包围盒和剔除结果的指针，Alloc扩容或者压缩后失效
+        CullingView GetView();
+        // 最近一次CreateCullJob用的平面，GPU剔除用同一份
+        cr<CullingPlanes> GetPlanes(const uint32_t viewIndex = 0) const { return m_planes[viewIndex]; }
+
+        // 默认使用CPU支持的最宽的指令集，只能设置为支持的指令集
+        static SimdIsa GetIsa() { return s_isa.load(std::memory_order_relaxed); }
+        static void SetIsa(SimdIsa isa);
+        // 开启后先用BVH按节点剔除，只测试和视锥相交的叶子
+        static bool IsBvhEnabled() { return s_bvhEnabled.load(std::memory_order_relaxed); }
+        static void SetBvhEnabled(const bool enable) { s_bvhEnabled.store(enable, std::memory_order_relaxed); }
+        // 开启后平面没变时只重新剔除包围盒变过的word，其余沿用上一帧的结果
+        static bool IsTemporalEnabled() { return s_temporalEnabled.load(std::memory_order_relaxed); }
+        static void SetTemporalEnabled(const bool enable) { s_temporalEnabled.store(enable, std::memory_order_relaxed); }
+        // 最近一次剔除实际测试的word数
+        uint32_t GetLastCulledWordCount() const { return m_lastCulledWordCount; }
+        uint32_t GetLiveCount() const { return static_cast<uint32_t>(m_slotAccessors.size() - m_freeSlots.size()); }
+        // 空闲槽位过多时CreateCullJob会先压缩，存活的包围盒挪到前面，Accessor的index会变
+        // 缓存了index的地方发现版本号变了需要重新读取
+        uint32_t GetCompactVersion() const { return m_compactVersion; }
 
     private:
         struct CullingSoA
@@ -90,19 +127,66 @@ namespace op
             sl<float> extentsY;
             sl<float> extentsZ;
 
-            sl<float> visible;
+            vec<sl<uint64_t>> visibleBits;
+
+            // 包围盒变过的word，每个word对应CULLING_BLOCK_SIZE个包围盒
+            vec<uint32_t> dirtyWords;
+            vec<uint8_t> wordDirty;
 
-            CullingSoA();
+            explicit CullingSoA(uint32_t viewCount);
 
+            uint32_t GetWordCount() const { return static_cast<uint32_t>(wordDirty.size()); }
             void Add();
+            void Move(uint32_t from, uint32_t to);
+            // size必须是CULLING_BLOCK_SIZE的倍数，dirty word一并清空
+            void Truncate(uint32_t size);
+            void MarkDirty(uint32_t index);
+            // dirty word移到words里，并清空dirty标记
+            void TakeDirty(vec<uint32_t>& words);
         };
         
+        // 空闲槽位至少有这么多个word并且超过一半时才压缩
+        static constexpr uint32_t COMPACT_MIN_FREE_WORDS = 4;
+
+        uint32_t m_viewCount;
         CullingSoA m_soa;
-        uint32_t m_firstEmpty = 0;
-        vec<Accessor*> m_accessors;
+        // Accessor按块分配，块内连续，扩容不会移动已有的Accessor
+        vec<up<arr<Accessor, CULLING_BLOCK_SIZE>>> m_accessorBlocks;
+        vec<Accessor*> m_freeAccessors;
+        // 每个槽位当前的Accessor，空闲槽位为nullptr
+        vec<Accessor*> m_slotAccessors;
+        vec<uint32_t> m_freeSlots;
+        uint32_t m_compactVersion = 0;
         sp<Job> m_cullJob = nullptr;
+        arr<CullingPlanes, CULLING_MAX_VIEW_COUNT> m_planes;
+        // 上一次剔除用的原始平面，判断平面有没有变
+        arr<arr<Vec4, 6>, CULLING_MAX_VIEW_COUNT> m_lastViewPlanes = {};
+        culling_kernel m_kernel = nullptr;
+        // 剔除dirty word时job读这份拷贝，和dirtyWords分开
+        vec<uint32_t> m_cullWords;
+        size_t m_planesHash = 0;
+        // 压缩后上一帧的结果不能再用
+        bool m_needFullCull = true;
+        uint32_t m_lastCulledWordCount = 0;
+        CullingBvh m_bvh;
+        // 启用的Accessor集合变了，BVH需要重建
+        bool m_bvhStructureDirty = true;
+
+        static std::atomic<SimdIsa> s_isa;
+        static std::atomic_bool s_bvhEnabled;
+        static std::atomic_bool s_temporalEnabled;
         
+        void Free(Accessor* accessor);
+        void Grow();
+        bool NeedCompact() const;
+        void PreparePlanes(cr<vec<arr<Vec4, 6>>> viewPlanes);
+        void Compact();
         void SetBounds(uint32_t index, cr<Bounds> bounds);
-        void CullBatch(cr<arr<Vec4, 6>> planes, uint32_t start, uint32_t end);
+        void UpdateBvh();
+        void CullBatch(uint32_t start, uint32_t end);
+        void CullDirtyBatch(uint32_t start, uint32_t end);
+        void CullBvhBatch(uint32_t start, uint32_t end);
+
+        static size_t HashPlanes(cr<vec<arr<Vec4, 6>>> viewPlanes);
     };
 }
@@ -8,6 +8,7 @@
 #include "gui.h"
 #include "windows.h"
 #include "objects/camera_comp.h"
+#include "objects/transform_comp.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 #include <tracy/Tracy.hpp>
@@ -15,6 +16,7 @@
 
 #include "game_resource.h"
 #include "render_pipeline.h"
+#include "job_system/job_arena.h"
 #include "render/render_target_pool.h"
 #include "render/gl/gl_state.h"
 
@@ -175,6 +177,8 @@ namespace op
         GetGR()->onFrameEnd.Invoke();
         GetRC()->renderTargetPool->TryRecycle();
         RealDestroyObjects();
+        FrameJobAllocator::Ins()->FrameEnd();
+        GetGR()->GetJobScheduler()->OnFrameEnd();
         
         FrameMark;
     }
@@ -192,11 +196,8 @@ namespace op
         {
             auto compStorage = GetGR()->GetMainScene()->GetIndices()->GetCompStorage();
 
-            compStorage->ForeachPendingComp([](crwp<Comp> compPtr) -> bool
+            compStorage->ForeachPendingComp([](Comp* comp) -> bool
             {
-                assert(!compPtr.expired());
-
-                auto comp = compPtr.lock();
                 if (!comp->IsEnable())
                 {
                     return false;
@@ -207,16 +208,17 @@ namespace op
                 return true;
             });
 
-            compStorage->ForeachAllComp([](crwp<Comp> compPtr) -> void
+            compStorage->ForeachAllComp([](Comp* comp) -> void
             {
-                assert(!compPtr.expired());
-
-                auto comp = compPtr.lock();
                 if (comp->IsEnable())
                 {
                     comp->Update();
                 }
             });
+
+            // 所有comp改完transform之后统一按层更新dirty的矩阵，再一次性通知变过的物体，渲染阶段读到的都是算好的
+            GetGR()->GetTransformSystem()->UpdateDirty();
+            TransformComp::DispatchChanged();
         }
 
         // if (scene)
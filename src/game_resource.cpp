@@ -4,13 +4,14 @@
 #include "scene.h"
 #include "render/gl/gl_cbuffer.h"
 #include "culling_system.h"
+#include "occlusion_culling.h"
 
 namespace op
 {
     GameResource::GameResource()
     {
-        m_threadPool = mup<ThreadPool>(5);
-        m_jobScheduler = mup<JobScheduler>();
+        CreateThreadPool();
+        m_jobScheduler = mup<JobScheduler>(m_threadPool.get());
         m_perObjectBuffer = mup<PerObjectBuffer>(5000, 4);
         for (auto& matName : PREDEFINED_MATERIALS)
         {
@@ -19,11 +20,11 @@ namespace op
         m_builtInRes = mup<BuiltInRes>();
         m_globalTextureSet = mup<TextureSet>();
         m_cullingSystem = msp<CullingSystem>();
-        for (auto& cullingBuffer : m_cullingBuffer)
-        {
-            cullingBuffer = mup<CullingBuffer>();
-        }
+        m_opaqueCullingBuffer = mup<CullingBuffer>(2);
+        m_transparentCullingBuffer = mup<CullingBuffer>(1);
+        m_occlusionCulling = mup<OcclusionCulling>();
         m_batchRenderUnit = mup<BatchRenderUnit>();
+        m_transformSystem = mup<TransformSystem>();
         // m_mainScene = Scene::LoadScene("scenes/test_scene/test_scene.json");
         // m_mainScene = Scene::LoadScene("scenes/rpgpp_lt_scene_1.0/scene.json");
         // m_scene = Scene::LoadScene("scenes/ImportTest/scene.json");
@@ -34,11 +35,11 @@ namespace op
     GameResource::~GameResource()
     {
         m_mainScene.reset();
+        m_transformSystem.reset();
         m_batchRenderUnit.reset();
-        for (auto& cullingBuffer : m_cullingBuffer)
-        {
-            cullingBuffer.reset();
-        }
+        m_occlusionCulling.reset();
+        m_transparentCullingBuffer.reset();
+        m_opaqueCullingBuffer.reset();
         m_cullingSystem.reset();
         m_globalTextureSet.reset();
         m_builtInRes.reset();
@@ -48,6 +49,30 @@ namespace op
         m_threadPool.reset();
     }
 
+    void GameResource::CreateThreadPool()
+    {
+        auto threadCount = ThreadPool::GetDefaultThreadCount();
+        auto pinThreads = false;
+
+        auto config = Utils::LoadJson("application.json");
+        if (config.contains("jobThreadCount") && config["jobThreadCount"].get<uint32_t>() > 0)
+        {
+            threadCount = config["jobThreadCount"].get<uint32_t>();
+        }
+        if (config.contains("pinThreads"))
+        {
+            pinThreads = config["pinThreads"].get<bool>();
+        }
+
+        if (pinThreads && !ThreadPool::PinCurrentThread(0))
+        {
+            log_warning("Thread affinity is not supported on this platform");
+            pinThreads = false;
+        }
+
+        m_threadPool = mup<ThreadPool>(threadCount, pinThreads);
+    }
+
     GlCbuffer* GameResource::GetPredefinedCbuffer(const size_t nameId)
     {
         return m_predefinedCbuffers.at(nameId).get();
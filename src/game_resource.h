@@ -2,6 +2,7 @@
 #include "built_in_res.h"
 #include "culling_system.h"
 #include "i_resource.h"
+#include "transform_system.h"
 #include "utils.h"
 #include "common/thread_pool.h"
 #include "job_system/job_scheduler.h"
@@ -14,6 +15,7 @@ struct GLFWwindow;
 namespace op
 {
     class CullingSystem;
+    class OcclusionCulling;
     class Scene;
     class RenderTexture;
     class Material;
@@ -37,10 +39,12 @@ namespace op
         TextureSet* GetGlobalTextureSet() const { return m_globalTextureSet.get(); }
         PerObjectBuffer* GetPerObjectBuffer() const { return m_perObjectBuffer.get(); }
         BatchRenderUnit* GetBatchRenderUnit() const { return m_batchRenderUnit.get(); }
+        TransformSystem* GetTransformSystem() const { return m_transformSystem.get(); }
         CullingSystem* GetCullingSystem() const { return m_cullingSystem.get(); }
         ThreadPool* GetThreadPool() const { return m_threadPool.get(); }
         JobScheduler* GetJobScheduler() const { return m_jobScheduler.get(); }
-        CullingBuffer* GetCullingBuffer(const CullingGroup group) const { return m_cullingBuffer[static_cast<uint8_t>(group)].get(); }
+        OcclusionCulling* GetOcclusionCulling() const { return m_occlusionCulling.get(); }
+        CullingBuffer* GetCullingBuffer(const CullingGroup group) const { return group == CullingGroup::TRANSPARENT ? m_transparentCullingBuffer.get() : m_opaqueCullingBuffer.get(); }
         
         GlCbuffer* GetPredefinedCbuffer(size_t nameId);
         bool IsPredefinedCbuffer(size_t nameId);
@@ -59,12 +63,18 @@ namespace op
         umap<string_hash, up<GlCbuffer>> m_predefinedCbuffers;
         up<TextureSet> m_globalTextureSet;
         up<BatchRenderUnit> m_batchRenderUnit;
+        up<TransformSystem> m_transformSystem;
         sp<CullingSystem> m_cullingSystem;
-        up<CullingBuffer> m_cullingBuffer[CULLING_BUFFER_COUNT];
+        // COMMON和SHADOW共用，主相机和阴影两个视锥
+        up<CullingBuffer> m_opaqueCullingBuffer;
+        up<CullingBuffer> m_transparentCullingBuffer;
+        up<OcclusionCulling> m_occlusionCulling;
         sp<Scene> m_mainScene = nullptr;
         up<BuiltInRes> m_builtInRes = nullptr;
         up<ThreadPool> m_threadPool = nullptr;
         up<JobScheduler> m_jobScheduler = nullptr;
+
+        void CreateThreadPool();
     };
 
     template <typename T>
@@ -72,9 +72,9 @@ namespace op
             DrawCube(renderComp->GetWorldBounds(), ImColor(155, 155, 155, 255));
         }
         
-        for (auto const& renderComp : GetGR()->GetMainScene()->GetIndices()->GetCompStorage()->GetComps<BatchRenderComp>())
+        for (auto renderComp : GetGR()->GetMainScene()->GetIndices()->GetCompStorage()->GetComps<BatchRenderComp>())
         {
-            DrawCube(renderComp.lock()->GetWorldBounds(), ImColor(155, 0, 0, 255));
+            DrawCube(renderComp->GetWorldBounds(), ImColor(155, 0, 0, 255));
         }
     }
     
@@ -0,0 +1,166 @@
+#include "job_arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <new>
+
+namespace op
+{
+    static constexpr size_t JOB_ARENA_BLOCK_ALIGNMENT = 64;
+
+    std::atomic<uint32_t> JobArena::s_heapAllocCount = 0;
+
+    JobArena::JobArena(const size_t blockSize)
+    {
+        m_current = CreateBlock(blockSize);
+    }
+
+    JobArena::~JobArena()
+    {
+        assert(m_liveCount == 0);
+
+        for (auto block : m_retiredBlocks)
+        {
+            DestroyBlock(block);
+        }
+        DestroyBlock(m_current.load());
+    }
+
+    void* JobArena::Alloc(const size_t size, const size_t alignment)
+    {
+        assert(alignment <= JOB_ARENA_BLOCK_ALIGNMENT);
+
+        while (true)
+        {
+            auto block = m_current.load(std::memory_order_acquire);
+            auto offset = block->offset.load(std::memory_order_relaxed);
+
+            while (true)
+            {
+                auto start = (offset + alignment - 1) & ~(alignment - 1);
+                auto end = start + size;
+                if (end > block->size)
+                {
+                    break;
+                }
+
+                if (block->offset.compare_exchange_weak(offset, end, std::memory_order_relaxed))
+                {
+                    m_liveCount.fetch_add(1, std::memory_order_relaxed);
+                    return block->data + start;
+                }
+            }
+
+            // 当前块用完了，换一个更大的块，旧块要等Reset时才能释放
+            std::lock_guard lock(m_growMutex);
+            if (m_current.load(std::memory_order_relaxed) == block)
+            {
+                m_retiredBlocks.push_back(block);
+                m_current.store(CreateBlock(std::max(block->size * 2, size + alignment)), std::memory_order_release);
+            }
+        }
+    }
+
+    void JobArena::Free(void* ptr)
+    {
+        assert(ptr && m_liveCount > 0);
+
+        m_liveCount.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    bool JobArena::Reset()
+    {
+        if (m_liveCount.load(std::memory_order_acquire) != 0)
+        {
+            return false;
+        }
+
+        std::lock_guard lock(m_growMutex);
+
+        if (!m_retiredBlocks.empty())
+        {
+            // 这一轮用到了多个块，合并成一个足够大的块，之后的帧就不需要再分配了
+            auto totalSize = m_current.load()->size;
+            for (auto block : m_retiredBlocks)
+            {
+                totalSize += block->size;
+                DestroyBlock(block);
+            }
+            m_retiredBlocks.clear();
+
+            DestroyBlock(m_current.load());
+            m_current = CreateBlock(totalSize);
+        }
+
+        m_current.load()->offset.store(0, std::memory_order_release);
+
+        return true;
+    }
+
+    size_t JobArena::GetCapacity()
+    {
+        std::lock_guard lock(m_growMutex);
+
+        auto capacity = m_current.load()->size;
+        for (auto block : m_retiredBlocks)
+        {
+            capacity += block->size;
+        }
+
+        return capacity;
+    }
+
+    JobArena::Block* JobArena::CreateBlock(const size_t size)
+    {
+        s_heapAllocCount.fetch_add(1, std::memory_order_relaxed);
+
+        auto block = new Block();
+        block->data = static_cast<std::byte*>(operator new(size, static_cast<std::align_val_t>(JOB_ARENA_BLOCK_ALIGNMENT)));
+        block->size = size;
+
+        return block;
+    }
+
+    void JobArena::DestroyBlock(const Block* block)
+    {
+        operator delete(block->data, static_cast<std::align_val_t>(JOB_ARENA_BLOCK_ALIGNMENT));
+        delete block;
+    }
+
+    FrameJobAllocator* FrameJobAllocator::Ins()
+    {
+        static FrameJobAllocator instance;
+        return &instance;
+    }
+
+    FrameJobAllocator::FrameJobAllocator()
+    {
+        for (auto& arena : m_arenas)
+        {
+            arena = mup<JobArena>();
+        }
+    }
+
+    void FrameJobAllocator::FrameEnd()
+    {
+        // Free里减完计数之后不会再访问arena，计数为0就可以销毁
+        std::erase_if(m_orphanedArenas, [](const up<JobArena>& arena)
+        {
+            return arena->GetLiveCount() == 0;
+        });
+
+        auto nextIndex = (m_currentIndex.load(std::memory_order_relaxed) + 1) % m_arenas.size();
+
+        // 上上帧的job正常来说已经全部释放，还有存活的说明被长期持有，这种情况下不能重置
+        // 继续往后分配的话这个arena会一直变大，换一个同样大小的新arena
+        auto& arena = m_arenas[nextIndex];
+        if (!arena->Reset())
+        {
+            auto capacity = arena->GetCapacity();
+            m_orphanedArenas.push_back(std::move(arena));
+            arena = mup<JobArena>(capacity);
+        }
+
+        m_currentIndex.store(static_cast<uint32_t>(nextIndex), std::memory_order_release);
+    }
+}
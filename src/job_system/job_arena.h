@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+#include "const.h"
+
+namespace op
+{
+    // 线性分配器，只能整体Reset，Reset时要求从它分配出去的对象都已经析构
+    class JobArena
+    {
+    public:
+        explicit JobArena(size_t blockSize = 64 * 1024);
+        ~JobArena();
+        JobArena(const JobArena& other) = delete;
+        JobArena(JobArena&& other) noexcept = delete;
+        JobArena& operator=(const JobArena& other) = delete;
+        JobArena& operator=(JobArena&& other) noexcept = delete;
+
+        void* Alloc(size_t size, size_t alignment);
+        void Free(void* ptr);
+        bool Reset();
+
+        uint32_t GetLiveCount() const { return m_liveCount.load(std::memory_order_relaxed); }
+        // 所有块的总大小，不能和Alloc同时调用
+        size_t GetCapacity();
+
+        // 所有JobArena从堆上分配内存块的总次数
+        static uint32_t GetHeapAllocCount() { return s_heapAllocCount.load(std::memory_order_relaxed); }
+
+    private:
+        struct Block
+        {
+            std::byte* data = nullptr;
+            size_t size = 0;
+            std::atomic<size_t> offset = 0;
+        };
+
+        std::atomic<Block*> m_current = nullptr;
+        vec<Block*> m_retiredBlocks;
+        std::mutex m_growMutex;
+        std::atomic<uint32_t> m_liveCount = 0;
+
+        static std::atomic<uint32_t> s_heapAllocCount;
+
+        static Block* CreateBlock(size_t size);
+        static void DestroyBlock(const Block* block);
+    };
+
+    // 两个arena轮流使用，FrameEnd时切换，并重置上上帧用过的那个
+    // 上上帧的job还被持有时换一个新的arena，旧的等job都释放后销毁，不会一直往后分配
+    class FrameJobAllocator
+    {
+    public:
+        static FrameJobAllocator* Ins();
+
+        FrameJobAllocator();
+        ~FrameJobAllocator() = default;
+        FrameJobAllocator(const FrameJobAllocator& other) = delete;
+        FrameJobAllocator(FrameJobAllocator&& other) noexcept = delete;
+        FrameJobAllocator& operator=(const FrameJobAllocator& other) = delete;
+        FrameJobAllocator& operator=(FrameJobAllocator&& other) noexcept = delete;
+
+        JobArena* GetCurrent() { return m_arenas[m_currentIndex.load(std::memory_order_acquire)].get(); }
+        void FrameEnd();
+
+        uint32_t GetOrphanedArenaCount() const { return static_cast<uint32_t>(m_orphanedArenas.size()); }
+
+    private:
+        arr<up<JobArena>, 2> m_arenas;
+        std::atomic<uint32_t> m_currentIndex = 0;
+        // 不能重置而被换下来的arena
+        vec<up<JobArena>> m_orphanedArenas;
+    };
+
+    template <typename T>
+    struct JobArenaAllocator
+    {
+        using value_type = T;
+
+        JobArena* arena = nullptr;
+
+        explicit JobArenaAllocator(JobArena* arena) : arena(arena) {}
+        template <typename U>
+        JobArenaAllocator(cr<JobArenaAllocator<U>> other) : arena(other.arena) {}
+
+        T* allocate(const size_t n)
+        {
+            return static_cast<T*>(arena->Alloc(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T* ptr, size_t)
+        {
+            arena->Free(ptr);
+        }
+
+        template <typename U>
+        bool operator==(cr<JobArenaAllocator<U>> other) const { return arena == other.arena; }
+    };
+}
@@ -1,127 +1,323 @@
 #include "job_scheduler.h"
 
-#include <mutex>
+#include <chrono>
 #include <tracy/Tracy.hpp>
 
-#include "common/function_pool.h"
+#include "utils.h"
 #include "math/math_utils.h"
 
 namespace op
 {
-    Job::~Job()
+    static uint64_t elapsed_ns(const std::chrono::steady_clock::time_point begin)
     {
-        std::lock_guard lock(m_accessMutex);
-        
-        FunctionPool<void()>::Ins()->Free(m_taskFunc);
-        FunctionPool<void(uint32_t, uint32_t)>::Ins()->Free(m_parallelTaskFunc);
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
     }
 
+    void JobStats::RecordBatch(const uint64_t ns, const bool stolen)
+    {
+        batchCount.fetch_add(1, std::memory_order_relaxed);
+        totalBatchNs.fetch_add(ns, std::memory_order_relaxed);
+        if (stolen)
+        {
+            stealCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        auto curMin = minBatchNs.load(std::memory_order_relaxed);
+        while (ns < curMin && !minBatchNs.compare_exchange_weak(curMin, ns, std::memory_order_relaxed)) {}
+
+        auto curMax = maxBatchNs.load(std::memory_order_relaxed);
+        while (ns > curMax && !maxBatchNs.compare_exchange_weak(curMax, ns, std::memory_order_relaxed)) {}
+    }
+
+    void JobStats::RecordNsPerElem(const float sample)
+    {
+        // 指数滑动平均，避免单帧的抖动让批大小来回跳
+        auto cur = nsPerElem.load(std::memory_order_relaxed);
+        while (true)
+        {
+            auto next = cur == 0.0f ? sample : cur * 0.8f + sample * 0.2f;
+            if (nsPerElem.compare_exchange_weak(cur, next, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+    }
+
+    void JobStats::Reset()
+    {
+        batchCount = 0;
+        totalBatchNs = 0;
+        minBatchNs = UINT64_MAX;
+        maxBatchNs = 0;
+        stealCount = 0;
+    }
+
+    Job::Job(JobArena* arena) : m_next(JobArenaAllocator<sp<Job>>(arena))
+    {
+    }
+
+    Job::~Job() = default;
+
     void Job::WaitForStart()
     {
         ZoneScopedC(TRACY_IDLE_COLOR);
 
-        std::unique_lock lock(m_accessMutex);
-        
-        m_startingSignal.wait(lock, [this]
-        {
-            return m_exceptTaskNum != 0;
-        });
+        m_started.wait(false, std::memory_order_acquire);
     }
 
     void Job::WaitForStop()
     {
         ZoneScopedC(TRACY_IDLE_COLOR);
 
-        assert(m_exceptTaskNum != 0 && "Job has not been scheduled");
-        
-        std::unique_lock lock(m_accessMutex);
-        
-        m_completeSignal.wait(lock, [this]
+        assert((m_started.load() || m_predecessorNum.load() != 0) && "Job has not been scheduled");
+
+        while (!IsComplete())
         {
-            return m_completed.load();
-        });
+            auto scheduler = m_scheduler.load(std::memory_order_acquire);
+            if (scheduler && scheduler->TryHelp())
+            {
+                continue;
+            }
+
+            // 已经开始的job所有任务都进了队列，队列里取不到说明都在别的线程上执行，可以放心阻塞
+            // 还没开始的job还在等前置job，前置job的后续任务随时可能入队，只让出时间片
+            if (!scheduler || !scheduler->IsHelpWhileWaiting() || IsStarted())
+            {
+                m_completed.wait(false, std::memory_order_acquire);
+                break;
+            }
+
+            std::this_thread::yield();
+        }
     }
 
     void Job::AppendNext(crsp<Job> next)
     {
-        std::lock_guard lock(m_accessMutex);
+        assert(!m_started.load() && "Dependencies must be built before scheduling");
+        assert(!next->m_started.load());
 
+        next->m_predecessorNum.fetch_add(1, std::memory_order_relaxed);
         m_next.push_back(next);
     }
 
     bool Job::CompleteOnce()
     {
-        std::lock_guard lock(m_accessMutex);
-        
-        m_completeTaskNum++;
-        if (m_completeTaskNum == m_exceptTaskNum)
+        return m_remainingTaskNum.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+
+    JobScheduler::JobScheduler(ThreadPool* threadPool) : m_threadPool(threadPool)
+    {
+        assert(m_threadPool);
+    }
+
+    JobScheduler::~JobScheduler()
+    {
+        uint32_t runningJobNum;
+        while ((runningJobNum = m_runningJobNum.load(std::memory_order_acquire)) != 0)
         {
-            m_completed = true;
-            return true;
+            m_runningJobNum.wait(runningJobNum, std::memory_order_acquire);
         }
-        return false;
     }
-    
-    
-    JobScheduler::JobScheduler()
+
+    uint32_t JobScheduler::GetHeapAllocCount() const
     {
-        m_threadPool = std::make_unique<ThreadPool>(JOB_THREAD_COUNT);
+        return JobArena::GetHeapAllocCount() +
+            m_threadPool->GetTaskAllocCount() +
+            ThreadPool::GetNodeAllocCount() +
+            m_statsAllocCount.load(std::memory_order_relaxed);
     }
 
-    JobScheduler::~JobScheduler()
+    void JobScheduler::RequestSteadyStateCheck(const uint32_t warmupFrameCount, const uint32_t frameCount)
     {
-        while (!m_runningParallelTasks.empty())
+        m_steadyStateCheck = {};
+        m_steadyStateCheck.running = true;
+        m_steadyStateWarmupFrameCount = warmupFrameCount;
+        m_steadyStateFrameCount = frameCount;
+    }
+
+    void JobScheduler::OnFrameEnd()
+    {
+        auto heapAllocCount = GetHeapAllocCount();
+        m_lastFrameHeapAllocCount = heapAllocCount - m_frameStartHeapAllocCount;
+        m_frameStartHeapAllocCount = heapAllocCount;
+
+        auto& check = m_steadyStateCheck;
+        if (!check.running)
+        {
+            return;
+        }
+
+        if (m_steadyStateWarmupFrameCount > 0)
+        {
+            m_steadyStateWarmupFrameCount--;
+            return;
+        }
+
+        check.checkedFrameCount++;
+        if (m_lastFrameHeapAllocCount > 0)
+        {
+            check.allocFrameCount++;
+            check.maxFrameAllocCount = std::max(check.maxFrameAllocCount, m_lastFrameHeapAllocCount);
+        }
+
+        if (check.checkedFrameCount >= m_steadyStateFrameCount)
         {
-            sp<Job> job = nullptr;
-            
+            check.running = false;
+            if (check.allocFrameCount > 0)
             {
-                std::lock_guard lock(m_schedulerMutex);
-                if (m_runningParallelTasks.empty())
-                {
-                    break;
-                }
-                job = m_runningParallelTasks[0].second;
+                log_error("Job system allocated on the heap in %u of %u steady-state frames, at most %u per frame",
+                    check.allocFrameCount, check.checkedFrameCount, check.maxFrameAllocCount);
             }
-            
-            job->WaitForStop();
         }
-        
-        m_threadPool.reset();
+    }
+
+    vec<JobStatsInfo> JobScheduler::GetJobStats()
+    {
+        std::lock_guard lock(m_jobStatsMutex);
+
+        vec<JobStatsInfo> result;
+        result.reserve(m_jobStats.size());
+        for (auto& [name, stats] : m_jobStats)
+        {
+            JobStatsInfo info;
+            info.name = name;
+            info.batchCount = stats->batchCount.load(std::memory_order_relaxed);
+            if (info.batchCount != 0)
+            {
+                info.minBatchUs = static_cast<float>(stats->minBatchNs.load(std::memory_order_relaxed)) / 1000.0f;
+                info.avgBatchUs = static_cast<float>(stats->totalBatchNs.load(std::memory_order_relaxed)) / static_cast<float>(info.batchCount) / 1000.0f;
+                info.maxBatchUs = static_cast<float>(stats->maxBatchNs.load(std::memory_order_relaxed)) / 1000.0f;
+            }
+            info.stealCount = stats->stealCount.load(std::memory_order_relaxed);
+            info.lastBatchSize = stats->lastBatchSize.load(std::memory_order_relaxed);
+            info.nsPerElem = stats->nsPerElem.load(std::memory_order_relaxed);
+            result.push_back(info);
+        }
+
+        return result;
+    }
+
+    void JobScheduler::ResetJobStats()
+    {
+        std::lock_guard lock(m_jobStatsMutex);
+
+        for (auto& [name, stats] : m_jobStats)
+        {
+            stats->Reset();
+        }
+    }
+
+    JobStats* JobScheduler::GetOrCreateStats(const cstr name)
+    {
+        if (!name)
+        {
+            return nullptr;
+        }
+
+        std::lock_guard lock(m_jobStatsMutex);
+
+        auto& stats = m_jobStats[name];
+        if (!stats)
+        {
+            stats = mup<JobStats>();
+            m_statsAllocCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        return stats.get();
+    }
+
+    uint32_t JobScheduler::CalcBatchSize(const Job* job) const
+    {
+        auto elemCount = job->m_taskElemCount;
+        auto nsPerElem = job->m_stats ? job->m_stats->nsPerElem.load(std::memory_order_relaxed) : 0.0f;
+
+        uint32_t batchSize;
+        if (nsPerElem > 0.0f)
+        {
+            batchSize = static_cast<uint32_t>(static_cast<float>(GetTargetGrainNs()) / nsPerElem);
+        }
+        else
+        {
+            // 还没有统计数据，先按线程数均分
+            batchSize = ceil_div(elemCount, GetThreadCount() * 5);
+        }
+
+        batchSize = std::max(batchSize, job->m_minBatchSize);
+        batchSize = std::min(batchSize, std::max(elemCount, 1u));
+
+        return batchSize;
+    }
+
+    bool JobScheduler::TryHelp()
+    {
+        if (!IsHelpWhileWaiting())
+        {
+            return false;
+        }
+
+        return m_threadPool->TryRunPendingTask();
+    }
+
+    void JobScheduler::BindScheduler(Job* job)
+    {
+        // 整个子图都记住调度器，等待其中任何一个job时都能帮忙执行前置job的任务
+        if (job->m_scheduler.exchange(this, std::memory_order_acq_rel) == this)
+        {
+            return;
+        }
+
+        for (auto& next : job->m_next)
+        {
+            BindScheduler(next.get());
+        }
     }
 
     void JobScheduler::Schedule(crsp<Job> job)
     {
-        std::lock_guard lock0(m_schedulerMutex);
-        std::lock_guard lock1(job->m_accessMutex);
-        
+        assert(job->m_predecessorNum.load() == 0 && "Job with predecessors is scheduled by its predecessors");
+
+        BindScheduler(job.get());
+        Dispatch(job);
+    }
+
+    void JobScheduler::Dispatch(crsp<Job> job)
+    {
         assert(!job->m_completed);
-        assert(job->m_exceptTaskNum == 0);
-        assert(!find(m_runningParallelTasks, job->m_taskGroupId));
-        assert(!(job->m_taskFunc == nullptr && job->m_parallelTaskFunc == nullptr));
-        assert(!(job->m_taskFunc != nullptr && job->m_parallelTaskFunc != nullptr));
-        
-        if (job->m_taskFunc != nullptr)
+        assert(!job->m_started);
+        assert(static_cast<bool>(job->m_taskFunc) != static_cast<bool>(job->m_parallelTaskFunc));
+
+        m_runningJobNum.fetch_add(1, std::memory_order_relaxed);
+
+        job->m_stats = GetOrCreateStats(job->m_name);
+
+        if (job->m_taskFunc)
         {
             ScheduleCommonJob(job);
         }
-        else if (job->m_parallelTaskFunc != nullptr)
+        else if (job->m_parallelTaskFunc)
         {
             ScheduleParallelJob(job);
         }
-        
-        insert(m_runningParallelTasks, job->m_taskGroupId, job);
-
-        job->m_startingSignal.notify_all();
     }
 
     void JobScheduler::ScheduleCommonJob(crsp<Job> job)
     {
-        job->m_exceptTaskNum = 1;
-        job->m_completeTaskNum = 0;
-        
+        job->m_remainingTaskNum.store(1, std::memory_order_relaxed);
+        job->m_started.store(true, std::memory_order_release);
+        job->m_started.notify_all();
+
         m_threadPool->Run([job, this]
         {
-            (*job->m_taskFunc)();
+            auto begin = std::chrono::steady_clock::now();
+
+            job->m_taskFunc();
+
+            if (job->m_stats)
+            {
+                job->m_stats->RecordBatch(elapsed_ns(begin), ThreadPool::IsCurrentTaskStolen());
+            }
 
             if (job->CompleteOnce())
             {
@@ -133,24 +329,40 @@ namespace op
     void JobScheduler::ScheduleParallelJob(crsp<Job> job)
     {
         assert(job->m_minBatchSize > 0);
-        assert(job->m_taskElemCount != 0);
 
-        auto batchSize = ceil_div(job->m_taskElemCount, JOB_THREAD_COUNT * 5);
-        batchSize = std::max(batchSize, job->m_minBatchSize);
+        auto batchSize = CalcBatchSize(job.get());
         assert(batchSize > 0);
-        
-        job->m_exceptTaskNum = 0;
-        for (uint32_t start = 0; start < job->m_taskElemCount; start += batchSize)
+        if (job->m_stats)
+        {
+            job->m_stats->lastBatchSize.store(batchSize, std::memory_order_relaxed);
+        }
+
+        auto taskNum = ceil_div(job->m_taskElemCount, batchSize);
+        job->m_remainingTaskNum.store(taskNum, std::memory_order_relaxed);
+        job->m_started.store(true, std::memory_order_release);
+        job->m_started.notify_all();
+
+        if (taskNum == 0)
         {
-            job->m_exceptTaskNum++;
+            JobComplete(job);
+            return;
         }
-        
+
         for (uint32_t start = 0; start < job->m_taskElemCount; start += batchSize)
         {
             auto end = std::min(start + batchSize, job->m_taskElemCount);
             m_threadPool->Run([start, end, job, this]
             {
-                (*job->m_parallelTaskFunc)(start, end);
+                auto begin = std::chrono::steady_clock::now();
+
+                job->m_parallelTaskFunc(start, end);
+
+                if (job->m_stats)
+                {
+                    auto ns = elapsed_ns(begin);
+                    job->m_batchTimeNs.fetch_add(ns, std::memory_order_relaxed);
+                    job->m_stats->RecordBatch(ns, ThreadPool::IsCurrentTaskStolen());
+                }
 
                 if (job->CompleteOnce())
                 {
@@ -159,19 +371,30 @@ namespace op
             }, job->m_priority);
         }
     }
-    
+
     void JobScheduler::JobComplete(crsp<Job> job)
     {
-        for (auto& next : job->m_next)
+        if (job->m_stats && job->m_parallelTaskFunc && job->m_taskElemCount != 0)
         {
-            Schedule(next);
+            auto batchTimeNs = job->m_batchTimeNs.load(std::memory_order_acquire);
+            job->m_stats->RecordNsPerElem(static_cast<float>(batchTimeNs) / static_cast<float>(job->m_taskElemCount));
         }
-        
+
+        job->m_completed.store(true, std::memory_order_release);
+        job->m_completed.notify_all();
+
+        for (auto& next : job->m_next)
         {
-            std::lock_guard lock(this->m_schedulerMutex);
-            remove(this->m_runningParallelTasks, job->m_taskGroupId);
+            // 最后一个完成的前置job负责调度next
+            if (next->m_predecessorNum.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                Dispatch(next);
+            }
         }
 
-        job->m_completeSignal.notify_all();
+        if (m_runningJobNum.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            m_runningJobNum.notify_all();
+        }
     }
 }
@@ -1,22 +1,54 @@
 #pragma once
+#include <atomic>
 #include <functional>
-#include <mutex>
 #include <tracy/Tracy.hpp>
 
 #include "const.h"
-#include "common/function_pool.h"
+#include "job_arena.h"
+#include "common/inline_function.h"
 #include "common/thread_pool.h"
 
 namespace op
 {
-    using task_func = std::function<void()>;
-    using parallel_task_func = std::function<void(uint32_t, uint32_t)>;
+    // 闭包存在Job内部，容量要能放下CullingBuffer捕获的6个平面
+    using task_func = InlineFunction<void(), 128>;
+    using parallel_task_func = InlineFunction<void(uint32_t, uint32_t), 128>;
     using task_finished_func = std::function<void(size_t)>;
 
+    // 同名job共享一份统计，批次的耗时用于推算下一次的批大小
+    struct JobStats
+    {
+        std::atomic<uint64_t> batchCount = 0;
+        std::atomic<uint64_t> totalBatchNs = 0;
+        std::atomic<uint64_t> minBatchNs = UINT64_MAX;
+        std::atomic<uint64_t> maxBatchNs = 0;
+        std::atomic<uint64_t> stealCount = 0;
+        std::atomic<uint32_t> lastBatchSize = 0;
+        std::atomic<float> nsPerElem = 0.0f;
+
+        void RecordBatch(uint64_t ns, bool stolen);
+        void RecordNsPerElem(float sample);
+        void Reset();
+    };
+
+    struct JobStatsInfo
+    {
+        cstr name = nullptr;
+        uint64_t batchCount = 0;
+        float minBatchUs = 0.0f;
+        float avgBatchUs = 0.0f;
+        float maxBatchUs = 0.0f;
+        uint64_t stealCount = 0;
+        uint32_t lastBatchSize = 0;
+        float nsPerElem = 0.0f;
+    };
+
+    class JobScheduler;
+
     class Job
     {
     public:
-        Job() = default;
+        explicit Job(JobArena* arena);
         ~Job();
         Job(const Job& other) = delete;
         Job(Job&& other) noexcept = delete;
@@ -24,60 +56,120 @@ namespace op
         Job& operator=(Job&& other) noexcept = delete;
 
         void WaitForStart();
+        // 开启了帮忙等待时，等待的线程会先执行队列里待处理的任务，直到job完成
         void WaitForStop();
+        // next会在它所有的前置job都完成后被自动调度，一个job可以有多个前置job
+        // 依赖关系需要在调度之前建立好
         void AppendNext(crsp<Job> next);
 
-        bool IsComplete() const { return m_completed.load(); }
+        bool IsStarted() const { return m_started.load(std::memory_order_acquire); }
+        bool IsComplete() const { return m_completed.load(std::memory_order_acquire); }
         void SetMinBatchSize(const uint32_t minBatchSize) { m_minBatchSize = minBatchSize; }
         void SetPriority(const int32_t priority) { m_priority = priority; }
-        
+        // name必须是字面量，用作统计的key
+        void SetName(const cstr name) { m_name = name; }
+
         template <typename TaskFunc>
         static sp<Job> CreateCommon(TaskFunc&& f);
         template <typename TaskFunc>
         static sp<Job> CreateParallel(uint32_t taskElemCount, TaskFunc&& f);
 
     private:
+        cstr m_name = nullptr;
         int32_t m_priority = 0;
         uint32_t m_taskElemCount = 0;
         uint32_t m_minBatchSize = 32;
-        size_t m_taskGroupId = 0;
-        
-        task_func* m_taskFunc = nullptr;
-        parallel_task_func* m_parallelTaskFunc = nullptr;
-        
-        uint32_t m_exceptTaskNum = 0;
-        uint32_t m_completeTaskNum = 0;
+        JobStats* m_stats = nullptr;
+        std::atomic<uint64_t> m_batchTimeNs = 0;
+        std::atomic<JobScheduler*> m_scheduler = nullptr;
+
+        task_func m_taskFunc;
+        parallel_task_func m_parallelTaskFunc;
+
+        std::atomic<uint32_t> m_remainingTaskNum = 0;
+        std::atomic<uint32_t> m_predecessorNum = 0;
+        std::atomic_bool m_started = false;
         std::atomic_bool m_completed = false;
 
-        vecsp<Job> m_next;
-        
-        std::mutex m_accessMutex;
-        std::condition_variable m_startingSignal;
-        std::condition_variable m_completeSignal;
-        
+        std::vector<sp<Job>, JobArenaAllocator<sp<Job>>> m_next;
+
         bool CompleteOnce();
 
         friend class JobScheduler;
     };
-    
+
     class JobScheduler
     {
     public:
-        JobScheduler();
+        // 线程池由外部持有，和其它系统共用同一组worker
+        explicit JobScheduler(ThreadPool* threadPool);
         ~JobScheduler();
         JobScheduler(const JobScheduler& other) = delete;
         JobScheduler(JobScheduler&& other) noexcept = delete;
         JobScheduler& operator=(const JobScheduler& other) = delete;
         JobScheduler& operator=(JobScheduler&& other) noexcept = delete;
 
+        // 只调度没有前置job的根job，后续job由前置job完成时释放
         void Schedule(crsp<Job> job);
 
-    private:
+        // job系统从堆上分配内存的总次数，包括arena的块、任务对象、无锁队列的节点和新名字的统计数据
+        uint32_t GetHeapAllocCount() const;
+        // 上一帧里堆分配的次数，稳定运行的帧里应该是0
+        uint32_t GetLastFrameHeapAllocCount() const { return m_lastFrameHeapAllocCount; }
+
+        struct SteadyStateCheck
+        {
+            uint32_t checkedFrameCount = 0;
+            // 有堆分配的帧数，不是0就说明检查失败
+            uint32_t allocFrameCount = 0;
+            uint32_t maxFrameAllocCount = 0;
+            bool running = false;
+        };
+
+        // 跳过warmupFrameCount帧之后连续检查frameCount帧，任何一帧有堆分配都算失败
+        void RequestSteadyStateCheck(uint32_t warmupFrameCount, uint32_t frameCount);
+        cr<SteadyStateCheck> GetSteadyStateCheck() const { return m_steadyStateCheck; }
+        // 每帧结束时在主线程调用，统计这一帧的堆分配
+        void OnFrameEnd();
+        uint32_t GetThreadCount() const { return m_threadPool->GetThreadCount(); }
+        uint64_t GetStealCount() const { return m_threadPool->GetStealCount(); }
+        uint64_t GetIdleTimeNs() const { return m_threadPool->GetIdleTimeNs(); }
+        uint64_t GetHelpedTaskCount() const { return m_threadPool->GetHelpedTaskCount(); }
+
+        // 关闭后等待job的线程直接阻塞，不会帮忙执行任务
+        bool IsHelpWhileWaiting() const { return m_helpWhileWaiting.load(std::memory_order_relaxed); }
+        void SetHelpWhileWaiting(const bool enable) { m_helpWhileWaiting.store(enable, std::memory_order_relaxed); }
+        // 在调用线程上执行一个待处理的任务，返回是否执行了任务
+        bool TryHelp();
+
+        // 并行job按照每个批次大约耗时targetGrainNs来切分
+        uint32_t GetTargetGrainNs() const { return m_targetGrainNs.load(std::memory_order_relaxed); }
+        void SetTargetGrainNs(const uint32_t ns) { m_targetGrainNs.store(ns, std::memory_order_relaxed); }
+
+        vec<JobStatsInfo> GetJobStats();
+        void ResetJobStats();
 
-        up<ThreadPool> m_threadPool;
-        vec<std::pair<size_t, sp<Job>>> m_runningParallelTasks;
-        std::mutex m_schedulerMutex;
+    private:
 
+        ThreadPool* m_threadPool = nullptr;
+        std::atomic<uint32_t> m_runningJobNum = 0;
+        std::atomic<uint32_t> m_targetGrainNs = 50000;
+        std::atomic_bool m_helpWhileWaiting = true;
+
+        umap<cstr, up<JobStats>> m_jobStats;
+        std::mutex m_jobStatsMutex;
+        std::atomic<uint32_t> m_statsAllocCount = 0;
+
+        uint32_t m_frameStartHeapAllocCount = 0;
+        uint32_t m_lastFrameHeapAllocCount = 0;
+        SteadyStateCheck m_steadyStateCheck;
+        uint32_t m_steadyStateWarmupFrameCount = 0;
+        uint32_t m_steadyStateFrameCount = 0;
+
+        JobStats* GetOrCreateStats(cstr name);
+        void BindScheduler(Job* job);
+        uint32_t CalcBatchSize(const Job* job) const;
+        void Dispatch(crsp<Job> job);
         void ScheduleCommonJob(crsp<Job> job);
         void ScheduleParallelJob(crsp<Job> job);
         void JobComplete(crsp<Job> job);
@@ -86,10 +178,9 @@ namespace op
     template <typename CommonTaskFunc>
     sp<Job> Job::CreateCommon(CommonTaskFunc&& f)
     {
-        auto job = msp<Job>();
-        job->m_taskGroupId = std::hash<size_t>{}(reinterpret_cast<uintptr_t>(job.get()));
-        job->m_taskFunc = FunctionPool<void()>::Ins()->Alloc(std::forward<CommonTaskFunc>(f));
-        job->m_parallelTaskFunc = nullptr;
+        auto arena = FrameJobAllocator::Ins()->GetCurrent();
+        auto job = std::allocate_shared<Job>(JobArenaAllocator<Job>(arena), arena);
+        job->m_taskFunc = std::forward<CommonTaskFunc>(f);
 
         return job;
     }
@@ -97,11 +188,10 @@ namespace op
     template <typename ParallelTaskFunc>
     sp<Job> Job::CreateParallel(const uint32_t taskElemCount, ParallelTaskFunc&& f)
     {
-        auto job = msp<Job>();
+        auto arena = FrameJobAllocator::Ins()->GetCurrent();
+        auto job = std::allocate_shared<Job>(JobArenaAllocator<Job>(arena), arena);
         job->m_taskElemCount = taskElemCount;
-        job->m_taskGroupId = std::hash<size_t>{}(reinterpret_cast<uintptr_t>(job.get()));
-        job->m_taskFunc = nullptr;
-        job->m_parallelTaskFunc = FunctionPool<void(uint32_t, uint32_t)>::Ins()->Alloc(std::forward<ParallelTaskFunc>(f));
+        job->m_parallelTaskFunc = std::forward<ParallelTaskFunc>(f);
 
         return job;
     }
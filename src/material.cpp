@@ -5,6 +5,7 @@
 #include "shader.h"
 #include "common/data_set.h"
 #include "render/shader_variants.h"
+#include "render/cbuffer.h"
 #include "render/texture_set.h"
 #include "render/gl/gl_cbuffer.h"
 #include "render/gl/gl_state.h"
@@ -220,6 +221,14 @@ namespace op
         m_cbuffer->BindBase();
     }
 
+    void Material::WriteParams(cr<CBufferLayout> layout, uint8_t* data)
+    {
+        for (const auto& [nameId, param] : layout.params)
+        {
+            TryGetImp(nameId, data + param.offsetB, param.sizeB);
+        }
+    }
+
     void Material::OnFrameEnd()
     {
         // m_dirtyValues.clear();
@@ -227,6 +236,8 @@ namespace op
 
     bool Material::TrySetImp(const string_hash nameId, const void* data, const uint32_t sizeB)
     {
+        m_paramVersion++;
+        
         if (HasCBuffer())
         {
             return m_cbuffer->TrySetRaw(nameId, data, sizeB);
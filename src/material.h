@@ -44,6 +44,10 @@ namespace op
         void BindShader(crsp<Shader> shader);
         void CreateCBuffer(crsp<CBufferLayout> cbufferLayout);
         void UseCBuffer();
+        // 按layout把参数写到data里，没有的参数不写，合批时材质参数放在一张表里
+        void WriteParams(cr<CBufferLayout> layout, uint8_t* data);
+        // 每次设置参数都会加一，用来判断写出去的参数是否需要更新
+        uint32_t GetParamVersion() const { return m_paramVersion; }
 
         static sp<Material> LoadFromFile(cr<StringHandle> path);
         static sp<Material> CreateFromShader(cr<StringHandle> path);
@@ -63,6 +67,7 @@ namespace op
         up<DataSet> m_dataSet = nullptr;
         up<TextureSet> m_textureSet = nullptr;
         VariantKeyword m_variantKeyword;
+        uint32_t m_paramVersion = 0;
 
         void OnFrameEnd();
 
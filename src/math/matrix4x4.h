@@ -16,6 +16,15 @@ namespace op
     private:
         float m_data[16];
 
+        // w分量必须是0
+        static __m128 Cross3(const __m128 l, const __m128 r)
+        {
+            auto lYzx = _mm_shuffle_ps(l, l, _MM_SHUFFLE(3, 0, 2, 1));
+            auto rYzx = _mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 0, 2, 1));
+            auto c = _mm_sub_ps(_mm_mul_ps(l, rYzx), _mm_mul_ps(lYzx, r));
+            return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+        }
+
     public:
         Matrix4x4()
         {
@@ -194,6 +203,50 @@ namespace op
             return result;
         }
 
+        // 只适用于最后一行是(0, 0, 0, 1)的仿射矩阵，比如TRS以及它们的乘积，允许非均匀缩放带来的切变
+        // 左上3x3的逆是伴随矩阵除以行列式，伴随矩阵的第j列是另外两行的叉乘，平移部分是-M⁻¹t
+        // 行列式接近0时和Inverse一样返回全0的矩阵
+        [[nodiscard]] Matrix4x4 AffineInverse() const
+        {
+            auto mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+            auto r0 = _mm_and_ps(_mm_load_ps(m_data), mask);
+            auto r1 = _mm_and_ps(_mm_load_ps(m_data + 4), mask);
+            auto r2 = _mm_and_ps(_mm_load_ps(m_data + 8), mask);
+
+            auto c0 = Cross3(r1, r2);
+            auto c1 = Cross3(r2, r0);
+            auto c2 = Cross3(r0, r1);
+
+            auto det = _mm_mul_ps(r0, c0);
+            det = _mm_hadd_ps(det, det);
+            det = _mm_hadd_ps(det, det);
+            if (std::abs(_mm_cvtss_f32(det)) < EPSILON * EPSILON)
+            {
+                return {};
+            }
+
+            auto invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+            c0 = _mm_mul_ps(c0, invDet);
+            c1 = _mm_mul_ps(c1, invDet);
+            c2 = _mm_mul_ps(c2, invDet);
+
+            auto t = _mm_mul_ps(c0, _mm_set1_ps(m_data[3]));
+            t = _mm_add_ps(t, _mm_mul_ps(c1, _mm_set1_ps(m_data[7])));
+            t = _mm_add_ps(t, _mm_mul_ps(c2, _mm_set1_ps(m_data[11])));
+            t = _mm_sub_ps(_mm_setzero_ps(), t);
+
+            // 转置之后第i行是(c0[i], c1[i], c2[i], t[i])，第4行全是0，换成(0, 0, 0, 1)
+            _MM_TRANSPOSE4_PS(c0, c1, c2, t);
+
+            Matrix4x4 result;
+            _mm_store_ps(result.m_data, c0);
+            _mm_store_ps(result.m_data + 4, c1);
+            _mm_store_ps(result.m_data + 8, c2);
+            result.m_data[15] = 1.0f;
+
+            return result;
+        }
+
         float Determinant3() const
         {
             return m_data[0] * (m_data[5] * m_data[10] - m_data[6] * m_data[9])
@@ -344,6 +397,45 @@ namespace op
             return m;
         }
 
+        // 等于TRS(trans, rot, scale).Inverse()，也就是S⁻¹Rᵀ再减去平移，不需要求逆
+        static Matrix4x4 InverseTRS(const Vec3& trans, const Quaternion& rot, const Vec3& scale)
+        {
+            auto qq = rot;
+            auto q = qq.GetNormalizedData();
+
+            auto x2 = q.x * q.x;
+            auto xy = q.x * q.y;
+            auto xz = q.x * q.z;
+            auto xw = q.x * q.w;
+            auto y2 = q.y * q.y;
+            auto yz = q.y * q.z;
+            auto yw = q.y * q.w;
+            auto z2 = q.z * q.z;
+            auto zw = q.z * q.w;
+
+            // 第i行是旋转矩阵的第i列除以第i个缩放
+            auto sx = 1.0f / scale.x;
+            auto sy = 1.0f / scale.y;
+            auto sz = 1.0f / scale.z;
+            auto m = Identity();
+            m[0][0] = (1 - 2 * (y2 + z2)) * sx;
+            m[0][1] = 2 * (xy + zw) * sx;
+            m[0][2] = 2 * (xz - yw) * sx;
+            m[1][0] = 2 * (xy - zw) * sy;
+            m[1][1] = (1 - 2 * (x2 + z2)) * sy;
+            m[1][2] = 2 * (yz + xw) * sy;
+            m[2][0] = 2 * (xz + yw) * sz;
+            m[2][1] = 2 * (yz - xw) * sz;
+            m[2][2] = (1 - 2 * (x2 + y2)) * sz;
+
+            for (size_t i = 0; i < 3; ++i)
+            {
+                m[i][3] = -(m[i][0] * trans.x + m[i][1] * trans.y + m[i][2] * trans.z);
+            }
+
+            return m;
+        }
+
         static const Matrix4x4& Identity()
         {
             static Matrix4x4 m = {
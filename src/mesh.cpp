@@ -9,6 +9,7 @@
 #include <tracy/Tracy.hpp>
 
 #include "game_resource.h"
+#include "mesh_simplifier.h"
 #include "common/asset_cache.h"
 #include "render/gl/gl_buffer.h"
 #include "render/gl/gl_vertex_array.h"
@@ -168,7 +169,8 @@ namespace op
     {
         float initScale;
         bool flipWindingOrder;
-        GetMeshLoadConfig(modelPath, initScale, flipWindingOrder);
+        uint32_t lodCount;
+        GetMeshLoadConfig(modelPath, initScale, flipWindingOrder, lodCount);
         
         auto importer = mup<Assimp::Importer>();
         importer->SetPropertyFloat(AI_CONFIG_GLOBAL_SCALE_FACTOR_KEY, initScale);
@@ -265,7 +267,7 @@ namespace op
         }
     }
 
-    void Mesh::GetMeshLoadConfig(crstr modelPath, float& initScale, bool& flipWindingOrder)
+    void Mesh::GetMeshLoadConfig(crstr modelPath, float& initScale, bool& flipWindingOrder, uint32_t& lodCount)
     {
         auto config = Utils::GetResourceMeta(modelPath);
 
@@ -280,6 +282,13 @@ namespace op
         {
             flipWindingOrder = config.at("flip_winding_order").get<bool>();
         }
+
+        // 包括LOD0，1就是不生成LOD
+        lodCount = MAX_MESH_LOD_COUNT;
+        if (config.contains("lod_count"))
+        {
+            lodCount = std::clamp(config.at("lod_count").get<uint32_t>(), 1u, MAX_MESH_LOD_COUNT);
+        }
     }
     
     crvec<float> Mesh::GetFullVertexData(const Mesh* mesh)
@@ -326,6 +335,23 @@ namespace op
         fullMesh.vertexData = GetFullVertexData(mesh.get());
         fullMesh.indices = mesh->GetIndexData();
 
+        float initScale;
+        bool flipWindingOrder;
+        uint32_t lodCount;
+        GetMeshLoadConfig(assetPath, initScale, flipWindingOrder, lodCount);
+
+        auto lods = build_mesh_lods(
+            fullMesh.vertexData.data(),
+            MAX_VERTEX_ATTR_STRIDE_F,
+            fullMesh.vertexCount,
+            fullMesh.indices,
+            lodCount);
+        for (auto& lod : lods)
+        {
+            fullMesh.lodIndices.push_back(std::move(lod.indices));
+            fullMesh.lodErrors.push_back(lod.error);
+        }
+
         return fullMesh;
     }
 
@@ -339,6 +365,8 @@ namespace op
             std::move(c.indices),
             c.bounds,
             c.vertexCount);
+        mesh->m_lodIndexData = std::move(c.lodIndices);
+        mesh->m_lodErrors = std::move(c.lodErrors);
 
         return mesh;
     }
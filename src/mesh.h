@@ -1,5 +1,6 @@
 ﻿#pragma once
 #include <assimp/Importer.hpp>
+#include <boost/serialization/version.hpp>
 
 #include "bounds.h"
 #include "i_resource.h"
@@ -14,18 +15,21 @@ namespace op
     {
         friend class MeshCacheMgr;
         
+    public:
         struct Cache
         {
             Bounds bounds = {};
             uint32_t vertexCount = 0;
             vec<float> vertexData = {};
             vec<uint32_t> indices = {};
+            // LOD1开始的索引，和LOD0共用vertexData，版本1开始才有
+            vec<vec<uint32_t>> lodIndices = {};
+            vec<float> lodErrors = {};
 
             template <class Archive>
             void serialize(Archive& ar, unsigned int version);
         };
         
-    public:
         struct VertexAttrInfo
         {
             bool enabled = false;
@@ -46,6 +50,12 @@ namespace op
         uint32_t GetVertexCount() const { return static_cast<uint32_t>(GetVertexData().size() * sizeof(float) / GetVertexDataStrideB());}
         uint32_t GetIndicesCount() const { return static_cast<uint32_t>(GetIndexData().size());}
 
+        // LOD0就是GetIndexData，后面每一级大约是上一级一半的三角形，所有LOD共用同一份顶点数据
+        uint32_t GetLodCount() const { return static_cast<uint32_t>(m_lodIndexData.size()) + 1;}
+        crvec<uint32_t> GetLodIndexData(const uint32_t lod) const { return lod == 0 ? m_indexData : m_lodIndexData[lod - 1];}
+        // 简化误差，模型空间的距离
+        float GetLodError(const uint32_t lod) const { return lod == 0 ? 0.0f : m_lodErrors[lod - 1];}
+
         static sp<Mesh> LoadFromFile(crstr modelPath);
         
         static Cache CreateCacheFromAsset(crstr assetPath);
@@ -62,11 +72,13 @@ namespace op
         uint32_t m_vertexDataStrideB;
         vec<float> m_vertexData;
         vec<uint32_t> m_indexData;
+        vec<vec<uint32_t>> m_lodIndexData;
+        vec<float> m_lodErrors;
         umap<VertexAttr, VertexAttrInfo> m_vertexAttribInfo;
 
         static sp<Mesh> LoadFromFileImp(crstr modelPath);
         static up<Assimp::Importer> ImportFile(crstr modelPath);
-        static void GetMeshLoadConfig(crstr modelPath, float& initScale, bool& flipWindingOrder);
+        static void GetMeshLoadConfig(crstr modelPath, float& initScale, bool& flipWindingOrder, uint32_t& lodCount);
         static sp<Mesh> CreateMesh(
             umap<VertexAttr, VertexAttrInfo>&& vertexAttribInfo,
             vec<float>&& vertexData,
@@ -85,5 +97,13 @@ namespace op
         ar & vertexCount;
         ar & vertexData;
         ar & indices;
+
+        if (version >= 1)
+        {
+            ar & lodIndices;
+            ar & lodErrors;
+        }
     }
 }
+
+BOOST_CLASS_VERSION(op::Mesh::Cache, 1)
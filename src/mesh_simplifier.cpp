@@ -0,0 +1,597 @@
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <cassert>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <queue>
+
+namespace op
+{
+    // 三角形太少的mesh不值得生成LOD
+    static constexpr uint32_t MIN_LOD_TRIANGLE_COUNT = 64;
+    // 新的一级至少要比上一级少这么多三角形，不然就停止
+    static constexpr float MAX_LOD_INDEX_RATIO = 0.8f;
+    static constexpr uint32_t NONE = ~0u;
+
+    namespace
+    {
+        // 对称矩阵只存上三角，weight是累加的三角形面积，用来把误差换算成距离
+        struct Quadric
+        {
+            double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+            double b0 = 0, b1 = 0, b2 = 0;
+            double c = 0;
+            double weight = 0;
+
+            void AddPlane(const double nx, const double ny, const double nz, const double d, const double w)
+            {
+                a00 += w * nx * nx; a01 += w * nx * ny; a02 += w * nx * nz;
+                a11 += w * ny * ny; a12 += w * ny * nz; a22 += w * nz * nz;
+                b0 += w * nx * d; b1 += w * ny * d; b2 += w * nz * d;
+                c += w * d * d;
+                weight += w;
+            }
+
+            void Add(cr<Quadric> o)
+            {
+                a00 += o.a00; a01 += o.a01; a02 += o.a02;
+                a11 += o.a11; a12 += o.a12; a22 += o.a22;
+                b0 += o.b0; b1 += o.b1; b2 += o.b2;
+                c += o.c;
+                weight += o.weight;
+            }
+
+            double Eval(const double x, const double y, const double z) const
+            {
+                auto result =
+                    a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z +
+                    a11 * y * y + 2 * a12 * y * z + a22 * z * z +
+                    2 * (b0 * x + b1 * y + b2 * z) + c;
+                return std::max(result, 0.0);
+            }
+        };
+
+        struct Collapse
+        {
+            double cost;
+            uint32_t from;
+            uint32_t to;
+            uint32_t fromVersion;
+            uint32_t toVersion;
+
+            bool operator>(cr<Collapse> other) const { return cost > other.cost; }
+        };
+
+        struct PositionKey
+        {
+            uint32_t x, y, z;
+
+            bool operator==(cr<PositionKey> other) const = default;
+        };
+
+        struct PositionKeyHash
+        {
+            size_t operator()(cr<PositionKey> key) const
+            {
+                return (static_cast<size_t>(key.x) * 73856093u) ^ (static_cast<size_t>(key.y) * 19349663u) ^ (static_cast<size_t>(key.z) * 83492791u);
+            }
+        };
+
+        // 拓扑只在焊接后的顶点上维护，三角形的角另外记着原始顶点，输出时用
+        class Simplifier
+        {
+        public:
+            Simplifier(const float* positions, uint32_t positionStrideF, uint32_t vertexCount, crvec<uint32_t> indices);
+
+            // 可以用越来越小的目标多次调用，每次接着上一次的结果继续简化
+            void Run(uint32_t targetIndexCount, float maxError);
+            uint32_t GetIndexCount() const { return m_liveTriangleCount * 3; }
+            float GetError() const { return m_error; }
+            vec<uint32_t> GetIndices() const;
+
+        private:
+            struct Triangle
+            {
+                // 焊接后的顶点
+                arr<uint32_t, 3> vertices;
+                // 原始顶点
+                arr<uint32_t, 3> corners;
+                bool alive = true;
+            };
+
+            vec<double> m_positions;
+            vec<Triangle> m_triangles;
+            vec<vec<uint32_t>> m_vertexTriangles;
+            vec<Quadric> m_quadrics;
+            vec<uint32_t> m_versions;
+            vec<bool> m_locked;
+            vec<bool> m_removed;
+            vec<uint32_t> m_marks;
+            uint32_t m_markStamp = 0;
+            uint32_t m_liveTriangleCount = 0;
+            float m_error = 0.0f;
+
+            std::priority_queue<Collapse, vec<Collapse>, std::greater<>> m_heap;
+
+            void PushCollapse(uint32_t from, uint32_t to);
+            bool IsCollapseValid(uint32_t from, uint32_t to);
+            void ApplyCollapse(uint32_t from, uint32_t to);
+            void CompactVertexTriangles(uint32_t vertex);
+            uint32_t NextMark();
+
+            static void TriangleNormal(const double* p0, const double* p1, const double* p2, double* n);
+        };
+
+        Simplifier::Simplifier(const float* positions, const uint32_t positionStrideF, const uint32_t vertexCount, crvec<uint32_t> indices)
+        {
+            // 位置完全相同的顶点焊接成一个，-0和0当作同一个值
+            vec<uint32_t> weld(vertexCount);
+            std::unordered_map<PositionKey, uint32_t, PositionKeyHash> weldMap;
+            weldMap.reserve(vertexCount);
+            for (uint32_t i = 0; i < vertexCount; ++i)
+            {
+                auto p = positions + static_cast<size_t>(i) * positionStrideF;
+                PositionKey key = {
+                    std::bit_cast<uint32_t>(p[0] + 0.0f),
+                    std::bit_cast<uint32_t>(p[1] + 0.0f),
+                    std::bit_cast<uint32_t>(p[2] + 0.0f)
+                };
+                auto [it, inserted] = weldMap.try_emplace(key, static_cast<uint32_t>(m_positions.size() / 3));
+                if (inserted)
+                {
+                    m_positions.push_back(p[0]);
+                    m_positions.push_back(p[1]);
+                    m_positions.push_back(p[2]);
+                }
+                weld[i] = it->second;
+            }
+
+            auto weldedCount = static_cast<uint32_t>(m_positions.size() / 3);
+            m_vertexTriangles.resize(weldedCount);
+            m_quadrics.resize(weldedCount);
+            m_versions.resize(weldedCount);
+            m_locked.resize(weldedCount);
+            m_removed.resize(weldedCount);
+            m_marks.resize(weldedCount);
+
+            // 一个焊接顶点被多个原始顶点使用就是属性接缝
+            vec<uint32_t> wedges(weldedCount, NONE);
+            vec<std::pair<uint32_t, uint32_t>> edges;
+            for (size_t i = 0; i + 2 < indices.size(); i += 3)
+            {
+                Triangle triangle;
+                for (uint32_t k = 0; k < 3; ++k)
+                {
+                    triangle.corners[k] = indices[i + k];
+                    triangle.vertices[k] = weld[indices[i + k]];
+                }
+
+                auto& v = triangle.vertices;
+                if (v[0] == v[1] || v[1] == v[2] || v[0] == v[2])
+                {
+                    continue;
+                }
+
+                auto index = static_cast<uint32_t>(m_triangles.size());
+                for (uint32_t k = 0; k < 3; ++k)
+                {
+                    m_vertexTriangles[v[k]].push_back(index);
+
+                    auto& wedge = wedges[v[k]];
+                    if (wedge == NONE)
+                    {
+                        wedge = triangle.corners[k];
+                    }
+                    else if (wedge != triangle.corners[k])
+                    {
+                        m_locked[v[k]] = true;
+                    }
+
+                    auto a = v[k];
+                    auto b = v[(k + 1) % 3];
+                    edges.emplace_back(std::min(a, b), std::max(a, b));
+                }
+
+                double n[3];
+                TriangleNormal(&m_positions[v[0] * 3], &m_positions[v[1] * 3], &m_positions[v[2] * 3], n);
+                auto length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                if (length > 0.0)
+                {
+                    auto nx = n[0] / length;
+                    auto ny = n[1] / length;
+                    auto nz = n[2] / length;
+                    auto d = -(nx * m_positions[v[0] * 3] + ny * m_positions[v[0] * 3 + 1] + nz * m_positions[v[0] * 3 + 2]);
+                    for (uint32_t k = 0; k < 3; ++k)
+                    {
+                        m_quadrics[v[k]].AddPlane(nx, ny, nz, d, length * 0.5);
+                    }
+                }
+
+                m_triangles.push_back(triangle);
+            }
+            m_liveTriangleCount = static_cast<uint32_t>(m_triangles.size());
+
+            // 只属于一个三角形的边在边界上，属于两个以上的是非流形，两端的顶点都锁住
+            std::sort(edges.begin(), edges.end());
+            for (size_t i = 0; i < edges.size();)
+            {
+                auto j = i;
+                while (j < edges.size() && edges[j] == edges[i])
+                {
+                    j++;
+                }
+                if (j - i != 2)
+                {
+                    m_locked[edges[i].first] = true;
+                    m_locked[edges[i].second] = true;
+                }
+                i = j;
+            }
+
+            for (size_t i = 0; i < edges.size(); ++i)
+            {
+                if (i > 0 && edges[i] == edges[i - 1])
+                {
+                    continue;
+                }
+                PushCollapse(edges[i].first, edges[i].second);
+                PushCollapse(edges[i].second, edges[i].first);
+            }
+        }
+
+        void Simplifier::Run(const uint32_t targetIndexCount, const float maxError)
+        {
+            while (m_liveTriangleCount * 3 > targetIndexCount && !m_heap.empty())
+            {
+                auto collapse = m_heap.top();
+                m_heap.pop();
+
+                if (m_removed[collapse.from] || m_removed[collapse.to] ||
+                    m_versions[collapse.from] != collapse.fromVersion ||
+                    m_versions[collapse.to] != collapse.toVersion)
+                {
+                    continue;
+                }
+
+                auto weight = m_quadrics[collapse.from].weight + m_quadrics[collapse.to].weight;
+                auto error = static_cast<float>(weight > 0.0 ? std::sqrt(collapse.cost / weight) : 0.0);
+                // 堆按代价排序，换算成距离后不一定单调，超出的只跳过，不提前结束
+                if (error > maxError)
+                {
+                    continue;
+                }
+
+                if (!IsCollapseValid(collapse.from, collapse.to))
+                {
+                    continue;
+                }
+
+                ApplyCollapse(collapse.from, collapse.to);
+                m_error = std::max(m_error, error);
+            }
+        }
+
+        vec<uint32_t> Simplifier::GetIndices() const
+        {
+            vec<uint32_t> result;
+            result.reserve(static_cast<size_t>(m_liveTriangleCount) * 3);
+            for (auto& triangle : m_triangles)
+            {
+                if (triangle.alive)
+                {
+                    result.insert(result.end(), triangle.corners.begin(), triangle.corners.end());
+                }
+            }
+
+            return result;
+        }
+
+        void Simplifier::PushCollapse(const uint32_t from, const uint32_t to)
+        {
+            if (m_locked[from])
+            {
+                return;
+            }
+
+            // 合并后的顶点留在to的位置上，误差用两边的二次误差之和
+            auto quadric = m_quadrics[from];
+            quadric.Add(m_quadrics[to]);
+            auto p = &m_positions[to * 3];
+            m_heap.push({ quadric.Eval(p[0], p[1], p[2]), from, to, m_versions[from], m_versions[to] });
+        }
+
+        bool Simplifier::IsCollapseValid(const uint32_t from, const uint32_t to)
+        {
+            // 两个顶点共同的邻居必须刚好是共享这条边的三角形的第三个顶点，否则合并后会产生非流形的边
+            auto mark = NextMark();
+            for (auto t : m_vertexTriangles[to])
+            {
+                auto& triangle = m_triangles[t];
+                if (!triangle.alive)
+                {
+                    continue;
+                }
+                for (auto v : triangle.vertices)
+                {
+                    if (v != to)
+                    {
+                        m_marks[v] = mark;
+                    }
+                }
+            }
+
+            auto counted = NextMark();
+            uint32_t commonCount = 0;
+            uint32_t sharedCount = 0;
+            for (auto t : m_vertexTriangles[from])
+            {
+                auto& triangle = m_triangles[t];
+                if (!triangle.alive)
+                {
+                    continue;
+                }
+
+                auto hasTo = false;
+                for (auto v : triangle.vertices)
+                {
+                    hasTo |= v == to;
+                    if (v != from && m_marks[v] == mark)
+                    {
+                        m_marks[v] = counted;
+                        commonCount++;
+                    }
+                }
+
+                if (hasTo)
+                {
+                    sharedCount++;
+                    continue;
+                }
+
+                // 保留下来的三角形不能翻面
+                double p[3][3];
+                for (uint32_t k = 0; k < 3; ++k)
+                {
+                    auto v = triangle.vertices[k] == from ? to : triangle.vertices[k];
+                    std::copy_n(&m_positions[v * 3], 3, p[k]);
+                }
+                double oldNormal[3];
+                double newNormal[3];
+                TriangleNormal(&m_positions[triangle.vertices[0] * 3], &m_positions[triangle.vertices[1] * 3], &m_positions[triangle.vertices[2] * 3], oldNormal);
+                TriangleNormal(p[0], p[1], p[2], newNormal);
+                if (oldNormal[0] * newNormal[0] + oldNormal[1] * newNormal[1] + oldNormal[2] * newNormal[2] <= 0.0)
+                {
+                    return false;
+                }
+            }
+
+            // to是from的邻居，不算在共同邻居里
+            return sharedCount > 0 && commonCount == sharedCount;
+        }
+
+        void Simplifier::ApplyCollapse(const uint32_t from, const uint32_t to)
+        {
+            // from不是接缝，所有的角都是同一个原始顶点，合并后用共享这条边的三角形里to的原始顶点
+            auto newCorner = NONE;
+            for (auto t : m_vertexTriangles[from])
+            {
+                auto& triangle = m_triangles[t];
+                if (!triangle.alive)
+                {
+                    continue;
+                }
+                for (uint32_t k = 0; k < 3; ++k)
+                {
+                    if (triangle.vertices[k] == to)
+                    {
+                        newCorner = triangle.corners[k];
+                    }
+                }
+                if (newCorner != NONE)
+                {
+                    break;
+                }
+            }
+            assert(newCorner != NONE);
+
+            for (auto t : m_vertexTriangles[from])
+            {
+                auto& triangle = m_triangles[t];
+                if (!triangle.alive)
+                {
+                    continue;
+                }
+
+                if (std::find(triangle.vertices.begin(), triangle.vertices.end(), to) != triangle.vertices.end())
+                {
+                    triangle.alive = false;
+                    m_liveTriangleCount--;
+                    continue;
+                }
+
+                for (uint32_t k = 0; k < 3; ++k)
+                {
+                    if (triangle.vertices[k] == from)
+                    {
+                        triangle.vertices[k] = to;
+                        triangle.corners[k] = newCorner;
+                    }
+                }
+                m_vertexTriangles[to].push_back(t);
+            }
+
+            m_quadrics[to].Add(m_quadrics[from]);
+            m_removed[from] = true;
+            m_vertexTriangles[from].clear();
+            m_versions[to]++;
+            CompactVertexTriangles(to);
+
+            // to的二次误差变了，和它相连的边都要重新算代价，旧的记录靠版本号作废
+            auto mark = NextMark();
+            for (auto t : m_vertexTriangles[to])
+            {
+                for (auto v : m_triangles[t].vertices)
+                {
+                    if (v != to && m_marks[v] != mark)
+                    {
+                        m_marks[v] = mark;
+                        PushCollapse(v, to);
+                        PushCollapse(to, v);
+                    }
+                }
+            }
+        }
+
+        void Simplifier::CompactVertexTriangles(const uint32_t vertex)
+        {
+            auto& triangles = m_vertexTriangles[vertex];
+            triangles.erase(std::remove_if(triangles.begin(), triangles.end(), [this](const uint32_t t)
+            {
+                return !m_triangles[t].alive;
+            }), triangles.end());
+        }
+
+        uint32_t Simplifier::NextMark()
+        {
+            return ++m_markStamp;
+        }
+
+        void Simplifier::TriangleNormal(const double* p0, const double* p1, const double* p2, double* n)
+        {
+            double e0[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            double e1[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+            n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+            n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+        }
+    }
+
+    MeshSimplifyResult simplify_mesh(
+        const float* positions,
+        const uint32_t positionStrideF,
+        const uint32_t vertexCount,
+        crvec<uint32_t> indices,
+        const uint32_t targetIndexCount,
+        const float maxError)
+    {
+        Simplifier simplifier(positions, positionStrideF, vertexCount, indices);
+        simplifier.Run(targetIndexCount, maxError);
+
+        return { simplifier.GetIndices(), simplifier.GetError() };
+    }
+
+    vec<MeshSimplifyResult> build_mesh_lods(
+        const float* positions,
+        const uint32_t positionStrideF,
+        const uint32_t vertexCount,
+        crvec<uint32_t> indices,
+        const uint32_t lodCount)
+    {
+        vec<MeshSimplifyResult> result;
+        if (lodCount <= 1 || indices.size() / 3 < MIN_LOD_TRIANGLE_COUNT)
+        {
+            return result;
+        }
+
+        // 合并的顺序和目标无关，一直往下简化，每到一级的目标就取一次结果
+        Simplifier simplifier(positions, positionStrideF, vertexCount, indices);
+        auto prevIndexCount = simplifier.GetIndexCount();
+        for (uint32_t lod = 1; lod < lodCount; ++lod)
+        {
+            if (prevIndexCount / 3 < MIN_LOD_TRIANGLE_COUNT)
+            {
+                break;
+            }
+
+            simplifier.Run(prevIndexCount / 6 * 3, std::numeric_limits<float>::max());
+            auto indexCount = simplifier.GetIndexCount();
+            if (static_cast<float>(indexCount) > static_cast<float>(prevIndexCount) * MAX_LOD_INDEX_RATIO)
+            {
+                break;
+            }
+
+            result.push_back({ simplifier.GetIndices(), simplifier.GetError() });
+            prevIndexCount = indexCount;
+        }
+
+        return result;
+    }
+
+    vec<MeshSimplifierBenchmark> benchmark_mesh_simplifier(const uint32_t segments)
+    {
+        // 经线多一列，第一列和最后一列位置相同UV不同，两极每一列也各有一个顶点，接缝和极点都会被锁住
+        auto rings = std::max(segments / 2, 2u);
+        auto columns = segments + 1;
+        vec<float> positions;
+        positions.reserve(static_cast<size_t>(rings + 1) * columns * 3);
+        for (uint32_t r = 0; r <= rings; ++r)
+        {
+            auto theta = 3.14159265f * static_cast<float>(r) / static_cast<float>(rings);
+            for (uint32_t c = 0; c < columns; ++c)
+            {
+                auto phi = 2.0f * 3.14159265f * static_cast<float>(c % segments) / static_cast<float>(segments);
+                // 两极的x、z算出来不一定刚好是0，直接写0保证焊接
+                auto poles = r == 0 || r == rings;
+                positions.push_back(poles ? 0.0f : std::sin(theta) * std::cos(phi));
+                positions.push_back(std::cos(theta));
+                positions.push_back(poles ? 0.0f : std::sin(theta) * std::sin(phi));
+            }
+        }
+
+        vec<uint32_t> indices;
+        for (uint32_t r = 0; r < rings; ++r)
+        {
+            for (uint32_t c = 0; c < segments; ++c)
+            {
+                auto i0 = r * columns + c;
+                auto i1 = i0 + 1;
+                auto i2 = i0 + columns;
+                auto i3 = i2 + 1;
+                if (r != 0)
+                {
+                    indices.insert(indices.end(), { i0, i2, i1 });
+                }
+                if (r != rings - 1)
+                {
+                    indices.insert(indices.end(), { i1, i2, i3 });
+                }
+            }
+        }
+
+        auto vertexCount = static_cast<uint32_t>(positions.size() / 3);
+        auto countInvalid = [&](crvec<uint32_t> lodIndices)
+        {
+            uint32_t invalid = 0;
+            for (size_t i = 0; i + 2 < lodIndices.size(); i += 3)
+            {
+                auto a = lodIndices[i];
+                auto b = lodIndices[i + 1];
+                auto c = lodIndices[i + 2];
+                if (a >= vertexCount || b >= vertexCount || c >= vertexCount ||
+                    std::equal(&positions[a * 3], &positions[a * 3] + 3, &positions[b * 3]) ||
+                    std::equal(&positions[b * 3], &positions[b * 3] + 3, &positions[c * 3]) ||
+                    std::equal(&positions[a * 3], &positions[a * 3] + 3, &positions[c * 3]))
+                {
+                    invalid++;
+                }
+            }
+            return invalid;
+        };
+
+        vec<MeshSimplifierBenchmark> result;
+        result.push_back({ static_cast<uint32_t>(indices.size() / 3), 0.0f, 0.0, countInvalid(indices) });
+
+        auto start = std::chrono::high_resolution_clock::now();
+        auto lods = build_mesh_lods(positions.data(), 3, vertexCount, indices, MAX_MESH_LOD_COUNT);
+        auto ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        for (auto& lod : lods)
+        {
+            result.push_back({ static_cast<uint32_t>(lod.indices.size() / 3), lod.error, ms, countInvalid(lod.indices) });
+        }
+
+        return result;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+#include "const.h"
+
+namespace op
+{
+    // 二次误差度量（QEM）的网格简化，只删三角形不改顶点，简化结果和原始网格共用同一份顶点数据
+    // 每次把一个顶点合并到相邻的顶点上，代价是目标顶点到两个顶点周围所有三角形平面距离的平方和（按面积加权）
+    // 位置相同的顶点焊接在一起处理拓扑，边界上的顶点和有多个属性的接缝顶点不会被移动，避免破坏轮廓和UV
+    // 不依赖GL，可以在没有窗口的环境下调用
+    struct MeshSimplifyResult
+    {
+        vec<uint32_t> indices;
+        // 被删掉的三角形到简化后网格的最大距离的估计，和位置的单位相同
+        float error = 0.0f;
+    };
+
+    // positions每个顶点positionStrideF个float，前三个是位置，targetIndexCount只是目标，拓扑不允许时会停在更多的三角形上
+    MeshSimplifyResult simplify_mesh(
+        const float* positions,
+        uint32_t positionStrideF,
+        uint32_t vertexCount,
+        crvec<uint32_t> indices,
+        uint32_t targetIndexCount,
+        float maxError = std::numeric_limits<float>::max());
+
+    // 依次生成LOD1到LOD(lodCount - 1)，每一级的目标是上一级的一半，简化不动了或者三角形太少时提前结束
+    vec<MeshSimplifyResult> build_mesh_lods(
+        const float* positions,
+        uint32_t positionStrideF,
+        uint32_t vertexCount,
+        crvec<uint32_t> indices,
+        uint32_t lodCount);
+
+    struct MeshSimplifierBenchmark
+    {
+        uint32_t triangleCount = 0;
+        float error = 0.0f;
+        double ms = 0.0;
+        // 输出里的退化三角形或者越界的索引，正常应该是0
+        uint32_t invalidTriangleCount = 0;
+    };
+
+    // 对segments * segments的带UV接缝的球生成LOD链，第一个结果是原始网格
+    vec<MeshSimplifierBenchmark> benchmark_mesh_simplifier(uint32_t segments);
+}
@@ -128,6 +128,12 @@ namespace op
 
             m_scene = obj->m_scene;
         }
+
+        // 创建物体时comp还没加上，transform的父节点在TransformComp::Awake里设置
+        if (transform)
+        {
+            transform->OnParentChanged();
+        }
     }
 
     void Object::Destroy()
@@ -6,8 +6,10 @@
 #include "material.h"
 #include "mesh.h"
 #include "object.h"
+#include "occlusion_culling.h"
 #include "transform_comp.h"
 #include "culling_system.h"
+#include "render/batch_mesh.h"
 #include "render/batch_render_unit.h"
 
 namespace op
@@ -16,38 +18,36 @@ namespace op
     {
         m_preHasONS = HasONS();
         
-        m_cullingBufferAccessor[static_cast<uint8_t>(CullingGroup::COMMON)] = GetGR()->GetCullingBuffer(CullingGroup::COMMON)->Alloc();
-        m_cullingBufferAccessor[static_cast<uint8_t>(CullingGroup::SHADOW)] = GetGR()->GetCullingBuffer(CullingGroup::SHADOW)->Alloc();
+        m_cullingBufferAccessor = GetGR()->GetCullingBuffer(CullingGroup::COMMON)->Alloc();
         
         GetGR()->GetBatchRenderUnit()->BindComp(this);
+
+        if (m_occluder)
+        {
+            GetGR()->GetOcclusionCulling()->AddOccluder(this);
+        }
         
-        m_onTransformDirtyHandler = GetOwner()->transform->dirtyEvent.Add(this, &BatchRenderComp::OnTransformDirty);
-        OnTransformDirty();
+        UpdateTransform();
     }
 
     void BatchRenderComp::OnDisable()
     {
-        GetOwner()->transform->dirtyEvent.Remove(m_onTransformDirtyHandler);
-        
         GetGR()->GetBatchRenderUnit()->UnBindComp(this);
 
-        for (auto& accessor : m_cullingBufferAccessor)
+        if (m_occluder)
         {
-            if (accessor)
-            {
-                accessor->Release();
-                accessor = nullptr;
-            }
+            GetGR()->GetOcclusionCulling()->RemoveOccluder(this);
         }
-    }
 
-    void BatchRenderComp::OnTransformDirty()
-    {
-        if (!IsEnable())
+        if (m_cullingBufferAccessor)
         {
-            return;
+            m_cullingBufferAccessor->Release();
+            m_cullingBufferAccessor = nullptr;
         }
-        
+    }
+
+    void BatchRenderComp::OnTransformChanged()
+    {
         UpdateTransform();
     }
     
@@ -65,12 +65,9 @@ namespace op
         }
         
         m_worldBounds = m_mesh->GetBounds().ToWorld(GetOwner()->transform->GetLocalToWorld());
-        for (auto& accessor : m_cullingBufferAccessor)
+        if (m_cullingBufferAccessor)
         {
-            if (accessor)
-            {
-                accessor->Submit(m_worldBounds);
-            }
+            m_cullingBufferAccessor->Submit(m_worldBounds);
         }
         
         UpdatePerObjectBuffer();
@@ -83,12 +80,15 @@ namespace op
 
     CullingBuffer::Accessor* BatchRenderComp::GetCullingAccessor(CullingGroup group)
     {
-        return m_cullingBufferAccessor[static_cast<uint8_t>(group)];
+        assert(group != CullingGroup::TRANSPARENT);
+        
+        return m_cullingBufferAccessor;
     }
 
     void BatchRenderComp::UpdatePerObjectBuffer()
     {
-        m_submitBuffer.localToWorld = GetOwner()->transform->GetLocalToWorld();
+        // BatchMesh里的顶点位置是按包围盒量化过的，先变回模型空间，法线不受影响，worldToLocal保持不变
+        m_submitBuffer.localToWorld = GetOwner()->transform->GetLocalToWorld() * BatchMesh::GetDequantizeMatrix(m_mesh.get());
         m_submitBuffer.worldToLocal = GetOwner()->transform->GetWorldToLocal();
 
         GetGR()->GetBatchRenderUnit()->UpdateMatrix(this, m_submitBuffer);
@@ -111,5 +111,10 @@ namespace op
             auto matPath = objJson["material"].get<std::string>();
             m_material = Material::LoadFromFile(matPath);
         }
+
+        if(objJson.contains("occluder"))
+        {
+            m_occluder = objJson["occluder"].get<bool>();
+        }
     }
 }
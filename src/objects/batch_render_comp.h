@@ -3,7 +3,6 @@
 #include "bounds.h"
 #include "comp.h"
 #include "culling_system.h"
-#include "event.h"
 #include "render/batch_matrix.h"
 
 namespace op
@@ -20,6 +19,7 @@ namespace op
 
         void OnEnable() override;
         void OnDisable() override;
+        void OnTransformChanged() override;
         void UpdateTransform();
         bool HasONS();
 
@@ -31,13 +31,14 @@ namespace op
     private:
         sp<Mesh> m_mesh = nullptr;
         sp<Material> m_material = nullptr;
-        EventHandler m_onTransformDirtyHandler = 0;
         BatchMatrix::Elem m_submitBuffer;
         bool m_preHasONS = false;
-        CullingBuffer::Accessor* m_cullingBufferAccessor[CULLING_BUFFER_COUNT] = { nullptr };
+        // 作为遮挡物光栅化到遮挡剔除的深度缓冲里
+        bool m_occluder = false;
+        // COMMON和SHADOW共用一个CullingBuffer，包围盒只提交一次
+        CullingBuffer::Accessor* m_cullingBufferAccessor = nullptr;
         Bounds m_worldBounds;
 
-        void OnTransformDirty();
         void UpdatePerObjectBuffer();
     };
 }
@@ -147,7 +147,7 @@ namespace op
         cameraLocalToWorld[0][2] = -cameraLocalToWorld[0][2];
         cameraLocalToWorld[1][2] = -cameraLocalToWorld[1][2];
         cameraLocalToWorld[2][2] = -cameraLocalToWorld[2][2];
-        auto view = cameraLocalToWorld.Inverse();
+        auto view = cameraLocalToWorld.AffineInverse();
 
         auto aspect = static_cast<float>(GetRC()->screenWidth) / static_cast<float>(GetRC()->screenHeight);
         auto proj = create_projection(fov, aspect, nearClip, farClip);
@@ -217,7 +217,7 @@ namespace op
             right.y, up.y, forward.y, shadowCameraPos.y,
             right.z, up.z, forward.z, shadowCameraPos.z,
             0, 0, 0, 1);
-        auto view = shadowCameraToWorld.Inverse();
+        auto view = shadowCameraToWorld.AffineInverse();
 
         auto proj = create_ortho_projection(shadowWidth, -shadowWidth, shadowWidth, -shadowWidth, depthRange, 0);
 
@@ -3,6 +3,7 @@
 
 #include "const.h"
 #include "nlohmann/json.hpp"
+#include "common/chunk_list.h"
 
 
 namespace op
@@ -33,6 +34,8 @@ namespace op
         virtual void OnDestroy(){}
         virtual void OnEnable(){}
         virtual void OnDisable(){}
+        // 物体或者它的父物体的transform变过，所有comp Update完、矩阵统一更新之后每帧最多调用一次
+        virtual void OnTransformChanged(){}
 
         Comp() = default;
         virtual ~Comp() = default;
@@ -49,6 +52,10 @@ namespace op
         StringHandle m_name;
         Object* m_owner = nullptr;
         std::type_index m_type = std::type_index(typeid(Comp));
+        // 在所属场景CompStorage里的位置，Start之前在m_pendingHandle，Start之后在m_allHandle
+        ChunkListHandle m_typeHandle;
+        ChunkListHandle m_pendingHandle;
+        ChunkListHandle m_allHandle;
         
         void Destroy();
         void UpdateRealEnable();
@@ -17,15 +17,14 @@ namespace op
 
     void RenderComp::Start()
     {
-        m_onTransformDirtyHandler = GetOwner()->transform->dirtyEvent.Add(this, &RenderComp::OnTransformDirty);
-        OnTransformDirty();
+        OnTransformChanged();
         UpdateTransform();
     }
 
     void RenderComp::OnEnable()
     {
         m_transparentCullingBufferAccessor = GetGR()->GetCullingBuffer(CullingGroup::TRANSPARENT)->Alloc();
-        OnTransformDirty();
+        OnTransformChanged();
         UpdateTransform();
     }
 
@@ -41,11 +40,6 @@ namespace op
     void RenderComp::OnDestroy()
     {
         GetGR()->GetPerObjectBuffer()->UnRegister(m_perObjectBufferIndex);
-
-        if (m_onTransformDirtyHandler)
-        {
-            GetOwner()->transform->dirtyEvent.Remove(m_onTransformDirtyHandler);
-        }
     }
 
     void RenderComp::LoadFromJson(const nlohmann::json& objJson)
@@ -75,7 +69,7 @@ namespace op
         return GetOwner()->transform->HasOddNegativeScale();
     }
 
-    void RenderComp::OnTransformDirty()
+    void RenderComp::OnTransformChanged()
     {
         m_transformDirty = true;
     }
@@ -5,7 +5,6 @@
 #include "bounds.h"
 #include "comp.h"
 #include "culling_system.h"
-#include "event.h"
 
 namespace op
 {
@@ -20,6 +19,7 @@ namespace op
         void OnEnable() override;
         void OnDisable() override;
         void OnDestroy() override;
+        void OnTransformChanged() override;
         void UpdateTransform();
         cr<Bounds> GetWorldBounds();
         
@@ -35,14 +35,11 @@ namespace op
         sp<Mesh> m_mesh = nullptr;
         sp<Material> m_material = nullptr;
     
-        EventHandler m_onTransformDirtyHandler = 0;
         bool m_transformDirty = true;
         Bounds m_worldBounds;
         uint32_t m_perObjectBufferIndex = ~0u;
         CullingBuffer::Accessor* m_transparentCullingBufferAccessor = nullptr;
 
-        void OnTransformDirty();
-
         void UpdateWorldBounds();
         void UpdatePerObjectBuffer();
     };
@@ -1,5 +1,8 @@
 ﻿#include "transform_comp.h"
 
+#include <tracy/Tracy.hpp>
+
+#include "game_resource.h"
 #include "object.h"
 #include "utils.h"
 
@@ -7,221 +10,232 @@ namespace op
 {
     using namespace std;
 
+    TransformComp::~TransformComp()
+    {
+        // 场景在TransformSystem之前销毁，这里只防止有物体在GameResource析构之后才释放
+        if (m_handle != TransformSystem::INVALID_HANDLE && GetGR() && GetGR()->GetTransformSystem())
+        {
+            GetGR()->GetTransformSystem()->Remove(m_handle);
+        }
+    }
+
     void TransformComp::Awake()
     {
         GetOwner()->transform = this;
+
+        auto system = GetGR()->GetTransformSystem();
+        m_handle = system->Add(GetParentHandle(), this);
+        system->SetLocalPosition(m_handle, m_position);
+        system->SetLocalRotation(m_handle, m_rotation);
+        system->SetLocalScale(m_handle, m_scale);
     }
 
     Vec3 TransformComp::GetWorldPosition()
     {
-        if (m_position.needUpdateFromWorld)
-        {
-            return m_position.worldVal;
-        }
-        
-        UpdateMatrix();
-        
-        return m_position.worldVal;
+        auto& localToWorld = GetLocalToWorld();
+        auto data = localToWorld.GetReadOnlyData();
+
+        return { data[3], data[7], data[11] };
     }
 
     void TransformComp::SetWorldPosition(const Vec3& pos)
     {
-        if (m_position.needUpdateFromWorld && m_position.worldVal == pos)
-        {
-            return;
-        }
-        
-        m_position.worldVal = pos;
-        m_position.needUpdateFromWorld = true;
+        m_positionFromWorld = true;
+        GetGR()->GetTransformSystem()->SetWorldPosition(m_handle, pos);
 
         SetDirty(GetOwner());
     }
 
     Vec3 TransformComp::GetPosition()
     {
-        if (m_position.needUpdateFromWorld)
+        if (m_positionFromWorld)
         {
-            UpdateMatrix();
+            m_position = GetGR()->GetTransformSystem()->GetLocalPosition(m_handle);
+            m_positionFromWorld = false;
         }
         
-        return m_position.localVal;
+        return m_position;
     }
 
     void TransformComp::SetPosition(const Vec3& pos)
     {
-        m_position.needUpdateFromWorld = false;
-        
-        if (m_position.localVal == pos)
+        if (!m_positionFromWorld && m_position == pos)
         {
             return;
         }
 
-        SetDirty(GetOwner());
+        m_positionFromWorld = false;
+        m_position = pos;
+        GetGR()->GetTransformSystem()->SetLocalPosition(m_handle, pos);
 
-        m_position.localVal = pos;
+        SetDirty(GetOwner());
     }
 
     Vec3 TransformComp::GetScale()
     {
-        return m_scale.localVal;
+        return m_scale;
     }
 
     void TransformComp::SetScale(const Vec3& scale)
     {
-        if (m_scale.localVal == scale)
+        if (m_scale == scale)
         {
             return;
         }
 
-        SetDirty(GetOwner());
+        m_scale = scale;
+        GetGR()->GetTransformSystem()->SetLocalScale(m_handle, scale);
 
-        m_scale.localVal = scale;
+        SetDirty(GetOwner());
     }
 
     Quaternion TransformComp::GetRotation()
     {
-        return m_rotation.localVal;
+        return m_rotation;
     }
 
     void TransformComp::SetRotation(Quaternion& rotation)
     {
-        if (m_rotation.localVal == rotation)
+        if (m_rotation == rotation)
         {
             return;
         }
 
-        SetDirty(GetOwner());
+        m_eulerAngles = rotation.ToEuler();
+        m_rotation = rotation;
+        GetGR()->GetTransformSystem()->SetLocalRotation(m_handle, rotation);
 
-        m_eulerAngles.localVal = rotation.ToEuler();
-        m_rotation.localVal = rotation;
+        SetDirty(GetOwner());
     }
 
     Vec3 TransformComp::GetEulerAngles()
     {
-        return m_eulerAngles.localVal;
+        return m_eulerAngles;
     }
 
     void TransformComp::SetEulerAngles(const Vec3& ea)
     {
-        if (m_eulerAngles.localVal == ea)
+        if (m_eulerAngles == ea)
         {
             return;
         }
 
-        SetDirty(GetOwner());
+        m_eulerAngles = ea;
+        m_rotation = Quaternion::Euler(ea);
+        GetGR()->GetTransformSystem()->SetLocalRotation(m_handle, m_rotation);
 
-        m_eulerAngles.localVal = ea;
-        m_rotation.localVal = Quaternion::Euler(ea);
+        SetDirty(GetOwner());
     }
 
     bool TransformComp::HasOddNegativeScale()
     {
-        UpdateMatrix();
-
-        return m_hasOddNegativeScale;
+        return GetGR()->GetTransformSystem()->HasOddNegativeScale(m_handle);
     }
 
     const Matrix4x4& TransformComp::GetLocalToWorld()
     {
-        UpdateMatrix();
-
-        return m_matrix.localVal;
+        return GetGR()->GetTransformSystem()->GetLocalToWorld(m_handle);
     }
     
     const Matrix4x4& TransformComp::GetWorldToLocal()
     {
-        UpdateMatrix();
+        return GetGR()->GetTransformSystem()->GetWorldToLocal(m_handle);
+    }
+
+    void TransformComp::OnParentChanged()
+    {
+        GetGR()->GetTransformSystem()->SetParent(m_handle, GetParentHandle());
 
-        return m_matrix.worldVal;
+        SetDirty(GetOwner());
     }
 
     void TransformComp::LoadFromJson(const nlohmann::json& objJson)
     {
         if(objJson.contains("position"))
         {
-            m_position.localVal = objJson.at("position").get<Vec3>();
+            m_position = objJson.at("position").get<Vec3>();
         }
     
         if(objJson.contains("rotation"))
         {
-            m_eulerAngles.localVal = objJson.at("rotation").get<Vec3>();
-            m_rotation.localVal = Quaternion::Euler(m_eulerAngles.localVal);
+            m_eulerAngles = objJson.at("rotation").get<Vec3>();
+            m_rotation = Quaternion::Euler(m_eulerAngles);
         }
     
         if(objJson.contains("scale"))
         {
-            m_scale.localVal = objJson.at("scale").get<Vec3>();
+            m_scale = objJson.at("scale").get<Vec3>();
         }
     }
 
     void TransformComp::UpdateMatrix()
     {
-        if (!m_dirty)
+        // dirty的话TransformSystem会沿着父节点递归更新
+        GetGR()->GetTransformSystem()->GetLocalToWorld(m_handle);
+    }
+
+    uint32_t TransformComp::GetParentHandle() const
+    {
+        auto parent = GetOwner()->parent.lock();
+        if (!parent || !parent->transform)
         {
-            return;
+            return TransformSystem::INVALID_HANDLE;
         }
-        m_dirty = false;
-        
-        Matrix4x4 parentLocalToWorld;
-        if (!GetOwner()->parent.expired())
+
+        return parent->transform->m_handle;
+    }
+
+    void TransformComp::DispatchChanged()
+    {
+        ZoneScoped;
+
+        auto system = GetGR()->GetTransformSystem();
+        auto& changedHandles = system->GetChangedHandles();
+        // OnTransformChanged里还可能移动别的物体，列表会变长，不能用迭代器
+        for (size_t i = 0; i < changedHandles.size(); ++i)
         {
-            // 如果parent还是dirty的话，GetLocalToWorld会继续往上递归地UpdateMatrix
-            parentLocalToWorld = GetOwner()->parent.lock()->transform->GetLocalToWorld();
-            if (m_position.needUpdateFromWorld)
+            auto transform = system->GetComp(changedHandles[i]);
+            if (!transform)
             {
-                auto& parentWorldToLocal = GetOwner()->parent.lock()->transform->GetWorldToLocal();
-                m_position.localVal = (parentWorldToLocal * Vec4(m_position.worldVal, 1.0f)).ToVec3();
-                m_position.needUpdateFromWorld = false;
+                continue;
             }
-        }
-        else
-        {
-            parentLocalToWorld = Matrix4x4::Identity();
-            if (m_position.needUpdateFromWorld)
+
+            for (auto& comp : transform->GetOwner()->GetComps())
             {
-                m_position.localVal = m_position.worldVal;
-                m_position.needUpdateFromWorld = false;
+                if (comp->IsEnable())
+                {
+                    comp->OnTransformChanged();
+                }
             }
         }
 
-        auto objectMatrix = Matrix4x4::TRS(m_position.localVal, m_rotation.localVal, m_scale.localVal);
-
-        m_matrix.localVal = parentLocalToWorld * objectMatrix;
-        m_matrix.worldVal = m_matrix.localVal.Inverse();
-
-        m_hasOddNegativeScale = m_matrix.localVal.Determinant3() < 0;
-
-        m_position.worldVal = {
-            m_matrix.localVal[0][3],
-            m_matrix.localVal[1][3],
-            m_matrix.localVal[2][3],
-        };
+        system->ClearChanged();
     }
 
-    /// 递归地将当前物体和它的子物体都标记为dirty
+    /// 将当前物体和它的子物体都标记为dirty，子物体的处理放到TransformComp::DispatchChanged里统一做
     void TransformComp::SetDirty(const Object* object)
     {
-        if (object->transform->m_dirty)
-        {
-            return;
-        }
-        
-        object->transform->m_dirty = true;
-        object->transform->dirtyEvent.Invoke();
-    
-        if (object->GetChildren().empty())
-        {
-            return;
-        }
+        thread_local vec<const Object*> stack;
 
-        for (auto& child : object->GetChildren())
+        auto system = GetGR()->GetTransformSystem();
+        stack.push_back(object);
+        while (!stack.empty())
         {
-            if (child->transform->m_dirty)
+            auto cur = stack.back();
+            stack.pop_back();
+
+            if (!system->MarkDirty(cur->transform->m_handle))
             {
                 continue;
             }
 
-            SetDirty(child.get());
+            for (auto& child : cur->GetChildren())
+            {
+                if (child->transform)
+                {
+                    stack.push_back(child.get());
+                }
+            }
         }
     }
 }
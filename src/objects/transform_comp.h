@@ -3,14 +3,15 @@
 #include "math/math.h"
 
 #include "comp.h"
-#include "event.h"
+#include "transform_system.h"
 
 namespace op
 {
+    // 局部TRS在这里保留一份给Get用，矩阵都存在TransformSystem里，Awake之后才注册到TransformSystem
     class TransformComp final : public Comp
     {
     public:
-        Event<> dirtyEvent;
+        ~TransformComp() override;
 
         void Awake() override;
 
@@ -32,42 +33,25 @@ namespace op
         const Matrix4x4& GetLocalToWorld();
         const Matrix4x4& GetWorldToLocal();
 
+        // Object::SetParent改完父节点之后调用
+        void OnParentChanged();
+
         void LoadFromJson(const nlohmann::json& objJson) override;
 
-    private:
-        template <typename T>
-        class TransformCompProp
-        {
-        public:
-            T localVal;
-            T worldVal = T();
-            bool needUpdateFromWorld = false;
+        // TransformSystem::UpdateDirty之后调用，对这一帧变过的transform所在物体上的comp调用OnTransformChanged
+        static void DispatchChanged();
 
-            explicit TransformCompProp(T localVal) : localVal(localVal) {}
-        };
-    
-        bool m_dirty = true;
+    private:
+        uint32_t m_handle = TransformSystem::INVALID_HANDLE;
+        // SetWorldPosition之后m_position过期了，局部坐标要等TransformSystem用父节点的矩阵换算
+        bool m_positionFromWorld = false;
 
-        bool m_hasOddNegativeScale = false;
-        
-        TransformCompProp<Vec3> m_position = TransformCompProp(Vec3());
-        TransformCompProp<Quaternion> m_rotation = TransformCompProp(Quaternion());
-        TransformCompProp<Vec3> m_eulerAngles = TransformCompProp(Vec3());
-        TransformCompProp<Vec3> m_scale = TransformCompProp(Vec3(1.0f));
-        TransformCompProp<Matrix4x4> m_matrix = TransformCompProp(Matrix4x4());
+        Vec3 m_position = Vec3();
+        Quaternion m_rotation = Quaternion();
+        Vec3 m_eulerAngles = Vec3();
+        Vec3 m_scale = Vec3(1.0f);
 
-        template <typename T, typename ExtractFromMatrix>
-        T GetWorldVal(TransformCompProp<T>& prop, ExtractFromMatrix extractFromMatrix)
-        {
-            if (!prop.worldDirty)
-            {
-                return prop.worldVal;
-            }
-        
-            prop.worldVal = extractFromMatrix(GetLocalToWorld());
-            prop.worldDirty = false;
-            return prop.worldVal;
-        }
+        uint32_t GetParentHandle() const;
 
         static void SetDirty(const Object* object);
     };
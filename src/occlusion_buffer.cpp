@@ -0,0 +1,483 @@
+#include "occlusion_buffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <immintrin.h>
+#include <limits>
+#include <random>
+
+#include "math/math_utils.h"
+
+namespace op
+{
+    static constexpr uint32_t TILES_PER_ROW = OCCLUSION_BUFFER_WIDTH / OCCLUSION_TILE_WIDTH;
+
+    OcclusionBuffer::OcclusionBuffer() :
+        m_depth(OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT, 16)
+    {
+        m_depth.Resize(OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT);
+        std::fill_n(m_depth.Data(), m_depth.Size(), 0.0f);
+
+        for (uint32_t level = 0; level < OCCLUSION_HIZ_LEVEL_COUNT; ++level)
+        {
+            m_hiZ[level].assign(GetHiZWidth(level) * GetHiZHeight(level), 0.0f);
+        }
+    }
+
+    void OcclusionBuffer::Begin(cr<Matrix4x4> vpMatrix, const uint32_t triangleCount)
+    {
+        m_vpMatrix = vpMatrix;
+        m_clipVertices.resize(triangleCount * 3);
+        m_finishedTileCount.store(0, std::memory_order_relaxed);
+    }
+
+    void OcclusionBuffer::RasterizeTile(const uint32_t tile)
+    {
+        auto tileX = tile % TILES_PER_ROW;
+        auto tileY = tile / TILES_PER_ROW;
+
+        for (uint32_t y = tileY * OCCLUSION_TILE_HEIGHT; y < (tileY + 1) * OCCLUSION_TILE_HEIGHT; ++y)
+        {
+            std::fill_n(m_depth.Data() + y * OCCLUSION_BUFFER_WIDTH + tileX * OCCLUSION_TILE_WIDTH, OCCLUSION_TILE_WIDTH, 0.0f);
+        }
+
+        for (size_t i = 0; i < m_clipVertices.size(); i += 3)
+        {
+            RasterizeTriangle(m_clipVertices[i], m_clipVertices[i + 1], m_clipVertices[i + 2], tileX, tileY);
+        }
+
+        BuildHiZ(tileX, tileY);
+
+        // 其它tile的hi-z对最后一个完成的tile可见
+        if (m_finishedTileCount.fetch_add(1, std::memory_order_acq_rel) + 1 == OCCLUSION_TILE_COUNT)
+        {
+            BuildHiZMips();
+        }
+    }
+
+    void OcclusionBuffer::RasterizeTriangle(cr<Vec4> v0, cr<Vec4> v1, cr<Vec4> v2, const uint32_t tileX, const uint32_t tileY)
+    {
+        if (v0.w < NEAR_W || v1.w < NEAR_W || v2.w < NEAR_W)
+        {
+            return;
+        }
+
+        // 转到像素坐标，z存1/w
+        auto toScreen = [](cr<Vec4> v)
+        {
+            auto invW = 1.0f / v.w;
+            return Vec3(
+                (v.x * invW * 0.5f + 0.5f) * static_cast<float>(OCCLUSION_BUFFER_WIDTH),
+                (v.y * invW * 0.5f + 0.5f) * static_cast<float>(OCCLUSION_BUFFER_HEIGHT),
+                invW);
+        };
+        auto p0 = toScreen(v0);
+        auto p1 = toScreen(v1);
+        auto p2 = toScreen(v2);
+
+        auto area = (p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y);
+        if (std::abs(area) < 1e-6f)
+        {
+            return;
+        }
+
+        // 统一成逆时针，内部的点三条边函数都不小于0，不剔除背面
+        if (area < 0.0f)
+        {
+            std::swap(p1, p2);
+            area = -area;
+        }
+
+        auto tileMinX = static_cast<int32_t>(tileX * OCCLUSION_TILE_WIDTH);
+        auto tileMinY = static_cast<int32_t>(tileY * OCCLUSION_TILE_HEIGHT);
+        auto minX = std::max(static_cast<int32_t>(std::floor(std::min({ p0.x, p1.x, p2.x }))), tileMinX);
+        auto maxX = std::min(static_cast<int32_t>(std::ceil(std::max({ p0.x, p1.x, p2.x }))), tileMinX + static_cast<int32_t>(OCCLUSION_TILE_WIDTH));
+        auto minY = std::max(static_cast<int32_t>(std::floor(std::min({ p0.y, p1.y, p2.y }))), tileMinY);
+        auto maxY = std::min(static_cast<int32_t>(std::ceil(std::max({ p0.y, p1.y, p2.y }))), tileMinY + static_cast<int32_t>(OCCLUSION_TILE_HEIGHT));
+        if (minX >= maxX || minY >= maxY)
+        {
+            return;
+        }
+
+        // 边函数 E(x, y) = a * x + b * y + c，第i条边是顶点i对面的边
+        auto edge = [](cr<Vec3> from, cr<Vec3> to, float& a, float& b, float& c)
+        {
+            a = from.y - to.y;
+            b = to.x - from.x;
+            c = from.x * to.y - from.y * to.x;
+        };
+        float a0, b0, c0, a1, b1, c1, a2, b2, c2;
+        edge(p1, p2, a0, b0, c0);
+        edge(p2, p0, a1, b1, c1);
+        edge(p0, p1, a2, b2, c2);
+
+        // 用重心坐标把1/w也写成平面方程
+        auto invArea = 1.0f / area;
+        auto za = (a0 * p0.z + a1 * p1.z + a2 * p2.z) * invArea;
+        auto zb = (b0 * p0.z + b1 * p1.z + b2 * p2.z) * invArea;
+        auto zc = (c0 * p0.z + c1 * p1.z + c2 * p2.z) * invArea;
+
+        // 一次处理4个像素，tile的宽度是4的倍数，起点向下对齐不会越过tile
+        auto startX = minX & ~3;
+        auto offsetX = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        auto stepX = _mm_set1_ps(4.0f);
+        auto zero = _mm_setzero_ps();
+
+        for (auto y = minY; y < maxY; ++y)
+        {
+            auto py = _mm_set1_ps(static_cast<float>(y) + 0.5f);
+            auto px = _mm_add_ps(_mm_set1_ps(static_cast<float>(startX)), offsetX);
+            auto row = m_depth.Data() + y * OCCLUSION_BUFFER_WIDTH;
+
+            for (auto x = startX; x < maxX; x += 4)
+            {
+                auto e0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), px), _mm_mul_ps(_mm_set1_ps(b0), py)), _mm_set1_ps(c0));
+                auto e1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), px), _mm_mul_ps(_mm_set1_ps(b1), py)), _mm_set1_ps(c1));
+                auto e2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), px), _mm_mul_ps(_mm_set1_ps(b2), py)), _mm_set1_ps(c2));
+                auto inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+
+                if (_mm_movemask_ps(inside) != 0)
+                {
+                    auto z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px), _mm_mul_ps(_mm_set1_ps(zb), py)), _mm_set1_ps(zc));
+                    auto depth = _mm_load_ps(row + x);
+                    auto nearer = _mm_max_ps(depth, z);
+                    _mm_store_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, depth)));
+                }
+
+                px = _mm_add_ps(px, stepX);
+            }
+        }
+    }
+
+    void OcclusionBuffer::BuildHiZ(const uint32_t tileX, const uint32_t tileY)
+    {
+        constexpr uint32_t CELLS_X = OCCLUSION_TILE_WIDTH / OCCLUSION_HIZ_CELL_SIZE;
+        constexpr uint32_t CELLS_Y = OCCLUSION_TILE_HEIGHT / OCCLUSION_HIZ_CELL_SIZE;
+
+        for (uint32_t cy = tileY * CELLS_Y; cy < (tileY + 1) * CELLS_Y; ++cy)
+        {
+            for (uint32_t cx = tileX * CELLS_X; cx < (tileX + 1) * CELLS_X; ++cx)
+            {
+                // 取格子里最远的深度，没有遮挡物的像素是0，整个格子就挡不住任何东西
+                auto farthest = _mm_set1_ps(std::numeric_limits<float>::max());
+                for (uint32_t y = cy * OCCLUSION_HIZ_CELL_SIZE; y < (cy + 1) * OCCLUSION_HIZ_CELL_SIZE; ++y)
+                {
+                    auto row = m_depth.Data() + y * OCCLUSION_BUFFER_WIDTH + cx * OCCLUSION_HIZ_CELL_SIZE;
+                    farthest = _mm_min_ps(farthest, _mm_load_ps(row));
+                    farthest = _mm_min_ps(farthest, _mm_load_ps(row + 4));
+                }
+
+                farthest = _mm_min_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+                farthest = _mm_min_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+                m_hiZ[0][cy * OCCLUSION_HIZ_WIDTH + cx] = _mm_cvtss_f32(farthest);
+            }
+        }
+
+        for (uint32_t level = 1; level < OCCLUSION_HIZ_TILE_LEVEL_COUNT; ++level)
+        {
+            auto cellsX = CELLS_X >> level;
+            auto cellsY = CELLS_Y >> level;
+            DownsampleHiZ(level, tileX * cellsX, tileY * cellsY, (tileX + 1) * cellsX, (tileY + 1) * cellsY);
+        }
+    }
+
+    void OcclusionBuffer::BuildHiZMips()
+    {
+        for (auto level = OCCLUSION_HIZ_TILE_LEVEL_COUNT; level < OCCLUSION_HIZ_LEVEL_COUNT; ++level)
+        {
+            DownsampleHiZ(level, 0, 0, GetHiZWidth(level), GetHiZHeight(level));
+        }
+    }
+
+    void OcclusionBuffer::DownsampleHiZ(const uint32_t level, const uint32_t minX, const uint32_t minY, const uint32_t maxX, const uint32_t maxY)
+    {
+        auto& src = m_hiZ[level - 1];
+        auto& dst = m_hiZ[level];
+        auto srcWidth = GetHiZWidth(level - 1);
+        auto dstWidth = GetHiZWidth(level);
+
+        for (auto y = minY; y < maxY; ++y)
+        {
+            for (auto x = minX; x < maxX; ++x)
+            {
+                auto srcRow0 = src.data() + y * 2 * srcWidth + x * 2;
+                auto srcRow1 = srcRow0 + srcWidth;
+                dst[y * dstWidth + x] = std::min({ srcRow0[0], srcRow0[1], srcRow1[0], srcRow1[1] });
+            }
+        }
+    }
+
+    bool OcclusionBuffer::IsOccluded(
+        const float centerX, const float centerY, const float centerZ,
+        const float extentsX, const float extentsY, const float extentsZ) const
+    {
+        auto minX = std::numeric_limits<float>::max();
+        auto minY = std::numeric_limits<float>::max();
+        auto maxX = std::numeric_limits<float>::lowest();
+        auto maxY = std::numeric_limits<float>::lowest();
+        auto nearest = 0.0f;
+
+        // 包围盒投影后在8个角点的屏幕包围矩形里，最近的点也一定是某个角点
+        for (uint32_t i = 0; i < 8; ++i)
+        {
+            auto corner = Vec4(
+                centerX + (i & 1 ? extentsX : -extentsX),
+                centerY + (i & 2 ? extentsY : -extentsY),
+                centerZ + (i & 4 ? extentsZ : -extentsZ),
+                1.0f);
+            auto clip = m_vpMatrix * corner;
+            if (clip.w < NEAR_W)
+            {
+                return false;
+            }
+
+            auto invW = 1.0f / clip.w;
+            auto x = (clip.x * invW * 0.5f + 0.5f) * static_cast<float>(OCCLUSION_BUFFER_WIDTH);
+            auto y = (clip.y * invW * 0.5f + 0.5f) * static_cast<float>(OCCLUSION_BUFFER_HEIGHT);
+            minX = std::min(minX, x);
+            minY = std::min(minY, y);
+            maxX = std::max(maxX, x);
+            maxY = std::max(maxY, y);
+            nearest = std::max(nearest, invW);
+        }
+
+        if (maxX < 0.0f || maxY < 0.0f || minX >= static_cast<float>(OCCLUSION_BUFFER_WIDTH) || minY >= static_cast<float>(OCCLUSION_BUFFER_HEIGHT))
+        {
+            return false;
+        }
+
+        auto toCell = [](const float v, const uint32_t cellCount)
+        {
+            auto cell = static_cast<int32_t>(std::floor(v / static_cast<float>(OCCLUSION_HIZ_CELL_SIZE)));
+            return static_cast<uint32_t>(std::clamp(cell, 0, static_cast<int32_t>(cellCount) - 1));
+        };
+        auto cellMinX = toCell(minX, OCCLUSION_HIZ_WIDTH);
+        auto cellMaxX = toCell(maxX, OCCLUSION_HIZ_WIDTH);
+        auto cellMinY = toCell(minY, OCCLUSION_HIZ_HEIGHT);
+        auto cellMaxY = toCell(maxY, OCCLUSION_HIZ_HEIGHT);
+
+        // 上一级的格子覆盖下一级的2x2个格子，存的是其中最远的深度，用哪一级都是保守的
+        uint32_t level = 0;
+        while (level + 1 < OCCLUSION_HIZ_LEVEL_COUNT &&
+            ((cellMaxX >> level) - (cellMinX >> level) > 1 || (cellMaxY >> level) - (cellMinY >> level) > 1))
+        {
+            level++;
+        }
+
+        auto& hiZ = m_hiZ[level];
+        auto width = GetHiZWidth(level);
+        for (auto cy = cellMinY >> level; cy <= cellMaxY >> level; ++cy)
+        {
+            for (auto cx = cellMinX >> level; cx <= cellMaxX >> level; ++cx)
+            {
+                if (hiZ[cy * width + cx] <= nearest)
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    OcclusionValidation validate_occlusion_buffer()
+    {
+        OcclusionValidation result;
+
+        // 相机在原点看向-z
+        auto vpMatrix = create_projection(60.0f, static_cast<float>(OCCLUSION_BUFFER_WIDTH) / static_cast<float>(OCCLUSION_BUFFER_HEIGHT), 0.1f, 100.0f);
+
+        // 固定的遮挡物：正对相机的大矩形、斜着的近处矩形、和大矩形交叉的三角形、部分在屏幕外的三角形，
+        // 还有退化的三角形和有顶点在相机后面的三角形，这两个都不会被画上
+        vec<Vec3> triangles = {
+            { -6, -4, -20 }, { 6, -4, -20 }, { 6, 4, -20 },
+            { -6, -4, -20 }, { 6, 4, -20 }, { -6, 4, -20 },
+            { -8, -2, -8 }, { -2, -2, -12 }, { -2, 3, -12 },
+            { -8, -2, -8 }, { -2, 3, -12 }, { -8, 3, -8 },
+            { 0, -6, -10 }, { 7, 1, -30 }, { -3, 5, -25 },
+            { 10, -9, -15 }, { 30, 2, -15 }, { 8, 9, -15 },
+            { 1, 1, -5 }, { 2, 2, -5 }, { 3, 3, -5 },
+            { 2, -3, 1 }, { 4, -3, -6 }, { 3, 0, -6 },
+        };
+
+        OcclusionBuffer buffer;
+        result.triangleCount = static_cast<uint32_t>(triangles.size() / 3);
+        buffer.Begin(vpMatrix, result.triangleCount);
+        auto clipVertices = buffer.GetClipVertices();
+        for (size_t i = 0; i < triangles.size(); ++i)
+        {
+            clipVertices[i] = vpMatrix * Vec4(triangles[i], 1.0f);
+        }
+        for (uint32_t tile = 0; tile < OCCLUSION_TILE_COUNT; ++tile)
+        {
+            buffer.RasterizeTile(tile);
+        }
+
+        // 标量参考：逐个像素用double算边函数和1/w，不分tile，不做SIMD
+        constexpr uint32_t PIXEL_COUNT = OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT;
+        vec<double> referenceDepth(PIXEL_COUNT, 0.0);
+        vec<bool> ambiguous(PIXEL_COUNT, false);
+        for (size_t i = 0; i < triangles.size(); i += 3)
+        {
+            arr<Vec4, 3> clip = { clipVertices[i], clipVertices[i + 1], clipVertices[i + 2] };
+            if (clip[0].w < 1e-3f || clip[1].w < 1e-3f || clip[2].w < 1e-3f)
+            {
+                continue;
+            }
+
+            arr<arr<double, 3>, 3> p;
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                auto invW = 1.0 / clip[j].w;
+                p[j] = {
+                    (clip[j].x * invW * 0.5 + 0.5) * OCCLUSION_BUFFER_WIDTH,
+                    (clip[j].y * invW * 0.5 + 0.5) * OCCLUSION_BUFFER_HEIGHT,
+                    invW
+                };
+            }
+
+            auto area = (p[1][0] - p[0][0]) * (p[2][1] - p[0][1]) - (p[2][0] - p[0][0]) * (p[1][1] - p[0][1]);
+            if (std::abs(area) < 1e-6)
+            {
+                continue;
+            }
+
+            for (uint32_t y = 0; y < OCCLUSION_BUFFER_HEIGHT; ++y)
+            {
+                for (uint32_t x = 0; x < OCCLUSION_BUFFER_WIDTH; ++x)
+                {
+                    auto px = x + 0.5;
+                    auto py = y + 0.5;
+                    arr<double, 3> weights;
+                    auto inside = true;
+                    auto nearEdge = false;
+                    for (uint32_t j = 0; j < 3; ++j)
+                    {
+                        auto& from = p[(j + 1) % 3];
+                        auto& to = p[(j + 2) % 3];
+                        auto e = ((from[1] - to[1]) * px + (to[0] - from[0]) * py + from[0] * to[1] - from[1] * to[0]) / area;
+                        auto edgeLength = std::hypot(to[0] - from[0], to[1] - from[1]);
+                        weights[j] = e;
+                        inside &= e >= 0.0;
+                        nearEdge |= std::abs(e * area) / edgeLength < 1e-3;
+                    }
+
+                    auto index = y * OCCLUSION_BUFFER_WIDTH + x;
+                    if (nearEdge)
+                    {
+                        ambiguous[index] = true;
+                    }
+                    else if (inside)
+                    {
+                        auto depth = weights[0] * p[0][2] + weights[1] * p[1][2] + weights[2] * p[2][2];
+                        referenceDepth[index] = std::max(referenceDepth[index], depth);
+                    }
+                }
+            }
+        }
+
+        auto depth = buffer.GetDepth();
+        for (uint32_t i = 0; i < PIXEL_COUNT; ++i)
+        {
+            if (ambiguous[i])
+            {
+                result.ambiguousPixelCount++;
+                continue;
+            }
+
+            result.coveredPixelCount += referenceDepth[i] > 0.0 ? 1 : 0;
+            auto error = static_cast<float>(std::abs(depth[i] - referenceDepth[i]));
+            result.maxDepthError = std::max(result.maxDepthError, error);
+            // 1/w在0.01到0.2之间，float插值的误差远小于这个值
+            if ((referenceDepth[i] > 0.0) != (depth[i] > 0.0f) || error > 1e-5f)
+            {
+                result.depthMismatchCount++;
+            }
+        }
+
+        // 每一级的每个格子直接从深度缓冲里取覆盖范围内最远的深度
+        for (uint32_t level = 0; level < OCCLUSION_HIZ_LEVEL_COUNT; ++level)
+        {
+            auto cellSize = OCCLUSION_HIZ_CELL_SIZE << level;
+            auto hiZ = buffer.GetHiZ(level);
+            for (uint32_t cy = 0; cy < OcclusionBuffer::GetHiZHeight(level); ++cy)
+            {
+                for (uint32_t cx = 0; cx < OcclusionBuffer::GetHiZWidth(level); ++cx)
+                {
+                    auto farthest = std::numeric_limits<float>::max();
+                    for (auto y = cy * cellSize; y < (cy + 1) * cellSize; ++y)
+                    {
+                        for (auto x = cx * cellSize; x < (cx + 1) * cellSize; ++x)
+                        {
+                            farthest = std::min(farthest, depth[y * OCCLUSION_BUFFER_WIDTH + x]);
+                        }
+                    }
+
+                    if (hiZ[cy * OcclusionBuffer::GetHiZWidth(level) + cx] != farthest)
+                    {
+                        result.hiZMismatchCount++;
+                    }
+                }
+            }
+        }
+
+        // 随机包围盒：投影后屏幕矩形覆盖的每个像素都比包围盒最近的点更近时才算被挡住
+        std::mt19937 random(12345);
+        std::uniform_real_distribution xDist(-12.0f, 12.0f);
+        std::uniform_real_distribution yDist(-8.0f, 8.0f);
+        std::uniform_real_distribution zDist(-45.0f, -6.0f);
+        std::uniform_real_distribution extentsDist(0.1f, 3.0f);
+        result.boxCount = 4096;
+        for (uint32_t i = 0; i < result.boxCount; ++i)
+        {
+            Vec3 center(xDist(random), yDist(random), zDist(random));
+            Vec3 extents(extentsDist(random), extentsDist(random), extentsDist(random));
+
+            auto occluded = buffer.IsOccluded(center.x, center.y, center.z, extents.x, extents.y, extents.z);
+            result.occludedCount += occluded ? 1 : 0;
+
+            auto minX = std::numeric_limits<float>::max();
+            auto minY = std::numeric_limits<float>::max();
+            auto maxX = std::numeric_limits<float>::lowest();
+            auto maxY = std::numeric_limits<float>::lowest();
+            auto nearest = 0.0f;
+            auto behindCamera = false;
+            for (uint32_t c = 0; c < 8; ++c)
+            {
+                auto corner = Vec4(
+                    center.x + (c & 1 ? extents.x : -extents.x),
+                    center.y + (c & 2 ? extents.y : -extents.y),
+                    center.z + (c & 4 ? extents.z : -extents.z),
+                    1.0f);
+                auto clip = vpMatrix * corner;
+                behindCamera |= clip.w < 1e-3f;
+                auto invW = 1.0f / clip.w;
+                auto x = (clip.x * invW * 0.5f + 0.5f) * static_cast<float>(OCCLUSION_BUFFER_WIDTH);
+                auto y = (clip.y * invW * 0.5f + 0.5f) * static_cast<float>(OCCLUSION_BUFFER_HEIGHT);
+                minX = std::min(minX, x);
+                minY = std::min(minY, y);
+                maxX = std::max(maxX, x);
+                maxY = std::max(maxY, y);
+                nearest = std::max(nearest, invW);
+            }
+
+            auto pixelMinX = std::max(static_cast<int32_t>(std::floor(minX)), 0);
+            auto pixelMinY = std::max(static_cast<int32_t>(std::floor(minY)), 0);
+            auto pixelMaxX = std::min(static_cast<int32_t>(std::floor(maxX)), static_cast<int32_t>(OCCLUSION_BUFFER_WIDTH) - 1);
+            auto pixelMaxY = std::min(static_cast<int32_t>(std::floor(maxY)), static_cast<int32_t>(OCCLUSION_BUFFER_HEIGHT) - 1);
+            auto referenceOccluded = !behindCamera && pixelMinX <= pixelMaxX && pixelMinY <= pixelMaxY;
+            for (auto y = pixelMinY; y <= pixelMaxY && referenceOccluded; ++y)
+            {
+                for (auto x = pixelMinX; x <= pixelMaxX && referenceOccluded; ++x)
+                {
+                    referenceOccluded = depth[y * OCCLUSION_BUFFER_WIDTH + x] > nearest;
+                }
+            }
+
+            result.referenceOccludedCount += referenceOccluded ? 1 : 0;
+            result.falseOccludedCount += occluded && !referenceOccluded ? 1 : 0;
+        }
+
+        return result;
+    }
+}
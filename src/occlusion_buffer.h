@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+
+#include "const.h"
+#include "math/matrix4x4.h"
+#include "math/vec.h"
+
+namespace op
+{
+    // 软光栅遮挡剔除用的低分辨率深度缓冲，按tile并行光栅化
+    static constexpr uint32_t OCCLUSION_BUFFER_WIDTH = 256;
+    static constexpr uint32_t OCCLUSION_BUFFER_HEIGHT = 128;
+    static constexpr uint32_t OCCLUSION_TILE_WIDTH = 64;
+    static constexpr uint32_t OCCLUSION_TILE_HEIGHT = 32;
+    static constexpr uint32_t OCCLUSION_TILE_COUNT = (OCCLUSION_BUFFER_WIDTH / OCCLUSION_TILE_WIDTH) * (OCCLUSION_BUFFER_HEIGHT / OCCLUSION_TILE_HEIGHT);
+    // hi-z第0级每个格子覆盖8x8个像素，往上每级格子边长翻倍，存格子里最远的深度
+    static constexpr uint32_t OCCLUSION_HIZ_CELL_SIZE = 8;
+    static constexpr uint32_t OCCLUSION_HIZ_WIDTH = OCCLUSION_BUFFER_WIDTH / OCCLUSION_HIZ_CELL_SIZE;
+    static constexpr uint32_t OCCLUSION_HIZ_HEIGHT = OCCLUSION_BUFFER_HEIGHT / OCCLUSION_HIZ_CELL_SIZE;
+    // 最高一级是2x1
+    static constexpr uint32_t OCCLUSION_HIZ_LEVEL_COUNT = 5;
+    // 格子不超出tile的级数，光栅化完一个tile就能生成，更高的级跨tile，等所有tile光栅化完再生成
+    static constexpr uint32_t OCCLUSION_HIZ_TILE_LEVEL_COUNT = 3;
+    static_assert((OCCLUSION_HIZ_HEIGHT >> (OCCLUSION_HIZ_LEVEL_COUNT - 1)) == 1);
+    static_assert(OCCLUSION_TILE_HEIGHT % (OCCLUSION_HIZ_CELL_SIZE << (OCCLUSION_HIZ_TILE_LEVEL_COUNT - 1)) == 0);
+    static_assert(OCCLUSION_TILE_WIDTH % (OCCLUSION_HIZ_CELL_SIZE << (OCCLUSION_HIZ_TILE_LEVEL_COUNT - 1)) == 0);
+
+    // 深度存1/w，在屏幕空间可以线性插值，越大越近，0表示这个像素没有遮挡物
+    class OcclusionBuffer
+    {
+    public:
+        OcclusionBuffer();
+        ~OcclusionBuffer() = default;
+        OcclusionBuffer(const OcclusionBuffer& other) = delete;
+        OcclusionBuffer(OcclusionBuffer&& other) noexcept = delete;
+        OcclusionBuffer& operator=(const OcclusionBuffer& other) = delete;
+        OcclusionBuffer& operator=(OcclusionBuffer&& other) noexcept = delete;
+
+        // 遮挡物的三角形在裁剪空间里，每3个顶点一个三角形，光栅化前填好
+        void Begin(cr<Matrix4x4> vpMatrix, uint32_t triangleCount);
+        Vec4* GetClipVertices() { return m_clipVertices.data(); }
+        uint32_t GetTriangleCount() const { return static_cast<uint32_t>(m_clipVertices.size() / 3); }
+
+        // 不同的tile可以同时光栅化，光栅化完顺便生成这个tile的hi-z，最后一个完成的tile生成跨tile的几级
+        void RasterizeTile(uint32_t tile);
+
+        // 包围盒被完全挡住时返回true，不确定的情况都当作可见
+        // 按包围盒在屏幕上的大小选hi-z的级别，每次最多测试2x2个格子
+        bool IsOccluded(float centerX, float centerY, float centerZ, float extentsX, float extentsY, float extentsZ) const;
+
+        const float* GetDepth() const { return m_depth.Data(); }
+        const float* GetHiZ(const uint32_t level = 0) const { return m_hiZ[level].data(); }
+
+        static uint32_t GetHiZWidth(const uint32_t level) { return OCCLUSION_HIZ_WIDTH >> level; }
+        static uint32_t GetHiZHeight(const uint32_t level) { return OCCLUSION_HIZ_HEIGHT >> level; }
+
+    private:
+        // w小于这个值的顶点离相机太近或者在相机后面，不做裁剪，整个三角形跳过
+        static constexpr float NEAR_W = 1e-3f;
+
+        Matrix4x4 m_vpMatrix;
+        vec<Vec4> m_clipVertices;
+        sl<float> m_depth;
+        arr<vec<float>, OCCLUSION_HIZ_LEVEL_COUNT> m_hiZ;
+        std::atomic<uint32_t> m_finishedTileCount = 0;
+
+        void RasterizeTriangle(cr<Vec4> v0, cr<Vec4> v1, cr<Vec4> v2, uint32_t tileX, uint32_t tileY);
+        void BuildHiZ(uint32_t tileX, uint32_t tileY);
+        void BuildHiZMips();
+        // 用level - 1级生成level级[minX, maxX) x [minY, maxY)范围的格子
+        void DownsampleHiZ(uint32_t level, uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY);
+    };
+
+    struct OcclusionValidation
+    {
+        uint32_t triangleCount = 0;
+        uint32_t coveredPixelCount = 0;
+        // 像素中心离三角形的边太近，两种实现可能判断不同，不参与比较
+        uint32_t ambiguousPixelCount = 0;
+        uint32_t depthMismatchCount = 0;
+        float maxDepthError = 0;
+        // 每一级hi-z和直接从深度缓冲取最远深度的结果不同的格子数
+        uint32_t hiZMismatchCount = 0;
+        uint32_t boxCount = 0;
+        // 逐像素比较得到的被挡住的包围盒数
+        uint32_t referenceOccludedCount = 0;
+        uint32_t occludedCount = 0;
+        // IsOccluded认为被挡住，逐像素比较却有露出来的部分，必须是0
+        uint32_t falseOccludedCount = 0;
+    };
+
+    // 不需要GL，光栅化一组固定的遮挡物，和标量参考实现比较深度缓冲、hi-z和遮挡测试的结果
+    OcclusionValidation validate_occlusion_buffer();
+}
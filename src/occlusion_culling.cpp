@@ -0,0 +1,140 @@
+#include "occlusion_culling.h"
+
+#include <tracy/Tracy.hpp>
+
+#include "culling_system.h"
+#include "mesh.h"
+#include "object.h"
+#include "objects/batch_render_comp.h"
+#include "objects/transform_comp.h"
+
+namespace op
+{
+    void OcclusionCulling::AddOccluder(BatchRenderComp* comp)
+    {
+        assert(!exists(m_occluders, comp));
+
+        m_occluders.push_back(comp);
+    }
+
+    void OcclusionCulling::RemoveOccluder(BatchRenderComp* comp)
+    {
+        remove(m_occluders, comp);
+    }
+
+    sp<Job> OcclusionCulling::CreateRasterJob(cr<Matrix4x4> vpMatrix)
+    {
+        ZoneScoped;
+
+        // 变换矩阵在主线程取好，job里只读mesh
+        m_occluderInfos.clear();
+        uint32_t vertexCount = 0;
+        for (auto comp : m_occluders)
+        {
+            auto mesh = comp->GetMesh().get();
+            m_occluderInfos.push_back({
+                mesh,
+                vpMatrix * comp->GetOwner()->transform->GetLocalToWorld(),
+                vertexCount
+            });
+            vertexCount += mesh->GetIndicesCount();
+        }
+
+        m_buffer.Begin(vpMatrix, vertexCount / 3);
+
+        auto transformJob = Job::CreateParallel(static_cast<uint32_t>(m_occluderInfos.size()), [this](const uint32_t start, const uint32_t end)
+        {
+            this->TransformBatch(start, end);
+        });
+        transformJob->SetName("Occlusion Transform");
+        transformJob->SetMinBatchSize(1);
+
+        m_rasterJob = Job::CreateParallel(OCCLUSION_TILE_COUNT, [this](const uint32_t start, const uint32_t end)
+        {
+            this->RasterizeBatch(start, end);
+        });
+        m_rasterJob->SetName("Occlusion Raster");
+        m_rasterJob->SetMinBatchSize(1);
+        transformJob->AppendNext(m_rasterJob);
+
+        return transformJob;
+    }
+
+    sp<Job> OcclusionCulling::CreateTestJob(CullingBuffer* cullingBuffer, const uint32_t viewIndex)
+    {
+        assert(m_rasterJob && !m_rasterJob->IsStarted());
+
+        m_cullingBuffer = cullingBuffer;
+        m_viewIndex = viewIndex;
+        m_visibleBits.resize(cullingBuffer->GetVisibleWordCount());
+        m_occludedCount.store(0, std::memory_order_relaxed);
+
+        auto job = Job::CreateParallel(cullingBuffer->GetVisibleWordCount(), [this](const uint32_t start, const uint32_t end)
+        {
+            this->TestBatch(start, end);
+        });
+        job->SetName("Occlusion Test");
+        m_rasterJob->AppendNext(job);
+
+        return job;
+    }
+
+    void OcclusionCulling::TransformBatch(const uint32_t start, const uint32_t end)
+    {
+        ZoneScoped;
+
+        auto clipVertices = m_buffer.GetClipVertices();
+        for (auto i = start; i < end; ++i)
+        {
+            auto& info = m_occluderInfos[i];
+            auto& vertexData = info.mesh->GetVertexData();
+            auto& indexData = info.mesh->GetIndexData();
+            auto strideF = info.mesh->GetVertexDataStrideB() / sizeof(float);
+            auto positionOffsetF = info.mesh->GetVertexAttribInfo().at(VertexAttr::POSITION_OS).offsetB / sizeof(float);
+
+            for (size_t j = 0; j < indexData.size(); ++j)
+            {
+                auto position = vertexData.data() + indexData[j] * strideF + positionOffsetF;
+                clipVertices[info.firstVertex + j] = info.mvpMatrix * Vec4(position[0], position[1], position[2], 1.0f);
+            }
+        }
+    }
+
+    void OcclusionCulling::RasterizeBatch(const uint32_t start, const uint32_t end)
+    {
+        ZoneScoped;
+
+        for (auto i = start; i < end; ++i)
+        {
+            m_buffer.RasterizeTile(i);
+        }
+    }
+
+    void OcclusionCulling::TestBatch(const uint32_t start, const uint32_t end)
+    {
+        ZoneScoped;
+
+        auto view = m_cullingBuffer->GetView();
+        auto frustumBits = view.visibleBits[m_viewIndex];
+
+        uint32_t occludedCount = 0;
+        for (auto i = start; i < end; ++i)
+        {
+            auto word = frustumBits[i];
+            for_each_set_bit(word, i, [&](const uint32_t index)
+            {
+                if (m_buffer.IsOccluded(
+                    view.centerX[index], view.centerY[index], view.centerZ[index],
+                    view.extentsX[index], view.extentsY[index], view.extentsZ[index]))
+                {
+                    word &= ~bit_word_mask(index);
+                    occludedCount++;
+                }
+            });
+
+            m_visibleBits[i] = word;
+        }
+
+        m_occludedCount.fetch_add(occludedCount, std::memory_order_relaxed);
+    }
+}
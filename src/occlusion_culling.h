@@ -0,0 +1,64 @@
+#pragma once
+
+#include "occlusion_buffer.h"
+#include "job_system/job_scheduler.h"
+
+namespace op
+{
+    class BatchRenderComp;
+    class CullingBuffer;
+    class Mesh;
+
+    // 把标记为遮挡物的BatchRenderComp光栅化到OcclusionBuffer，再用hi-z剔除视锥剔除后被挡住的物体
+    // 结果单独存一份，不改CullingBuffer里的视锥剔除结果，时间一致性复用的始终是视锥剔除的结果
+    class OcclusionCulling
+    {
+    public:
+        OcclusionCulling() = default;
+        ~OcclusionCulling() = default;
+        OcclusionCulling(const OcclusionCulling& other) = delete;
+        OcclusionCulling(OcclusionCulling&& other) noexcept = delete;
+        OcclusionCulling& operator=(const OcclusionCulling& other) = delete;
+        OcclusionCulling& operator=(OcclusionCulling&& other) noexcept = delete;
+
+        void AddOccluder(BatchRenderComp* comp);
+        void RemoveOccluder(BatchRenderComp* comp);
+
+        // 返回变换遮挡物顶点的根job，需要调度，完成后接着按tile并行光栅化
+        sp<Job> CreateRasterJob(cr<Matrix4x4> vpMatrix);
+        // 在光栅化完成后执行，调用方还需要让视锥剔除的job也在它之前完成
+        sp<Job> CreateTestJob(CullingBuffer* cullingBuffer, uint32_t viewIndex);
+        // 视锥剔除和遮挡剔除合并后的结果，CreateTestJob返回的job完成后可用
+        const uint64_t* GetVisibleWords() const { return m_visibleBits.data(); }
+
+        bool IsEnabled() const { return m_enabled; }
+        void SetEnabled(const bool enable) { m_enabled = enable; }
+
+        uint32_t GetOccluderCount() const { return static_cast<uint32_t>(m_occluders.size()); }
+        uint32_t GetTriangleCount() const { return m_buffer.GetTriangleCount(); }
+        uint32_t GetOccludedCount() const { return m_occludedCount.load(std::memory_order_relaxed); }
+
+    private:
+        struct OccluderInfo
+        {
+            const Mesh* mesh;
+            Matrix4x4 mvpMatrix;
+            uint32_t firstVertex;
+        };
+
+        bool m_enabled = false;
+        OcclusionBuffer m_buffer;
+        vec<BatchRenderComp*> m_occluders;
+        vec<OccluderInfo> m_occluderInfos;
+        sp<Job> m_rasterJob = nullptr;
+
+        CullingBuffer* m_cullingBuffer = nullptr;
+        uint32_t m_viewIndex = 0;
+        vec<uint64_t> m_visibleBits;
+        std::atomic<uint32_t> m_occludedCount = 0;
+
+        void TransformBatch(uint32_t start, uint32_t end);
+        void RasterizeBatch(uint32_t start, uint32_t end);
+        void TestBatch(uint32_t start, uint32_t end);
+    };
+}
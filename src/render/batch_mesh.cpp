@@ -1,30 +1,33 @@
 #include "batch_mesh.h"
 
+#include <cstddef>
 #include <mutex>
+#include <tracy/Tracy.hpp>
 
 #include "mesh.h"
-#include "common/elem_accessor_var.h"
 #include "gl/gl_state.h"
 #include "render/gl/gl_vertex_array.h"
 #include "render/gl/gl_submit_buffer.h"
 
 namespace op
 {
-    BatchMesh::BatchMesh()
+    static constexpr uint32_t INITIAL_VERTEX_CAPACITY = 500000;
+    static constexpr uint32_t INITIAL_INDEX_CAPACITY = 100000;
+
+    BatchMesh::BatchMesh() :
+        m_vertexAllocator(INITIAL_VERTEX_CAPACITY),
+        m_indexAllocator(INITIAL_INDEX_CAPACITY)
     {
         m_vao = msp<GlVertexArray>();
         m_vbo = msp<GlSubmitBuffer>(
             static_cast<uint32_t>(GL_ARRAY_BUFFER),
             static_cast<uint32_t>(GL_STATIC_DRAW),
-            static_cast<uint32_t>(500000 * MAX_VERTEX_ATTR_STRIDE_F * sizeof(float)));
+            INITIAL_VERTEX_CAPACITY * VERTEX_STRIDE_B);
 
         m_ebo = msp<GlSubmitBuffer>(
             static_cast<uint32_t>(GL_ELEMENT_ARRAY_BUFFER),
             static_cast<uint32_t>(GL_STATIC_DRAW),
-            static_cast<uint32_t>(100000 * sizeof(uint32_t)));
-
-        m_vboAccessor = mup<ElemAccessorVar>(m_vbo);
-        m_eboAccessor = mup<ElemAccessorVar>(m_ebo);
+            INITIAL_INDEX_CAPACITY * INDEX_STRIDE_B);
 
         {
             std::lock_guard usingVao(*m_vao);
@@ -35,10 +38,16 @@ namespace op
         }
     }
 
+    BatchMesh::~BatchMesh()
+    {
+        assert(m_meshes.empty());
+    }
+
     void BatchMesh::Use()
     {
-        assert(m_delayAddMeshes.empty());
-        
+        m_vbo->Submit();
+        m_ebo->Submit();
+
         m_vao->Use();
     }
 
@@ -49,67 +58,99 @@ namespace op
 
     void BatchMesh::RegisterMesh(crsp<Mesh> mesh)
     {
-        m_delayAddMeshes.push_back(mesh);
-    }
+        ZoneScoped;
 
-    void BatchMesh::GetMeshInfo(Mesh* mesh, uint32_t& vertexOffsetB, uint32_t& vertexSizeB, uint32_t& indexOffsetB, uint32_t& indexSizeB)
-    {
-        RegisterMeshActually();
+        auto& meshInfo = m_meshes[mesh.get()];
+        if (meshInfo.refCount++ > 0)
+        {
+            return;
+        }
 
-        auto meshInfo = find_if(m_meshes, [mesh](cr<MeshInfo> x){ return x.mesh.get() == mesh;});
-        if (!meshInfo)
+        // 顶点先展开成VERTEX_ATTR_DEFINES的布局，再统一压缩
+        auto& vertexData = GetFullVertexData(mesh);
+        auto vertexCount = mesh->GetVertexCount();
+        auto lodCount = std::min(mesh->GetLodCount(), MAX_MESH_LOD_COUNT);
+
+        uint32_t indexCount = 0;
+        for (uint32_t lod = 0; lod < lodCount; ++lod)
         {
-            THROW_ERROR("Unregistered mesh!")
+            meshInfo.lodIndexStart[lod] = indexCount;
+            meshInfo.lodIndexCount[lod] = static_cast<uint32_t>(mesh->GetLodIndexData(lod).size());
+            indexCount += meshInfo.lodIndexCount[lod];
+        }
+
+        static vec<PackedVertex> packedVertices;
+        packedVertices.resize(vertexCount);
+        encode_vertices(vertexData.data(), vertexCount, VertexQuantization(mesh->GetBounds()), packedVertices.data());
+
+        meshInfo.mesh = mesh;
+        meshInfo.vertexHandle = Alloc(m_vertexAllocator, m_vbo.get(), vertexCount, VERTEX_STRIDE_B);
+        meshInfo.indexHandle = Alloc(m_indexAllocator, m_ebo.get(), indexCount, INDEX_STRIDE_B);
+
+        m_vbo->SetData(
+            m_vertexAllocator.GetOffset(meshInfo.vertexHandle) * VERTEX_STRIDE_B,
+            vertexCount * VERTEX_STRIDE_B,
+            packedVertices.data());
+        for (uint32_t lod = 0; lod < lodCount; ++lod)
+        {
+            m_ebo->SetData(
+                (m_indexAllocator.GetOffset(meshInfo.indexHandle) + meshInfo.lodIndexStart[lod]) * INDEX_STRIDE_B,
+                meshInfo.lodIndexCount[lod] * INDEX_STRIDE_B,
+                mesh->GetLodIndexData(lod).data());
         }
-        
-        m_vboAccessor->GetInfo(meshInfo->vertexBufferId, vertexOffsetB, vertexSizeB);
-        m_eboAccessor->GetInfo(meshInfo->indexBufferId, indexOffsetB, indexSizeB);
     }
 
-    void BatchMesh::RegisterMeshActually()
+    void BatchMesh::UnregisterMesh(Mesh* mesh)
     {
-        if (m_delayAddMeshes.empty())
+        auto it = m_meshes.find(mesh);
+        if (it == m_meshes.end())
         {
-            return;
+            THROW_ERROR("Unregistered mesh!")
         }
-        
-        vecwp<Mesh> needAddMeshes;
-        size_t addVertexDataSizeB = 0;
-        size_t addIndexDataSizeB = 0;
-        for (auto& meshPtr : m_delayAddMeshes)
+
+        auto& meshInfo = it->second;
+        if (--meshInfo.refCount > 0)
         {
-            if (!meshPtr.expired() &&
-                !exists_if(m_meshes, [meshPtr](cr<MeshInfo> x){ return x.mesh == meshPtr.lock();}) &&
-                !exists_if(needAddMeshes, [meshPtr](crwp<Mesh> x){ return x.lock() == meshPtr.lock();}))
-            {
-                auto mesh = meshPtr.lock().get();
-                needAddMeshes.push_back(meshPtr);
-                addVertexDataSizeB += MAX_VERTEX_ATTR_STRIDE_F * mesh->GetVertexCount() * sizeof(float);
-                addIndexDataSizeB += mesh->GetIndicesCount() * sizeof(uint32_t);
-            }
+            return;
         }
-        m_delayAddMeshes.clear();
 
-        m_vboAccessor->Reserve(m_vboAccessor->Size() + addVertexDataSizeB);
-        m_eboAccessor->Reserve(m_eboAccessor->Size() + addIndexDataSizeB);
+        // GPU上已经提交的绘制还会读旧的数据，之后复用这段空间的上传在命令流里排在它们后面，不会互相影响
+        m_vertexAllocator.Free(meshInfo.vertexHandle);
+        m_indexAllocator.Free(meshInfo.indexHandle);
+        m_meshes.erase(it);
+    }
 
-        for (const auto& meshPtr : needAddMeshes)
+    void BatchMesh::GetMeshInfo(Mesh* mesh, const uint32_t lod, uint32_t& vertexOffsetB, uint32_t& vertexSizeB, uint32_t& indexOffsetB, uint32_t& indexSizeB)
+    {
+        auto it = m_meshes.find(mesh);
+        if (it == m_meshes.end())
         {
-            auto mesh = meshPtr.lock().get();
-            auto& vertexData = mesh->GetVertexData();
-            auto& indexData = mesh->GetIndexData();
+            THROW_ERROR("Unregistered mesh!")
+        }
 
-            auto vertexBufferId = m_vboAccessor->Alloc(vertexData.size() * sizeof(float));
-            m_vboAccessor->Set(vertexBufferId, vertexData.data());
-            
-            auto indexBufferId = m_eboAccessor->Alloc(indexData.size() * sizeof(uint32_t));
-            m_eboAccessor->Set(indexBufferId, indexData.data());
+        auto& meshInfo = it->second;
+        vertexOffsetB = m_vertexAllocator.GetOffset(meshInfo.vertexHandle) * VERTEX_STRIDE_B;
+        vertexSizeB = m_vertexAllocator.GetSize(meshInfo.vertexHandle) * VERTEX_STRIDE_B;
+        indexOffsetB = (m_indexAllocator.GetOffset(meshInfo.indexHandle) + meshInfo.lodIndexStart[lod]) * INDEX_STRIDE_B;
+        indexSizeB = meshInfo.lodIndexCount[lod] * INDEX_STRIDE_B;
+    }
+
+    Matrix4x4 BatchMesh::GetDequantizeMatrix(const Mesh* mesh)
+    {
+        return VertexQuantization(mesh->GetBounds()).GetDequantizeMatrix();
+    }
 
-            m_meshes.push_back({ meshPtr.lock(), vertexBufferId, indexBufferId});
+    uint32_t BatchMesh::Alloc(TlsfAllocator& allocator, GlSubmitBuffer* buffer, const uint32_t count, const uint32_t strideB)
+    {
+        auto handle = allocator.Alloc(count);
+        while (handle == TlsfAllocator::INVALID_HANDLE)
+        {
+            allocator.Grow(allocator.GetCapacity() * 2);
+            buffer->Resize(allocator.GetCapacity() * strideB);
+            handle = allocator.Alloc(count);
         }
 
-        m_vbo->Submit();
-        m_ebo->Submit();
+        return handle;
     }
 
     crvec<float> BatchMesh::GetFullVertexData(crwp<Mesh> meshPtr)
@@ -119,8 +160,9 @@ namespace op
         auto& rawVertexData = mesh->GetVertexData();
         auto rawVertexStrideF = mesh->GetVertexDataStrideB() / sizeof(float);
         
+        // mesh没有的属性填0，编码时长度为0的法线和切线会变成(0, 0, 1)
         static std::vector<float> vertexData;
-        vertexData.resize(MAX_VERTEX_ATTR_STRIDE_F * vertexCount);
+        vertexData.assign(MAX_VERTEX_ATTR_STRIDE_F * vertexCount, 0.0f);
 
         uint32_t curOffsetF = 0;
         for (auto& attrInfo : VERTEX_ATTR_DEFINES)
@@ -149,13 +191,27 @@ namespace op
     
     void BatchMesh::ConfigVaoPointer(crsp<GlVertexArray> vao)
     {
-        for (auto& attr : VERTEX_ATTR_DEFINES)
+        // 和PackedVertex的布局一致
+        struct PackedAttr
+        {
+            VertexAttr attr;
+            uint32_t componentCount;
+            uint32_t type;
+            bool normalized;
+            uint32_t offsetB;
+        };
+        static const PackedAttr PACKED_ATTRS[] = {
+            {VertexAttr::POSITION_OS, 4, GL_UNSIGNED_SHORT, true, offsetof(PackedVertex, position)},
+            {VertexAttr::NORMAL_OS, 2, GL_SHORT, true, offsetof(PackedVertex, normal)},
+            {VertexAttr::TANGENT_OS, 2, GL_SHORT, true, offsetof(PackedVertex, tangent)},
+            {VertexAttr::UV0, 2, GL_HALF_FLOAT, false, offsetof(PackedVertex, uv0)},
+            {VertexAttr::UV1, 2, GL_HALF_FLOAT, false, offsetof(PackedVertex, uv1)},
+        };
+
+        for (auto& attr : PACKED_ATTRS)
         {
             vao->SetAttrEnable(static_cast<uint32_t>(attr.attr), true);
-            vao->SetAttr(
-                attr.attr,
-                MAX_VERTEX_ATTR_STRIDE_F * sizeof(float),
-                attr.offsetF * sizeof(float));
+            vao->SetAttr(attr.attr, attr.componentCount, attr.type, attr.normalized, VERTEX_STRIDE_B, attr.offsetB);
         }
     }
 }
@@ -3,7 +3,8 @@
 #include <memory>
 
 #include "utils.h"
-#include "common/elem_accessor_var.h"
+#include "common/tlsf_allocator.h"
+#include "render/vertex_compression.h"
 
 namespace op
 {
@@ -11,36 +12,59 @@ namespace op
     class GlVertexArray;
     class GlSubmitBuffer;
     
+    // 所有批量绘制的mesh共用一份顶点和索引，顶点压缩成PackedVertex
     class BatchMesh final
     {
     public:
         BatchMesh();
+        ~BatchMesh();
+        BatchMesh(const BatchMesh& other) = delete;
+        BatchMesh(BatchMesh&& other) noexcept = delete;
+        BatchMesh& operator=(const BatchMesh& other) = delete;
+        BatchMesh& operator=(BatchMesh&& other) noexcept = delete;
 
+        // 绘制前把新注册的mesh上传到GPU，只上传新写入的区间
         void Use();
         void StopUse();
+        // 同一个mesh可以注册多次，第一次注册时分配空间并写入CPU端的缓冲
         void RegisterMesh(crsp<Mesh> mesh);
-        void GetMeshInfo(Mesh* mesh, uint32_t& vertexOffsetB, uint32_t& vertexSizeB, uint32_t& indexOffsetB, uint32_t& indexSizeB);
+        // 和RegisterMesh成对调用，引用计数归零时释放顶点和索引占的空间，之后的注册可以复用
+        void UnregisterMesh(Mesh* mesh);
+        // 所有LOD的索引连续放在一起，indexOffsetB和indexSizeB是指定LOD的那一段
+        void GetMeshInfo(Mesh* mesh, uint32_t lod, uint32_t& vertexOffsetB, uint32_t& vertexSizeB, uint32_t& indexOffsetB, uint32_t& indexSizeB);
+
+        uint32_t GetMeshCount() const { return static_cast<uint32_t>(m_meshes.size()); }
+
+        // 顶点位置按mesh的包围盒量化，用这个mesh的实例要把它乘在localToWorld的右边
+        static Matrix4x4 GetDequantizeMatrix(const Mesh* mesh);
 
     private:
         struct MeshInfo
         {
             sp<Mesh> mesh;
-            size_t vertexBufferId;
-            size_t indexBufferId;
+            uint32_t refCount = 0;
+            uint32_t vertexHandle = TlsfAllocator::INVALID_HANDLE;
+            uint32_t indexHandle = TlsfAllocator::INVALID_HANDLE;
+            // 每个LOD的索引相对indexHandle的起始位置和数量，单位是索引
+            arr<uint32_t, MAX_MESH_LOD_COUNT> lodIndexStart = {};
+            arr<uint32_t, MAX_MESH_LOD_COUNT> lodIndexCount = {};
         };
 
+        static constexpr uint32_t VERTEX_STRIDE_B = sizeof(PackedVertex);
+        static constexpr uint32_t INDEX_STRIDE_B = sizeof(uint32_t);
+
         sp<GlVertexArray> m_vao;
         sp<GlSubmitBuffer> m_vbo;
         sp<GlSubmitBuffer> m_ebo;
 
-        up<ElemAccessorVar> m_vboAccessor;
-        up<ElemAccessorVar> m_eboAccessor;
+        // 顶点按顶点分配，索引按索引分配，偏移始终是整个顶点的倍数，可以直接当作baseVertex
+        TlsfAllocator m_vertexAllocator;
+        TlsfAllocator m_indexAllocator;
 
-        vec<MeshInfo> m_meshes;
-        vecwp<Mesh> m_delayAddMeshes;
+        umap<Mesh*, MeshInfo> m_meshes;
 
-        void RegisterMeshActually();
-        
+        // 放不下时容量翻倍，buffer变大后下一次上传会整个重新上传一次
+        static uint32_t Alloc(TlsfAllocator& allocator, GlSubmitBuffer* buffer, uint32_t count, uint32_t strideB);
         static void ConfigVaoPointer(crsp<GlVertexArray> vao);
         static crvec<float> GetFullVertexData(crwp<Mesh> meshPtr);
     };
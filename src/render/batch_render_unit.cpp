@@ -1,28 +1,41 @@
 #include "batch_render_unit.h"
 
+#include <algorithm>
+#include <random>
+#include <tuple>
 #include <tracy/Tracy.hpp>
 
 #include "batch_matrix.h"
 #include "batch_mesh.h"
+#include "gpu_culling.h"
 #include "game_resource.h"
 #include "material.h"
+#include "mesh.h"
 #include "rendering_utils.h"
 #include "shader.h"
 #include "objects/batch_render_comp.h"
+#include "render/cbuffer.h"
 #include "utils.h"
 #include "common/asset_cache.h"
 #include "gl/gl_buffer.h"
+#include "gl/gl_fence.h"
+#include "gl/gl_ring_buffer.h"
 #include "gl/gl_state.h"
 
 namespace op
 {
     class BatchRenderUnit;
+
+    // 和batch_rendering.hlsl里的register对应
+    static constexpr uint32_t MATERIAL_INDICES_SLOT = 12;
+    static constexpr uint32_t MATERIAL_PARAMS_SLOT = 13;
     
-    BatchRenderUnit::IndirectCmd BatchRenderUnit::IndirectCmd::CreateIndirectCmd(cr<BatchRenderParam> param)
+    BatchRenderUnit::IndirectCmd BatchRenderUnit::IndirectCmd::CreateIndirectCmd(BatchMesh* batchMesh, Mesh* mesh, const uint32_t lod)
     {
         uint32_t vertexOffset, vertexSize, indexOffset, indexSize;
-        param.unit->m_batchMesh->GetMeshInfo(
-            param.mesh.get(),
+        batchMesh->GetMeshInfo(
+            mesh,
+            lod,
             vertexOffset,
             vertexSize,
             indexOffset,
@@ -32,108 +45,122 @@ namespace op
         cmd.count = static_cast<uint32_t>(indexSize / sizeof(uint32_t));
         cmd.instanceCount = 0;
         cmd.firstIndex = static_cast<uint32_t>(indexOffset / sizeof(uint32_t));
-        cmd.baseVertex = static_cast<uint32_t>(vertexOffset / (MAX_VERTEX_ATTR_STRIDE_F * sizeof(float)));
+        cmd.baseVertex = static_cast<uint32_t>(vertexOffset / sizeof(PackedVertex));
         cmd.baseInstance = 0;
 
         return cmd;
     }
 
-    BatchRenderUnit::BatchRenderCompInfo* BatchRenderUnit::BatchRenderTree::AddComp(cr<BatchRenderParam> param)
+    uint32_t BatchRenderUnit::LodSelection::Select(cr<CullingView> view, const uint32_t cullingIndex, const uint32_t lodCount) const
     {
-        auto material = param.material;
-        auto mesh = param.mesh;
-        auto comp = param.comp;
-        auto hasONS = param.hasONS;
-
-        assert(material && mesh && comp);
+        // 用包围盒的半对角线当作半径，只比较平方，不需要开方和除法
+        auto ex = view.extentsX[cullingIndex];
+        auto ey = view.extentsY[cullingIndex];
+        auto ez = view.extentsZ[cullingIndex];
+        auto dx = view.centerX[cullingIndex] - cameraPosition.x;
+        auto dy = view.centerY[cullingIndex] - cameraPosition.y;
+        auto dz = view.centerZ[cullingIndex] - cameraPosition.z;
+        auto radiusSq = ex * ex + ey * ey + ez * ez;
+        auto distanceSq = dx * dx + dy * dy + dz * dz;
 
-        // find cmd
-        auto cmd = op::find_if(cmds, [material, hasONS](const BatchRenderCmd* x)
+        uint32_t lod = 0;
+        while (lod + 1 < lodCount && radiusSq < distanceScalesSq[lod] * distanceSq)
         {
-            return x->material == material && x->hasONS == hasONS;
-        });
-        if (!cmd)
-        {
-            cmds.push_back(new BatchRenderCmd{
-                material,
-                hasONS,
-            });
-            cmd = cmds.back();
+            lod++;
         }
 
-        // find subCmd
-        auto subCmd = find_if(cmd->subCmds, [mesh](const BatchRenderSubCmd* x)
-        {
-            return x->mesh == mesh.get();
-        });
-        if (!subCmd)
+        return lod;
+    }
+
+    template <typename T>
+    static void permute_column(vec<T>& column, cr<vec<uint32_t>> order)
+    {
+        vec<T> sorted;
+        sorted.reserve(column.size());
+        for (auto index : order)
         {
-            param.unit->m_batchMesh->RegisterMesh(comp->GetMesh());
-            cmd->subCmds.push_back(new BatchRenderSubCmd{
-                mesh.get(),
-                IndirectCmd::CreateIndirectCmd(param)
-            });
-            subCmd = cmd->subCmds.back();
+            sorted.push_back(column[index]);
         }
+        column.swap(sorted);
+    }
 
-        // find comp
-        assert(!exists_if(subCmd->comps, [comp](const BatchRenderCompInfo* x){ return x->comp == comp; }));
-        subCmd->comps.push_back(new BatchRenderCompInfo{
-            param.matrixIndex,
-            comp->GetCullingAccessor(GetCullingGroup(group)),
-            comp
-        });
-        cmd->compCount++;
-
-        return subCmd->comps.back();
+    void BatchRenderUnit::BatchRenderInstances::Add(cr<BatchRenderKey> key, const uint32_t cullingIndex, const uint32_t matrixIndex, BatchRenderComp* comp)
+    {
+        keys.push_back(key);
+        cullingIndices.push_back(cullingIndex);
+        matrixIndices.push_back(matrixIndex);
+        comps.push_back(comp);
     }
 
-    void BatchRenderUnit::BatchRenderTree::RemoveComp(BatchRenderComp* comp)
+    BatchRenderComp* BatchRenderUnit::BatchRenderInstances::SwapRemove(const uint32_t index)
     {
-        auto removeFromSubCmd = [comp](BatchRenderSubCmd* subCmd)
+        auto last = Size() - 1;
+        BatchRenderComp* moved = nullptr;
+        if (index != last)
         {
-            if (auto compInfo = find(subCmd->comps, &BatchRenderCompInfo::comp, comp))
-            {
-                remove(subCmd->comps, compInfo);
-                delete compInfo;
-                return true;
-            }
+            keys[index] = keys[last];
+            cullingIndices[index] = cullingIndices[last];
+            matrixIndices[index] = matrixIndices[last];
+            comps[index] = comps[last];
+            moved = comps[index];
+        }
 
-            return false;
-        };
+        keys.pop_back();
+        cullingIndices.pop_back();
+        matrixIndices.pop_back();
+        comps.pop_back();
 
-        auto removeFromCmd = [removeFromSubCmd](BatchRenderCmd* cmd)
-        {
-            if (auto subCmd = find_if(cmd->subCmds, removeFromSubCmd))
-            {
-                cmd->compCount--;
+        return moved;
+    }
 
-                if (subCmd->comps.empty())
-                {
-                    remove(cmd->subCmds, subCmd);
-                    delete subCmd;
-                }
+    void BatchRenderUnit::BatchRenderInstances::Permute(cr<vec<uint32_t>> order)
+    {
+        permute_column(keys, order);
+        permute_column(cullingIndices, order);
+        permute_column(matrixIndices, order);
+        permute_column(comps, order);
+    }
 
-                return true;
-            }
+    void BatchRenderUnit::BatchRenderTree::AddComp(cr<BatchRenderParam> param)
+    {
+        auto material = param.material;
+        auto mesh = param.mesh;
+        auto comp = param.comp;
+        auto hasONS = param.hasONS;
 
-            return false;
-        };
+        assert(material && mesh && comp);
+        assert(instanceIndices.find(comp) == instanceIndices.end());
+
+        instanceIndices[comp] = instances.Size();
+        instances.Add(
+            { material, mesh.get(), hasONS },
+            comp->GetCullingAccessor(GetCullingGroup(group))->GetIndex(),
+            param.matrixIndex,
+            comp);
+        dirty = true;
+    }
 
-        if (auto cmd = find_if(cmds, removeFromCmd))
+    void BatchRenderUnit::BatchRenderTree::RemoveComp(BatchRenderComp* comp)
+    {
+        auto it = instanceIndices.find(comp);
+        if (it == instanceIndices.end())
         {
-            if (cmd->subCmds.empty())
-            {
-                remove(cmds, cmd);
-                delete cmd;
-            }
+            return;
+        }
+
+        auto index = it->second;
+        instanceIndices.erase(it);
+        if (auto moved = instances.SwapRemove(index))
+        {
+            instanceIndices[moved] = index;
         }
+        dirty = true;
     }
 
     BatchRenderUnit::BatchRenderUnit()
     {
-        m_cmdBuffer = msp<GlBuffer>(GL_DRAW_INDIRECT_BUFFER);
-        m_matrixIndicesBuffer = msp<GlBuffer>(GL_SHADER_STORAGE_BUFFER, 5);
+        m_fence = mup<GlFence>();
+        m_matrixIndicesAlignmentB = static_cast<uint32_t>(GlState::GlGetInteger(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT));
         m_batchMesh = msp<BatchMesh>();
         m_batchMatrix = msp<BatchMatrix>(200, 6);
 
@@ -147,6 +174,9 @@ namespace op
                  {},
                  {},
             };
+            renderTree->batchMesh = m_batchMesh.get();
+            renderTree->cmdRing = mup<GlRingBuffer>(GL_DRAW_INDIRECT_BUFFER, 64 * 1024, MAX_FRAMES_IN_FLIGHT, m_fence.get());
+            renderTree->matrixIndicesRing = mup<GlRingBuffer>(GL_SHADER_STORAGE_BUFFER, 256 * 1024, MAX_FRAMES_IN_FLIGHT, m_fence.get(), 5);
             m_renderTrees.emplace_back(renderTree);
         }
 
@@ -178,8 +208,26 @@ namespace op
         GetGlobalCbuffer()->BindBase();
         GetPerViewCbuffer()->BindBase();
 
+        if (renderTree->gpuDriven)
+        {
+            ExecuteGpuCulling(renderTree);
+            renderTree->encodingJob.reset();
+            return;
+        }
+
         {
             ZoneScopedNC("Waiting For Cmd", TRACY_IDLE_COLOR);
+
+            // 编码job开始前先帮忙执行剔除之类的前置任务
+            assert(renderTree->encodingJob);
+            auto jobScheduler = GetGR()->GetJobScheduler();
+            while (jobScheduler->IsHelpWhileWaiting() && renderTree->encodedCmds.empty() && !renderTree->encodingJob->IsStarted())
+            {
+                if (!jobScheduler->TryHelp())
+                {
+                    std::this_thread::yield();
+                }
+            }
             
             std::unique_lock lock(renderTree->mtx);    
             renderTree->startExecuteCond.wait(lock, [renderTree]
@@ -188,7 +236,23 @@ namespace op
             });
         }
 
+        // 整个tree的数据在ring buffer里是连续的，绑定一次就够了
+        renderTree->cmdRing->GetGlBuffer()->Bind();
+        if (renderTree->matrixIndicesSizeB > 0)
+        {
+            renderTree->matrixIndicesRing->GetGlBuffer()->BindRange(renderTree->matrixIndicesOffsetB, renderTree->matrixIndicesSizeB);
+        }
+        if (renderTree->materialTable.instanceMaterialIndicesBuffer)
+        {
+            renderTree->materialTable.instanceMaterialIndicesBuffer->BindBase();
+        }
+
         DrawContext context;
+        // 只用来统计每个cmd单独画时的状态切换，不调用GL
+        DrawContext unmergedContext;
+        // 攒着还没画的连续cmd，下一个cmd的状态不同或者编码结束时再一起画
+        const BatchRenderCmd* firstCmd = nullptr;
+        const BatchRenderCmd* lastCmd = nullptr;
         
         while (true)
         {
@@ -201,91 +265,458 @@ namespace op
 
             if (cmd)
             {
-                CallGlCmd(cmd, context);
+                m_frameStats.cmdCount++;
+                m_frameStats.unmergedDrawCalls++;
+                m_frameStats.unmergedStateChanges += UpdateDrawContext(cmd, unmergedContext).Count();
             }
-            else
+
+            if (cmd && firstCmd && m_mergeDrawsEnabled && CanMergeDraw(firstCmd, cmd))
+            {
+                lastCmd = cmd;
+                continue;
+            }
+
+            if (firstCmd)
+            {
+                CallGlCmd(renderTree, firstCmd, lastCmd, context);
+            }
+
+            if (!cmd)
             {
                 break;
             }
+
+            firstCmd = lastCmd = cmd;
         }
 
         renderTree->encodingJob.reset();
     }
 
-    sp<Job> BatchRenderUnit::CreateEncodingJob(BatchRenderGroup group)
+    sp<Job> BatchRenderUnit::CreateEncodingJob(BatchRenderGroup group, const uint64_t* visibleWords)
     {
         auto renderTree = m_renderTrees[static_cast<uint8_t>(group)].get();
-        
-        auto job = Job::CreateCommon([this, renderTree]
+        renderTree->SyncCullingIndices();
+        renderTree->Rebuild();
+        UploadMaterialTable(renderTree);
+
+        renderTree->lodSelection.enabled = m_lodSettings.enabled;
+        renderTree->lodSelection.cameraPosition = m_lodCameraPosition;
+        for (uint32_t i = 0; i < MAX_MESH_LOD_COUNT - 1; ++i)
         {
-            renderTree->EncodeCmdsTask();
-        });
+            auto scale = m_lodSettings.screenSizes[i] / m_lodProjScale;
+            renderTree->lodSelection.distanceScalesSq[i] = scale * scale;
+        }
+
+        renderTree->gpuDriven = m_gpuCullingEnabled;
+        if (renderTree->gpuDriven)
+        {
+            // 剔除和编码都在Execute里提交给GPU，依赖编码的任务拿到的是一个空job
+            auto job = Job::CreateCommon([] {});
+            job->SetName("Encoding");
+            renderTree->encodingJob = job;
+
+            return job;
+        }
+
+        AllocCmdMemory(renderTree);
+        renderTree->ResetEncoding();
+        renderTree->visibleWordsOverride = visibleWords;
+
+        sp<Job> job;
+        if (renderTree->cmds.empty())
+        {
+            // 没有cmd也要发布结束标记，不然Execute会一直等
+            job = Job::CreateCommon([renderTree]
+            {
+                renderTree->PublishEncodedCmds();
+            });
+        }
+        else
+        {
+            // 每个cmd写自己的indirectCmds和matrixIndices，按cmd并行编码
+            job = Job::CreateParallel(static_cast<uint32_t>(renderTree->cmds.size()), [renderTree](const uint32_t start, const uint32_t end)
+            {
+                renderTree->EncodeCmdsBatch(start, end);
+            });
+            job->SetMinBatchSize(1);
+        }
+        job->SetName("Encoding");
 
         renderTree->encodingJob = job;
 
         return job;
     }
 
-    void BatchRenderUnit::BatchRenderTree::EncodeCmdsTask()
+    void BatchRenderUnit::BatchRenderTree::SyncCullingIndices()
+    {
+        auto compactVersion = GetGR()->GetCullingBuffer(GetCullingGroup(group))->GetCompactVersion();
+        if (compactVersion == cullingCompactVersion)
+        {
+            return;
+        }
+        cullingCompactVersion = compactVersion;
+
+        for (uint32_t i = 0; i < instances.Size(); ++i)
+        {
+            instances.cullingIndices[i] = instances.comps[i]->GetCullingAccessor(GetCullingGroup(group))->GetIndex();
+        }
+        dirty = true;
+    }
+
+    void BatchRenderUnit::BatchRenderTree::Rebuild()
     {
+        if (!dirty)
+        {
+            return;
+        }
+        dirty = false;
+        gpuTablesDirty = true;
+        materialTable.dirty = true;
+
         ZoneScoped;
 
-        BatchRenderCmd* dummy;
-        while (encodedCmds.pop(dummy)) {}
+        vec<uint32_t> order(instances.Size());
+        for (uint32_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [this](const uint32_t x, const uint32_t y)
+        {
+            auto& keyX = instances.keys[x];
+            auto& keyY = instances.keys[y];
+            // 状态相同的cmd排在一起，方便Execute合并
+            return std::tuple_cat(GetDrawOrderKey(keyX), std::tie(keyX.mesh, instances.cullingIndices[x])) <
+                std::tuple_cat(GetDrawOrderKey(keyY), std::tie(keyY.mesh, instances.cullingIndices[y]));
+        });
+        instances.Permute(order);
+
+        for (uint32_t i = 0; i < instances.Size(); ++i)
+        {
+            instanceIndices[instances.comps[i]] = i;
+        }
 
-        bool firstProduct = true;
+        // 有序之后相同的material和mesh都是连续的，扫一遍切出cmd和subCmd的区间，cmd的输出缓冲尽量复用
+        subCmds.clear();
+        uint32_t cmdCount = 0;
+        for (uint32_t i = 0; i < instances.Size(); ++i)
+        {
+            auto& key = instances.keys[i];
+            auto newCmd = i == 0 || key.material != instances.keys[i - 1].material || key.hasONS != instances.keys[i - 1].hasONS;
+            if (newCmd)
+            {
+                if (cmdCount == cmds.size())
+                {
+                    cmds.emplace_back();
+                }
+                auto& cmd = cmds[cmdCount++];
+                cmd.material = key.material;
+                cmd.hasONS = key.hasONS;
+                cmd.subCmdStart = static_cast<uint32_t>(subCmds.size());
+                cmd.compCount = 0;
+            }
 
-        auto pushProduct = [this, &firstProduct](BatchRenderCmd* cmd)
-        { 
-            encodedCmds.push(cmd);
-            if (firstProduct)
+            if (newCmd || key.mesh != instances.keys[i - 1].mesh)
             {
-                std::lock_guard lock(mtx);
-                startExecuteCond.notify_all();
-                firstProduct = false;
+                // mesh在BatchMesh里的位置只会在增删comp时变化，这时tree一定是dirty的
+                BatchRenderSubCmd subCmd;
+                subCmd.lodCount = std::min(key.mesh->GetLodCount(), MAX_MESH_LOD_COUNT);
+                for (uint32_t lod = 0; lod < subCmd.lodCount; ++lod)
+                {
+                    subCmd.lodCmds[lod] = IndirectCmd::CreateIndirectCmd(batchMesh, key.mesh, lod);
+                }
+                subCmd.instanceStart = i;
+                subCmd.instanceEnd = i;
+                subCmds.push_back(subCmd);
             }
-        };
 
-        for (auto cmd : cmds)
+            auto& cmd = cmds[cmdCount - 1];
+            subCmds.back().instanceEnd = i + 1;
+            cmd.subCmdEnd = static_cast<uint32_t>(subCmds.size());
+            cmd.compCount++;
+        }
+        cmds.resize(cmdCount);
+
+        // 每个subCmd的所有LOD都占一条indirect cmd，cmd之间依然连续
+        indirectCmdCount = 0;
+        for (auto& cmd : cmds)
         {
-            ZoneScopedN("Encode Cmd");
-            
-            cmd->indirectCmds.Clear();
-            cmd->indirectCmds.Reserve(cmd->subCmds.size());
-            cmd->matrixIndices.Clear();
-            cmd->matrixIndices.Reserve(cmd->compCount);
+            cmd.indirectCmdStart = indirectCmdCount;
+            for (auto s = cmd.subCmdStart; s < cmd.subCmdEnd; ++s)
+            {
+                subCmds[s].indirectCmdStart = indirectCmdCount;
+                indirectCmdCount += subCmds[s].lodCount;
+            }
+            cmd.indirectCmdEnd = indirectCmdCount;
+        }
+
+        if (cmdEncoded.size() != cmds.size())
+        {
+            cmdEncoded = vec<std::atomic_bool>(cmds.size());
+        }
+    }
+
+    void BatchRenderUnit::BatchRenderTree::ResetEncoding()
+    {
+        BatchRenderCmd* dummy;
+        while (encodedCmds.pop(dummy)) {}
+
+        for (auto& encoded : cmdEncoded)
+        {
+            encoded.store(false, std::memory_order_relaxed);
+        }
+        publishCursor = 0;
+        firstProduct = true;
+    }
+
+    void BatchRenderUnit::BatchRenderTree::EncodeCmdsBatch(const uint32_t start, const uint32_t end)
+    {
+        ZoneScoped;
+
+        auto cullingGroup = GetCullingGroup(group);
+        auto cullingBuffer = GetGR()->GetCullingBuffer(cullingGroup);
+        auto visibleWords = visibleWordsOverride ?
+            visibleWordsOverride :
+            cullingBuffer->GetVisibleWords(get_culling_view_index(cullingGroup));
+        auto view = cullingBuffer->GetView();
+
+        for (auto i = start; i < end; ++i)
+        {
+            EncodeCmd(cmds[i], visibleWords, view);
+            cmdEncoded[i].store(true, std::memory_order_release);
+        }
+
+        PublishEncodedCmds();
+    }
+
+    void BatchRenderUnit::BatchRenderTree::EncodeCmd(BatchRenderCmd& cmd, const uint64_t* visibleWords, cr<CullingView> view)
+    {
+        ZoneScopedN("Encode Cmd");
+        
+        cmd.visibleCount = 0;
 
-            auto baseInstanceCount = 0;
-            for (auto& subCmd : cmd->subCmds)
+        auto cullingIndices = instances.cullingIndices.data();
+        auto matrixIndices = instances.matrixIndices.data();
+
+        // 有多个LOD时可见的实例先按LOD分开放，subCmd结束后再依次写进cmd的matrixIndices
+        thread_local arr<vec<uint32_t>, MAX_MESH_LOD_COUNT> lodMatrixIndices;
+
+        auto baseInstanceCount = 0;
+        for (auto s = cmd.subCmdStart; s < cmd.subCmdEnd; ++s)
+        {
+            auto& subCmd = subCmds[s];
+            auto selectLod = lodSelection.enabled && subCmd.lodCount > 1;
+            if (selectLod)
             {
-                auto instanceCount = 0;
-                for (auto& compInfo : subCmd->comps)
+                for (uint32_t lod = 0; lod < subCmd.lodCount; ++lod)
                 {
-                    if (compInfo->cullingAccessor->GetVisible())
+                    lodMatrixIndices[lod].clear();
+                }
+            }
+
+            auto instanceCount = 0;
+            for (auto i = subCmd.instanceStart; i < subCmd.instanceEnd;)
+            {
+                auto wordIndex = bit_word_index(cullingIndices[i]);
+                auto word = visibleWords[wordIndex];
+
+                // 区间内按cullingIndex有序，word为0时二分跳到下一个word的第一个comp
+                if (word == 0)
+                {
+                    auto nextWordStart = (wordIndex + 1) * BIT_WORD_SIZE;
+                    i = static_cast<uint32_t>(std::lower_bound(cullingIndices + i, cullingIndices + subCmd.instanceEnd, nextWordStart) - cullingIndices);
+                    continue;
+                }
+
+                for (; i < subCmd.instanceEnd && bit_word_index(cullingIndices[i]) == wordIndex; ++i)
+                {
+                    if (!(word & bit_word_mask(cullingIndices[i])))
                     {
-                        cmd->matrixIndices.Add<false>(compInfo->matrixIndex);
+                        continue;
+                    }
+
+                    if (selectLod)
+                    {
+                        auto lod = lodSelection.Select(view, cullingIndices[i], subCmd.lodCount);
+                        lodMatrixIndices[lod].push_back(matrixIndices[i]);
+                    }
+                    else
+                    {
+                        cmd.matrixIndices[cmd.visibleCount++] = matrixIndices[i];
                         instanceCount++;
                     }
                 }
+            }
 
-                subCmd->indirectCmd.instanceCount = instanceCount;
-                subCmd->indirectCmd.baseInstance = baseInstanceCount;
+            auto indirectCmds = cmd.indirectCmds + (subCmd.indirectCmdStart - cmd.indirectCmdStart);
+            if (!selectLod)
+            {
+                auto indirectCmd = subCmd.lodCmds[0];
+                indirectCmd.instanceCount = instanceCount;
+                indirectCmd.baseInstance = cmd.matrixIndexStart + baseInstanceCount;
+                indirectCmds[0] = indirectCmd;
+                // 关掉LOD时其余的LOD也要写成空的，ring buffer里是上一次使用留下的数据
+                for (uint32_t lod = 1; lod < subCmd.lodCount; ++lod)
+                {
+                    indirectCmds[lod] = subCmd.lodCmds[lod];
+                    indirectCmds[lod].instanceCount = 0;
+                    indirectCmds[lod].baseInstance = 0;
+                }
 
                 baseInstanceCount += instanceCount;
+                continue;
+            }
+
+            for (uint32_t lod = 0; lod < subCmd.lodCount; ++lod)
+            {
+                auto& lodIndices = lodMatrixIndices[lod];
+                std::copy(lodIndices.begin(), lodIndices.end(), cmd.matrixIndices + cmd.visibleCount);
+                cmd.visibleCount += static_cast<uint32_t>(lodIndices.size());
+
+                auto indirectCmd = subCmd.lodCmds[lod];
+                indirectCmd.instanceCount = static_cast<uint32_t>(lodIndices.size());
+                indirectCmd.baseInstance = cmd.matrixIndexStart + baseInstanceCount;
+                indirectCmds[lod] = indirectCmd;
+
+                baseInstanceCount += indirectCmd.instanceCount;
+            }
+        }
+    }
+
+    void BatchRenderUnit::BatchRenderTree::PublishEncodedCmds()
+    {
+        // 哪个线程编码完都来推进一次游标，前面的cmd没编码完就先停下，由编码它的线程继续推进
+        std::lock_guard lock(publishMtx);
+
+        if (publishCursor > cmds.size())
+        {
+            return;
+        }
+
+        while (publishCursor < cmds.size() && cmdEncoded[publishCursor].load(std::memory_order_acquire))
+        {
+            auto cmd = &cmds[publishCursor++];
+            if (cmd->visibleCount != 0)
+            {
+                PushProduct(cmd);
+            }
+        }
+
+        if (publishCursor == cmds.size())
+        {
+            PushProduct(nullptr);
+            publishCursor++;
+        }
+    }
+
+    void BatchRenderUnit::BatchRenderTree::PushProduct(BatchRenderCmd* cmd)
+    {
+        encodedCmds.push(cmd);
+        if (firstProduct)
+        {
+            std::lock_guard lock(mtx);
+            startExecuteCond.notify_all();
+            firstProduct = false;
+        }
+    }
 
-                if (instanceCount != 0)
+    void BatchRenderUnit::BatchRenderTree::UploadGpuCullingTables()
+    {
+        ZoneScoped;
+
+        gpuTablesDirty = false;
+
+        // 和CPU编码的布局相同，实例按cmd和subCmd连续，subCmd的实例区间直接当作输出区间
+        vec<GpuCullingRecord> records(instances.Size());
+        vec<GpuCullingSubCmd> gpuSubCmds(subCmds.size());
+        for (uint32_t c = 0; c < cmds.size(); ++c)
+        {
+            auto& cmd = cmds[c];
+            for (auto s = cmd.subCmdStart; s < cmd.subCmdEnd; ++s)
+            {
+                auto& subCmd = subCmds[s];
+                // GPU剔除只画LOD0
+                gpuSubCmds[s] = {
+                    subCmd.lodCmds[0].count,
+                    subCmd.lodCmds[0].firstIndex,
+                    subCmd.lodCmds[0].baseVertex,
+                    subCmd.instanceStart,
+                    c,
+                    cmd.subCmdStart,
+                    0,
+                    0
+                };
+
+                for (auto i = subCmd.instanceStart; i < subCmd.instanceEnd; ++i)
                 {
-                    cmd->indirectCmds.Add<false>(subCmd->indirectCmd);
+                    records[i] = { instances.cullingIndices[i], instances.matrixIndices[i], s, 0 };
                 }
             }
+        }
+
+        gpuCulling->UploadTables(std::move(records), std::move(gpuSubCmds), static_cast<uint32_t>(cmds.size()));
+    }
+
+    void BatchRenderUnit::MaterialTable::Build(vec<BatchRenderCmd>& cmds, const uint32_t alignmentB)
+    {
+        ZoneScoped;
+
+        entries.clear();
+        params.clear();
+        instanceMaterialIndices.clear();
+
+        // cmds按shader有序，每个shader的材质占连续的一段，起点按SSBO的对齐要求排开，段内按材质第一次出现的顺序编号
+        umap<Material*, uint32_t> materialIndices;
+        Shader* shader = nullptr;
+        uint32_t rangeStartB = 0;
+        for (auto& cmd : cmds)
+        {
+            auto cmdShader = cmd.material->GetShader().get();
+            if (cmdShader != shader)
+            {
+                shader = cmdShader;
+                materialIndices.clear();
+                rangeStartB = align_up(static_cast<uint32_t>(params.size()), alignmentB);
+            }
+
+            cmd.materialParamsOffsetB = rangeStartB;
+            cmd.materialIndex = 0;
 
-            if (!cmd->indirectCmds.Empty())
+            if (auto layout = shader->batchMaterialParams.get())
             {
-                pushProduct(cmd);
+                auto [it, added] = materialIndices.try_emplace(cmd.material, static_cast<uint32_t>(materialIndices.size()));
+                cmd.materialIndex = it->second;
+
+                if (added)
+                {
+                    auto offsetB = rangeStartB + cmd.materialIndex * layout->sizeB;
+                    params.resize(offsetB + layout->sizeB);
+                    cmd.material->WriteParams(*layout, params.data() + offsetB);
+                    entries.push_back({ cmd.material, layout, offsetB, cmd.material->GetParamVersion() });
+                }
             }
+
+            // 实例和matrixIndices一样按cmd连续排列
+            instanceMaterialIndices.insert(instanceMaterialIndices.end(), cmd.compCount, cmd.materialIndex);
         }
+    }
 
-        pushProduct(nullptr);
+    bool BatchRenderUnit::MaterialTable::SyncParams()
+    {
+        auto changed = false;
+        for (auto& entry : entries)
+        {
+            auto version = entry.material->GetParamVersion();
+            if (version == entry.version)
+            {
+                continue;
+            }
+
+            entry.version = version;
+            entry.material->WriteParams(*entry.layout, params.data() + entry.offsetB);
+            changed = true;
+        }
+
+        return changed;
     }
 
     void BatchRenderUnit::BindComp(BatchRenderComp* comp)
@@ -296,6 +727,7 @@ namespace op
         }
         auto matrixIndex = m_batchMatrix->Register();
         m_comps[comp] = matrixIndex;
+        m_batchMesh->RegisterMesh(comp->GetMesh());
 
         auto commonRenderTree = m_renderTrees[static_cast<uint8_t>(BatchRenderGroup::COMMON)].get();
         commonRenderTree->AddComp({
@@ -325,6 +757,7 @@ namespace op
             return;
         }
         m_comps.erase(comp);
+        m_batchMesh->UnregisterMesh(comp->GetMesh().get());
 
         auto commonRenderTree = m_renderTrees[static_cast<uint8_t>(BatchRenderGroup::COMMON)].get();
         commonRenderTree->RemoveComp(comp);
@@ -333,36 +766,401 @@ namespace op
         shadowRenderTree->RemoveComp(comp);
     }
 
-    void BatchRenderUnit::CallGlCmd(const BatchRenderCmd* cmd, DrawContext& context)
+    void BatchRenderUnit::EndFrame()
+    {
+        // 所有tree共用一个fence，GPU执行到这里时这一帧所有的cmd都读完了
+        auto fence = m_fence->Insert();
+        for (auto& renderTree : m_renderTrees)
+        {
+            renderTree->cmdRing->EndFrame(fence);
+            renderTree->matrixIndicesRing->EndFrame(fence);
+            if (renderTree->gpuCulling)
+            {
+                renderTree->gpuCulling->EndFrame(fence);
+            }
+        }
+        m_gpuCullingValidationRequested = false;
+
+        m_lastFrameStats = m_frameStats;
+        m_frameStats = {};
+    }
+
+    void BatchRenderUnit::SetLodCamera(cr<Vec3> position, const float projScale)
+    {
+        m_lodCameraPosition = position;
+        m_lodProjScale = projScale;
+    }
+
+    void BatchRenderUnit::RequestGpuCullingValidation()
+    {
+        m_gpuCullingValidationRequested = true;
+        m_gpuCullingValidation = {};
+    }
+
+    BatchRenderUnit::MergeDrawsValidation BatchRenderUnit::ValidateMergeDraws(const uint32_t materialCount, crsp<Shader> batchShader)
     {
         ZoneScoped;
 
-        auto shaderChanged = context.shader != cmd->material->GetShader().get();
-        auto materialChanged = context.material != cmd->material;
-        auto onsChanged = cmd->hasONS != context.hasONS;
-        auto textureSetHashChanged = cmd->material->GetTextureSet()->GetHash() != context.textureSetHash;
+        MergeDrawsValidation result;
+        result.materialCount = materialCount;
+        auto check = [&result](const bool condition, const char* name)
+        {
+            result.checkCount++;
+            if (!condition)
+            {
+                if (result.failedCount == 0)
+                {
+                    result.firstFailure = name;
+                }
+                result.failedCount++;
+            }
+        };
 
-        context.shader = cmd->material->GetShader().get();
-        context.material = cmd->material;
-        context.hasONS = cmd->hasONS;
-        context.textureSetHash = cmd->material->GetTextureSet()->GetHash();
+        // batchShader的参数表是从shaders.pack里反射出来的，另外两个shader一个有布局不同的参数表，一个没有材质参数
+        auto batchLayout = batchShader ? batchShader->batchMaterialParams.get() : nullptr;
+        check(batchLayout && batchLayout->params.contains(ALBEDO.Hash()), "batch shader has a material param table");
+        auto createLayout = [](const std::initializer_list<std::pair<StringHandle, uint32_t>> params, const uint32_t sizeB)
+        {
+            auto layout = msp<CBufferLayout>();
+            layout->name = BATCH_MATERIAL_PARAMS;
+            layout->sizeB = sizeB;
+            for (const auto& [name, offsetB] : params)
+            {
+                layout->params[name.Hash()] = { name, static_cast<uint32_t>(sizeof(Vec4)), offsetB, layout->name.Hash() };
+            }
+            return layout;
+        };
+        arr<sp<Shader>, 3> shaders = { batchShader ? batchShader : msp<Shader>(), msp<Shader>(), msp<Shader>() };
+        shaders[1]->batchMaterialParams = createLayout({ { ALBEDO_1, 0 }, { ALBEDO, 32 } }, 48);
+
+        // 渲染状态只取少数几种，同一个shader下有很多材质只有参数不同
+        std::mt19937 rng(17);
+        vec<sp<Material>> materials;
+        for (uint32_t i = 0; i < materialCount; ++i)
+        {
+            auto material = msp<Material>();
+            material->BindShader(shaders[rng() % shaders.size()]);
+            material->cullMode = rng() % 2 ? CullMode::BACK : CullMode::FRONT;
+            material->blendMode = rng() % 4 ? BlendMode::NONE : BlendMode::BLEND;
+            if (rng() % 3 == 0)
+            {
+                material->SetTexture(MAIN_TEX, nullptr);
+            }
+            material->Set(ALBEDO, Vec4(static_cast<float>(i), 0.25f, 0.5f, 1.0f));
+            material->Set(ALBEDO_1, Vec4(-static_cast<float>(i), 1.0f, 2.0f, 4.0f));
+            materials.push_back(material);
+        }
+
+        // 和Rebuild一样，每个(material, hasONS)一个cmd，按GetDrawOrderKey排序
+        vec<BatchRenderKey> keys;
+        for (auto& material : materials)
+        {
+            for (auto hasONS : { false, true })
+            {
+                if (rng() % 2)
+                {
+                    keys.push_back({ material.get(), nullptr, hasONS });
+                }
+            }
+        }
+        std::sort(keys.begin(), keys.end(), [](cr<BatchRenderKey> x, cr<BatchRenderKey> y)
+        {
+            return GetDrawOrderKey(x) < GetDrawOrderKey(y);
+        });
+
+        vec<BatchRenderCmd> cmds(keys.size());
+        uint32_t instanceCount = 0;
+        for (uint32_t i = 0; i < cmds.size(); ++i)
+        {
+            cmds[i].material = keys[i].material;
+            cmds[i].hasONS = keys[i].hasONS;
+            cmds[i].compCount = 1 + rng() % 4;
+            instanceCount += cmds[i].compCount;
+        }
+        result.cmdCount = static_cast<uint32_t>(cmds.size());
+
+        // 参考实现：合成的材质都没有cbuffer，shader、ONS、渲染状态和纹理都相同的cmd就应该画在一起
+        auto sameState = [](cr<BatchRenderCmd> x, cr<BatchRenderCmd> y)
+        {
+            auto materialX = x.material;
+            auto materialY = y.material;
+            return materialX->GetShader() == materialY->GetShader() &&
+                x.hasONS == y.hasONS &&
+                materialX->cullMode == materialY->cullMode &&
+                materialX->blendMode == materialY->blendMode &&
+                materialX->depthMode == materialY->depthMode &&
+                materialX->depthWrite == materialY->depthWrite &&
+                materialX->GetTextureSet()->GetHash() == materialY->GetTextureSet()->GetHash();
+        };
+        for (uint32_t i = 0; i < cmds.size(); ++i)
+        {
+            if (i == 0 || !sameState(cmds[i - 1], cmds[i]))
+            {
+                result.expectedDrawCalls++;
+            }
+        }
+
+        // 和Execute相同的合并方式，同时统计每个cmd单独画的数量
+        DrawContext mergedContext;
+        DrawContext unmergedContext;
+        vec<uint32_t> runFirsts;
+        uint32_t first = 0;
+        for (uint32_t i = 0; i <= cmds.size(); ++i)
+        {
+            if (i < cmds.size())
+            {
+                result.unmergedDrawCalls++;
+                result.unmergedStateChanges += UpdateDrawContext(&cmds[i], unmergedContext).Count();
+
+                if (i > first && CanMergeDraw(&cmds[first], &cmds[i]))
+                {
+                    continue;
+                }
+            }
+
+            if (i > first)
+            {
+                result.mergedDrawCalls++;
+                result.mergedStateChanges += UpdateDrawContext(&cmds[first], mergedContext).Count();
+
+                auto crossMaterial = false;
+                for (auto c = first + 1; c < i; ++c)
+                {
+                    check(sameState(cmds[first], cmds[c]), "merged cmds share shader and render state");
+                    crossMaterial |= cmds[c].material != cmds[first].material;
+                }
+                check(i == cmds.size() || !sameState(cmds[i - 1], cmds[i]), "merge stops only at a state change");
+                result.crossMaterialDrawCalls += crossMaterial;
+                result.batchShaderCrossMaterialDrawCalls += crossMaterial && cmds[first].material->GetShader() == shaders[0];
+
+                // 排序把状态相同的cmd都排在了一起，每种状态只画一次
+                auto drawnBefore = std::any_of(runFirsts.begin(), runFirsts.end(), [&](const uint32_t runFirst)
+                {
+                    return sameState(cmds[runFirst], cmds[first]);
+                });
+                check(!drawnBefore, "each render state is drawn once");
+                runFirsts.push_back(first);
+            }
+
+            first = i;
+        }
+
+        check(result.mergedDrawCalls == result.expectedDrawCalls, "merged draw calls equal state runs");
+        check(result.mergedDrawCalls <= result.unmergedDrawCalls, "merging never adds draw calls");
+        check(result.mergedStateChanges <= result.unmergedStateChanges, "merging never adds state changes");
+        if (materialCount > shaders.size() * 8)
+        {
+            check(result.mergedDrawCalls < result.unmergedDrawCalls, "merging reduces draw calls");
+            check(result.crossMaterialDrawCalls > 0, "materials differing only in params merge");
+            check(result.batchShaderCrossMaterialDrawCalls > 0, "batch shader materials differing only in params merge");
+        }
 
-        if (shaderChanged)
+        // 参数表：每个实例通过材质下标读到的是自己材质的参数
+        constexpr uint32_t ALIGNMENT_B = 256;
+        MaterialTable table;
+        table.Build(cmds, ALIGNMENT_B);
+        check(table.instanceMaterialIndices.size() == instanceCount, "one material index per instance");
+
+        umap<uint32_t, Material*> slotOwners;
+        uint32_t instanceStart = 0;
+        for (auto& cmd : cmds)
+        {
+            for (auto i = instanceStart; i < instanceStart + cmd.compCount && i < table.instanceMaterialIndices.size(); ++i)
+            {
+                check(table.instanceMaterialIndices[i] == cmd.materialIndex, "instance material index matches its cmd");
+            }
+            instanceStart += cmd.compCount;
+
+            auto layout = cmd.material->GetShader()->batchMaterialParams.get();
+            if (!layout)
+            {
+                continue;
+            }
+
+            auto offsetB = cmd.materialParamsOffsetB + cmd.materialIndex * layout->sizeB;
+            check(cmd.materialParamsOffsetB % ALIGNMENT_B == 0, "shader range is aligned");
+            check(slotOwners.try_emplace(offsetB, cmd.material).first->second == cmd.material, "each table slot belongs to one material");
+            if (offsetB + layout->sizeB > table.params.size())
+            {
+                check(false, "material params inside the table");
+                continue;
+            }
+
+            for (const auto& [nameId, param] : layout->params)
+            {
+                auto expected = cmd.material->Get<Vec4>(nameId);
+                check(memcmp(table.params.data() + offsetB + param.offsetB, &expected, sizeof(Vec4)) == 0, "instance reads its own material params");
+            }
+        }
+
+        // 运行时改参数后同步到表里，没改时不用重新上传
+        check(!table.SyncParams(), "unchanged params need no sync");
+        if (!table.entries.empty())
+        {
+            auto& entry = table.entries.front();
+            auto albedo = Vec4(100.0f, 200.0f, 300.0f, 400.0f);
+            entry.material->Set(ALBEDO, albedo);
+            check(table.SyncParams(), "changed params are synced");
+            check(memcmp(table.params.data() + entry.offsetB + entry.layout->params.at(ALBEDO.Hash()).offsetB, &albedo, sizeof(Vec4)) == 0, "synced params are written");
+            check(!table.SyncParams(), "params are synced once");
+        }
+
+        return result;
+    }
+
+    void BatchRenderUnit::AllocCmdMemory(BatchRenderTree* renderTree)
+    {
+        ZoneScoped;
+
+        // 整个tree的matrixIndices绑定成一个SSBO，每个cmd按compCount预留连续的一段
+        auto indirectCmdsSizeB = renderTree->indirectCmdCount * static_cast<uint32_t>(sizeof(IndirectCmd));
+        renderTree->matrixIndicesSizeB = renderTree->instances.Size() * static_cast<uint32_t>(sizeof(uint32_t));
+        renderTree->indirectCmdsOffsetB = renderTree->cmdRing->Alloc(indirectCmdsSizeB, sizeof(uint32_t));
+        renderTree->matrixIndicesOffsetB = renderTree->matrixIndicesRing->Alloc(renderTree->matrixIndicesSizeB, m_matrixIndicesAlignmentB);
+
+        auto indirectCmds = reinterpret_cast<IndirectCmd*>(renderTree->cmdRing->GetData() + renderTree->indirectCmdsOffsetB);
+        auto matrixIndices = reinterpret_cast<uint32_t*>(renderTree->matrixIndicesRing->GetData() + renderTree->matrixIndicesOffsetB);
+        uint32_t matrixIndexStart = 0;
+        for (auto& cmd : renderTree->cmds)
+        {
+            cmd.indirectCmds = indirectCmds + cmd.indirectCmdStart;
+            cmd.matrixIndices = matrixIndices + matrixIndexStart;
+            cmd.matrixIndexStart = matrixIndexStart;
+            matrixIndexStart += cmd.compCount;
+        }
+    }
+
+    void BatchRenderUnit::UploadMaterialTable(BatchRenderTree* renderTree)
+    {
+        ZoneScoped;
+
+        auto& materialTable = renderTree->materialTable;
+        auto rebuilt = materialTable.dirty;
+        if (rebuilt)
+        {
+            materialTable.Build(renderTree->cmds, m_matrixIndicesAlignmentB);
+            materialTable.dirty = false;
+        }
+
+        // 没有shader用参数表时不需要绑定，shader只会读用到参数表的实例
+        if (materialTable.params.empty())
+        {
+            return;
+        }
+
+        if (!materialTable.paramsBuffer)
+        {
+            materialTable.paramsBuffer = msp<GlBuffer>(GL_SHADER_STORAGE_BUFFER, MATERIAL_PARAMS_SLOT);
+            materialTable.instanceMaterialIndicesBuffer = msp<GlBuffer>(GL_SHADER_STORAGE_BUFFER, MATERIAL_INDICES_SLOT);
+            rebuilt = true;
+        }
+
+        if (rebuilt)
+        {
+            materialTable.paramsBuffer->SetData(
+                GL_DYNAMIC_DRAW,
+                static_cast<uint32_t>(materialTable.params.size()),
+                materialTable.params.data());
+            materialTable.instanceMaterialIndicesBuffer->SetData(
+                GL_STATIC_DRAW,
+                static_cast<uint32_t>(materialTable.instanceMaterialIndices.size() * sizeof(uint32_t)),
+                materialTable.instanceMaterialIndices.data());
+            return;
+        }
+
+        // 参数是运行时改的，只是少数材质，整张表一起更新
+        if (materialTable.SyncParams())
+        {
+            materialTable.paramsBuffer->SetSubData(0, static_cast<uint32_t>(materialTable.params.size()), materialTable.params.data());
+        }
+    }
+
+    void BatchRenderUnit::ExecuteGpuCulling(BatchRenderTree* renderTree)
+    {
+        ZoneScoped;
+
+        if (!renderTree->gpuCulling)
+        {
+            renderTree->gpuCulling = mup<GpuCulling>(m_fence.get(), MAX_FRAMES_IN_FLIGHT);
+            renderTree->gpuTablesDirty = true;
+        }
+
+        if (renderTree->gpuTablesDirty)
+        {
+            renderTree->UploadGpuCullingTables();
+        }
+
+        auto cullingGroup = GetCullingGroup(renderTree->group);
+        auto cullingBuffer = GetGR()->GetCullingBuffer(cullingGroup);
+        auto& planes = cullingBuffer->GetPlanes(get_culling_view_index(cullingGroup));
+        auto view = cullingBuffer->GetView();
+        renderTree->gpuCulling->Dispatch(planes, view, cullingBuffer->GetVisibleWordCount() * CULLING_BLOCK_SIZE);
+
+        if (m_gpuCullingValidationRequested)
+        {
+            m_gpuCullingValidation.treeCount++;
+            m_gpuCullingValidation.cmdCount += static_cast<uint32_t>(renderTree->cmds.size());
+            m_gpuCullingValidation.mismatchCount += renderTree->gpuCulling->Validate(planes, view);
+        }
+
+        renderTree->gpuCulling->BindDrawBuffers();
+        if (renderTree->materialTable.instanceMaterialIndicesBuffer)
+        {
+            renderTree->materialTable.instanceMaterialIndicesBuffer->BindBase();
+        }
+
+        // 每个cmd可见的subCmd压缩到了自己区间的前面，画几个由GPU写的绘制数决定，CPU不知道哪些cmd是空的，也就不合并
+        DrawContext context;
+        for (uint32_t i = 0; i < renderTree->cmds.size(); ++i)
+        {
+            auto& cmd = renderTree->cmds[i];
+            auto stateChangeCount = ApplyCmdState(renderTree, &cmd, context).Count();
+            m_frameStats.stateChanges += stateChangeCount;
+            m_frameStats.unmergedStateChanges += stateChangeCount;
+
+            auto indirectCmdsOffsetB = cmd.subCmdStart * static_cast<uint32_t>(sizeof(IndirectCmd));
+            GlState::GlMultiDrawElementsIndirectCount(
+                GL_TRIANGLES,
+                GL_UNSIGNED_INT,
+                reinterpret_cast<const void*>(static_cast<uintptr_t>(indirectCmdsOffsetB)),
+                i * static_cast<uint32_t>(sizeof(uint32_t)),
+                cmd.subCmdEnd - cmd.subCmdStart,
+                0);
+            m_frameStats.cmdCount++;
+            m_frameStats.drawCalls++;
+            m_frameStats.unmergedDrawCalls++;
+        }
+    }
+
+    BatchRenderUnit::StateChanges BatchRenderUnit::ApplyCmdState(const BatchRenderTree* renderTree, const BatchRenderCmd* cmd, DrawContext& context)
+    {
+        auto changes = UpdateDrawContext(cmd, context);
+
+        if (changes.shader)
         {
             context.shader->Use();
+
+            // 参数表按shader分段，换shader时绑定这个shader的那一段
+            auto& materialTable = renderTree->materialTable;
+            if (context.shader->batchMaterialParams && materialTable.paramsBuffer)
+            {
+                materialTable.paramsBuffer->BindRange(
+                    cmd->materialParamsOffsetB,
+                    static_cast<uint32_t>(materialTable.params.size()) - cmd->materialParamsOffsetB);
+            }
         }
 
-        if (shaderChanged || textureSetHashChanged)
+        if (changes.textures)
         {
-            cmd->material->GetTextureSet()->ApplyTextures(context.shader);
+            context.material->GetTextureSet()->ApplyTextures(context.shader);
         }
 
-        if (materialChanged || onsChanged)
+        if (changes.cullMode)
         {
             GlState::Ins()->SetCullMode(context.material->cullMode, context.hasONS);
         }
 
-        if (materialChanged)
+        if (changes.material)
         {
             context.material->UseCBuffer();
             
@@ -370,24 +1168,81 @@ namespace op
             GlState::Ins()->SetDepthMode(context.material->depthMode, context.material->depthWrite);
         }
 
+        return changes;
+    }
+
+    void BatchRenderUnit::CallGlCmd(const BatchRenderTree* renderTree, const BatchRenderCmd* firstCmd, const BatchRenderCmd* lastCmd, DrawContext& context)
+    {
+        ZoneScoped;
+
+        // 合并的cmd状态都相同，用第一个cmd的材质设置状态，各自的材质参数由实例的材质下标从参数表里读
+        m_frameStats.stateChanges += ApplyCmdState(renderTree, firstCmd, context).Count();
+
+        // 中间被跳过的空cmd的indirect cmd实例数都是0，一起画也没有影响
+        auto indirectCmdsOffsetB = renderTree->indirectCmdsOffsetB + firstCmd->indirectCmdStart * static_cast<uint32_t>(sizeof(IndirectCmd));
+        GlState::GlMultiDrawElementsIndirect(
+            GL_TRIANGLES,
+            GL_UNSIGNED_INT,
+            reinterpret_cast<const void*>(static_cast<uintptr_t>(indirectCmdsOffsetB)),
+            lastCmd->indirectCmdEnd - firstCmd->indirectCmdStart,
+            0);
+        m_frameStats.drawCalls++;
+    }
+
+    BatchRenderUnit::StateChanges BatchRenderUnit::UpdateDrawContext(const BatchRenderCmd* cmd, DrawContext& context)
+    {
+        auto material = cmd->material;
+        auto shader = material->GetShader().get();
+        auto textureSetHash = material->GetTextureSet()->GetHash();
+
+        StateChanges changes;
+        changes.shader = context.shader != shader;
+        changes.textures = changes.shader || context.textureSetHash != textureSetHash;
+        changes.cullMode = context.material != material || context.hasONS != cmd->hasONS;
+        changes.material = context.material != material;
+
+        context.shader = shader;
+        context.material = material;
+        context.hasONS = cmd->hasONS;
+        context.textureSetHash = textureSetHash;
+
+        return changes;
+    }
+
+    bool BatchRenderUnit::CanMergeDraw(const BatchRenderCmd* x, const BatchRenderCmd* y)
+    {
+        if (x->material == y->material)
         {
-            ZoneScopedN("Submit GL Draw Data");
-            
-            m_cmdBuffer->Bind();
-            m_cmdBuffer->SetData(
-                GL_STREAM_DRAW,
-                sizeof(IndirectCmd) * cmd->indirectCmds.Size(),
-                cmd->indirectCmds.Data());
-
-            m_matrixIndicesBuffer->Bind();
-            m_matrixIndicesBuffer->SetData(
-                GL_STREAM_DRAW,
-                sizeof(uint32_t) * cmd->matrixIndices.Size(),
-                cmd->matrixIndices.Data());
-            m_matrixIndicesBuffer->BindBase();
+            return x->hasONS == y->hasONS;
         }
-        
-        GlState::GlMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(cmd->indirectCmds.Size()), 0);
+
+        // 参数在参数表里的材质按实例读自己的参数，可以和别的材质合并，参数在cbuffer里的只能和自己合并
+        auto materialX = x->material;
+        auto materialY = y->material;
+        return !materialX->HasCBuffer() &&
+            !materialY->HasCBuffer() &&
+            materialX->GetShader() == materialY->GetShader() &&
+            x->hasONS == y->hasONS &&
+            materialX->cullMode == materialY->cullMode &&
+            materialX->blendMode == materialY->blendMode &&
+            materialX->depthMode == materialY->depthMode &&
+            materialX->depthWrite == materialY->depthWrite &&
+            materialX->GetTextureSet()->GetHash() == materialY->GetTextureSet()->GetHash();
+    }
+
+    BatchRenderUnit::DrawOrderKey BatchRenderUnit::GetDrawOrderKey(cr<BatchRenderKey> key)
+    {
+        auto material = key.material;
+        return {
+            material->GetShader().get(),
+            key.hasONS,
+            material->GetTextureSet()->GetHash(),
+            material->cullMode,
+            material->blendMode,
+            material->depthMode,
+            material->depthWrite,
+            material
+        };
     }
 
     CullingGroup BatchRenderUnit::GetCullingGroup(const BatchRenderGroup group)
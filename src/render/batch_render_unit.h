@@ -1,7 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
+#include <string>
+#include <tuple>
 
 #include <boost/lockfree/queue.hpp>
 
@@ -16,9 +19,17 @@ namespace op
 {
     class Shader;
     class BatchMesh;
+    class GlBuffer;
     class Mesh;
     class Material;
     class BatchRenderComp;
+    class GlFence;
+    class GlRingBuffer;
+    class GpuCulling;
+    struct CBufferLayout;
+    enum class BlendMode : uint8_t;
+    enum class CullMode : uint8_t;
+    enum class DepthMode : uint8_t;
 
     enum class BatchRenderGroup : uint8_t
     {
@@ -34,7 +45,8 @@ namespace op
     {
         struct BatchRenderParam;
         struct IndirectCmd;
-        struct BatchRenderCompInfo;
+        struct BatchRenderKey;
+        struct BatchRenderInstances;
         struct BatchRenderSubCmd;
         struct BatchRenderCmd;
         struct BatchRenderTree;
@@ -51,7 +63,75 @@ namespace op
         void UnBindComp(BatchRenderComp* comp);
         void UpdateMatrix(BatchRenderComp* comp, cr<BatchMatrix::Elem> matrices);
         void Execute(BatchRenderGroup group);
-        sp<Job> CreateEncodingJob(BatchRenderGroup group);
+        // 一帧的绘制都提交之后调用，给这一帧用到的ring buffer空间插入fence
+        void EndFrame();
+
+        struct DrawStats
+        {
+            uint32_t cmdCount = 0;
+            uint32_t drawCalls = 0;
+            uint32_t stateChanges = 0;
+            // 同样的cmd每个单独画时的数量，不管是否开启合并都会统计，用来和实际的数量比较
+            uint32_t unmergedDrawCalls = 0;
+            uint32_t unmergedStateChanges = 0;
+        };
+
+        cr<DrawStats> GetLastFrameStats() const { return m_lastFrameStats; }
+        // 开启后状态完全相同的相邻cmd合并成一次MultiDrawIndirect
+        bool IsMergeDrawsEnabled() const { return m_mergeDrawsEnabled; }
+        void SetMergeDrawsEnabled(const bool enable) { m_mergeDrawsEnabled = enable; }
+        // 开启后剔除和编码都改成在Execute里用compute shader做，只有视锥剔除，visibleWords会被忽略
+        bool IsGpuCullingEnabled() const { return m_gpuCullingEnabled; }
+        void SetGpuCullingEnabled(const bool enable) { m_gpuCullingEnabled = enable; }
+
+        struct GpuCullingValidation
+        {
+            uint32_t treeCount = 0;
+            uint32_t cmdCount = 0;
+            uint32_t mismatchCount = 0;
+        };
+
+        // 之后的一帧里每个用GPU剔除的tree都读回结果，和CPU参考实现比较
+        void RequestGpuCullingValidation();
+        cr<GpuCullingValidation> GetGpuCullingValidation() const { return m_gpuCullingValidation; }
+
+        struct MergeDrawsValidation
+        {
+            uint32_t materialCount = 0;
+            uint32_t cmdCount = 0;
+            uint32_t expectedDrawCalls = 0;
+            uint32_t mergedDrawCalls = 0;
+            uint32_t unmergedDrawCalls = 0;
+            uint32_t mergedStateChanges = 0;
+            uint32_t unmergedStateChanges = 0;
+            // 合并的绘制里包含了不止一个材质的次数
+            uint32_t crossMaterialDrawCalls = 0;
+            // 其中用batchShader的次数
+            uint32_t batchShaderCrossMaterialDrawCalls = 0;
+            uint32_t checkCount = 0;
+            uint32_t failedCount = 0;
+            std::string firstFailure;
+        };
+
+        // 用合成的材质和cmd走一遍Execute的合并逻辑，和逐个绘制的绘制数、状态切换数比较
+        // batchShader是合批材质实际用的shader，一部分材质用它，检查它从shaders.pack里反射出了参数表
+        // 同时检查材质参数表里每个实例都能读到自己材质的参数，不需要GL
+        static MergeDrawsValidation ValidateMergeDraws(uint32_t materialCount, crsp<Shader> batchShader);
+
+        struct LodSettings
+        {
+            bool enabled = true;
+            // 包围盒半径和相机距离投影到屏幕上，占半个屏幕高度的比例小于screenSizes[i]时至少用LOD i+1，必须递减
+            arr<float, MAX_MESH_LOD_COUNT - 1> screenSizes = { 0.25f, 0.1f, 0.04f };
+        };
+
+        cr<LodSettings> GetLodSettings() const { return m_lodSettings; }
+        void SetLodSettings(cr<LodSettings> settings) { m_lodSettings = settings; }
+        // 每帧在CreateEncodingJob之前设置，projScale是投影矩阵的[1][1]，阴影也按主相机选LOD，和看到的形状一致
+        void SetLodCamera(cr<Vec3> position, float projScale);
+
+        // visibleWords为空时使用CullingBuffer里视锥剔除的结果，不为空时必须在job完成前保持有效
+        sp<Job> CreateEncodingJob(BatchRenderGroup group, const uint64_t* visibleWords = nullptr);
 
     private:
 
@@ -63,7 +143,18 @@ namespace op
             uint32_t baseVertex;
             uint32_t baseInstance;
             
-            static IndirectCmd CreateIndirectCmd(cr<BatchRenderParam> param);
+            static IndirectCmd CreateIndirectCmd(BatchMesh* batchMesh, Mesh* mesh, uint32_t lod);
+        };
+
+        // CreateEncodingJob时从LodSettings和相机算好，编码过程中不会变
+        struct LodSelection
+        {
+            bool enabled = false;
+            Vec3 cameraPosition = {};
+            // (screenSizes[i] / projScale)²，包围盒半径的平方小于它乘距离的平方时至少用LOD i+1
+            arr<float, MAX_MESH_LOD_COUNT - 1> distanceScalesSq = {};
+
+            uint32_t Select(cr<CullingView> view, uint32_t cullingIndex, uint32_t lodCount) const;
         };
 
         struct BatchRenderParam
@@ -76,20 +167,39 @@ namespace op
             uint32_t matrixIndex = ~0u;
         };
             
-        struct BatchRenderCompInfo
+        struct BatchRenderKey
+        {
+            Material* material = nullptr;
+            Mesh* mesh = nullptr;
+            bool hasONS = true;
+        };
+
+        // 每个comp一条记录，按列连续存放，重排后按(material, hasONS, mesh, cullingIndex)有序
+        struct BatchRenderInstances
         {
-            uint32_t matrixIndex;
-            CullingBuffer::Accessor* cullingAccessor;
-            BatchRenderComp* comp;
+            vec<BatchRenderKey> keys;
+            vec<uint32_t> cullingIndices;
+            vec<uint32_t> matrixIndices;
+            vec<BatchRenderComp*> comps;
+
+            uint32_t Size() const { return static_cast<uint32_t>(comps.size()); }
+            void Add(cr<BatchRenderKey> key, uint32_t cullingIndex, uint32_t matrixIndex, BatchRenderComp* comp);
+            // 把最后一条记录挪到index，返回被挪动的comp，index本来就是最后一条时返回nullptr
+            BatchRenderComp* SwapRemove(uint32_t index);
+            void Permute(cr<vec<uint32_t>> order);
         };
         
         struct BatchRenderSubCmd
         {
-            Mesh* mesh = nullptr;
-            
-            IndirectCmd indirectCmd = {};
+            // 每个LOD一条indirect cmd，lodCmds[0]是原始的mesh
+            arr<IndirectCmd, MAX_MESH_LOD_COUNT> lodCmds = {};
+            uint32_t lodCount = 1;
+            // 在整个tree的indirect cmd里的起点，连续占lodCount条
+            uint32_t indirectCmdStart = 0;
             
-            vec<BatchRenderCompInfo*> comps = {};
+            // instances里[instanceStart, instanceEnd)是这个mesh的comp
+            uint32_t instanceStart = 0;
+            uint32_t instanceEnd = 0;
         };
 
         struct BatchRenderCmd
@@ -97,25 +207,98 @@ namespace op
             Material* material = nullptr;
             bool hasONS = true;
             
+            // subCmds里[subCmdStart, subCmdEnd)属于这个cmd
+            uint32_t subCmdStart = 0;
+            uint32_t subCmdEnd = 0;
             uint32_t compCount = 0;
-            SimpleList<IndirectCmd> indirectCmds = {};
-            SimpleList<uint32_t> matrixIndices = {};
-            
-            vec<BatchRenderSubCmd*> subCmds = {};
+            // 编码直接写进持久映射的ring buffer，空间在CreateEncodingJob时按最大数量分好，Execute只需要偏移
+            // 每个subCmd固定占lodCount条indirect cmd，没有可见实例时instanceCount为0，相邻cmd的indirect cmd连续，可以合并成一次绘制
+            IndirectCmd* indirectCmds = nullptr;
+            uint32_t indirectCmdStart = 0;
+            uint32_t indirectCmdEnd = 0;
+            uint32_t* matrixIndices = nullptr;
+            // 这个cmd的matrixIndices在整个tree里的起点，baseInstance从这里开始算
+            uint32_t matrixIndexStart = 0;
+            uint32_t visibleCount = 0;
+            // 材质在参数表里属于自己shader的那一段的起点和段内的下标，shader没有参数表时不用
+            uint32_t materialParamsOffsetB = 0;
+            uint32_t materialIndex = 0;
+        };
+
+        // shader有_BatchMaterialParams时，材质参数按材质写进这张表，实例通过_BatchMaterialIndices找到自己的材质
+        // 这样只有参数不同的材质也能合并成一次绘制
+        struct MaterialTable
+        {
+            struct Entry
+            {
+                Material* material = nullptr;
+                const CBufferLayout* layout = nullptr;
+                uint32_t offsetB = 0;
+                uint32_t version = 0;
+            };
+
+            vec<Entry> entries;
+            vec<uint8_t> params;
+            // 每个实例一个，和_BatchObjectIndices用同一个下标，GPU剔除时也一样
+            vec<uint32_t> instanceMaterialIndices;
+            sp<GlBuffer> paramsBuffer;
+            sp<GlBuffer> instanceMaterialIndicesBuffer;
+            // cmds重建后要重新生成整张表
+            bool dirty = true;
+
+            void Build(vec<BatchRenderCmd>& cmds, uint32_t alignmentB);
+            // 把参数变了的材质重新写进表里，返回是否有变化
+            bool SyncParams();
         };
 
         struct BatchRenderTree
         {
             BatchRenderGroup group;
-            vec<BatchRenderCmd*> cmds;
+            vec<BatchRenderCmd> cmds;
             sp<Job> encodingJob;
             lock_free_queue<BatchRenderCmd*> encodedCmds;
             std::mutex mtx;
             std::condition_variable startExecuteCond;
+            // CullingBuffer压缩后instances里缓存的cullingIndex需要重新读取
+            uint32_t cullingCompactVersion = 0;
+            const uint64_t* visibleWordsOverride = nullptr;
+            // 按cmds的顺序发布编码完的cmd，保证Execute的材质顺序不受并行影响
+            std::mutex publishMtx;
+            uint32_t publishCursor = 0;
+            bool firstProduct = true;
+            // 编码job里每个cmd只会被一个线程编码，写完后置位
+            vec<std::atomic_bool> cmdEncoded;
 
-            BatchRenderCompInfo* AddComp(cr<BatchRenderParam> param);
+            // 增删只改instances，编码前发现dirty再统一排序并重建cmds和subCmds
+            BatchRenderInstances instances;
+            umap<BatchRenderComp*, uint32_t> instanceIndices;
+            vec<BatchRenderSubCmd> subCmds;
+            uint32_t indirectCmdCount = 0;
+            BatchMesh* batchMesh = nullptr;
+            LodSelection lodSelection;
+            bool dirty = false;
+            // 每个tree一帧只分配一次，ring buffer扩容时不会影响别的tree已经分好的空间
+            up<GlRingBuffer> cmdRing;
+            up<GlRingBuffer> matrixIndicesRing;
+            uint32_t indirectCmdsOffsetB = 0;
+            uint32_t matrixIndicesOffsetB = 0;
+            uint32_t matrixIndicesSizeB = 0;
+            // CreateEncodingJob时决定这一帧是否用GPU剔除，中途切换不影响已经创建的job
+            bool gpuDriven = false;
+            bool gpuTablesDirty = true;
+            up<GpuCulling> gpuCulling;
+            MaterialTable materialTable;
+
+            void AddComp(cr<BatchRenderParam> param);
             void RemoveComp(BatchRenderComp* comp);
-            void EncodeCmdsTask();
+            void SyncCullingIndices();
+            void Rebuild();
+            void ResetEncoding();
+            void EncodeCmdsBatch(uint32_t start, uint32_t end);
+            void EncodeCmd(BatchRenderCmd& cmd, const uint64_t* visibleWords, cr<CullingView> view);
+            void PublishEncodedCmds();
+            void PushProduct(BatchRenderCmd* cmd);
+            void UploadGpuCullingTables();
         };
 
         struct DrawContext
@@ -127,8 +310,32 @@ namespace op
             size_t textureSetHash = 0;
         };
 
-        sp<GlBuffer> m_cmdBuffer = nullptr;
-        sp<GlBuffer> m_matrixIndicesBuffer = nullptr;
+        // 切换到一个cmd时要改的状态，每一项算一次状态切换
+        struct StateChanges
+        {
+            bool shader = false;
+            bool textures = false;
+            bool cullMode = false;
+            bool material = false;
+
+            uint32_t Count() const { return shader + textures + cullMode + material; }
+        };
+
+        // GPU最多落后CPU这么多帧，ring buffer按这个数量留空间
+        static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+
+        up<GlFence> m_fence = nullptr;
+        uint32_t m_matrixIndicesAlignmentB = 0;
+
+        bool m_mergeDrawsEnabled = true;
+        bool m_gpuCullingEnabled = false;
+        bool m_gpuCullingValidationRequested = false;
+        LodSettings m_lodSettings;
+        Vec3 m_lodCameraPosition = {};
+        float m_lodProjScale = 1.0f;
+        GpuCullingValidation m_gpuCullingValidation;
+        DrawStats m_frameStats;
+        DrawStats m_lastFrameStats;
         sp<BatchMesh> m_batchMesh = nullptr;
         sp<BatchMatrix> m_batchMatrix = nullptr;
         umap<BatchRenderComp*, uint32_t> m_comps;
@@ -137,7 +344,18 @@ namespace op
         
         vecup<BatchRenderTree> m_renderTrees;
 
-        void CallGlCmd(const BatchRenderCmd* cmd, DrawContext& context);
+        void AllocCmdMemory(BatchRenderTree* renderTree);
+        void UploadMaterialTable(BatchRenderTree* renderTree);
+        void ExecuteGpuCulling(BatchRenderTree* renderTree);
+        StateChanges ApplyCmdState(const BatchRenderTree* renderTree, const BatchRenderCmd* cmd, DrawContext& context);
+        void CallGlCmd(const BatchRenderTree* renderTree, const BatchRenderCmd* firstCmd, const BatchRenderCmd* lastCmd, DrawContext& context);
+        
+        // 只更新context，返回需要切换的状态，不调用GL
+        static StateChanges UpdateDrawContext(const BatchRenderCmd* cmd, DrawContext& context);
+        static bool CanMergeDraw(const BatchRenderCmd* x, const BatchRenderCmd* y);
+        // Rebuild按这个顺序排列实例，CanMergeDraw比较的状态都在材质前面，能合并的cmd一定相邻
+        using DrawOrderKey = std::tuple<Shader*, bool, size_t, CullMode, BlendMode, DepthMode, bool, Material*>;
+        static DrawOrderKey GetDrawOrderKey(cr<BatchRenderKey> key);
         
         static CullingGroup GetCullingGroup(BatchRenderGroup group);
         
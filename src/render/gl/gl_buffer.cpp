@@ -28,7 +28,7 @@ namespace op
 
     void GlBuffer::SetData(const uint32_t usage, const uint32_t sizeB, const void* data)
     {
-        assert(!m_mapping);
+        assert(!m_mapping && !m_immutable);
 
         GlState::Ins()->BindBuffer(shared_from_this());
         GlState::GlBufferData(m_type, sizeB, data, usage);
@@ -64,6 +64,53 @@ namespace op
         GlState::GlUnmapBuffer(m_type);
     }
 
+    void GlBuffer::SetStorage(const uint32_t sizeB, const uint32_t flags)
+    {
+        assert(!m_mapping && !m_immutable);
+
+        GlState::Ins()->BindBuffer(shared_from_this());
+        GlState::GlBufferStorage(m_type, sizeB, nullptr, flags);
+
+        m_sizeB = sizeB;
+        m_immutable = true;
+    }
+
+    void* GlBuffer::MapPersistent(const uint32_t access)
+    {
+        assert(m_immutable && (access & GL_MAP_PERSISTENT_BIT));
+
+        if (!m_persistentData)
+        {
+            GlState::Ins()->BindBuffer(shared_from_this());
+            m_persistentData = GlState::GlMapBufferRange(m_type, 0, m_sizeB, access);
+        }
+
+        return m_persistentData;
+    }
+
+    void GlBuffer::BindRange(const uint32_t offsetB, const uint32_t sizeB)
+    {
+        assert(!m_mapping);
+        assert(m_slot != ~0u && offsetB + sizeB <= m_sizeB);
+
+        GlState::Ins()->BindBufferRange(shared_from_this(), m_slot, offsetB, sizeB);
+    }
+
+    void GlBuffer::BindAs(const uint32_t type)
+    {
+        assert(!m_mapping);
+
+        GlState::Ins()->BindBuffer(shared_from_this(), type);
+    }
+
+    void GlBuffer::GetSubData(const uint32_t offsetB, const uint32_t sizeB, void* data)
+    {
+        assert(!m_mapping && offsetB + sizeB <= m_sizeB);
+
+        GlState::Ins()->BindBuffer(shared_from_this());
+        GlState::GlGetBufferSubData(m_type, offsetB, sizeB, data);
+    }
+
     void GlBuffer::Bind()
     {
         assert(!m_mapping);
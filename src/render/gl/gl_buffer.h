@@ -27,6 +27,15 @@ namespace op
         void SetSubData(uint32_t offsetB, uint32_t sizeB, const void* data);
         void* MapBuffer(uint32_t access);
         void UnMapBuffer();
+        // 不可变存储，之后不能再SetData
+        void SetStorage(uint32_t sizeB, uint32_t flags);
+        // 持久映射，返回的指针在buffer删除前一直有效，期间可以正常绑定和绘制
+        void* MapPersistent(uint32_t access);
+        void BindRange(uint32_t offsetB, uint32_t sizeB);
+        // 绑定到创建时以外的target，compute写完的SSBO可以直接当indirect buffer或者parameter buffer用
+        void BindAs(uint32_t type);
+        // 读回GPU上的数据，会等GPU写完，只用来调试和校验
+        void GetSubData(uint32_t offsetB, uint32_t sizeB, void* data);
 
     private:
         uint32_t m_id = 0;
@@ -35,5 +44,7 @@ namespace op
         uint32_t m_sizeB = 0;
         uint32_t m_usage = 0;
         bool m_mapping = false;
+        bool m_immutable = false;
+        void* m_persistentData = nullptr;
     };
 }
@@ -0,0 +1,38 @@
+#include "gl_fence.h"
+
+#include <tracy/Tracy.hpp>
+
+#include "gl_state.h"
+
+namespace op
+{
+    GlFence::~GlFence()
+    {
+        for (auto& syncInfo : m_syncs)
+        {
+            GlState::GlDeleteSync(syncInfo.sync);
+        }
+    }
+
+    uint64_t GlFence::Insert()
+    {
+        m_syncs.push_back({ ++m_nextFence, GlState::GlFenceSync() });
+
+        return m_nextFence;
+    }
+
+    void GlFence::Wait(const uint64_t fence)
+    {
+        ZoneScoped;
+
+        // 已经等过的fence不在队列里了，直接返回
+        while (!m_syncs.empty() && m_syncs.front().fence <= fence)
+        {
+            auto sync = m_syncs.front().sync;
+            while (!GlState::GlClientWaitSync(sync, 1000000)) {}
+
+            GlState::GlDeleteSync(sync);
+            m_syncs.pop_front();
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <deque>
+
+#include "common/i_gpu_fence.h"
+
+namespace op
+{
+    class GlFence final : public IGpuFence
+    {
+    public:
+        GlFence() = default;
+        ~GlFence() override;
+        GlFence(const GlFence& other) = delete;
+        GlFence(GlFence&& other) noexcept = delete;
+        GlFence& operator=(const GlFence& other) = delete;
+        GlFence& operator=(GlFence&& other) noexcept = delete;
+
+        uint64_t Insert() override;
+        void Wait(uint64_t fence) override;
+
+    private:
+        struct SyncInfo
+        {
+            uint64_t fence;
+            void* sync;
+        };
+
+        uint64_t m_nextFence = 0;
+        std::deque<SyncInfo> m_syncs;
+    };
+}
@@ -0,0 +1,63 @@
+#include "gl_ring_buffer.h"
+
+#include <glad/glad.h>
+
+#include "gl_buffer.h"
+#include "utils.h"
+
+namespace op
+{
+    static uint32_t align_ring_size(const uint32_t sizeB, const uint32_t alignmentB)
+    {
+        return align_up(std::max(sizeB, alignmentB), alignmentB);
+    }
+
+    GlRingBuffer::GlRingBuffer(const uint32_t type, const uint32_t sizeB, const uint32_t maxFramesInFlight, IGpuFence* fence, const uint32_t slot) :
+        m_type(type),
+        m_slot(slot),
+        m_allocator(align_ring_size(sizeB, MAX_ALIGNMENT), maxFramesInFlight, fence)
+    {
+        CreateBuffer(m_allocator.GetCapacity());
+    }
+
+    uint32_t GlRingBuffer::Alloc(const uint32_t sizeB, const uint32_t alignmentB)
+    {
+        assert(alignmentB <= MAX_ALIGNMENT);
+
+        uint32_t offsetB;
+        if (m_allocator.Alloc(sizeB, alignmentB, offsetB))
+        {
+            return offsetB;
+        }
+
+        // 等完所有帧还放不下，GPU已经不再读旧buffer，直接换一个大的，保证之后每帧都有自己的一份空间
+        m_allocator.WaitAll();
+        auto capacityB = m_allocator.GetCapacity();
+        while (capacityB < static_cast<uint64_t>(sizeB) * m_allocator.GetMaxFramesInFlight())
+        {
+            capacityB *= 2;
+        }
+        capacityB = align_ring_size(capacityB, MAX_ALIGNMENT);
+        m_allocator.Reset(capacityB);
+        CreateBuffer(capacityB);
+
+        auto success = m_allocator.Alloc(sizeB, alignmentB, offsetB);
+        assert(success);
+
+        return offsetB;
+    }
+
+    void GlRingBuffer::EndFrame(const uint64_t fence)
+    {
+        m_allocator.EndFrame(fence);
+    }
+
+    void GlRingBuffer::CreateBuffer(const uint32_t sizeB)
+    {
+        constexpr uint32_t FLAGS = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        m_glBuffer = msp<GlBuffer>(m_type, m_slot);
+        m_glBuffer->SetStorage(sizeB, FLAGS);
+        m_data = static_cast<uint8_t*>(m_glBuffer->MapPersistent(FLAGS));
+    }
+}
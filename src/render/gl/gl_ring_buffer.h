@@ -0,0 +1,43 @@
+#pragma once
+
+#include "const.h"
+#include "common/ring_allocator.h"
+
+namespace op
+{
+    class GlBuffer;
+    class IGpuFence;
+
+    // 持久映射的环形buffer，CPU直接往映射的内存里写，GPU读完之前由fence保证不会被覆盖
+    class GlRingBuffer
+    {
+    public:
+        GlRingBuffer(uint32_t type, uint32_t sizeB, uint32_t maxFramesInFlight, IGpuFence* fence, uint32_t slot = ~0u);
+        ~GlRingBuffer() = default;
+        GlRingBuffer(const GlRingBuffer& other) = delete;
+        GlRingBuffer(GlRingBuffer&& other) noexcept = delete;
+        GlRingBuffer& operator=(const GlRingBuffer& other) = delete;
+        GlRingBuffer& operator=(GlRingBuffer&& other) noexcept = delete;
+
+        // 放不下时等GPU用完所有帧再换一个更大的buffer，所以一帧里只能分配一次，之前拿到的指针会失效
+        uint32_t Alloc(uint32_t sizeB, uint32_t alignmentB);
+        uint8_t* GetData() const { return m_data; }
+        void EndFrame(uint64_t fence);
+
+        crsp<GlBuffer> GetGlBuffer() const { return m_glBuffer; }
+        uint32_t GetCapacity() const { return m_allocator.GetCapacity(); }
+        uint64_t GetWaitCount() const { return m_allocator.GetWaitCount(); }
+
+    private:
+        // 分配对齐不会超过这个值，容量按它对齐
+        static constexpr uint32_t MAX_ALIGNMENT = 256;
+
+        uint32_t m_type;
+        uint32_t m_slot;
+        RingAllocator m_allocator;
+        sp<GlBuffer> m_glBuffer;
+        uint8_t* m_data = nullptr;
+
+        void CreateBuffer(uint32_t sizeB);
+    };
+}
@@ -30,6 +30,25 @@ namespace op
         m_uniforms = LoadUniforms(m_id);
     }
 
+    GlShader::GlShader(cr<std::string> preparedComp)
+    {
+        auto cCharSource = preparedComp.c_str();
+
+        GLuint compShader = GlState::GlGenShader(GL_COMPUTE_SHADER);
+        GlState::GlShaderSource(compShader, 1, &cCharSource, nullptr);
+        GlState::GlCompileShader(compShader);
+        CheckShaderCompilation(compShader, preparedComp);
+
+        m_id = GlState::GlGenProgram();
+        GlState::GlAttachShader(m_id, compShader);
+        GlState::GlLinkProgram(m_id);
+
+        GlState::GlDeleteShader(compShader);
+
+        m_uniforms = LoadUniforms(m_id);
+        m_isCompute = true;
+    }
+
     GlShader::~GlShader()
     {
         GlState::GlDeleteProgram(m_id);
@@ -51,6 +70,13 @@ namespace op
         GlState::Ins()->BindShader(shared_from_this());
     }
 
+    void GlShader::Dispatch(const uint32_t groupCountX, const uint32_t groupCountY, const uint32_t groupCountZ)
+    {
+        assert(m_isCompute && GlState::Ins()->GetShader() == shared_from_this());
+
+        GlState::GlDispatchCompute(groupCountX, groupCountY, groupCountZ);
+    }
+
     void GlShader::SetInt(const string_hash name, const int32_t val)
     {
         assert(GlState::Ins()->GetShader() == shared_from_this());
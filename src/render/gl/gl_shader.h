@@ -19,6 +19,8 @@ namespace op
         };
         
         GlShader(cr<std::string> preparedVert, cr<std::string> preparedFrag);
+        // compute shader，只有一个阶段
+        explicit GlShader(cr<std::string> preparedComp);
         ~GlShader();
         GlShader(const GlShader& other) = delete;
         GlShader(GlShader&& other) noexcept = delete;
@@ -29,6 +31,8 @@ namespace op
         UniformInfo* GetUniformInfo(string_hash name);
 
         void Use();
+        // 需要先Use，只能用于compute shader
+        void Dispatch(uint32_t groupCountX, uint32_t groupCountY = 1, uint32_t groupCountZ = 1);
 
         void SetInt(string_hash name, int32_t val);
         void SetFloat(string_hash name, float val);
@@ -38,6 +42,7 @@ namespace op
 
     private:
         uint32_t m_id;
+        bool m_isCompute = false;
         umap<string_hash, UniformInfo> m_uniforms;
         
         static void CheckShaderCompilation(GLuint vertexShader, cr<str> source);
@@ -95,13 +95,18 @@ namespace op
 
     bool GlState::BindBuffer(const std::shared_ptr<GlBuffer>& buffer)
     {
-        auto glBufferInfo = GetGlBufferInfo(buffer->GetType());
+        return BindBuffer(buffer, buffer->GetType());
+    }
+
+    bool GlState::BindBuffer(crsp<GlBuffer> buffer, const uint32_t type)
+    {
+        auto glBufferInfo = GetGlBufferInfo(type);
         if (glBufferInfo->buffer == buffer)
         {
             return false;
         }
         
-        if (buffer->GetType() == GL_ARRAY_BUFFER || buffer->GetType() == GL_ELEMENT_ARRAY_BUFFER)
+        if (type == GL_ARRAY_BUFFER || type == GL_ELEMENT_ARRAY_BUFFER)
         {
             auto& vao = GetVertexArray();
             if (vao && !vao->IsSettingAttr())
@@ -112,7 +117,7 @@ namespace op
         
         glBufferInfo->buffer = buffer;
 
-        glBindBuffer(buffer->GetType(), buffer->GetId());
+        glBindBuffer(type, buffer->GetId());
 
         GlCheckError();
         
@@ -137,6 +142,18 @@ namespace op
         return true;
     }
 
+    void GlState::BindBufferRange(crsp<GlBuffer> buffer, const uint32_t slot, const uint32_t offsetB, const uint32_t sizeB)
+    {
+        // 每次的区间都可能不同，不做缓存，清掉记录让之后的BindBufferBase重新绑定整个buffer
+        auto glBufferInfo = GetGlBufferInfo(buffer->GetType());
+        glBufferInfo->baseBuffers[slot].buffer.reset();
+        glBufferInfo->buffer.reset();
+
+        glBindBufferRange(buffer->GetType(), slot, buffer->GetId(), offsetB, sizeB);
+
+        GlCheckError();
+    }
+
     bool GlState::BindShader(crsp<GlShader> shader)
     {
         if (m_glShader == shader)
@@ -701,6 +718,49 @@ namespace op
         GlCheckError();
     }
 
+    void GlState::GlBufferStorage(const uint32_t target, const uint32_t sizeB, const void* data, const uint32_t flags)
+    {
+        glBufferStorage(target, sizeB, data, flags);
+
+        GlCheckError();
+    }
+
+    int32_t GlState::GlGetInteger(const uint32_t param)
+    {
+        GLint result = 0;
+        glGetIntegerv(param, &result);
+
+        GlCheckError();
+
+        return result;
+    }
+
+    void* GlState::GlFenceSync()
+    {
+        auto result = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        GlCheckError();
+
+        return result;
+    }
+
+    bool GlState::GlClientWaitSync(void* sync, const uint64_t timeoutNs)
+    {
+        auto result = glClientWaitSync(static_cast<GLsync>(sync), GL_SYNC_FLUSH_COMMANDS_BIT, timeoutNs);
+
+        GlCheckError();
+
+        assert(result != GL_WAIT_FAILED);
+        return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+    }
+
+    void GlState::GlDeleteSync(void* sync)
+    {
+        glDeleteSync(static_cast<GLsync>(sync));
+
+        GlCheckError();
+    }
+
     void GlState::GlActiveTexture(const uint32_t slot)
     {
         glActiveTexture(GL_TEXTURE0 + slot);
@@ -972,6 +1032,34 @@ namespace op
         GlCheckError();
     }
 
+    void GlState::GlMultiDrawElementsIndirectCount(const uint32_t mode, const uint32_t type, const void* indirect, const uint32_t drawCountOffsetB, const uint32_t maxDrawCount, const uint32_t stride)
+    {
+        glMultiDrawElementsIndirectCount(mode, type, indirect, drawCountOffsetB, static_cast<GLsizei>(maxDrawCount), static_cast<GLsizei>(stride));
+
+        GlCheckError();
+    }
+
+    void GlState::GlDispatchCompute(const uint32_t groupCountX, const uint32_t groupCountY, const uint32_t groupCountZ)
+    {
+        glDispatchCompute(groupCountX, groupCountY, groupCountZ);
+
+        GlCheckError();
+    }
+
+    void GlState::GlMemoryBarrier(const uint32_t barriers)
+    {
+        glMemoryBarrier(barriers);
+
+        GlCheckError();
+    }
+
+    void GlState::GlGetBufferSubData(const uint32_t target, const uint32_t offsetB, const uint32_t sizeB, void* data)
+    {
+        glGetBufferSubData(target, offsetB, sizeB, data);
+
+        GlCheckError();
+    }
+
     void GlState::GlUniform1i(const uint32_t location, const int32_t value)
     {
         glUniform1i(static_cast<GLsizei>(location), value);
@@ -1025,6 +1113,15 @@ namespace op
         return result;
     }
 
+    void* GlState::GlMapBufferRange(const uint32_t target, const uint32_t offsetB, const uint32_t sizeB, const uint32_t access)
+    {
+        auto result = glMapBufferRange(target, offsetB, sizeB, access);
+
+        GlCheckError();
+        
+        return result;
+    }
+
     void GlState::GlUnmapBuffer(const uint32_t target)
     {
         glUnmapBuffer(target);
@@ -1039,6 +1136,8 @@ namespace op
             { GL_ELEMENT_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER_BINDING },
             { GL_UNIFORM_BUFFER, GL_UNIFORM_BUFFER_BINDING },
             { GL_SHADER_STORAGE_BUFFER, GL_SHADER_STORAGE_BUFFER_BINDING },
+            { GL_DRAW_INDIRECT_BUFFER, GL_DRAW_INDIRECT_BUFFER_BINDING },
+            { GL_PARAMETER_BUFFER, GL_PARAMETER_BUFFER_BINDING },
         };
 
         return GL_BUFFER_BINDING_TYPE.at(type);
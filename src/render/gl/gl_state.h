@@ -58,9 +58,11 @@ namespace op
         friend class GlTexture;
         friend class GlRenderTarget;
         friend class GlShader;
+        friend class GlFence;
         friend class RenderingUtils;
         friend class CBufferLayout;
         friend class BatchRenderUnit;
+        friend class GpuCulling;
         
     public:
         void Reset();
@@ -119,7 +121,10 @@ namespace op
 
         bool BindVertexArray(crsp<GlVertexArray> vao);
         bool BindBuffer(crsp<GlBuffer> buffer);
+        // 同一个buffer绑定到别的target上，比如compute写的SSBO当作indirect buffer用
+        bool BindBuffer(crsp<GlBuffer> buffer, uint32_t type);
         bool BindBufferBase(crsp<GlBuffer> buffer, uint32_t slot);
+        void BindBufferRange(crsp<GlBuffer> buffer, uint32_t slot, uint32_t offsetB, uint32_t sizeB);
         bool BindTexture(uint32_t slot, GlTexture* texture);
         bool BindRenderTarget(crsp<GlRenderTarget> frameBuffer);
         
@@ -146,6 +151,7 @@ namespace op
         static uint32_t GlGenShader(uint32_t type);
         static uint32_t GlGenProgram();
         static void* GlMapBuffer(uint32_t target, uint32_t access);
+        static void* GlMapBufferRange(uint32_t target, uint32_t offsetB, uint32_t sizeB, uint32_t access);
         static void GlUnmapBuffer(uint32_t target);
         static void GlSetVertAttrEnable(uint32_t index, bool enable);
         static void GlSetVertAttrLayout(uint32_t index, uint32_t strideF, uint32_t type, uint32_t normalized, uint32_t vertexDataStrideB, uint32_t vertexDataOffsetB);
@@ -157,6 +163,12 @@ namespace op
         static void GlDeleteProgram(uint32_t id);
         static void GlBufferData(uint32_t target, uint32_t sizeB, const void* data, uint32_t usage);
         static void GlBufferSubData(uint32_t target, uint32_t offsetB, uint32_t sizeB, const void* data);
+        static void GlBufferStorage(uint32_t target, uint32_t sizeB, const void* data, uint32_t flags);
+        static int32_t GlGetInteger(uint32_t param);
+        static void* GlFenceSync();
+        // 超时返回false
+        static bool GlClientWaitSync(void* sync, uint64_t timeoutNs);
+        static void GlDeleteSync(void* sync);
         static void GlActiveTexture(uint32_t slot);
         static void GlBindTexture(GlTextureType type, uint32_t id);
         static void GlTexParameter(GlTextureType type, uint32_t param, uint32_t value);
@@ -190,6 +202,10 @@ namespace op
         static void GlGetProgramiv(uint32_t programId, uint32_t param, int* value);
         static void GlGetActiveUniform(uint32_t programId, uint32_t index, uint32_t bufSize, int32_t* length, int* size, uint32_t* type, char* name);
         static void GlMultiDrawElementsIndirect(uint32_t mode, uint32_t type, const void* indirect, uint32_t drawCount, uint32_t stride);
+        static void GlMultiDrawElementsIndirectCount(uint32_t mode, uint32_t type, const void* indirect, uint32_t drawCountOffsetB, uint32_t maxDrawCount, uint32_t stride);
+        static void GlDispatchCompute(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ);
+        static void GlMemoryBarrier(uint32_t barriers);
+        static void GlGetBufferSubData(uint32_t target, uint32_t offsetB, uint32_t sizeB, void* data);
 
         static void GlUniform1i(uint32_t location, int32_t value);
         static void GlUniform1f(uint32_t location, float value);
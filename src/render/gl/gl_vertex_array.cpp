@@ -74,6 +74,21 @@ namespace op
         const VertexAttr attr,
         const uint32_t vertexDataStrideB,
         const uint32_t vertexDataOffsetB)
+    {
+        auto index = find_index_if(VERTEX_ATTR_DEFINES, [&attr](cr<VertexAttrDefine> d)
+        {
+            return attr == d.attr;
+        });
+        SetAttr(attr, VERTEX_ATTR_DEFINES[index.value()].strideF, GL_FLOAT, false, vertexDataStrideB, vertexDataOffsetB);
+    }
+
+    void GlVertexArray::SetAttr(
+        const VertexAttr attr,
+        const uint32_t componentCount,
+        const uint32_t type,
+        const bool normalized,
+        const uint32_t vertexDataStrideB,
+        const uint32_t vertexDataOffsetB)
     {
         assert(m_settingAttr);
         assert(m_vbo);
@@ -82,12 +97,11 @@ namespace op
         {
             return attr == d.attr;
         });
-        auto& attrInfo = VERTEX_ATTR_DEFINES[index.value()];
         GlState::GlSetVertAttrLayout(
             index.value(),
-            attrInfo.strideF,
-            GL_FLOAT,
-            GL_FALSE,
+            componentCount,
+            type,
+            normalized ? GL_TRUE : GL_FALSE,
             vertexDataStrideB,
             vertexDataOffsetB);
     }
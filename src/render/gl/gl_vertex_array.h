@@ -31,6 +31,8 @@ namespace op
         void BindEbo(const std::shared_ptr<GlBuffer>& ebo);
         void SetAttrEnable(uint32_t index, bool enable);
         void SetAttr(VertexAttr attr, uint32_t vertexDataStrideB, uint32_t vertexDataOffsetB);
+        // 顶点数据不是float时用，type是GL_UNSIGNED_SHORT之类的分量类型，normalized为true时整数归一化到[0, 1]或[-1, 1]
+        void SetAttr(VertexAttr attr, uint32_t componentCount, uint32_t type, bool normalized, uint32_t vertexDataStrideB, uint32_t vertexDataOffsetB);
 
         // lock_guard implements
         void lock();
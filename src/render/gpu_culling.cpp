@@ -0,0 +1,583 @@
+#include "gpu_culling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <tuple>
+#include <tracy/Tracy.hpp>
+
+#include "gl/gl_buffer.h"
+#include "gl/gl_ring_buffer.h"
+#include "gl/gl_shader.h"
+#include "gl/gl_state.h"
+#include "math/math_utils.h"
+
+namespace op
+{
+    static_assert(sizeof(GpuCullingRecord) == 16);
+    static_assert(sizeof(GpuCullingSubCmd) == 32);
+    static_assert(sizeof(GpuDrawCmd) == 20);
+
+    STRING_HANDLE(RECORD_COUNT, _RecordCount)
+    STRING_HANDLE(SUB_CMD_COUNT, _SubCmdCount)
+    STRING_HANDLE(CMD_COUNT, _CmdCount)
+    STRING_HANDLE(BOUNDS_STRIDE, _BoundsStride)
+    STRING_HANDLE(CULLING_PLANES, _CullingPlanes)
+
+    static constexpr auto GPU_CULLING_SHADER_PATH = "shaders/compute/gpu_culling.comp";
+    static constexpr uint32_t BOUNDS_SLOT = 7;
+    static constexpr uint32_t RECORDS_SLOT = 8;
+    static constexpr uint32_t SUB_CMDS_SLOT = 9;
+    static constexpr uint32_t DRAW_COUNTS_SLOT = 10;
+    static constexpr uint32_t DRAW_CMDS_SLOT = 11;
+    // 和batch_rendering.hlsl里的_BatchObjectIndices相同，绘制时直接读剔除的输出
+    static constexpr uint32_t MATRIX_INDICES_SLOT = 5;
+
+    GpuCulling::GpuCulling(IGpuFence* fence, const uint32_t maxFramesInFlight)
+    {
+        m_cullShader = LoadShader(GPU_CULLING_SHADER_PATH, "CULL_PASS");
+        m_compactShader = LoadShader(GPU_CULLING_SHADER_PATH, "COMPACT_PASS");
+
+        m_boundsAlignmentB = static_cast<uint32_t>(GlState::GlGetInteger(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT));
+        m_boundsRing = mup<GlRingBuffer>(GL_SHADER_STORAGE_BUFFER, 256 * 1024, maxFramesInFlight, fence, BOUNDS_SLOT);
+        m_recordsBuffer = msp<GlBuffer>(GL_SHADER_STORAGE_BUFFER, RECORDS_SLOT);
+        m_subCmdsBuffer = msp<GlBuffer>(GL_SHADER_STORAGE_BUFFER, SUB_CMDS_SLOT);
+        m_drawCountsBuffer = msp<GlBuffer>(GL_SHADER_STORAGE_BUFFER, DRAW_COUNTS_SLOT);
+        m_drawCmdsBuffer = msp<GlBuffer>(GL_SHADER_STORAGE_BUFFER, DRAW_CMDS_SLOT);
+        m_matrixIndicesBuffer = msp<GlBuffer>(GL_SHADER_STORAGE_BUFFER, MATRIX_INDICES_SLOT);
+    }
+
+    GpuCulling::~GpuCulling() = default;
+
+    void GpuCulling::UploadTables(vec<GpuCullingRecord> records, vec<GpuCullingSubCmd> subCmds, const uint32_t cmdCount)
+    {
+        ZoneScoped;
+
+        m_records = std::move(records);
+        m_subCmds = std::move(subCmds);
+        m_cmdCount = cmdCount;
+
+        // visibleCount在GPU上累加，上传时必须是0
+        for (auto& subCmd : m_subCmds)
+        {
+            subCmd.visibleCount = 0;
+        }
+
+        auto recordCount = static_cast<uint32_t>(m_records.size());
+        auto subCmdCount = static_cast<uint32_t>(m_subCmds.size());
+        m_recordsBuffer->SetData(GL_STATIC_DRAW, recordCount * sizeof(GpuCullingRecord), m_records.data());
+        m_subCmdsBuffer->SetData(GL_DYNAMIC_COPY, subCmdCount * sizeof(GpuCullingSubCmd), m_subCmds.data());
+        m_drawCountsBuffer->SetData(GL_DYNAMIC_COPY, m_cmdCount * sizeof(uint32_t), nullptr);
+        m_drawCmdsBuffer->SetData(GL_DYNAMIC_COPY, subCmdCount * sizeof(GpuDrawCmd), nullptr);
+        m_matrixIndicesBuffer->SetData(GL_DYNAMIC_COPY, recordCount * sizeof(uint32_t), nullptr);
+    }
+
+    void GpuCulling::Dispatch(cr<CullingPlanes> planes, cr<CullingView> view, const uint32_t boundsCount)
+    {
+        ZoneScoped;
+
+        if (m_records.empty())
+        {
+            return;
+        }
+
+        // 包围盒每帧都从CullingBuffer拷一份，6个分量依次排列
+        auto boundsSizeB = boundsCount * 6 * static_cast<uint32_t>(sizeof(float));
+        auto boundsOffsetB = m_boundsRing->Alloc(boundsSizeB, m_boundsAlignmentB);
+        auto bounds = reinterpret_cast<float*>(m_boundsRing->GetData() + boundsOffsetB);
+        const arr<const float*, 6> columns = {
+            view.centerX, view.centerY, view.centerZ,
+            view.extentsX, view.extentsY, view.extentsZ
+        };
+        for (uint32_t i = 0; i < columns.size(); ++i)
+        {
+            std::memcpy(bounds + i * boundsCount, columns[i], boundsCount * sizeof(float));
+        }
+
+        arr<float, 24> packedPlanes;
+        for (uint32_t p = 0; p < 6; ++p)
+        {
+            packedPlanes[p * 4 + 0] = planes.nx[p];
+            packedPlanes[p * 4 + 1] = planes.ny[p];
+            packedPlanes[p * 4 + 2] = planes.nz[p];
+            packedPlanes[p * 4 + 3] = planes.w[p];
+        }
+
+        m_boundsRing->GetGlBuffer()->BindRange(boundsOffsetB, boundsSizeB);
+        m_recordsBuffer->BindBase();
+        m_subCmdsBuffer->BindBase();
+        m_drawCountsBuffer->BindBase();
+        m_drawCmdsBuffer->BindBase();
+        m_matrixIndicesBuffer->BindBase();
+
+        auto recordCount = static_cast<uint32_t>(m_records.size());
+        auto subCmdCount = static_cast<uint32_t>(m_subCmds.size());
+
+        // 剔除的同时清零每个cmd的绘制数，线程数要覆盖实例和cmd
+        m_cullShader->Use();
+        m_cullShader->SetInt(RECORD_COUNT, static_cast<int32_t>(recordCount));
+        m_cullShader->SetInt(CMD_COUNT, static_cast<int32_t>(m_cmdCount));
+        m_cullShader->SetInt(BOUNDS_STRIDE, static_cast<int32_t>(boundsCount));
+        m_cullShader->SetFloatArr(CULLING_PLANES, packedPlanes.data(), static_cast<uint32_t>(packedPlanes.size()));
+        m_cullShader->Dispatch((std::max(recordCount, m_cmdCount) + GROUP_SIZE - 1) / GROUP_SIZE);
+        GlState::GlMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        m_compactShader->Use();
+        m_compactShader->SetInt(SUB_CMD_COUNT, static_cast<int32_t>(subCmdCount));
+        m_compactShader->Dispatch((subCmdCount + GROUP_SIZE - 1) / GROUP_SIZE);
+        GlState::GlMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    void GpuCulling::BindDrawBuffers()
+    {
+        m_drawCmdsBuffer->BindAs(GL_DRAW_INDIRECT_BUFFER);
+        m_drawCountsBuffer->BindAs(GL_PARAMETER_BUFFER);
+        m_matrixIndicesBuffer->BindBase();
+    }
+
+    void GpuCulling::EndFrame(const uint64_t fence)
+    {
+        m_boundsRing->EndFrame(fence);
+    }
+
+    void GpuCulling::ReadBack(GpuCullingOutput& output)
+    {
+        ZoneScoped;
+
+        output.matrixIndices.resize(m_records.size());
+        output.drawCmds.resize(m_subCmds.size());
+        output.drawCounts.resize(m_cmdCount);
+
+        if (m_records.empty())
+        {
+            return;
+        }
+
+        m_matrixIndicesBuffer->GetSubData(0, static_cast<uint32_t>(output.matrixIndices.size() * sizeof(uint32_t)), output.matrixIndices.data());
+        m_drawCmdsBuffer->GetSubData(0, static_cast<uint32_t>(output.drawCmds.size() * sizeof(GpuDrawCmd)), output.drawCmds.data());
+        m_drawCountsBuffer->GetSubData(0, static_cast<uint32_t>(output.drawCounts.size() * sizeof(uint32_t)), output.drawCounts.data());
+    }
+
+    uint32_t GpuCulling::Validate(cr<CullingPlanes> planes, cr<CullingView> view)
+    {
+        ZoneScoped;
+
+        GpuCullingOutput expected;
+        CullReference(planes, view, m_records, m_subCmds, m_cmdCount, expected);
+
+        GpuCullingOutput actual;
+        ReadBack(actual);
+
+        return CompareOutput(m_subCmds, m_cmdCount, expected, actual);
+    }
+
+    void GpuCulling::CullReference(
+        cr<CullingPlanes> planes,
+        cr<CullingView> view,
+        cr<vec<GpuCullingRecord>> records,
+        cr<vec<GpuCullingSubCmd>> subCmds,
+        const uint32_t cmdCount,
+        GpuCullingOutput& output)
+    {
+        output.matrixIndices.assign(records.size(), ~0u);
+        output.drawCmds.assign(subCmds.size(), {});
+        output.drawCounts.assign(cmdCount, 0);
+
+        // 和CULL_PASS相同，用fma按相同的顺序累加
+        vec<uint32_t> visibleCounts(subCmds.size(), 0);
+        for (auto& record : records)
+        {
+            auto index = record.cullingIndex;
+            auto visible = true;
+            for (uint32_t p = 0; p < 6 && visible; ++p)
+            {
+                auto d = std::fma(planes.nx[p], view.centerX[index], planes.w[p]);
+                d = std::fma(planes.ny[p], view.centerY[index], d);
+                d = std::fma(planes.nz[p], view.centerZ[index], d);
+                d = std::fma(std::abs(planes.nx[p]), view.extentsX[index], d);
+                d = std::fma(std::abs(planes.ny[p]), view.extentsY[index], d);
+                d = std::fma(std::abs(planes.nz[p]), view.extentsZ[index], d);
+                visible = d >= 0.0f;
+            }
+
+            if (visible)
+            {
+                auto slot = visibleCounts[record.subCmdIndex]++;
+                output.matrixIndices[subCmds[record.subCmdIndex].instanceStart + slot] = record.matrixIndex;
+            }
+        }
+
+        // 和COMPACT_PASS相同
+        for (uint32_t s = 0; s < subCmds.size(); ++s)
+        {
+            auto& subCmd = subCmds[s];
+            if (visibleCounts[s] == 0)
+            {
+                continue;
+            }
+
+            auto slot = output.drawCounts[subCmd.cmdIndex]++;
+            output.drawCmds[subCmd.drawCmdStart + slot] = {
+                subCmd.count,
+                visibleCounts[s],
+                subCmd.firstIndex,
+                subCmd.baseVertex,
+                subCmd.instanceStart
+            };
+        }
+    }
+
+    uint32_t GpuCulling::CompareOutput(cr<vec<GpuCullingSubCmd>> subCmds, const uint32_t cmdCount, cr<GpuCullingOutput> x, cr<GpuCullingOutput> y)
+    {
+        vec<uint32_t> drawCmdStarts(cmdCount, 0);
+        for (auto& subCmd : subCmds)
+        {
+            drawCmdStarts[subCmd.cmdIndex] = subCmd.drawCmdStart;
+        }
+
+        auto sortedDrawCmds = [](cr<GpuCullingOutput> output, const uint32_t start, const uint32_t count)
+        {
+            vec<GpuDrawCmd> result(output.drawCmds.begin() + start, output.drawCmds.begin() + start + count);
+            std::sort(result.begin(), result.end(), [](cr<GpuDrawCmd> a, cr<GpuDrawCmd> b)
+            {
+                return a.baseInstance < b.baseInstance;
+            });
+            return result;
+        };
+        auto sortedMatrixIndices = [](cr<GpuCullingOutput> output, cr<GpuDrawCmd> drawCmd)
+        {
+            auto begin = output.matrixIndices.begin() + drawCmd.baseInstance;
+            vec<uint32_t> result(begin, begin + drawCmd.instanceCount);
+            std::sort(result.begin(), result.end());
+            return result;
+        };
+
+        uint32_t mismatchCount = 0;
+        for (uint32_t c = 0; c < cmdCount; ++c)
+        {
+            if (x.drawCounts[c] != y.drawCounts[c])
+            {
+                mismatchCount++;
+                continue;
+            }
+
+            auto drawCmdsX = sortedDrawCmds(x, drawCmdStarts[c], x.drawCounts[c]);
+            auto drawCmdsY = sortedDrawCmds(y, drawCmdStarts[c], y.drawCounts[c]);
+            auto same = true;
+            for (uint32_t i = 0; i < drawCmdsX.size() && same; ++i)
+            {
+                auto& a = drawCmdsX[i];
+                auto& b = drawCmdsY[i];
+                same = std::tie(a.count, a.instanceCount, a.firstIndex, a.baseVertex, a.baseInstance) ==
+                    std::tie(b.count, b.instanceCount, b.firstIndex, b.baseVertex, b.baseInstance) &&
+                    sortedMatrixIndices(x, a) == sortedMatrixIndices(y, b);
+            }
+
+            if (!same)
+            {
+                mismatchCount++;
+            }
+        }
+
+        return mismatchCount;
+    }
+
+    GpuCulling::ReferenceValidation GpuCulling::ValidateReference(const uint32_t recordCount)
+    {
+        ReferenceValidation result;
+
+        // 每个subCmd的实例聚在一起，有的subCmd整个在视锥外，这样会有cmd只画一部分subCmd
+        std::mt19937 random(12345);
+        std::uniform_int_distribution subCmdCountDist(1, 8);
+        std::uniform_int_distribution instanceCountDist(1, 64);
+        std::uniform_real_distribution clusterDist(-100.0f, 100.0f);
+        std::uniform_real_distribution offsetDist(-15.0f, 15.0f);
+        std::uniform_real_distribution extentsDist(0.1f, 3.0f);
+
+        // 法线朝内的盒状视锥
+        arr<Vec4, 6> planeVecs = {
+            Vec4(1, 0, 0, 60), Vec4(-1, 0, 0, 60),
+            Vec4(0, 1, 0, 60), Vec4(0, -1, 0, 60),
+            Vec4(0, 0, 1, 60), Vec4(0, 0, -1, 60),
+        };
+        CullingPlanes planes(planeVecs);
+
+        vec<GpuCullingSubCmd> subCmds;
+        vec<GpuCullingRecord> records;
+        arr<vec<float>, 6> bounds;
+        uint32_t cmdCount = 0;
+        while (records.size() < recordCount)
+        {
+            auto drawCmdStart = static_cast<uint32_t>(subCmds.size());
+            auto subCmdCount = subCmdCountDist(random);
+            for (int32_t i = 0; i < subCmdCount && records.size() < recordCount; ++i)
+            {
+                auto subCmdIndex = static_cast<uint32_t>(subCmds.size());
+                auto instanceStart = static_cast<uint32_t>(records.size());
+                auto instanceCount = std::min(static_cast<uint32_t>(instanceCountDist(random)), recordCount - instanceStart);
+                Vec3 cluster(clusterDist(random), clusterDist(random), clusterDist(random));
+                for (uint32_t j = 0; j < instanceCount; ++j)
+                {
+                    auto cullingIndex = static_cast<uint32_t>(records.size());
+                    // 离平面太近的包围盒不同的算法可能判断不同，重新生成
+                    arr<float, 6> box;
+                    auto ambiguous = true;
+                    while (ambiguous)
+                    {
+                        for (uint32_t k = 0; k < 3; ++k)
+                        {
+                            box[k] = cluster[k] + offsetDist(random);
+                            box[k + 3] = extentsDist(random);
+                        }
+
+                        ambiguous = false;
+                        for (auto& plane : planeVecs)
+                        {
+                            auto d = static_cast<double>(plane.x) * box[0] + static_cast<double>(plane.y) * box[1] + static_cast<double>(plane.z) * box[2] +
+                                std::abs(plane.x) * box[3] + std::abs(plane.y) * box[4] + std::abs(plane.z) * box[5] + plane.w;
+                            ambiguous |= std::abs(d) < 1e-3;
+                        }
+                    }
+                    for (uint32_t k = 0; k < 6; ++k)
+                    {
+                        bounds[k].push_back(box[k]);
+                    }
+
+                    records.push_back({ cullingIndex, cullingIndex * 7 + 3, subCmdIndex, 0 });
+                }
+
+                subCmds.push_back({
+                    static_cast<uint32_t>(random() % 1000 + 1),
+                    static_cast<uint32_t>(random() % 100000),
+                    static_cast<uint32_t>(random() % 100000),
+                    instanceStart,
+                    cmdCount,
+                    drawCmdStart,
+                    0,
+                    0
+                });
+            }
+            cmdCount++;
+        }
+        // GPU上record的执行顺序不固定
+        std::shuffle(records.begin(), records.end(), random);
+
+        result.recordCount = static_cast<uint32_t>(records.size());
+        result.subCmdCount = static_cast<uint32_t>(subCmds.size());
+        result.cmdCount = cmdCount;
+
+        CullingView view;
+        view.centerX = bounds[0].data();
+        view.centerY = bounds[1].data();
+        view.centerZ = bounds[2].data();
+        view.extentsX = bounds[3].data();
+        view.extentsY = bounds[4].data();
+        view.extentsZ = bounds[5].data();
+
+        GpuCullingOutput reference;
+        CullReference(planes, view, records, subCmds, cmdCount, reference);
+
+        // 暴力剔除：每个subCmd扫一遍所有record，和CullReference的输出逐个cmd比较
+        vec<vec<uint32_t>> expectedIndices(subCmds.size());
+        for (uint32_t s = 0; s < subCmds.size(); ++s)
+        {
+            for (auto& record : records)
+            {
+                auto i = record.cullingIndex;
+                if (record.subCmdIndex == s && frustum_culling(planeVecs,
+                    Vec3(bounds[0][i], bounds[1][i], bounds[2][i]),
+                    Vec3(bounds[3][i], bounds[4][i], bounds[5][i])))
+                {
+                    expectedIndices[s].push_back(record.matrixIndex);
+                }
+            }
+            std::sort(expectedIndices[s].begin(), expectedIndices[s].end());
+            result.visibleCount += static_cast<uint32_t>(expectedIndices[s].size());
+        }
+
+        vec<uint32_t> cmdFirstSubCmds(cmdCount, 0);
+        vec<uint32_t> cmdSubCmdCounts(cmdCount, 0);
+        for (uint32_t s = 0; s < subCmds.size(); ++s)
+        {
+            cmdFirstSubCmds[subCmds[s].cmdIndex] = subCmds[s].drawCmdStart;
+            cmdSubCmdCounts[subCmds[s].cmdIndex]++;
+        }
+
+        for (uint32_t c = 0; c < cmdCount; ++c)
+        {
+            auto first = cmdFirstSubCmds[c];
+            uint32_t expectedDrawCount = 0;
+            for (auto s = first; s < first + cmdSubCmdCounts[c]; ++s)
+            {
+                expectedDrawCount += expectedIndices[s].empty() ? 0 : 1;
+            }
+
+            auto same = reference.drawCounts[c] == expectedDrawCount;
+            // 每个可见的subCmd正好出现一次，按instanceStart找回对应的subCmd
+            vec<bool> drawn(cmdSubCmdCounts[c], false);
+            for (uint32_t i = 0; i < reference.drawCounts[c] && same; ++i)
+            {
+                auto& drawCmd = reference.drawCmds[first + i];
+                auto it = std::find_if(subCmds.begin() + first, subCmds.begin() + first + cmdSubCmdCounts[c], [&drawCmd](cr<GpuCullingSubCmd> subCmd)
+                {
+                    return subCmd.instanceStart == drawCmd.baseInstance;
+                });
+                if (it == subCmds.begin() + first + cmdSubCmdCounts[c])
+                {
+                    same = false;
+                    break;
+                }
+
+                auto s = static_cast<uint32_t>(it - subCmds.begin());
+                auto begin = reference.matrixIndices.begin() + drawCmd.baseInstance;
+                vec<uint32_t> indices(begin, begin + drawCmd.instanceCount);
+                std::sort(indices.begin(), indices.end());
+                same = !drawn[s - first] &&
+                    drawCmd.count == it->count && drawCmd.firstIndex == it->firstIndex && drawCmd.baseVertex == it->baseVertex &&
+                    indices == expectedIndices[s];
+                drawn[s - first] = true;
+            }
+
+            if (!same)
+            {
+                result.bruteForceMismatchCount++;
+            }
+        }
+
+        // 同一个cmd里indirect cmd的顺序、同一个subCmd里实例的顺序反过来，无效区域填上垃圾值，结果应当一致
+        auto permuted = reference;
+        for (auto& index : permuted.matrixIndices)
+        {
+            index = ~0u - 1;
+        }
+        for (uint32_t c = 0; c < cmdCount; ++c)
+        {
+            auto begin = permuted.drawCmds.begin() + cmdFirstSubCmds[c];
+            std::reverse(begin, begin + permuted.drawCounts[c]);
+            std::fill(begin + permuted.drawCounts[c], begin + cmdSubCmdCounts[c], GpuDrawCmd{ 1, 2, 3, 4, 5 });
+            for (uint32_t i = 0; i < permuted.drawCounts[c]; ++i)
+            {
+                auto& drawCmd = begin[i];
+                auto src = reference.matrixIndices.begin() + drawCmd.baseInstance;
+                std::reverse_copy(src, src + drawCmd.instanceCount, permuted.matrixIndices.begin() + drawCmd.baseInstance);
+            }
+        }
+        result.permutedMismatchCount = CompareOutput(subCmds, cmdCount, reference, permuted);
+
+        // 每次只改坏一个cmd，CompareOutput应当正好报告一个不一致
+        auto corrupt = [&](auto&& modify)
+        {
+            auto corrupted = reference;
+            if (!modify(corrupted))
+            {
+                return;
+            }
+
+            result.corruptionCount++;
+            if (CompareOutput(subCmds, cmdCount, reference, corrupted) != 1)
+            {
+                result.undetectedCorruptionCount++;
+            }
+        };
+        auto findCmd = [&](auto&& predicate)
+        {
+            for (uint32_t c = 0; c < cmdCount; ++c)
+            {
+                if (predicate(c))
+                {
+                    return c;
+                }
+            }
+            return ~0u;
+        };
+        auto firstMultiInstance = findCmd([&](const uint32_t c)
+        {
+            return reference.drawCounts[c] > 0 && reference.drawCmds[cmdFirstSubCmds[c]].instanceCount > 1;
+        });
+        auto firstPartial = findCmd([&](const uint32_t c)
+        {
+            return reference.drawCounts[c] > 0 && reference.drawCounts[c] < cmdSubCmdCounts[c];
+        });
+
+        // 可见实例里换掉一个矩阵
+        corrupt([&](GpuCullingOutput& output)
+        {
+            if (firstMultiInstance == ~0u)
+            {
+                return false;
+            }
+            output.matrixIndices[output.drawCmds[cmdFirstSubCmds[firstMultiInstance]].baseInstance] = ~0u - 2;
+            return true;
+        });
+        // 少画一个实例
+        corrupt([&](GpuCullingOutput& output)
+        {
+            if (firstMultiInstance == ~0u)
+            {
+                return false;
+            }
+            output.drawCmds[cmdFirstSubCmds[firstMultiInstance]].instanceCount--;
+            return true;
+        });
+        // 几何参数不对
+        corrupt([&](GpuCullingOutput& output)
+        {
+            if (firstMultiInstance == ~0u)
+            {
+                return false;
+            }
+            output.drawCmds[cmdFirstSubCmds[firstMultiInstance]].baseVertex++;
+            return true;
+        });
+        // 多画一个被剔除的subCmd
+        corrupt([&](GpuCullingOutput& output)
+        {
+            if (firstPartial == ~0u)
+            {
+                return false;
+            }
+            output.drawCounts[firstPartial]++;
+            return true;
+        });
+        // 漏掉一个可见的subCmd
+        corrupt([&](GpuCullingOutput& output)
+        {
+            if (firstPartial == ~0u)
+            {
+                return false;
+            }
+            output.drawCounts[firstPartial]--;
+            return true;
+        });
+
+        return result;
+    }
+
+    sp<GlShader> GpuCulling::LoadShader(crstr assetPath, cstr pass)
+    {
+        std::ifstream file(Utils::GetAbsolutePath(assetPath));
+        if (!file)
+        {
+            THROW_ERRORF("打开compute shader失败：%s", assetPath.c_str())
+        }
+        std::stringstream ss;
+        ss << file.rdbuf();
+        auto source = ss.str();
+
+        // 宏只能插在#version后面
+        auto versionEnd = source.find('\n') + 1;
+        source.insert(versionEnd, format_string("#define %s\n", pass));
+
+        try
+        {
+            return msp<GlShader>(source);
+        }
+        catch (const std::exception& e)
+        {
+            THROW_ERRORF("Compute shader加载失败：%s %s \n %s", assetPath.c_str(), pass, e.what())
+        }
+    }
+}
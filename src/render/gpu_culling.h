@@ -0,0 +1,130 @@
+#pragma once
+
+#include "culling_kernels.h"
+#include "utils.h"
+
+namespace op
+{
+    class GlBuffer;
+    class GlShader;
+    class GlRingBuffer;
+    class IGpuFence;
+
+    // 布局和assets/shaders/compute/gpu_culling.comp里的结构体一致
+    struct GpuCullingRecord
+    {
+        uint32_t cullingIndex;
+        uint32_t matrixIndex;
+        uint32_t subCmdIndex;
+        uint32_t padding;
+    };
+
+    struct GpuCullingSubCmd
+    {
+        uint32_t count;
+        uint32_t firstIndex;
+        uint32_t baseVertex;
+        // 输出的matrixIndices里给这个subCmd预留了全部实例的空间，baseInstance就是instanceStart
+        uint32_t instanceStart;
+        uint32_t cmdIndex;
+        // 所属cmd的第一个subCmd，压缩后的indirect cmd从这里开始写
+        uint32_t drawCmdStart;
+        // 剔除时累加，压缩完清零
+        uint32_t visibleCount;
+        uint32_t padding;
+    };
+
+    struct GpuDrawCmd
+    {
+        uint32_t count;
+        uint32_t instanceCount;
+        uint32_t firstIndex;
+        uint32_t baseVertex;
+        uint32_t baseInstance;
+    };
+
+    struct GpuCullingOutput
+    {
+        // 每个实例一个位置，只有[instanceStart, instanceStart + instanceCount)有意义
+        vec<uint32_t> matrixIndices;
+        // 每个cmd只有前drawCounts[cmdIndex]个有意义
+        vec<GpuDrawCmd> drawCmds;
+        vec<uint32_t> drawCounts;
+    };
+
+    // 用compute shader做视锥剔除，结果直接写进indirect buffer，绘制时由GPU决定每个cmd画几个subCmd，CPU不需要等剔除结果
+    class GpuCulling
+    {
+    public:
+        GpuCulling(IGpuFence* fence, uint32_t maxFramesInFlight);
+        ~GpuCulling();
+        GpuCulling(const GpuCulling& other) = delete;
+        GpuCulling(GpuCulling&& other) noexcept = delete;
+        GpuCulling& operator=(const GpuCulling& other) = delete;
+        GpuCulling& operator=(GpuCulling&& other) noexcept = delete;
+
+        // 实例和subCmd的表只在BatchRenderTree重建后上传，subCmd按cmd连续存放
+        void UploadTables(vec<GpuCullingRecord> records, vec<GpuCullingSubCmd> subCmds, uint32_t cmdCount);
+        // 上传这一帧的包围盒，boundsCount要覆盖所有的cullingIndex，每帧最多调用一次
+        void Dispatch(cr<CullingPlanes> planes, cr<CullingView> view, uint32_t boundsCount);
+        // 压缩后的indirect cmd绑定为indirect buffer，每个cmd的绘制数绑定为parameter buffer，偏移都按cmd算
+        void BindDrawBuffers();
+        void EndFrame(uint64_t fence);
+
+        // 读回最近一次Dispatch的结果，会等GPU执行完，只用来校验
+        void ReadBack(GpuCullingOutput& output);
+        // 用CPU参考实现重新算一遍最近一次Dispatch，返回结果不一致的cmd数
+        uint32_t Validate(cr<CullingPlanes> planes, cr<CullingView> view);
+
+        uint32_t GetRecordCount() const { return static_cast<uint32_t>(m_records.size()); }
+        uint32_t GetCmdCount() const { return m_cmdCount; }
+
+        // 和compute shader逻辑相同的CPU实现，同一个subCmd里实例的顺序、同一个cmd里indirect cmd的顺序和GPU可能不同
+        static void CullReference(
+            cr<CullingPlanes> planes,
+            cr<CullingView> view,
+            cr<vec<GpuCullingRecord>> records,
+            cr<vec<GpuCullingSubCmd>> subCmds,
+            uint32_t cmdCount,
+            GpuCullingOutput& output);
+        // 忽略上面说的顺序差异，返回结果不一致的cmd数
+        static uint32_t CompareOutput(cr<vec<GpuCullingSubCmd>> subCmds, uint32_t cmdCount, cr<GpuCullingOutput> x, cr<GpuCullingOutput> y);
+
+        struct ReferenceValidation
+        {
+            uint32_t recordCount = 0;
+            uint32_t subCmdCount = 0;
+            uint32_t cmdCount = 0;
+            uint32_t visibleCount = 0;
+            // CullReference和逐个包围盒暴力剔除结果不一致的cmd数
+            uint32_t bruteForceMismatchCount = 0;
+            // 打乱顺序、改动无效区域之后CompareOutput认为不一致的cmd数
+            uint32_t permutedMismatchCount = 0;
+            uint32_t corruptionCount = 0;
+            // 故意改坏的结果里CompareOutput没有发现的个数
+            uint32_t undetectedCorruptionCount = 0;
+        };
+
+        // 不需要GL，在随机生成的records和subCmds上检查CullReference和CompareOutput
+        static ReferenceValidation ValidateReference(uint32_t recordCount);
+
+    private:
+        static constexpr uint32_t GROUP_SIZE = 64;
+
+        sp<GlShader> m_cullShader;
+        sp<GlShader> m_compactShader;
+        up<GlRingBuffer> m_boundsRing;
+        sp<GlBuffer> m_recordsBuffer;
+        sp<GlBuffer> m_subCmdsBuffer;
+        sp<GlBuffer> m_drawCountsBuffer;
+        sp<GlBuffer> m_drawCmdsBuffer;
+        sp<GlBuffer> m_matrixIndicesBuffer;
+        uint32_t m_boundsAlignmentB = 0;
+
+        vec<GpuCullingRecord> m_records;
+        vec<GpuCullingSubCmd> m_subCmds;
+        uint32_t m_cmdCount = 0;
+
+        static sp<GlShader> LoadShader(crstr assetPath, cstr pass);
+    };
+}
@@ -0,0 +1,435 @@
+#include "vertex_compression.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+#include <random>
+
+#include "bounds.h"
+
+namespace op
+{
+    // 和VERTEX_ATTR_DEFINES里的偏移一致，uv0和uv1相邻，一次读4个float
+    static constexpr uint32_t POSITION_OFFSET_F = 0;
+    static constexpr uint32_t NORMAL_OFFSET_F = 4;
+    static constexpr uint32_t TANGENT_OFFSET_F = 8;
+    static constexpr uint32_t UV_OFFSET_F = 12;
+
+    // 长度为0的法线编码成(0, 0, 1)，不产生NaN
+    static constexpr float OCT_MIN_LENGTH = 1e-20f;
+    static constexpr float UNORM16_MAX = 65535.0f;
+    static constexpr float SNORM16_MAX = 32767.0f;
+
+    // float转half，向最近的偶数舍入，超出范围的变成无穷，NaN保持NaN
+    static constexpr uint32_t HALF_F32_INFINITY = 255u << 23;
+    static constexpr uint32_t HALF_F32_OVERFLOW = (127u + 16u) << 23;
+    static constexpr uint32_t HALF_F32_MIN_NORMAL = 113u << 23;
+    // 加上这个数之后，float的尾数低位刚好就是half的非规格化数
+    static constexpr uint32_t HALF_DENORM_MAGIC = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+    static constexpr uint32_t HALF_REBIAS = ((15u - 127u) << 23) + 0xfffu;
+
+    VertexQuantization::VertexQuantization(cr<Bounds> bounds)
+    {
+        auto center = &bounds.center.x;
+        auto extents = &bounds.extents.x;
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            min[i] = center[i] - extents[i];
+            size[i] = extents[i] * 2.0f;
+            invSize[i] = size[i] > 0.0f ? 1.0f / size[i] : 0.0f;
+        }
+    }
+
+    Matrix4x4 VertexQuantization::GetDequantizeMatrix() const
+    {
+        return {
+            size[0], 0, 0, min[0],
+            0, size[1], 0, min[1],
+            0, 0, size[2], min[2],
+            0, 0, 0, 1
+        };
+    }
+
+    uint16_t float_to_half(const float f)
+    {
+        auto x = std::bit_cast<uint32_t>(f);
+        auto sign = x & 0x80000000u;
+        x ^= sign;
+
+        uint32_t result;
+        if (x >= HALF_F32_OVERFLOW)
+        {
+            result = x > HALF_F32_INFINITY ? 0x7e00u : 0x7c00u;
+        }
+        else if (x < HALF_F32_MIN_NORMAL)
+        {
+            auto denorm = std::bit_cast<float>(x) + std::bit_cast<float>(HALF_DENORM_MAGIC);
+            result = std::bit_cast<uint32_t>(denorm) - HALF_DENORM_MAGIC;
+        }
+        else
+        {
+            auto mantissaOdd = (x >> 13) & 1u;
+            result = (x + HALF_REBIAS + mantissaOdd) >> 13;
+        }
+
+        return static_cast<uint16_t>(result | (sign >> 16));
+    }
+
+    float half_to_float(const uint16_t h)
+    {
+        auto sign = static_cast<uint32_t>(h & 0x8000u) << 16;
+        auto exponent = (h >> 10) & 0x1fu;
+        auto mantissa = h & 0x3ffu;
+
+        if (exponent == 0)
+        {
+            auto value = std::ldexp(static_cast<float>(mantissa), -24);
+            return sign ? -value : value;
+        }
+        if (exponent == 0x1f)
+        {
+            return std::bit_cast<float>(sign | 0x7f800000u | (mantissa << 13));
+        }
+
+        return std::bit_cast<float>(sign | ((exponent + 112u) << 23) | (mantissa << 13));
+    }
+
+    static int16_t quantize_snorm16(const float f)
+    {
+        return static_cast<int16_t>(std::lrint(std::clamp(f, -1.0f, 1.0f) * SNORM16_MAX));
+    }
+
+    static float dequantize_snorm16(const int16_t v)
+    {
+        return std::max(static_cast<float>(v) / SNORM16_MAX, -1.0f);
+    }
+
+    static void encode_octahedral(const float* v, int16_t* dst)
+    {
+        auto inv = 1.0f / std::max(std::abs(v[0]) + std::abs(v[1]) + std::abs(v[2]), OCT_MIN_LENGTH);
+        auto px = v[0] * inv;
+        auto py = v[1] * inv;
+
+        // 下半球沿对角线翻折到外面的四个三角形
+        if (v[2] < 0.0f)
+        {
+            auto fx = 1.0f - std::abs(py);
+            auto fy = 1.0f - std::abs(px);
+            px = std::copysign(fx, px);
+            py = std::copysign(fy, py);
+        }
+
+        dst[0] = quantize_snorm16(px);
+        dst[1] = quantize_snorm16(py);
+    }
+
+    static void decode_octahedral(const int16_t* v, float* dst)
+    {
+        auto x = dequantize_snorm16(v[0]);
+        auto y = dequantize_snorm16(v[1]);
+        auto z = 1.0f - std::abs(x) - std::abs(y);
+        auto t = std::max(-z, 0.0f);
+        x += x >= 0.0f ? -t : t;
+        y += y >= 0.0f ? -t : t;
+
+        auto invLength = 1.0f / std::sqrt(x * x + y * y + z * z);
+        dst[0] = x * invLength;
+        dst[1] = y * invLength;
+        dst[2] = z * invLength;
+    }
+
+    static void encode_vertex_reference(const float* v, cr<VertexQuantization> quantization, PackedVertex& dst)
+    {
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            auto t = (v[POSITION_OFFSET_F + i] - quantization.min[i]) * quantization.invSize[i];
+            dst.position[i] = static_cast<uint16_t>(std::lrint(std::clamp(t, 0.0f, 1.0f) * UNORM16_MAX));
+        }
+        dst.position[3] = v[TANGENT_OFFSET_F + 3] >= 0.0f ? 0xffffu : 0u;
+
+        encode_octahedral(v + NORMAL_OFFSET_F, dst.normal);
+        encode_octahedral(v + TANGENT_OFFSET_F, dst.tangent);
+
+        dst.uv0[0] = float_to_half(v[UV_OFFSET_F]);
+        dst.uv0[1] = float_to_half(v[UV_OFFSET_F + 1]);
+        dst.uv1[0] = float_to_half(v[UV_OFFSET_F + 2]);
+        dst.uv1[1] = float_to_half(v[UV_OFFSET_F + 3]);
+    }
+
+    void encode_vertices_reference(const float* fullVertexData, const uint32_t vertexCount, cr<VertexQuantization> quantization, PackedVertex* dst)
+    {
+        for (uint32_t i = 0; i < vertexCount; ++i)
+        {
+            encode_vertex_reference(fullVertexData + static_cast<size_t>(i) * MAX_VERTEX_ATTR_STRIDE_F, quantization, dst[i]);
+        }
+    }
+
+    // 读4个顶点同一个偏移处的4个float，转置成每个分量一个寄存器
+    static void load_transposed(const float* v, const uint32_t offsetF, __m128& x, __m128& y, __m128& z, __m128& w)
+    {
+        x = _mm_loadu_ps(v + offsetF);
+        y = _mm_loadu_ps(v + MAX_VERTEX_ATTR_STRIDE_F + offsetF);
+        z = _mm_loadu_ps(v + MAX_VERTEX_ATTR_STRIDE_F * 2 + offsetF);
+        w = _mm_loadu_ps(v + MAX_VERTEX_ATTR_STRIDE_F * 3 + offsetF);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+    }
+
+    static __m128i select_si128(const __m128i mask, const __m128i a, const __m128i b)
+    {
+        return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+    }
+
+    static __m128i float_to_half_sse(const __m128 f)
+    {
+        auto x = _mm_castps_si128(f);
+        auto sign = _mm_and_si128(x, _mm_set1_epi32(static_cast<int>(0x80000000u)));
+        x = _mm_xor_si128(x, sign);
+
+        // 去掉符号位后都是非负数，有符号比较就够了
+        auto isOverflow = _mm_cmpgt_epi32(x, _mm_set1_epi32(static_cast<int>(HALF_F32_OVERFLOW - 1)));
+        auto isNan = _mm_cmpgt_epi32(x, _mm_set1_epi32(static_cast<int>(HALF_F32_INFINITY)));
+        auto overflow = select_si128(isNan, _mm_set1_epi32(0x7e00), _mm_set1_epi32(0x7c00));
+
+        auto isDenorm = _mm_cmplt_epi32(x, _mm_set1_epi32(static_cast<int>(HALF_F32_MIN_NORMAL)));
+        auto magic = _mm_set1_epi32(static_cast<int>(HALF_DENORM_MAGIC));
+        auto denorm = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(x), _mm_castsi128_ps(magic))), magic);
+
+        auto mantissaOdd = _mm_and_si128(_mm_srli_epi32(x, 13), _mm_set1_epi32(1));
+        auto normal = _mm_add_epi32(_mm_add_epi32(x, _mm_set1_epi32(static_cast<int>(HALF_REBIAS))), mantissaOdd);
+        normal = _mm_srli_epi32(normal, 13);
+
+        auto result = select_si128(isDenorm, denorm, normal);
+        result = select_si128(isOverflow, overflow, result);
+
+        return _mm_or_si128(result, _mm_srli_epi32(sign, 16));
+    }
+
+    static void encode_octahedral_sse(const __m128 x, const __m128 y, const __m128 z, __m128i& dstX, __m128i& dstY)
+    {
+        auto signMask = _mm_set1_ps(-0.0f);
+        auto one = _mm_set1_ps(1.0f);
+
+        auto length = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signMask, x), _mm_andnot_ps(signMask, y)), _mm_andnot_ps(signMask, z));
+        auto inv = _mm_div_ps(one, _mm_max_ps(length, _mm_set1_ps(OCT_MIN_LENGTH)));
+        auto px = _mm_mul_ps(x, inv);
+        auto py = _mm_mul_ps(y, inv);
+
+        // 1 - |p|不会是负数，直接拼上另一个分量的符号位
+        auto fx = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, py)), _mm_and_ps(signMask, px));
+        auto fy = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, px)), _mm_and_ps(signMask, py));
+        auto lower = _mm_cmplt_ps(z, _mm_setzero_ps());
+        px = _mm_or_ps(_mm_and_ps(lower, fx), _mm_andnot_ps(lower, px));
+        py = _mm_or_ps(_mm_and_ps(lower, fy), _mm_andnot_ps(lower, py));
+
+        auto snormMax = _mm_set1_ps(SNORM16_MAX);
+        dstX = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(px, _mm_set1_ps(-1.0f)), one), snormMax));
+        dstY = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(py, _mm_set1_ps(-1.0f)), one), snormMax));
+    }
+
+    static __m128i quantize_unorm16_sse(const __m128 v, const float min, const float invSize)
+    {
+        auto t = _mm_mul_ps(_mm_sub_ps(v, _mm_set1_ps(min)), _mm_set1_ps(invSize));
+        t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+
+        return _mm_cvtps_epi32(_mm_mul_ps(t, _mm_set1_ps(UNORM16_MAX)));
+    }
+
+    // SSE2没有无符号的饱和打包，先减去32768变成有符号的，打包后再把最高位翻回来
+    static __m128i pack_u16(const __m128i a, const __m128i b)
+    {
+        auto bias = _mm_set1_epi32(0x8000);
+        auto packed = _mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias));
+
+        return _mm_xor_si128(packed, _mm_set1_epi16(static_cast<short>(0x8000)));
+    }
+
+    // ab、cd是两个分量打包后的结果，交错成a0 b0 c0 d0 a1 b1 c1 d1和a2 b2 c2 d2 a3 b3 c3 d3
+    static void interleave_u16(const __m128i ab, const __m128i cd, __m128i& v01, __m128i& v23)
+    {
+        auto t0 = _mm_unpacklo_epi16(ab, cd);
+        auto t1 = _mm_unpackhi_epi16(ab, cd);
+        v01 = _mm_unpacklo_epi16(t0, t1);
+        v23 = _mm_unpackhi_epi16(t0, t1);
+    }
+
+    static void store_vertex_pair(PackedVertex* dst, const __m128i position, const __m128i normalTangent, const __m128i uv)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi64(position, normalTangent));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst->uv0), uv);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 1), _mm_unpackhi_epi64(position, normalTangent));
+        _mm_storeh_pd(reinterpret_cast<double*>(dst[1].uv0), _mm_castsi128_pd(uv));
+    }
+
+    void encode_vertices(const float* fullVertexData, const uint32_t vertexCount, cr<VertexQuantization> quantization, PackedVertex* dst)
+    {
+        uint32_t i = 0;
+        for (; i + 4 <= vertexCount; i += 4)
+        {
+            auto v = fullVertexData + static_cast<size_t>(i) * MAX_VERTEX_ATTR_STRIDE_F;
+
+            __m128 px, py, pz, pw;
+            load_transposed(v, POSITION_OFFSET_F, px, py, pz, pw);
+            __m128 nx, ny, nz, nw;
+            load_transposed(v, NORMAL_OFFSET_F, nx, ny, nz, nw);
+            __m128 tx, ty, tz, tw;
+            load_transposed(v, TANGENT_OFFSET_F, tx, ty, tz, tw);
+            __m128 u0, v0, u1, v1;
+            load_transposed(v, UV_OFFSET_F, u0, v0, u1, v1);
+
+            auto qx = quantize_unorm16_sse(px, quantization.min[0], quantization.invSize[0]);
+            auto qy = quantize_unorm16_sse(py, quantization.min[1], quantization.invSize[1]);
+            auto qz = quantize_unorm16_sse(pz, quantization.min[2], quantization.invSize[2]);
+            auto tangentSign = _mm_and_si128(_mm_castps_si128(_mm_cmpge_ps(tw, _mm_setzero_ps())), _mm_set1_epi32(0xffff));
+
+            __m128i onx, ony, otx, oty;
+            encode_octahedral_sse(nx, ny, nz, onx, ony);
+            encode_octahedral_sse(tx, ty, tz, otx, oty);
+
+            __m128i position01, position23;
+            interleave_u16(pack_u16(qx, qy), pack_u16(qz, tangentSign), position01, position23);
+            __m128i normalTangent01, normalTangent23;
+            interleave_u16(_mm_packs_epi32(onx, ony), _mm_packs_epi32(otx, oty), normalTangent01, normalTangent23);
+            __m128i uv01, uv23;
+            interleave_u16(pack_u16(float_to_half_sse(u0), float_to_half_sse(v0)), pack_u16(float_to_half_sse(u1), float_to_half_sse(v1)), uv01, uv23);
+
+            store_vertex_pair(dst + i, position01, normalTangent01, uv01);
+            store_vertex_pair(dst + i + 2, position23, normalTangent23, uv23);
+        }
+
+        encode_vertices_reference(fullVertexData + static_cast<size_t>(i) * MAX_VERTEX_ATTR_STRIDE_F, vertexCount - i, quantization, dst + i);
+    }
+
+    void decode_vertex(cr<PackedVertex> vertex, cr<VertexQuantization> quantization, float* fullVertex)
+    {
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            fullVertex[POSITION_OFFSET_F + i] = quantization.min[i] + static_cast<float>(vertex.position[i]) / UNORM16_MAX * quantization.size[i];
+        }
+        fullVertex[POSITION_OFFSET_F + 3] = 1.0f;
+
+        decode_octahedral(vertex.normal, fullVertex + NORMAL_OFFSET_F);
+        fullVertex[NORMAL_OFFSET_F + 3] = 0.0f;
+
+        decode_octahedral(vertex.tangent, fullVertex + TANGENT_OFFSET_F);
+        fullVertex[TANGENT_OFFSET_F + 3] = vertex.position[3] >= 0x8000u ? 1.0f : -1.0f;
+
+        fullVertex[UV_OFFSET_F] = half_to_float(vertex.uv0[0]);
+        fullVertex[UV_OFFSET_F + 1] = half_to_float(vertex.uv0[1]);
+        fullVertex[UV_OFFSET_F + 2] = half_to_float(vertex.uv1[0]);
+        fullVertex[UV_OFFSET_F + 3] = half_to_float(vertex.uv1[1]);
+    }
+
+    // 误差很小，acos(dot)在float精度下不够准，用叉积和点积算角度
+    static float angle_between(const float* a, const float* b)
+    {
+        auto crossX = a[1] * b[2] - a[2] * b[1];
+        auto crossY = a[2] * b[0] - a[0] * b[2];
+        auto crossZ = a[0] * b[1] - a[1] * b[0];
+        auto crossLength = std::sqrt(crossX * crossX + crossY * crossY + crossZ * crossZ);
+        auto dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+
+        return std::atan2(crossLength, dot) * (180.0f / 3.14159265f);
+    }
+
+    VertexEncodingValidation validate_vertex_encoding(const uint32_t count)
+    {
+        VertexEncodingValidation result;
+        result.vertexCount = count;
+
+        std::mt19937 rng(12345);
+        std::uniform_real_distribution<float> positionDist(-50.0f, 50.0f);
+        std::uniform_real_distribution<float> extentsDist(0.1f, 20.0f);
+        std::normal_distribution<float> directionDist(0.0f, 1.0f);
+        std::uniform_real_distribution<float> uvDist(-4.0f, 4.0f);
+
+        Bounds bounds(
+            Vec3(positionDist(rng), positionDist(rng), positionDist(rng)),
+            Vec3(extentsDist(rng), extentsDist(rng), extentsDist(rng)));
+        VertexQuantization quantization(bounds);
+
+        vec<float> vertices(static_cast<size_t>(count) * MAX_VERTEX_ATTR_STRIDE_F);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            auto v = vertices.data() + static_cast<size_t>(i) * MAX_VERTEX_ATTR_STRIDE_F;
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                std::uniform_real_distribution<float> dist(quantization.min[j], quantization.min[j] + quantization.size[j]);
+                v[POSITION_OFFSET_F + j] = dist(rng);
+            }
+            v[POSITION_OFFSET_F + 3] = 1.0f;
+
+            for (auto offset : { NORMAL_OFFSET_F, TANGENT_OFFSET_F })
+            {
+                float length;
+                do
+                {
+                    v[offset] = directionDist(rng);
+                    v[offset + 1] = directionDist(rng);
+                    v[offset + 2] = directionDist(rng);
+                    length = std::sqrt(v[offset] * v[offset] + v[offset + 1] * v[offset + 1] + v[offset + 2] * v[offset + 2]);
+                } while (length < 1e-4f);
+
+                for (uint32_t j = 0; j < 3; ++j)
+                {
+                    v[offset + j] /= length;
+                }
+            }
+            v[NORMAL_OFFSET_F + 3] = 0.0f;
+            v[TANGENT_OFFSET_F + 3] = rng() & 1 ? 1.0f : -1.0f;
+
+            for (uint32_t j = 0; j < 4; ++j)
+            {
+                v[UV_OFFSET_F + j] = uvDist(rng);
+            }
+        }
+
+        vec<PackedVertex> simdResult(count);
+        vec<PackedVertex> referenceResult(count);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        encode_vertices(vertices.data(), count, quantization, simdResult.data());
+        auto simdNs = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+
+        start = std::chrono::high_resolution_clock::now();
+        encode_vertices_reference(vertices.data(), count, quantization, referenceResult.data());
+        auto referenceNs = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+
+        result.simdVerticesPerNs = simdNs > 0.0 ? count / simdNs : 0.0;
+        result.referenceVerticesPerNs = referenceNs > 0.0 ? count / referenceNs : 0.0;
+
+        arr<float, MAX_VERTEX_ATTR_STRIDE_F> decoded;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (std::memcmp(&simdResult[i], &referenceResult[i], sizeof(PackedVertex)) != 0)
+            {
+                result.simdMismatchCount++;
+            }
+
+            auto v = vertices.data() + static_cast<size_t>(i) * MAX_VERTEX_ATTR_STRIDE_F;
+            decode_vertex(simdResult[i], quantization, decoded.data());
+
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                auto error = std::abs(decoded[POSITION_OFFSET_F + j] - v[POSITION_OFFSET_F + j]) * quantization.invSize[j];
+                result.maxPositionError = std::max(result.maxPositionError, error);
+            }
+
+            result.maxNormalError = std::max(result.maxNormalError, angle_between(decoded.data() + NORMAL_OFFSET_F, v + NORMAL_OFFSET_F));
+            result.maxTangentError = std::max(result.maxTangentError, angle_between(decoded.data() + TANGENT_OFFSET_F, v + TANGENT_OFFSET_F));
+            if (decoded[TANGENT_OFFSET_F + 3] != v[TANGENT_OFFSET_F + 3])
+            {
+                result.tangentSignMismatchCount++;
+            }
+
+            for (uint32_t j = 0; j < 4; ++j)
+            {
+                result.maxUvError = std::max(result.maxUvError, std::abs(decoded[UV_OFFSET_F + j] - v[UV_OFFSET_F + j]));
+            }
+        }
+
+        return result;
+    }
+}
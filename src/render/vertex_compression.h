@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+
+#include "const.h"
+#include "math/matrix4x4.h"
+
+namespace op
+{
+    class Bounds;
+
+    // BatchMesh里一个顶点的布局，每个顶点24字节，解码在shaders/lib/batch_rendering.hlsl里
+    // position: xyz按mesh的包围盒归一化到unorm16，w存切线的副法线方向，0是负，65535是正
+    // normal、tangent: 八面体映射后的snorm16
+    // uv0、uv1: half
+    struct PackedVertex
+    {
+        uint16_t position[4];
+        int16_t normal[2];
+        int16_t tangent[2];
+        uint16_t uv0[2];
+        uint16_t uv1[2];
+    };
+    static_assert(sizeof(PackedVertex) == 24);
+
+    // 顶点位置的量化范围，包围盒的某个轴为0时这个轴的量化结果都是0
+    struct VertexQuantization
+    {
+        arr<float, 3> min;
+        arr<float, 3> size;
+        arr<float, 3> invSize;
+
+        explicit VertexQuantization(cr<Bounds> bounds);
+
+        // 把[0, 1]的量化坐标变回模型空间，乘在localToWorld的右边，shader里不需要单独解码位置
+        Matrix4x4 GetDequantizeMatrix() const;
+    };
+
+    // 输入按VERTEX_ATTR_DEFINES展开，每个顶点MAX_VERTEX_ATTR_STRIDE_F个float，法线和切线不需要是单位向量
+    // 每4个顶点一起用SSE编码，剩下的走标量实现，两者结果逐位一致
+    void encode_vertices(const float* fullVertexData, uint32_t vertexCount, cr<VertexQuantization> quantization, PackedVertex* dst);
+    void encode_vertices_reference(const float* fullVertexData, uint32_t vertexCount, cr<VertexQuantization> quantization, PackedVertex* dst);
+    // 和shader里的解码相同，输出按VERTEX_ATTR_DEFINES展开，位置已经变回模型空间
+    void decode_vertex(cr<PackedVertex> vertex, cr<VertexQuantization> quantization, float* fullVertex);
+
+    uint16_t float_to_half(float f);
+    float half_to_float(uint16_t h);
+
+    struct VertexEncodingValidation
+    {
+        uint32_t vertexCount = 0;
+        // SSE和标量实现结果不同的顶点数
+        uint32_t simdMismatchCount = 0;
+        // 相对包围盒大小
+        float maxPositionError = 0;
+        // 角度
+        float maxNormalError = 0;
+        float maxTangentError = 0;
+        uint32_t tangentSignMismatchCount = 0;
+        float maxUvError = 0;
+        double simdVerticesPerNs = 0;
+        double referenceVerticesPerNs = 0;
+    };
+
+    // 编码count个随机顶点再解码，统计往返误差，并比较SSE和标量实现的结果和速度
+    VertexEncodingValidation validate_vertex_encoding(uint32_t count);
+}
@@ -5,6 +5,7 @@
 #include <unordered_map>
 
 #include "utils.h"
+#include "common/chunk_list.h"
 #include "math/math.h"
 #include "render/render_target.h"
 
@@ -65,9 +66,9 @@ namespace op
 
         const vecwp<Object>* allSceneObjs;
         
-        const vecwp<LightComp>* lights;
-        const vecwp<CameraComp>* cameras;
-        const vecwp<RenderComp>* allRenderObjs;
+        const ChunkList<LightComp*>* lights;
+        const ChunkList<CameraComp*>* cameras;
+        const ChunkList<RenderComp*>* allRenderObjs;
         vec<RenderComp*> visibleRenderObjs;
 
         sp<ViewProjInfo> mainVPInfo = nullptr;
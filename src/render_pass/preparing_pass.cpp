@@ -9,6 +9,7 @@
 #include "objects/transform_comp.h"
 #include "const.h"
 #include "material.h"
+#include "occlusion_culling.h"
 #include "objects/render_comp.h"
 #include "render/render_target.h"
 #include "render/gl/gl_cbuffer.h"
@@ -73,11 +74,6 @@ namespace op
         GetRC()->mainVPInfo = GetRC()->camera->CreateVPMatrix();
         GetRC()->mainVPInfo->UpdateFrustumPlanes();
         GetRC()->PushViewProjMatrix(GetRC()->mainVPInfo);
-        auto commonCullJob = GetGR()->GetCullingBuffer(CullingGroup::COMMON)->CreateCullJob(GetRC()->mainVPInfo->frustumPlanes.value());
-        commonCullJob->SetPriority(2);
-        auto commonEncodingJob = GetGR()->GetBatchRenderUnit()->CreateEncodingJob(BatchRenderGroup::COMMON);
-        commonEncodingJob->SetPriority(2);
-        commonCullJob->AppendNext(commonEncodingJob);
         
         // Shadow camera
         auto lightDirection = GetRC()->mainLight ?
@@ -85,20 +81,64 @@ namespace op
             Vec3::One().Normalize();
         GetRC()->shadowVPInfo = GetRC()->camera->CreateShadowVPMatrix(lightDirection);
         GetRC()->shadowVPInfo->UpdateFrustumPlanes();
-        auto shadowCullJob = GetGR()->GetCullingBuffer(CullingGroup::SHADOW)->CreateCullJob(GetRC()->shadowVPInfo->frustumPlanes.value());
-        shadowCullJob->SetPriority(1);
-        auto shadowEncodingJob = GetGR()->GetBatchRenderUnit()->CreateEncodingJob(BatchRenderGroup::SHADOW);
-        shadowEncodingJob->SetPriority(1);
-        shadowCullJob->AppendNext(shadowEncodingJob);
 
-        // commonCullJob->AppendNext(shadowCullJob);
+        auto batchRenderUnit = GetGR()->GetBatchRenderUnit();
+        batchRenderUnit->SetLodCamera(GetRC()->mainVPInfo->viewCenter, GetRC()->mainVPInfo->pMatrix[1][1]);
 
-        GetGR()->GetJobScheduler()->Schedule(commonCullJob);
-        GetGR()->GetJobScheduler()->Schedule(shadowCullJob);
+        // 主相机和阴影的视锥在同一个job里剔除，顺序和get_culling_view_index一致
+        vec<arr<Vec4, 6>> opaqueViewPlanes = {
+            GetRC()->mainVPInfo->frustumPlanes.value(),
+            GetRC()->shadowVPInfo->frustumPlanes.value()
+        };
+        auto opaqueCullingBuffer = GetGR()->GetCullingBuffer(CullingGroup::COMMON);
+
+        if (batchRenderUnit->IsGpuCullingEnabled())
+        {
+            // 剔除和编码都在BatchRenderUnit::Execute里交给GPU，CPU的剔除结果用不上，不创建剔除和遮挡剔除的job
+            // 这样也不会有job在下一帧开始时还在读写剔除数据
+            opaqueCullingBuffer->PrepareGpuCull(opaqueViewPlanes);
+            batchRenderUnit->CreateEncodingJob(BatchRenderGroup::COMMON);
+            batchRenderUnit->CreateEncodingJob(BatchRenderGroup::SHADOW);
+        }
+        else
+        {
+            auto opaqueCullJob = opaqueCullingBuffer->CreateCullJob(opaqueViewPlanes);
+            opaqueCullJob->SetPriority(2);
+
+            auto occlusionCulling = GetGR()->GetOcclusionCulling();
+            if (occlusionCulling->IsEnabled())
+            {
+                // 遮挡物的光栅化和视锥剔除同时进行，都完成后再用hi-z剔除主相机看到的物体
+                auto occlusionRasterJob = occlusionCulling->CreateRasterJob(GetRC()->mainVPInfo->vpMatrix);
+                occlusionRasterJob->SetPriority(2);
+                auto occlusionTestJob = occlusionCulling->CreateTestJob(
+                    opaqueCullingBuffer,
+                    get_culling_view_index(CullingGroup::COMMON));
+                occlusionTestJob->SetPriority(2);
+                opaqueCullJob->AppendNext(occlusionTestJob);
+
+                auto commonEncodingJob = batchRenderUnit->CreateEncodingJob(BatchRenderGroup::COMMON, occlusionCulling->GetVisibleWords());
+                commonEncodingJob->SetPriority(2);
+                occlusionTestJob->AppendNext(commonEncodingJob);
+
+                GetGR()->GetJobScheduler()->Schedule(occlusionRasterJob);
+            }
+            else
+            {
+                auto commonEncodingJob = batchRenderUnit->CreateEncodingJob(BatchRenderGroup::COMMON);
+                commonEncodingJob->SetPriority(2);
+                opaqueCullJob->AppendNext(commonEncodingJob);
+            }
+            auto shadowEncodingJob = batchRenderUnit->CreateEncodingJob(BatchRenderGroup::SHADOW);
+            shadowEncodingJob->SetPriority(1);
+            opaqueCullJob->AppendNext(shadowEncodingJob);
+
+            GetGR()->GetJobScheduler()->Schedule(opaqueCullJob);
+        }
 
         // GetGR()->GetCullingSystem()->Cull();
 
-        auto transparentCullJob = GetGR()->GetCullingBuffer(CullingGroup::TRANSPARENT)->CreateCullJob(GetRC()->mainVPInfo->frustumPlanes.value());
+        auto transparentCullJob = GetGR()->GetCullingBuffer(CullingGroup::TRANSPARENT)->CreateCullJob({ GetRC()->mainVPInfo->frustumPlanes.value() });
         GetGR()->GetJobScheduler()->Schedule(transparentCullJob);
     }
 
@@ -156,24 +196,23 @@ namespace op
 
         auto globalCBuffer = GetGR()->GetPredefinedCbuffer(GLOBAL_CBUFFER);
 
-        for (const auto& lightPtr : *GetRC()->lights)
+        for (auto light : *GetRC()->lights)
         {
-            auto light = lightPtr.lock();
             constexpr int maxPointLights = 16;
             constexpr int maxParallelLights = 4;
             if (light->lightType == 0 && parallelLights.size() < maxParallelLights)
             {
                 if (!GetRC()->mainLight)
                 {
-                    GetRC()->mainLight = light.get();
+                    GetRC()->mainLight = light;
                     globalCBuffer->Set(MAIN_LIGHT_DIRECTION, Vec4(-light->GetOwner()->transform->GetLocalToWorld().Forward(), 0));
                 }
 
-                parallelLights.push_back(light.get());
+                parallelLights.push_back(light);
             }
             else if (light->lightType == 1 && pointLights.size() < maxPointLights)
             {
-                pointLights.push_back(light.get());
+                pointLights.push_back(light);
             }
         }
 
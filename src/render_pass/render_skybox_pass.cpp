@@ -48,7 +48,7 @@ namespace op
 
         PerObjectBuffer::Elem submitBuffer;
         submitBuffer.localToWorld = Matrix4x4::TRS(camera->GetOwner()->transform->GetWorldPosition(), Quaternion::Identity(), Vec3::One());
-        submitBuffer.worldToLocal = submitBuffer.localToWorld.Inverse();
+        submitBuffer.worldToLocal = submitBuffer.localToWorld.AffineInverse();
         GetGR()->GetPerObjectBuffer()->SubmitData(m_objectIndex, submitBuffer);
 
         RenderingUtils::RenderMesh({
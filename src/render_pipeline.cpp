@@ -3,6 +3,7 @@
 #include <tracy/Tracy.hpp>
 
 #include "culling_system.h"
+#include "game_resource.h"
 #include "render_texture.h"
 #include "gui.h"
 
@@ -13,6 +14,7 @@
 #include "objects/light_comp.h"
 #include "objects/camera_comp.h"
 #include "objects/render_comp.h"
+#include "render/batch_render_unit.h"
 #include "render/render_target.h"
 #include "render/texture_set.h"
 #include "render/gl/gl_state.h"
@@ -94,6 +96,8 @@ namespace op
         RenderUiPass(m_renderContext.get());
         end_debug_group();
 
+        GetGR()->GetBatchRenderUnit()->EndFrame();
+
         GlState::Ins()->Reset();
         //
         // GL_CHECK_ERROR(帧绘制结束)
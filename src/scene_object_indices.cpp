@@ -9,8 +9,6 @@
 
 namespace op
 {
-    umap<std::type_index, CompStorage::CompsAccessor> CompStorage::m_compAccessors = {};
-    
     SceneObjectIndices::SceneObjectIndices(crsp<Scene> scene)
     {
         m_scene = scene;
@@ -94,6 +92,7 @@ namespace op
                 return (cameraPos - xPos).Magnitude() >= (cameraPos - yPos).Magnitude();
             });
         });
+        m_transparentSortJob->SetName("Transparent Sort");
         return m_transparentSortJob;
     }
 
@@ -79,6 +79,8 @@ namespace op
         // Load CBuffer
         result->LoadCBuffer(vertShaderResources);
         result->LoadCBuffer(fragShaderResources);
+        result->LoadBatchMaterialParams(vertCompilerGlsl, vertShaderResources);
+        result->LoadBatchMaterialParams(fragCompilerGlsl, fragShaderResources);
 
         // Load Textures
         result->LoadTextures(vertCompilerGlsl, vertShaderResources);
@@ -132,6 +134,48 @@ namespace op
         }
     }
 
+    void Shader::LoadBatchMaterialParams(
+        cr<spirv_cross::CompilerGLSL> compiler,
+        cr<spirv_cross::ShaderResources> resources)
+    {
+        if (batchMaterialParams)
+        {
+            return;
+        }
+
+        for (const auto& buffer : resources.storage_buffers)
+        {
+            if (StringHandle(buffer.name) != BATCH_MATERIAL_PARAMS)
+            {
+                continue;
+            }
+
+            // StructuredBuffer编译出来是一个只有运行时数组成员的block，数组元素才是材质参数的结构体
+            const auto& blockType = compiler.get_type(buffer.base_type_id);
+            const auto& arrayType = compiler.get_type(blockType.member_types[0]);
+            const auto& elemType = compiler.get_type(arrayType.parent_type);
+
+            auto layout = msp<CBufferLayout>();
+            layout->name = BATCH_MATERIAL_PARAMS;
+            layout->sizeB = compiler.type_struct_member_array_stride(blockType, 0);
+            layout->binding = compiler.get_decoration(buffer.id, spv::DecorationBinding);
+
+            for (uint32_t i = 0; i < elemType.member_types.size(); ++i)
+            {
+                CBufferParam param;
+                param.name = compiler.get_member_name(elemType.self, i);
+                param.offsetB = compiler.type_struct_member_offset(elemType, i);
+                param.sizeB = static_cast<uint32_t>(compiler.get_declared_struct_member_size(elemType, i));
+                param.blockNameId = layout->name.Hash();
+
+                layout->params[param.name.Hash()] = param;
+            }
+
+            batchMaterialParams = layout;
+            return;
+        }
+    }
+
     void Shader::LoadTextures(
         cr<spirv_cross::CompilerGLSL> compiler,
         cr<spirv_cross::ShaderResources> resources)
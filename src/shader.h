@@ -29,6 +29,8 @@ namespace op
 
         TextureSet textures;
         umap<string_hash, sp<CBufferLayout>> cbuffers;
+        // 合批变体的材质参数不在cbuffer里，而是放在按材质下标索引的_BatchMaterialParams里，这里是一个元素的布局，sizeB是元素的跨度
+        sp<CBufferLayout> batchMaterialParams = nullptr;
 
         Shader();
 
@@ -55,6 +57,7 @@ namespace op
         void SetValImp(string_hash nameId, const T& value, GlSetValueFunc&& glSetValue);
 
         void LoadCBuffer(cr<spirv_cross::ShaderResources> resources);
+        void LoadBatchMaterialParams(cr<spirv_cross::CompilerGLSL> compiler, cr<spirv_cross::ShaderResources> resources);
         void LoadTextures(cr<spirv_cross::CompilerGLSL> compiler, cr<spirv_cross::ShaderResources> resources);
         void CreatePredefinedCBuffer(cr<StringHandle> uniformBufferName);
 
@@ -0,0 +1,636 @@
+#include "transform_system.h"
+
+#include <chrono>
+#include <random>
+#include <tracy/Tracy.hpp>
+
+#include "game_resource.h"
+
+namespace op
+{
+    template <typename T>
+    static void permute(vec<T>& column, crvec<uint32_t> order)
+    {
+        vec<T> sorted;
+        sorted.reserve(order.size());
+        for (auto index : order)
+        {
+            sorted.push_back(column[index]);
+        }
+        column.swap(sorted);
+    }
+
+    // parent必须是仿射矩阵，结果也是仿射矩阵，parent为空时直接输出TRS
+    static void compose_trs(const Matrix4x4* parent, cr<Vec3> t, cr<Vec4> q, cr<Vec3> s, Matrix4x4& dst)
+    {
+        auto x2 = q.x * q.x;
+        auto y2 = q.y * q.y;
+        auto z2 = q.z * q.z;
+        auto xy = q.x * q.y;
+        auto xz = q.x * q.z;
+        auto xw = q.x * q.w;
+        auto yz = q.y * q.z;
+        auto yw = q.y * q.w;
+        auto zw = q.z * q.w;
+
+        // 每一行的旋转部分乘上对应列的缩放，平移放在第4列
+        auto scale = _mm_setr_ps(s.x, s.y, s.z, 1.0f);
+        auto r0 = _mm_mul_ps(_mm_setr_ps(1 - 2 * (y2 + z2), 2 * (xy - zw), 2 * (xz + yw), t.x), scale);
+        auto r1 = _mm_mul_ps(_mm_setr_ps(2 * (xy + zw), 1 - 2 * (x2 + z2), 2 * (yz - xw), t.y), scale);
+        auto r2 = _mm_mul_ps(_mm_setr_ps(2 * (xz - yw), 2 * (yz + xw), 1 - 2 * (x2 + y2), t.z), scale);
+        auto r3 = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+
+        auto out = dst.GetData();
+        if (!parent)
+        {
+            _mm_store_ps(out, r0);
+            _mm_store_ps(out + 4, r1);
+            _mm_store_ps(out + 8, r2);
+            _mm_store_ps(out + 12, r3);
+            return;
+        }
+
+        // 结果的第i行是parent第i行的4个元素分别乘上局部矩阵的4行再相加
+        auto p = parent->GetReadOnlyData();
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            auto row = _mm_mul_ps(_mm_set1_ps(p[i * 4]), r0);
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(p[i * 4 + 1]), r1));
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(p[i * 4 + 2]), r2));
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(p[i * 4 + 3]), r3));
+            _mm_store_ps(out + i * 4, row);
+        }
+        _mm_store_ps(out + 12, r3);
+    }
+
+    static Vec4 normalized_rotation(cr<Quaternion> rotation)
+    {
+        auto q = rotation;
+        return q.GetNormalizedData();
+    }
+
+    TransformSystem::TransformSystem() = default;
+
+    TransformSystem::~TransformSystem() = default;
+
+    uint32_t TransformSystem::Add(const uint32_t parentHandle, TransformComp* comp)
+    {
+        uint32_t handle;
+        if (!m_freeHandles.empty())
+        {
+            handle = m_freeHandles.back();
+            m_freeHandles.pop_back();
+        }
+        else
+        {
+            handle = static_cast<uint32_t>(m_handleToIndex.size());
+            m_handleToIndex.push_back(NONE);
+            m_handleComps.push_back(nullptr);
+        }
+        m_handleComps[handle] = comp;
+
+        auto index = static_cast<uint32_t>(m_parents.size());
+        m_handleToIndex[handle] = index;
+        m_parents.push_back(parentHandle == INVALID_HANDLE ? NONE : m_handleToIndex[parentHandle]);
+        m_handles.push_back(handle);
+        m_flags.push_back(0);
+        m_positions.emplace_back();
+        m_rotations.emplace_back(0.0f, 0.0f, 0.0f, 1.0f);
+        m_scales.emplace_back(1.0f);
+        m_localToWorld.push_back(Matrix4x4::Identity());
+        m_worldToLocal.push_back(Matrix4x4::Identity());
+        MarkChanged(index);
+
+        m_structureDirty = true;
+
+        return handle;
+    }
+
+    void TransformSystem::Remove(const uint32_t handle)
+    {
+        auto index = m_handleToIndex[handle];
+        m_flags[index] = DEAD;
+        m_handleToIndex[handle] = NONE;
+        m_handleComps[handle] = nullptr;
+        m_pendingFreeHandles.push_back(handle);
+        m_structureDirty = true;
+    }
+
+    void TransformSystem::SetParent(const uint32_t handle, const uint32_t parentHandle)
+    {
+        auto index = m_handleToIndex[handle];
+        m_parents[index] = parentHandle == INVALID_HANDLE ? NONE : m_handleToIndex[parentHandle];
+        m_structureDirty = true;
+    }
+
+    void TransformSystem::SetLocalPosition(const uint32_t handle, cr<Vec3> position)
+    {
+        auto index = m_handleToIndex[handle];
+        m_positions[index] = position;
+        m_flags[index] &= ~WORLD_POSITION_PENDING;
+    }
+
+    void TransformSystem::SetLocalRotation(const uint32_t handle, cr<Quaternion> rotation)
+    {
+        m_rotations[m_handleToIndex[handle]] = normalized_rotation(rotation);
+    }
+
+    void TransformSystem::SetLocalScale(const uint32_t handle, cr<Vec3> scale)
+    {
+        m_scales[m_handleToIndex[handle]] = scale;
+    }
+
+    void TransformSystem::SetWorldPosition(const uint32_t handle, cr<Vec3> position)
+    {
+        auto index = m_handleToIndex[handle];
+        m_positions[index] = position;
+        m_flags[index] |= WORLD_POSITION_PENDING;
+    }
+
+    Vec3 TransformSystem::GetLocalPosition(const uint32_t handle)
+    {
+        auto index = m_handleToIndex[handle];
+        if (m_flags[index] & WORLD_POSITION_PENDING)
+        {
+            UpdateRecursive(index);
+        }
+
+        return m_positions[index];
+    }
+
+    bool TransformSystem::MarkDirty(const uint32_t handle)
+    {
+        auto index = m_handleToIndex[handle];
+        if ((m_flags[index] & (DIRTY | CHANGED)) == (DIRTY | CHANGED))
+        {
+            return false;
+        }
+
+        MarkChanged(index);
+
+        return true;
+    }
+
+    void TransformSystem::ClearChanged()
+    {
+        for (auto handle : m_changedHandles)
+        {
+            auto index = m_handleToIndex[handle];
+            if (index != NONE)
+            {
+                m_flags[index] &= ~CHANGED;
+            }
+        }
+
+        m_lastChangedCount = static_cast<uint32_t>(m_changedHandles.size());
+        m_changedHandles.clear();
+    }
+
+    void TransformSystem::MarkChanged(const uint32_t index)
+    {
+        m_flags[index] |= DIRTY;
+        m_anyDirty = true;
+
+        if (!(m_flags[index] & CHANGED))
+        {
+            m_flags[index] |= CHANGED;
+            m_changedHandles.push_back(m_handles[index]);
+        }
+    }
+
+    cr<Matrix4x4> TransformSystem::GetLocalToWorld(const uint32_t handle)
+    {
+        auto index = m_handleToIndex[handle];
+        UpdateRecursive(index);
+
+        return m_localToWorld[index];
+    }
+
+    cr<Matrix4x4> TransformSystem::GetWorldToLocal(const uint32_t handle)
+    {
+        auto index = m_handleToIndex[handle];
+        UpdateRecursive(index);
+
+        return m_worldToLocal[index];
+    }
+
+    bool TransformSystem::HasOddNegativeScale(const uint32_t handle)
+    {
+        auto index = m_handleToIndex[handle];
+        UpdateRecursive(index);
+
+        return m_flags[index] & ODD_NEGATIVE_SCALE;
+    }
+
+    void TransformSystem::UpdateDirty()
+    {
+        ZoneScoped;
+
+        if (m_structureDirty)
+        {
+            Rebuild();
+        }
+
+        if (!m_anyDirty)
+        {
+            return;
+        }
+        m_anyDirty = false;
+
+        UpdateLevels(true);
+    }
+
+    void TransformSystem::Rebuild()
+    {
+        ZoneScoped;
+
+        m_structureDirty = false;
+
+        // 父节点被删掉的节点变成根节点，它的世界矩阵也就变了
+        auto count = static_cast<uint32_t>(m_parents.size());
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            auto parent = m_parents[i];
+            if (!(m_flags[i] & DEAD) && parent != NONE && (m_flags[parent] & DEAD))
+            {
+                m_parents[i] = NONE;
+                MarkChanged(i);
+            }
+        }
+
+        // 沿着父节点往上走到深度已知的节点，再往回填，每个节点只算一次
+        vec<uint32_t> depths(count, NONE);
+        vec<uint32_t> chain;
+        uint32_t maxDepth = 0;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (m_flags[i] & DEAD)
+            {
+                continue;
+            }
+
+            auto cur = i;
+            while (cur != NONE && depths[cur] == NONE)
+            {
+                chain.push_back(cur);
+                cur = m_parents[cur];
+            }
+
+            auto depth = cur == NONE ? 0 : depths[cur] + 1;
+            for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+            {
+                depths[*it] = depth++;
+            }
+            chain.clear();
+            maxDepth = std::max(maxDepth, depths[i]);
+        }
+
+        // 按深度计数排序，同一层里保持原来的顺序
+        m_levelStarts.assign(static_cast<size_t>(maxDepth) + 2, 0);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (depths[i] != NONE)
+            {
+                m_levelStarts[depths[i] + 1]++;
+            }
+        }
+        for (uint32_t d = 1; d < m_levelStarts.size(); ++d)
+        {
+            m_levelStarts[d] += m_levelStarts[d - 1];
+        }
+
+        auto liveCount = m_levelStarts.back();
+        vec<uint32_t> order(liveCount);
+        vec<uint32_t> oldToNew(count, NONE);
+        auto cursors = m_levelStarts;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (depths[i] != NONE)
+            {
+                auto newIndex = cursors[depths[i]]++;
+                order[newIndex] = i;
+                oldToNew[i] = newIndex;
+            }
+        }
+
+        permute(m_parents, order);
+        permute(m_handles, order);
+        permute(m_flags, order);
+        permute(m_positions, order);
+        permute(m_rotations, order);
+        permute(m_scales, order);
+        permute(m_localToWorld, order);
+        permute(m_worldToLocal, order);
+
+        for (uint32_t i = 0; i < liveCount; ++i)
+        {
+            if (m_parents[i] != NONE)
+            {
+                m_parents[i] = oldToNew[m_parents[i]];
+            }
+            m_handleToIndex[m_handles[i]] = i;
+        }
+
+        // 变成根节点或者换了父节点的子树只标记了子树的根，父节点一定排在前面，顺序扫一遍把dirty传下去
+        for (uint32_t i = 0; i < liveCount; ++i)
+        {
+            auto parent = m_parents[i];
+            if (parent != NONE && (m_flags[parent] & DIRTY) && !(m_flags[i] & DIRTY))
+            {
+                MarkChanged(i);
+            }
+        }
+
+        m_freeHandles.insert(m_freeHandles.end(), m_pendingFreeHandles.begin(), m_pendingFreeHandles.end());
+        m_pendingFreeHandles.clear();
+    }
+
+    void TransformSystem::UpdateLevels(const bool parallel)
+    {
+        auto jobScheduler = GetGR()->GetJobScheduler();
+        for (uint32_t level = 0; level + 1 < m_levelStarts.size(); ++level)
+        {
+            auto start = m_levelStarts[level];
+            auto end = m_levelStarts[level + 1];
+
+            if (!parallel || end - start < MIN_PARALLEL_LEVEL_SIZE)
+            {
+                for (auto i = start; i < end; ++i)
+                {
+                    if (m_flags[i] & DIRTY)
+                    {
+                        UpdateNode(i);
+                    }
+                }
+                continue;
+            }
+
+            // 同一层的节点只读父节点，写自己的那一项，可以任意切分
+            auto job = Job::CreateParallel(end - start, [this, start](const uint32_t batchStart, const uint32_t batchEnd)
+            {
+                for (auto i = start + batchStart; i < start + batchEnd; ++i)
+                {
+                    if (m_flags[i] & DIRTY)
+                    {
+                        UpdateNode(i);
+                    }
+                }
+            });
+            job->SetName("Update Transforms");
+            job->SetMinBatchSize(256);
+            jobScheduler->Schedule(job);
+            job->WaitForStop();
+        }
+    }
+
+    void TransformSystem::UpdateRecursive(const uint32_t index)
+    {
+        if (!(m_flags[index] & DIRTY))
+        {
+            return;
+        }
+
+        // 父节点还是dirty的话先递归地更新父节点
+        auto parent = m_parents[index];
+        if (parent != NONE)
+        {
+            UpdateRecursive(parent);
+        }
+
+        UpdateNode(index);
+    }
+
+    void TransformSystem::UpdateNode(const uint32_t index)
+    {
+        auto parent = m_parents[index];
+        auto flags = m_flags[index];
+
+        if (flags & WORLD_POSITION_PENDING)
+        {
+            if (parent != NONE)
+            {
+                m_positions[index] = (m_worldToLocal[parent] * Vec4(m_positions[index], 1.0f)).ToVec3();
+            }
+        }
+
+        auto& localToWorld = m_localToWorld[index];
+        compose_trs(parent != NONE ? &m_localToWorld[parent] : nullptr, m_positions[index], m_rotations[index], m_scales[index], localToWorld);
+        m_worldToLocal[index] = localToWorld.AffineInverse();
+
+        flags &= ~(DIRTY | WORLD_POSITION_PENDING | ODD_NEGATIVE_SCALE);
+        if (localToWorld.Determinant3() < 0)
+        {
+            flags |= ODD_NEGATIVE_SCALE;
+        }
+        m_flags[index] = flags;
+    }
+
+    TransformSystem::BenchmarkResult TransformSystem::Benchmark(const uint32_t nodeCount)
+    {
+        // 原来TransformComp::UpdateMatrix的做法
+        struct RecursiveNode
+        {
+            RecursiveNode* parent = nullptr;
+            Vec3 position;
+            Quaternion rotation;
+            Vec3 scale;
+            Matrix4x4 localToWorld;
+            Matrix4x4 worldToLocal;
+            bool dirty = true;
+
+            cr<Matrix4x4> GetLocalToWorld()
+            {
+                if (dirty)
+                {
+                    dirty = false;
+                    auto parentLocalToWorld = parent ? parent->GetLocalToWorld() : Matrix4x4::Identity();
+                    localToWorld = parentLocalToWorld * Matrix4x4::TRS(position, rotation, scale);
+                    worldToLocal = localToWorld.Inverse();
+                }
+
+                return localToWorld;
+            }
+        };
+
+        // 每个节点的父节点在它之前随机挑选，得到的树大约有2ln(n)层
+        std::mt19937 random(12345);
+        std::uniform_real_distribution positionDist(-10.0f, 10.0f);
+        std::uniform_real_distribution angleDist(-180.0f, 180.0f);
+        std::uniform_real_distribution scaleDist(0.8f, 1.25f);
+
+        vec<RecursiveNode> recursiveNodes(nodeCount);
+        TransformSystem system;
+        vec<uint32_t> handles(nodeCount);
+        for (uint32_t i = 0; i < nodeCount; ++i)
+        {
+            auto parent = i == 0 ? NONE : static_cast<uint32_t>(random() % i);
+            auto position = Vec3(positionDist(random), positionDist(random), positionDist(random));
+            auto rotation = Quaternion::Euler(angleDist(random), angleDist(random), angleDist(random));
+            auto scale = Vec3(scaleDist(random), scaleDist(random), scaleDist(random));
+
+            auto& node = recursiveNodes[i];
+            node.parent = parent == NONE ? nullptr : &recursiveNodes[parent];
+            node.position = position;
+            node.rotation = rotation;
+            node.scale = scale;
+
+            handles[i] = system.Add(parent == NONE ? INVALID_HANDLE : handles[parent]);
+            system.SetLocalPosition(handles[i], position);
+            system.SetLocalRotation(handles[i], rotation);
+            system.SetLocalScale(handles[i], scale);
+        }
+        system.Rebuild();
+
+        auto measure = [](auto&& reset, auto&& f)
+        {
+            auto bestMs = std::numeric_limits<double>::max();
+            for (uint32_t i = 0; i < 3; ++i)
+            {
+                reset();
+                auto begin = std::chrono::steady_clock::now();
+                f();
+                auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                bestMs = std::min(bestMs, ms);
+            }
+            return bestMs;
+        };
+
+        auto markAllDirty = [&]
+        {
+            for (auto& flags : system.m_flags)
+            {
+                flags |= DIRTY;
+            }
+        };
+
+        BenchmarkResult result;
+        result.nodeCount = nodeCount;
+        result.levelCount = system.GetLevelCount();
+        result.recursiveMs = measure([&]
+        {
+            for (auto& node : recursiveNodes)
+            {
+                node.dirty = true;
+            }
+        }, [&]
+        {
+            for (auto& node : recursiveNodes)
+            {
+                node.GetLocalToWorld();
+            }
+        });
+        result.serialMs = measure(markAllDirty, [&]
+        {
+            system.UpdateLevels(false);
+        });
+        result.parallelMs = measure(markAllDirty, [&]
+        {
+            system.UpdateLevels(true);
+        });
+
+        for (uint32_t i = 0; i < nodeCount; ++i)
+        {
+            auto expected = recursiveNodes[i].localToWorld.GetReadOnlyData();
+            auto actual = system.GetLocalToWorld(handles[i]).GetReadOnlyData();
+            for (uint32_t j = 0; j < 16; ++j)
+            {
+                result.maxError = std::max(result.maxError, std::abs(expected[j] - actual[j]));
+            }
+        }
+
+        return result;
+    }
+
+    TransformSystem::InverseBenchmarkResult TransformSystem::BenchmarkInverse(const uint32_t count)
+    {
+        // 两个带非均匀缩放的TRS相乘，得到带切变的仿射矩阵，和层级里的世界矩阵一样
+        std::mt19937 random(12345);
+        std::uniform_real_distribution positionDist(-10.0f, 10.0f);
+        std::uniform_real_distribution angleDist(-180.0f, 180.0f);
+        std::uniform_real_distribution scaleDist(0.8f, 1.25f);
+
+        struct Trs
+        {
+            Vec3 position;
+            Quaternion rotation;
+            Vec3 scale;
+        };
+
+        vec<Trs> locals(count);
+        vec<Matrix4x4> matrices(count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            auto parent = Matrix4x4::TRS(
+                Vec3(positionDist(random), positionDist(random), positionDist(random)),
+                Quaternion::Euler(angleDist(random), angleDist(random), angleDist(random)),
+                Vec3(scaleDist(random), scaleDist(random), -scaleDist(random)));
+            auto& local = locals[i];
+            local.position = Vec3(positionDist(random), positionDist(random), positionDist(random));
+            local.rotation = Quaternion::Euler(angleDist(random), angleDist(random), angleDist(random));
+            local.scale = Vec3(scaleDist(random), scaleDist(random), scaleDist(random));
+            matrices[i] = parent * Matrix4x4::TRS(local.position, local.rotation, local.scale);
+        }
+
+        vec<Matrix4x4> general(count);
+        vec<Matrix4x4> affine(count);
+        vec<Matrix4x4> trs(count);
+
+        auto measure = [](auto&& f)
+        {
+            auto bestMs = std::numeric_limits<double>::max();
+            for (uint32_t i = 0; i < 3; ++i)
+            {
+                auto begin = std::chrono::steady_clock::now();
+                f();
+                auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                bestMs = std::min(bestMs, ms);
+            }
+            return bestMs;
+        };
+
+        InverseBenchmarkResult result;
+        result.count = count;
+        result.generalMs = measure([&]
+        {
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                general[i] = matrices[i].Inverse();
+            }
+        });
+        result.affineMs = measure([&]
+        {
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                affine[i] = matrices[i].AffineInverse();
+            }
+        });
+        result.trsMs = measure([&]
+        {
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                auto& local = locals[i];
+                trs[i] = Matrix4x4::InverseTRS(local.position, local.rotation, local.scale);
+            }
+        });
+
+        auto maxDiff = [](cr<Matrix4x4> x, cr<Matrix4x4> y)
+        {
+            auto diff = 0.0f;
+            for (uint32_t j = 0; j < 16; ++j)
+            {
+                diff = std::max(diff, std::abs(x.GetReadOnlyData()[j] - y.GetReadOnlyData()[j]));
+            }
+            return diff;
+        };
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            auto& local = locals[i];
+            result.affineMaxError = std::max(result.affineMaxError, maxDiff(general[i], affine[i]));
+            auto trsGeneral = Matrix4x4::TRS(local.position, local.rotation, local.scale).Inverse();
+            result.trsMaxError = std::max(result.trsMaxError, maxDiff(trsGeneral, trs[i]));
+        }
+
+        return result;
+    }
+}
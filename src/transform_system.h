@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+
+#include "const.h"
+#include "math/matrix4x4.h"
+
+namespace op
+{
+    class TransformComp;
+
+    // 所有TransformComp的局部TRS、世界矩阵和父节点都存在这里，按深度排好序，每个数组一项
+    // 同一层的节点互不依赖，每帧按层并行更新dirty的节点，父节点一定在前面的层里已经算完
+    // 帧中途读取dirty节点的矩阵时沿着父节点递归更新，和原来TransformComp的做法相同
+    // 外部持有的是handle，增删和改父节点后下标会在下一次UpdateDirty时重新排序，handle不变
+    class TransformSystem final
+    {
+    public:
+        static constexpr uint32_t INVALID_HANDLE = ~0u;
+
+        TransformSystem();
+        ~TransformSystem();
+        TransformSystem(const TransformSystem& other) = delete;
+        TransformSystem(TransformSystem&& other) noexcept = delete;
+        TransformSystem& operator=(const TransformSystem& other) = delete;
+        TransformSystem& operator=(TransformSystem&& other) noexcept = delete;
+
+        // parentHandle为INVALID_HANDLE时是根节点，新节点是dirty的，也会出现在这一帧的变化列表里
+        uint32_t Add(uint32_t parentHandle, TransformComp* comp = nullptr);
+        // 还活着的子节点在下一次UpdateDirty时变成根节点
+        void Remove(uint32_t handle);
+        void SetParent(uint32_t handle, uint32_t parentHandle);
+
+        // 只修改这个节点的值，不标记dirty，子节点由调用者通过MarkDirty标记
+        void SetLocalPosition(uint32_t handle, cr<Vec3> position);
+        void SetLocalRotation(uint32_t handle, cr<Quaternion> rotation);
+        void SetLocalScale(uint32_t handle, cr<Vec3> scale);
+        // 下一次更新这个节点时用父节点的worldToLocal换算成局部坐标
+        void SetWorldPosition(uint32_t handle, cr<Vec3> position);
+        Vec3 GetLocalPosition(uint32_t handle);
+
+        // 标记dirty并加入这一帧的变化列表，返回false表示已经在列表里并且还是dirty的，它的子节点也不用再标记
+        bool MarkDirty(uint32_t handle);
+        bool IsDirty(const uint32_t handle) const { return m_flags[m_handleToIndex[handle]] & DIRTY; }
+
+        // 上一次ClearChanged之后标记过的节点，每个节点只出现一次，可能包含已经删掉的节点
+        crvec<uint32_t> GetChangedHandles() const { return m_changedHandles; }
+        // 已经删掉的节点返回nullptr
+        TransformComp* GetComp(const uint32_t handle) const { return m_handleComps[handle]; }
+        void ClearChanged();
+        uint32_t GetLastChangedCount() const { return m_lastChangedCount; }
+
+        // 返回的引用在下一次增删节点或者UpdateDirty之前有效
+        cr<Matrix4x4> GetLocalToWorld(uint32_t handle);
+        cr<Matrix4x4> GetWorldToLocal(uint32_t handle);
+        bool HasOddNegativeScale(uint32_t handle);
+
+        // 每帧Update之后调用一次，结构变了先按深度重新排序，再逐层更新所有dirty的节点
+        void UpdateDirty();
+
+        uint32_t GetNodeCount() const { return static_cast<uint32_t>(m_parents.size()); }
+        uint32_t GetLevelCount() const { return m_levelStarts.empty() ? 0 : static_cast<uint32_t>(m_levelStarts.size() - 1); }
+
+        struct BenchmarkResult
+        {
+            uint32_t nodeCount = 0;
+            uint32_t levelCount = 0;
+            // 原来TransformComp的做法，按创建顺序逐个读取世界矩阵，递归更新父节点
+            double recursiveMs = 0;
+            double serialMs = 0;
+            double parallelMs = 0;
+            // 和递归结果的最大差值
+            float maxError = 0;
+        };
+
+        // 随机生成nodeCount个节点的树，全部标记dirty后分别用三种方式更新
+        static BenchmarkResult Benchmark(uint32_t nodeCount);
+
+        struct InverseBenchmarkResult
+        {
+            uint32_t count = 0;
+            double generalMs = 0;
+            double affineMs = 0;
+            // 直接从局部TRS求逆
+            double trsMs = 0;
+            // 和Inverse结果的最大差值
+            float affineMaxError = 0;
+            float trsMaxError = 0;
+        };
+
+        // 对count个带切变和负缩放的仿射矩阵比较Inverse、AffineInverse和InverseTRS
+        static InverseBenchmarkResult BenchmarkInverse(uint32_t count);
+
+    private:
+        static constexpr uint32_t NONE = ~0u;
+        static constexpr uint8_t DIRTY = 1 << 0;
+        static constexpr uint8_t WORLD_POSITION_PENDING = 1 << 1;
+        static constexpr uint8_t ODD_NEGATIVE_SCALE = 1 << 2;
+        static constexpr uint8_t DEAD = 1 << 3;
+        static constexpr uint8_t CHANGED = 1 << 4;
+        // 节点数少于这个的层直接在当前线程更新
+        static constexpr uint32_t MIN_PARALLEL_LEVEL_SIZE = 1024;
+
+        // 下面的数组都按下标对应，Rebuild之后按深度有序，新加的节点先追加在最后
+        vec<uint32_t> m_parents;
+        vec<uint32_t> m_handles;
+        vec<uint8_t> m_flags;
+        vec<Vec3> m_positions;
+        // 归一化的四元数
+        vec<Vec4> m_rotations;
+        vec<Vec3> m_scales;
+        vec<Matrix4x4> m_localToWorld;
+        vec<Matrix4x4> m_worldToLocal;
+
+        // 第i层是[m_levelStarts[i], m_levelStarts[i + 1])
+        vec<uint32_t> m_levelStarts;
+        bool m_structureDirty = false;
+        bool m_anyDirty = false;
+
+        vec<uint32_t> m_handleToIndex;
+        vec<uint32_t> m_freeHandles;
+        // 被删掉的节点可能还是别的节点的父节点，Rebuild处理完之后handle才能复用
+        vec<uint32_t> m_pendingFreeHandles;
+        vec<TransformComp*> m_handleComps;
+
+        vec<uint32_t> m_changedHandles;
+        uint32_t m_lastChangedCount = 0;
+
+        void MarkChanged(uint32_t index);
+        void Rebuild();
+        void UpdateLevels(bool parallel);
+        void UpdateRecursive(uint32_t index);
+        void UpdateNode(uint32_t index);
+    };
+}
@@ -7,6 +7,10 @@
 #include "scene.h"
 #include "game_framework.h"
 #include "game_resource.h"
+#include "material.h"
+#include "culling_kernels.h"
+#include "occlusion_culling.h"
+#include "render/batch_render_unit.h"
 #include "objects/transform_comp.h"
 
 namespace op
@@ -27,6 +31,12 @@ namespace op
     {
         DrawApplicationInfo();
 
+        DrawJobInfo();
+
+        DrawCullingInfo();
+
+        DrawBatchRenderInfo();
+
         DrawSceneInfo();
     
         DrawLogInfo();
@@ -52,6 +62,55 @@ namespace op
         ImGui::EndChild();
         
         DrawProperties(m_selected.lock().get());
+
+        auto transformSystem = GetGR()->GetTransformSystem();
+        ImGui::Text(std::string(
+            "transforms: " + std::to_string(transformSystem->GetNodeCount()) +
+            "  levels: " + std::to_string(transformSystem->GetLevelCount()) +
+            "  changed last frame: " + std::to_string(transformSystem->GetLastChangedCount())).c_str());
+
+        if (ImGui::Button("Benchmark Transforms 100K"))
+        {
+            m_transformBenchmark = TransformSystem::Benchmark(100000);
+        }
+
+        if (m_transformBenchmark.nodeCount > 0)
+        {
+            ImGui::Text(std::string(
+                "levels: " + std::to_string(m_transformBenchmark.levelCount) +
+                "  recursive: " + to_string(static_cast<float>(m_transformBenchmark.recursiveMs), 2) + "ms" +
+                "  serial: " + to_string(static_cast<float>(m_transformBenchmark.serialMs), 2) + "ms" +
+                "  parallel: " + to_string(static_cast<float>(m_transformBenchmark.parallelMs), 2) + "ms").c_str());
+            ImGui::Text(std::string("max error: " + to_string(m_transformBenchmark.maxError, 6)).c_str());
+        }
+
+        if (ImGui::Button("Benchmark Comp Iteration 100K"))
+        {
+            m_compIterationBenchmark = CompStorage::Benchmark(100000);
+        }
+
+        if (m_compIterationBenchmark.compCount > 0)
+        {
+            ImGui::Text(std::string(
+                "weak_ptr: " + to_string(static_cast<float>(m_compIterationBenchmark.weakPtrMs), 2) + "ms" +
+                "  chunk: " + to_string(static_cast<float>(m_compIterationBenchmark.chunkMs), 2) + "ms").c_str());
+        }
+
+        if (ImGui::Button("Benchmark Inverse 1M"))
+        {
+            m_inverseBenchmark = TransformSystem::BenchmarkInverse(1000000);
+        }
+
+        if (m_inverseBenchmark.count > 0)
+        {
+            ImGui::Text(std::string(
+                "general: " + to_string(static_cast<float>(m_inverseBenchmark.generalMs), 2) + "ms" +
+                "  affine: " + to_string(static_cast<float>(m_inverseBenchmark.affineMs), 2) + "ms" +
+                "  trs: " + to_string(static_cast<float>(m_inverseBenchmark.trsMs), 2) + "ms").c_str());
+            ImGui::Text(std::string(
+                "affine max error: " + to_string(m_inverseBenchmark.affineMaxError, 6) +
+                "  trs max error: " + to_string(m_inverseBenchmark.trsMaxError, 6)).c_str());
+        }
     }
 
     void ControlPanelUi::DrawHierarchy(crsp<Object> obj)
@@ -118,6 +177,381 @@ namespace op
         }
     }
 
+    void ControlPanelUi::DrawJobInfo()
+    {
+        if (!ImGui::CollapsingHeader("Job System"))
+        {
+            return;
+        }
+
+        auto jobScheduler = GetGR()->GetJobScheduler();
+        ImGui::Text(std::string("Threads: " + std::to_string(jobScheduler->GetThreadCount())).c_str());
+        ImGui::Text(std::string(
+            "Heap Allocs: " + std::to_string(jobScheduler->GetHeapAllocCount()) +
+            "  last frame: " + std::to_string(jobScheduler->GetLastFrameHeapAllocCount()) +
+            "  orphaned arenas: " + std::to_string(FrameJobAllocator::Ins()->GetOrphanedArenaCount())).c_str());
+
+        if (ImGui::Button("Check Steady-State Allocs"))
+        {
+            jobScheduler->RequestSteadyStateCheck(10, 300);
+        }
+
+        auto& steadyStateCheck = jobScheduler->GetSteadyStateCheck();
+        if (steadyStateCheck.running || steadyStateCheck.checkedFrameCount > 0)
+        {
+            ImGui::SameLine();
+            ImGui::Text(std::string(
+                std::string(steadyStateCheck.running ? "checking" : steadyStateCheck.allocFrameCount == 0 ? "passed" : "FAILED") +
+                "  frames: " + std::to_string(steadyStateCheck.checkedFrameCount) +
+                "  alloc frames: " + std::to_string(steadyStateCheck.allocFrameCount) +
+                "  max per frame: " + std::to_string(steadyStateCheck.maxFrameAllocCount)).c_str());
+        }
+        ImGui::Text(std::string("Steals: " + std::to_string(jobScheduler->GetStealCount())).c_str());
+        ImGui::Text(std::string("Idle: " + to_string(static_cast<float>(jobScheduler->GetIdleTimeNs()) / 1000000.0f, 1) + "ms").c_str());
+        ImGui::Text(std::string("Helped Tasks: " + std::to_string(jobScheduler->GetHelpedTaskCount())).c_str());
+
+        auto helpWhileWaiting = jobScheduler->IsHelpWhileWaiting();
+        if (ImGui::Checkbox("Help While Waiting", &helpWhileWaiting))
+        {
+            jobScheduler->SetHelpWhileWaiting(helpWhileWaiting);
+        }
+
+        auto grainUs = static_cast<int>(jobScheduler->GetTargetGrainNs() / 1000);
+        if (ImGui::SliderInt("Grain (us)", &grainUs, 5, 500))
+        {
+            jobScheduler->SetTargetGrainNs(static_cast<uint32_t>(grainUs) * 1000);
+        }
+
+        for (auto& info : jobScheduler->GetJobStats())
+        {
+            ImGui::Text(std::string(info.name).c_str());
+            ImGui::Indent(s_intent);
+            ImGui::Text(std::string(
+                "batch: " + std::to_string(info.lastBatchSize) +
+                "  ns/elem: " + to_string(info.nsPerElem, 1)).c_str());
+            ImGui::Text(std::string(
+                "us min/avg/max: " + to_string(info.minBatchUs, 1) +
+                " / " + to_string(info.avgBatchUs, 1) +
+                " / " + to_string(info.maxBatchUs, 1)).c_str());
+            ImGui::Text(std::string(
+                "batches: " + std::to_string(info.batchCount) +
+                "  stolen: " + std::to_string(info.stealCount)).c_str());
+            ImGui::Unindent(s_intent);
+        }
+
+        if (ImGui::Button("Reset Stats"))
+        {
+            jobScheduler->ResetJobStats();
+        }
+
+        if (ImGui::Button("Benchmark Thread Pool 100K Tasks"))
+        {
+            m_threadPoolBenchmark = ThreadPool::Benchmark(100000);
+        }
+
+        for (auto& result : m_threadPoolBenchmark)
+        {
+            ImGui::Text(std::string(
+                std::to_string(result.threadCount) + " threads" +
+                "  flat legacy/stealing: " + to_string(static_cast<float>(result.legacyFlatMs), 2) +
+                " / " + to_string(static_cast<float>(result.flatMs), 2) + "ms" +
+                "  nested legacy/stealing: " + to_string(static_cast<float>(result.legacyNestedMs), 2) +
+                " / " + to_string(static_cast<float>(result.nestedMs), 2) + "ms").c_str());
+        }
+    }
+
+    void ControlPanelUi::DrawCullingInfo()
+    {
+        if (!ImGui::CollapsingHeader("Culling"))
+        {
+            return;
+        }
+
+        for (uint8_t i = 0; i < static_cast<uint8_t>(SimdIsa::COUNT); ++i)
+        {
+            auto isa = static_cast<SimdIsa>(i);
+            if (!simd_isa_supported(isa))
+            {
+                continue;
+            }
+
+            if (ImGui::RadioButton(simd_isa_name(isa), CullingBuffer::GetIsa() == isa))
+            {
+                CullingBuffer::SetIsa(isa);
+            }
+            ImGui::SameLine();
+        }
+        ImGui::NewLine();
+
+        if (ImGui::Button("Benchmark 1M Bounds"))
+        {
+            for (uint8_t i = 0; i < static_cast<uint8_t>(SimdIsa::COUNT); ++i)
+            {
+                m_cullingBenchmark[i] = benchmark_culling_kernel(static_cast<SimdIsa>(i), 1000000);
+            }
+        }
+
+        for (uint8_t i = 0; i < static_cast<uint8_t>(SimdIsa::COUNT); ++i)
+        {
+            if (m_cullingBenchmark[i] > 0.0)
+            {
+                auto isaName = std::string(simd_isa_name(static_cast<SimdIsa>(i)));
+                ImGui::Text(std::string(isaName + ": " + to_string(static_cast<float>(m_cullingBenchmark[i]), 3) + " bounds/ns").c_str());
+            }
+        }
+
+        auto temporalEnabled = CullingBuffer::IsTemporalEnabled();
+        if (ImGui::Checkbox("Temporal Coherence", &temporalEnabled))
+        {
+            CullingBuffer::SetTemporalEnabled(temporalEnabled);
+        }
+
+        for (auto group : { CullingGroup::COMMON, CullingGroup::TRANSPARENT })
+        {
+            auto cullingBuffer = GetGR()->GetCullingBuffer(group);
+            ImGui::Text(std::string(
+                std::string(group == CullingGroup::COMMON ? "Opaque" : "Transparent") +
+                " (" + std::to_string(cullingBuffer->GetViewCount()) + " views) culled words: " +
+                std::to_string(cullingBuffer->GetLastCulledWordCount()) + " / " +
+                std::to_string(cullingBuffer->GetVisibleWordCount()) +
+                "  live: " + std::to_string(cullingBuffer->GetLiveCount())).c_str());
+        }
+
+        auto occlusionCulling = GetGR()->GetOcclusionCulling();
+        auto occlusionEnabled = occlusionCulling->IsEnabled();
+        if (ImGui::Checkbox("Occlusion Culling", &occlusionEnabled))
+        {
+            occlusionCulling->SetEnabled(occlusionEnabled);
+        }
+        if (occlusionEnabled)
+        {
+            ImGui::Text(std::string(
+                "Occluders: " + std::to_string(occlusionCulling->GetOccluderCount()) +
+                "  triangles: " + std::to_string(occlusionCulling->GetTriangleCount()) +
+                "  occluded: " + std::to_string(occlusionCulling->GetOccludedCount())).c_str());
+        }
+
+        if (ImGui::Button("Validate Occlusion Rasterizer"))
+        {
+            m_occlusionValidation = validate_occlusion_buffer();
+        }
+
+        if (m_occlusionValidation.triangleCount > 0)
+        {
+            auto& occlusion = m_occlusionValidation;
+            ImGui::Text(std::string(
+                "covered pixels: " + std::to_string(occlusion.coveredPixelCount) +
+                "  ambiguous: " + std::to_string(occlusion.ambiguousPixelCount) +
+                "  depth mismatches: " + std::to_string(occlusion.depthMismatchCount) +
+                "  max error: " + to_string(occlusion.maxDepthError, 8) +
+                "  hi-z mismatches: " + std::to_string(occlusion.hiZMismatchCount)).c_str());
+            ImGui::Text(std::string(
+                "boxes: " + std::to_string(occlusion.boxCount) +
+                "  occluded: " + std::to_string(occlusion.occludedCount) +
+                " / " + std::to_string(occlusion.referenceOccludedCount) +
+                "  false occluded: " + std::to_string(occlusion.falseOccludedCount)).c_str());
+        }
+
+        auto bvhEnabled = CullingBuffer::IsBvhEnabled();
+        if (ImGui::Checkbox("BVH Broadphase", &bvhEnabled))
+        {
+            CullingBuffer::SetBvhEnabled(bvhEnabled);
+        }
+
+        if (ImGui::Button("Benchmark Flat vs BVH 100K Bounds"))
+        {
+            m_bvhBenchmark = CullingBvh::Benchmark(100000);
+        }
+
+        for (auto& result : m_bvhBenchmark)
+        {
+            ImGui::Text(std::string(
+                "visible " + to_string(result.visibleRatio * 100.0f, 1) + "%" +
+                "  flat: " + to_string(static_cast<float>(result.flatNs / 1000.0), 1) + "us" +
+                "  bvh: " + to_string(static_cast<float>(result.bvhNs / 1000.0), 1) + "us").c_str());
+        }
+    }
+
+    void ControlPanelUi::DrawBatchRenderInfo()
+    {
+        if (!ImGui::CollapsingHeader("Batch Rendering"))
+        {
+            return;
+        }
+
+        auto batchRenderUnit = GetGR()->GetBatchRenderUnit();
+        auto mergeDrawsEnabled = batchRenderUnit->IsMergeDrawsEnabled();
+        if (ImGui::Checkbox("Merge Draws", &mergeDrawsEnabled))
+        {
+            batchRenderUnit->SetMergeDrawsEnabled(mergeDrawsEnabled);
+        }
+
+        auto gpuCullingEnabled = batchRenderUnit->IsGpuCullingEnabled();
+        if (ImGui::Checkbox("GPU Culling", &gpuCullingEnabled))
+        {
+            batchRenderUnit->SetGpuCullingEnabled(gpuCullingEnabled);
+        }
+
+        // GPU剔除只画LOD0
+        auto lodSettings = batchRenderUnit->GetLodSettings();
+        auto lodChanged = ImGui::Checkbox("LOD", &lodSettings.enabled);
+        for (uint32_t i = 0; i < lodSettings.screenSizes.size(); ++i)
+        {
+            auto maxScreenSize = i == 0 ? 1.0f : lodSettings.screenSizes[i - 1];
+            auto label = "LOD" + std::to_string(i + 1) + " Screen Size";
+            if (ImGui::SliderFloat(label.c_str(), &lodSettings.screenSizes[i], 0.001f, maxScreenSize, "%.3f"))
+            {
+                // 保持递减
+                for (auto j = i + 1; j < lodSettings.screenSizes.size(); ++j)
+                {
+                    lodSettings.screenSizes[j] = std::min(lodSettings.screenSizes[j], lodSettings.screenSizes[i]);
+                }
+                lodChanged = true;
+            }
+        }
+        if (lodChanged)
+        {
+            batchRenderUnit->SetLodSettings(lodSettings);
+        }
+
+        if (ImGui::Button("Benchmark Mesh Simplifier"))
+        {
+            m_meshSimplifierBenchmark = benchmark_mesh_simplifier(256);
+        }
+
+        for (uint32_t i = 0; i < m_meshSimplifierBenchmark.size(); ++i)
+        {
+            auto& result = m_meshSimplifierBenchmark[i];
+            ImGui::Text(std::string(
+                "LOD" + std::to_string(i) +
+                "  triangles: " + std::to_string(result.triangleCount) +
+                "  error: " + to_string(result.error, 5) +
+                "  invalid: " + std::to_string(result.invalidTriangleCount) +
+                "  build: " + to_string(static_cast<float>(result.ms), 2) + "ms").c_str());
+        }
+
+        if (ImGui::Button("Validate GPU Culling"))
+        {
+            batchRenderUnit->RequestGpuCullingValidation();
+        }
+
+        auto& validation = batchRenderUnit->GetGpuCullingValidation();
+        if (validation.treeCount > 0)
+        {
+            ImGui::Text(std::string(
+                "validated trees: " + std::to_string(validation.treeCount) +
+                "  cmds: " + std::to_string(validation.cmdCount) +
+                "  mismatches: " + std::to_string(validation.mismatchCount)).c_str());
+        }
+
+        if (ImGui::Button("Validate GPU Culling Reference 20K"))
+        {
+            m_gpuCullingReferenceValidation = GpuCulling::ValidateReference(20000);
+        }
+
+        if (m_gpuCullingReferenceValidation.recordCount > 0)
+        {
+            auto& reference = m_gpuCullingReferenceValidation;
+            ImGui::Text(std::string(
+                "records: " + std::to_string(reference.recordCount) +
+                "  subCmds: " + std::to_string(reference.subCmdCount) +
+                "  cmds: " + std::to_string(reference.cmdCount) +
+                "  visible: " + std::to_string(reference.visibleCount)).c_str());
+            ImGui::Text(std::string(
+                "brute force mismatches: " + std::to_string(reference.bruteForceMismatchCount) +
+                "  permuted mismatches: " + std::to_string(reference.permutedMismatchCount) +
+                "  undetected corruptions: " + std::to_string(reference.undetectedCorruptionCount) +
+                " / " + std::to_string(reference.corruptionCount)).c_str());
+        }
+
+        if (ImGui::Button("Validate Vertex Encoding 1M"))
+        {
+            m_vertexEncodingValidation = validate_vertex_encoding(1000000);
+        }
+
+        if (m_vertexEncodingValidation.vertexCount > 0)
+        {
+            auto& encoding = m_vertexEncodingValidation;
+            ImGui::Text(std::string(
+                "simd mismatches: " + std::to_string(encoding.simdMismatchCount) +
+                "  sse: " + to_string(static_cast<float>(encoding.simdVerticesPerNs), 3) + " vertices/ns" +
+                "  scalar: " + to_string(static_cast<float>(encoding.referenceVerticesPerNs), 3) + " vertices/ns").c_str());
+            ImGui::Text(std::string(
+                "max error position: " + to_string(encoding.maxPositionError * 100.0f, 4) + "%" +
+                "  normal: " + to_string(encoding.maxNormalError, 4) + "deg" +
+                "  tangent: " + to_string(encoding.maxTangentError, 4) + "deg" +
+                "  uv: " + to_string(encoding.maxUvError, 4) +
+                "  tangent sign mismatches: " + std::to_string(encoding.tangentSignMismatchCount)).c_str());
+        }
+
+        if (ImGui::Button("Validate Ring Allocator"))
+        {
+            m_ringAllocatorValidation = validate_ring_allocator();
+        }
+
+        if (m_ringAllocatorValidation.checkCount > 0)
+        {
+            auto& ring = m_ringAllocatorValidation;
+            ImGui::Text(std::string(
+                "checks: " + std::to_string(ring.checkCount) +
+                "  failed: " + std::to_string(ring.failedCount) +
+                (ring.failedCount > 0 ? "  first: " + ring.firstFailure : "")).c_str());
+            ImGui::Text(std::string(
+                "random allocs: " + std::to_string(ring.randomAllocCount) +
+                "  waits: " + std::to_string(ring.randomWaitCount) +
+                "  overlaps: " + std::to_string(ring.overlapCount)).c_str());
+        }
+
+        if (ImGui::Button("Validate TLSF Allocator"))
+        {
+            m_tlsfAllocatorValidation = validate_tlsf_allocator();
+        }
+
+        if (m_tlsfAllocatorValidation.checkCount > 0)
+        {
+            auto& tlsf = m_tlsfAllocatorValidation;
+            ImGui::Text(std::string(
+                "checks: " + std::to_string(tlsf.checkCount) +
+                "  failed: " + std::to_string(tlsf.failedCount) +
+                (tlsf.failedCount > 0 ? "  first: " + tlsf.firstFailure : "")).c_str());
+            ImGui::Text(std::string(
+                "random ops: " + std::to_string(tlsf.randomOpCount) +
+                "  grows: " + std::to_string(tlsf.growCount) +
+                "  invalid: " + std::to_string(tlsf.invalidCount) +
+                "  overlaps: " + std::to_string(tlsf.overlapCount)).c_str());
+        }
+
+        auto& stats = batchRenderUnit->GetLastFrameStats();
+        ImGui::Text(std::string(
+            "cmds: " + std::to_string(stats.cmdCount) +
+            "  draw calls: " + std::to_string(stats.drawCalls) + " / " + std::to_string(stats.unmergedDrawCalls) +
+            "  state changes: " + std::to_string(stats.stateChanges) + " / " + std::to_string(stats.unmergedStateChanges) +
+            " (merged / unmerged)").c_str());
+
+        if (ImGui::Button("Validate Merge Draws 2K Materials"))
+        {
+            // 用合批材质实际的shader，参数表是从shaders.pack里反射出来的
+            auto batchShader = Material::LoadFromFile("materials/lit_mat_batch.json")->GetShader();
+            m_mergeDrawsValidation = BatchRenderUnit::ValidateMergeDraws(2000, batchShader);
+        }
+
+        if (m_mergeDrawsValidation.checkCount > 0)
+        {
+            auto& merge = m_mergeDrawsValidation;
+            ImGui::Text(std::string(
+                "cmds: " + std::to_string(merge.cmdCount) +
+                "  draw calls: " + std::to_string(merge.mergedDrawCalls) + " / " + std::to_string(merge.unmergedDrawCalls) +
+                "  expected: " + std::to_string(merge.expectedDrawCalls) +
+                "  state changes: " + std::to_string(merge.mergedStateChanges) + " / " + std::to_string(merge.unmergedStateChanges) +
+                "  cross material: " + std::to_string(merge.crossMaterialDrawCalls) +
+                " (batch shader: " + std::to_string(merge.batchShaderCrossMaterialDrawCalls) + ")").c_str());
+            ImGui::Text(std::string(
+                "checks: " + std::to_string(merge.checkCount) +
+                "  failed: " + std::to_string(merge.failedCount) +
+                (merge.failedCount > 0 ? "  first: " + merge.firstFailure : "")).c_str());
+        }
+    }
+
     void ControlPanelUi::DrawLogInfo()
     {
         if (ImGui::CollapsingHeader("Log Info"))
@@ -1,5 +1,16 @@
 #pragma once
 #include "time_out_buffer.h"
+#include "comp_storage.h"
+#include "culling_bvh.h"
+#include "mesh_simplifier.h"
+#include "occlusion_buffer.h"
+#include "transform_system.h"
+#include "common/ring_allocator.h"
+#include "common/thread_pool.h"
+#include "common/tlsf_allocator.h"
+#include "render/batch_render_unit.h"
+#include "render/gpu_culling.h"
+#include "render/vertex_compression.h"
 
 namespace op
 {
@@ -30,10 +41,27 @@ namespace op
 
         Event<> m_drawConsoleUiEvent;
 
+        vec<ThreadPool::BenchmarkResult> m_threadPoolBenchmark;
+        arr<double, static_cast<uint8_t>(SimdIsa::COUNT)> m_cullingBenchmark = {};
+        vec<CullingBvh::BenchmarkResult> m_bvhBenchmark;
+        OcclusionValidation m_occlusionValidation;
+        GpuCulling::ReferenceValidation m_gpuCullingReferenceValidation;
+        BatchRenderUnit::MergeDrawsValidation m_mergeDrawsValidation;
+        VertexEncodingValidation m_vertexEncodingValidation;
+        RingAllocatorValidation m_ringAllocatorValidation;
+        TlsfAllocatorValidation m_tlsfAllocatorValidation;
+        vec<MeshSimplifierBenchmark> m_meshSimplifierBenchmark;
+        TransformSystem::BenchmarkResult m_transformBenchmark;
+        TransformSystem::InverseBenchmarkResult m_inverseBenchmark;
+        CompStorage::BenchmarkResult m_compIterationBenchmark;
+
         void DrawSceneInfo();
         void DrawHierarchy(crsp<Object> obj);
         void DrawProperties(const Object* obj);
         void DrawApplicationInfo();
+        void DrawJobInfo();
+        void DrawCullingInfo();
+        void DrawBatchRenderInfo();
         void DrawLogInfo();
     };
 }
\ No newline at end of file
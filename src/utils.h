@@ -459,6 +459,12 @@ namespace op
         _aligned_free(ptr);
     }
 
+    // alignment必须是2的幂
+    static uint32_t align_up(const uint32_t value, const uint32_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
     static std::string replace(const std::string& original, const std::string& toReplace, const std::string& replacement)
     {
         std::string result = original;